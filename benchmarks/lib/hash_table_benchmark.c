@@ -0,0 +1,538 @@
+/*
+ * Compares hash_table with the chained implementation it replaced.
+ *
+ * For each table size, creates tables, inserts keys, looks up present
+ * and absent keys, iterates and deletes all the keys, and reports the
+ * time per operation and the heap used by a table of that size. Then
+ * reports how typical keys spread with the hash functions of the
+ * library and those they replaced.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trema.h"
+
+
+#define DEFAULT_OPERATIONS 2000000
+
+
+/********************************************************************************
+ * The chained hash table with 65521 preallocated buckets, as it was
+ * before hash_table moved to open addressing.
+ ********************************************************************************/
+
+static const unsigned int legacy_hash_size = 65521;
+
+
+typedef struct {
+  unsigned int number_of_buckets;
+  compare_function compare;
+  hash_function hash;
+  unsigned int length;
+  dlist_element **buckets;
+  dlist_element *nonempty_bucket_index;
+  pthread_mutex_t mutex;
+} legacy_hash_table;
+
+
+typedef struct {
+  dlist_element **buckets;
+  dlist_element *bucket_index;
+  dlist_element *next_bucket_index;
+  dlist_element *element;
+} legacy_hash_iterator;
+
+
+static legacy_hash_table *
+legacy_create_hash( compare_function compare, hash_function hash ) {
+  legacy_hash_table *table = xmalloc( sizeof( legacy_hash_table ) );
+
+  table->number_of_buckets = legacy_hash_size;
+  table->compare = compare;
+  table->hash = hash;
+  table->length = 0;
+  table->buckets = xmalloc( sizeof( dlist_element * ) * legacy_hash_size );
+  for ( unsigned int i = 0; i < table->number_of_buckets; i++ ) {
+    table->buckets[ i ] = create_dlist();
+  }
+  table->nonempty_bucket_index = create_dlist();
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init( &attr );
+  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
+  pthread_mutex_init( &table->mutex, &attr );
+
+  return table;
+}
+
+
+static dlist_element *
+legacy_find_element( legacy_hash_table *table, const void *key, unsigned int i ) {
+  dlist_element *e;
+  for ( e = table->buckets[ i ]->next; e; e = e->next ) {
+    if ( ( *table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
+      break;
+    }
+  }
+  return e;
+}
+
+
+static void *
+legacy_insert_hash_entry( legacy_hash_table *table, void *key, void *value ) {
+  pthread_mutex_lock( &table->mutex );
+
+  unsigned int i = ( *table->hash )( key ) % table->number_of_buckets;
+  if ( table->buckets[ i ]->next == NULL ) {
+    table->buckets[ i ]->data = insert_after_dlist( table->nonempty_bucket_index, ( void * ) ( unsigned long ) i );
+  }
+  dlist_element *old_elem = legacy_find_element( table, key, i );
+  hash_entry *new_entry = xmalloc( sizeof( hash_entry ) );
+  new_entry->key = key;
+  new_entry->value = value;
+  insert_after_dlist( table->buckets[ i ], new_entry );
+  table->length++;
+
+  pthread_mutex_unlock( &table->mutex );
+
+  return old_elem == NULL ? NULL : ( ( hash_entry * ) old_elem->data )->value;
+}
+
+
+static void *
+legacy_lookup_hash_entry( legacy_hash_table *table, const void *key ) {
+  pthread_mutex_lock( &table->mutex );
+
+  void *value = NULL;
+  dlist_element *e = legacy_find_element( table, key, ( *table->hash )( key ) % table->number_of_buckets );
+  if ( e != NULL ) {
+    value = ( ( hash_entry * ) e->data )->value;
+  }
+
+  pthread_mutex_unlock( &table->mutex );
+
+  return value;
+}
+
+
+static void *
+legacy_delete_hash_entry( legacy_hash_table *table, const void *key ) {
+  pthread_mutex_lock( &table->mutex );
+
+  void *deleted = NULL;
+  unsigned int i = ( *table->hash )( key ) % table->number_of_buckets;
+  dlist_element *e = legacy_find_element( table, key, i );
+  if ( e != NULL ) {
+    hash_entry *delete_me = e->data;
+    deleted = delete_me->value;
+    delete_dlist_element( e );
+    xfree( delete_me );
+    if ( table->buckets[ i ]->next == NULL ) {
+      delete_dlist_element( table->buckets[ i ]->data );
+      table->buckets[ i ]->data = NULL;
+    }
+    table->length--;
+  }
+
+  pthread_mutex_unlock( &table->mutex );
+
+  return deleted;
+}
+
+
+static unsigned int
+legacy_hash_mac( const void *mac ) {
+  unsigned int value;
+  memcpy( &value, ( const uint8_t * ) mac + 2, sizeof( value ) );
+  return value;
+}
+
+
+static unsigned int
+legacy_hash_datapath_id( const void *key ) {
+  uint32_t halves[ 2 ];
+  memcpy( halves, key, sizeof( halves ) );
+  return halves[ 0 ] ^ halves[ 1 ];
+}
+
+
+static void
+legacy_init_hash_iterator( legacy_hash_table *table, legacy_hash_iterator *iter ) {
+  iter->buckets = table->buckets;
+  if ( table->nonempty_bucket_index->next ) {
+    iter->bucket_index = table->nonempty_bucket_index->next;
+    iter->next_bucket_index = iter->bucket_index->next;
+    iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ]->next;
+  }
+  else {
+    iter->bucket_index = NULL;
+    iter->element = NULL;
+  }
+}
+
+
+static hash_entry *
+legacy_iterate_hash_next( legacy_hash_iterator *iter ) {
+  for ( ;; ) {
+    if ( iter->bucket_index == NULL ) {
+      return NULL;
+    }
+    dlist_element *e = iter->element;
+    if ( e == NULL ) {
+      if ( iter->next_bucket_index == NULL ) {
+        return NULL;
+      }
+      iter->bucket_index = iter->next_bucket_index;
+      iter->next_bucket_index = iter->next_bucket_index->next;
+      iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ]->next;
+    }
+    else {
+      iter->element = e->next;
+      return e->data;
+    }
+  }
+}
+
+
+static void
+legacy_delete_hash( legacy_hash_table *table ) {
+  for ( unsigned int i = 0; i < table->number_of_buckets; i++ ) {
+    dlist_element *e;
+    for ( e = table->buckets[ i ]->next; e != NULL; e = e->next ) {
+      xfree( e->data );
+    }
+    if ( table->buckets[ i ]->data != NULL ) {
+      delete_dlist_element( table->buckets[ i ]->data );
+    }
+    table->buckets[ i ]->data = NULL;
+    delete_dlist( table->buckets[ i ] );
+  }
+  xfree( table->buckets );
+  delete_dlist( table->nonempty_bucket_index );
+  pthread_mutex_destroy( &table->mutex );
+  xfree( table );
+}
+
+
+/********************************************************************************
+ * Benchmark.
+ ********************************************************************************/
+
+static uint32_t *keys = NULL;
+static uint32_t *absent_keys = NULL;
+
+
+typedef struct {
+  double create_usec;
+  double insert_nsec;
+  double lookup_nsec;
+  double lookup_absent_nsec;
+  double iterate_nsec;
+  double delete_nsec;
+  size_t heap_bytes;
+} result;
+
+
+static double
+elapsed_nsec( const struct timespec *begin ) {
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( double ) ( end.tv_sec - begin->tv_sec ) * 1e9 + ( double ) ( end.tv_nsec - begin->tv_nsec );
+}
+
+
+static size_t
+heap_in_use() {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+
+static void
+run_legacy( unsigned int size, int rounds, result *r ) {
+  memset( r, 0, sizeof( result ) );
+  struct timespec begin;
+  uint32_t sum = 0;
+
+  for ( int round = 0; round < rounds; round++ ) {
+    size_t heap_before = heap_in_use();
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    legacy_hash_table *table = legacy_create_hash( compare_uint32, hash_uint32 );
+    r->create_usec += elapsed_nsec( &begin ) / 1e3;
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      legacy_insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+    }
+    r->insert_nsec += elapsed_nsec( &begin );
+    r->heap_bytes = heap_in_use() - heap_before;
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      sum += *( uint32_t * ) legacy_lookup_hash_entry( table, &keys[ i ] );
+    }
+    r->lookup_nsec += elapsed_nsec( &begin );
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      sum += legacy_lookup_hash_entry( table, &absent_keys[ i ] ) == NULL ? 0U : 1U;
+    }
+    r->lookup_absent_nsec += elapsed_nsec( &begin );
+
+    legacy_hash_iterator iter;
+    hash_entry *e;
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    legacy_init_hash_iterator( table, &iter );
+    while ( ( e = legacy_iterate_hash_next( &iter ) ) != NULL ) {
+      sum += *( uint32_t * ) e->value;
+    }
+    r->iterate_nsec += elapsed_nsec( &begin );
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      legacy_delete_hash_entry( table, &keys[ i ] );
+    }
+    r->delete_nsec += elapsed_nsec( &begin );
+
+    legacy_delete_hash( table );
+  }
+
+  if ( sum == 1 ) {
+    // Keeps the loops above from being optimized away.
+    printf( "#\n" );
+  }
+}
+
+
+static void
+run_open_addressing( unsigned int size, unsigned int size_hint, int concurrency, int rounds, result *r ) {
+  memset( r, 0, sizeof( result ) );
+  struct timespec begin;
+  uint32_t sum = 0;
+
+  for ( int round = 0; round < rounds; round++ ) {
+    size_t heap_before = heap_in_use();
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    hash_table *table = create_hash_with_concurrency( compare_uint32, hash_uint32, size_hint, concurrency );
+    r->create_usec += elapsed_nsec( &begin ) / 1e3;
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+    }
+    r->insert_nsec += elapsed_nsec( &begin );
+    r->heap_bytes = heap_in_use() - heap_before;
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      sum += *( uint32_t * ) lookup_hash_entry( table, &keys[ i ] );
+    }
+    r->lookup_nsec += elapsed_nsec( &begin );
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      sum += lookup_hash_entry( table, &absent_keys[ i ] ) == NULL ? 0U : 1U;
+    }
+    r->lookup_absent_nsec += elapsed_nsec( &begin );
+
+    hash_iterator iter;
+    hash_entry *e;
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    init_hash_iterator( table, &iter );
+    while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+      sum += *( uint32_t * ) e->value;
+    }
+    r->iterate_nsec += elapsed_nsec( &begin );
+
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < size; i++ ) {
+      delete_hash_entry( table, &keys[ i ] );
+    }
+    r->delete_nsec += elapsed_nsec( &begin );
+
+    delete_hash( table );
+  }
+
+  if ( sum == 1 ) {
+    printf( "#\n" );
+  }
+}
+
+
+static void
+print_result( const char *name, unsigned int size, int rounds, const result *r ) {
+  double operations = ( double ) size * rounds;
+
+  printf( "- implementation: %s\n", name );
+  printf( "  entries: %u\n", size );
+  printf( "  rounds: %d\n", rounds );
+  printf( "  create_usec: %.1f\n", r->create_usec / rounds );
+  printf( "  heap_bytes: %zu\n", r->heap_bytes );
+  printf( "  insert_nsec: %.1f\n", r->insert_nsec / operations );
+  printf( "  lookup_nsec: %.1f\n", r->lookup_nsec / operations );
+  printf( "  lookup_absent_nsec: %.1f\n", r->lookup_absent_nsec / operations );
+  printf( "  iterate_nsec: %.1f\n", r->iterate_nsec / operations );
+  printf( "  delete_nsec: %.1f\n", r->delete_nsec / operations );
+}
+
+
+static bool
+compare_key_bytes( const void *x, const void *y ) {
+  // Keys in this section are all stored in one array and are unique,
+  // so comparing addresses is enough.
+  return x == y;
+}
+
+
+/**
+ * Reports how keys spread with a hash function, both over the slots
+ * of hash_table and over the buckets of the chained table.
+ */
+static void
+print_key_distribution( const char *name, hash_function hash, const uint8_t *key_data, size_t key_size, unsigned int n ) {
+  hash_table *table = create_hash_with_size( compare_key_bytes, hash, n );
+  unsigned int *chains = xcalloc( legacy_hash_size, sizeof( unsigned int ) );
+  unsigned int max_chain_length = 0;
+  for ( unsigned int i = 0; i < n; i++ ) {
+    const uint8_t *key = key_data + key_size * i;
+    insert_hash_entry( table, ( void * ) ( uintptr_t ) key, NULL );
+    unsigned int *chain = &chains[ ( *hash )( key ) % legacy_hash_size ];
+    if ( ++*chain > max_chain_length ) {
+      max_chain_length = *chain;
+    }
+  }
+
+  hash_table_stats stats;
+  get_hash_table_stats( table, &stats );
+  printf( "- keys: %s\n", name );
+  printf( "  entries: %u\n", stats.entries );
+  printf( "  hash_collisions: %u\n", stats.hash_collisions );
+  printf( "  displaced_entries: %u\n", stats.displaced_entries );
+  printf( "  average_probe_length: %.2f\n", stats.average_probe_length );
+  printf( "  max_probe_length: %u\n", stats.max_probe_length );
+  printf( "  max_cluster_length: %u\n", stats.max_cluster_length );
+  printf( "  chained_max_chain_length: %u\n", max_chain_length );
+
+  xfree( chains );
+  delete_hash( table );
+}
+
+
+static void
+run_key_distribution( unsigned int n ) {
+  // Vendor-sequential MAC addresses under a single OUI.
+  uint8_t *macs = xmalloc( OFP_ETH_ALEN * n );
+  for ( unsigned int i = 0; i < n; i++ ) {
+    uint8_t *mac = macs + OFP_ETH_ALEN * i;
+    mac[ 0 ] = 0x00;
+    mac[ 1 ] = 0x1b;
+    mac[ 2 ] = 0x21;
+    mac[ 3 ] = ( uint8_t ) ( i >> 16 );
+    mac[ 4 ] = ( uint8_t ) ( i >> 8 );
+    mac[ 5 ] = ( uint8_t ) i;
+  }
+  print_key_distribution( "sequential_mac_legacy_hash", legacy_hash_mac, macs, OFP_ETH_ALEN, n );
+  print_key_distribution( "sequential_mac", hash_mac, macs, OFP_ETH_ALEN, n );
+  xfree( macs );
+
+  // Datapath IDs with a vendor prefix in the upper half.
+  uint64_t *datapath_ids = xmalloc( sizeof( uint64_t ) * n );
+  for ( unsigned int i = 0; i < n; i++ ) {
+    datapath_ids[ i ] = ( ( uint64_t ) ( i % 16 ) << 32 ) | ( i / 16 );
+  }
+  print_key_distribution( "datapath_id_legacy_hash", legacy_hash_datapath_id, ( uint8_t * ) datapath_ids, sizeof( uint64_t ), n );
+  print_key_distribution( "datapath_id", hash_datapath_id, ( uint8_t * ) datapath_ids, sizeof( uint64_t ), n );
+  xfree( datapath_ids );
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  unsigned int sizes[] = { 16, 1024, 65536, 262144 };
+  unsigned int n_sizes = sizeof( sizes ) / sizeof( sizes[ 0 ] );
+  unsigned long operations = DEFAULT_OPERATIONS;
+
+  if ( argc > 1 ) {
+    sizes[ 0 ] = ( unsigned int ) strtoul( argv[ 1 ], NULL, 10 );
+    n_sizes = 1;
+  }
+  if ( argc > 2 ) {
+    operations = strtoul( argv[ 2 ], NULL, 10 );
+  }
+  if ( sizes[ 0 ] == 0 || operations == 0 ) {
+    fprintf( stderr, "Usage: %s [entries] [operations]\n", argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  unsigned int max_size = 0;
+  for ( unsigned int i = 0; i < n_sizes; i++ ) {
+    if ( sizes[ i ] > max_size ) {
+      max_size = sizes[ i ];
+    }
+  }
+  keys = xmalloc( sizeof( uint32_t ) * max_size );
+  absent_keys = xmalloc( sizeof( uint32_t ) * max_size );
+  srandom( 1 );
+  for ( unsigned int i = 0; i < max_size; i++ ) {
+    // Even keys are present and odd keys are absent.
+    keys[ i ] = ( uint32_t ) random() << 1;
+    absent_keys[ i ] = keys[ i ] | 1;
+  }
+
+  for ( unsigned int i = 0; i < n_sizes; i++ ) {
+    unsigned int size = sizes[ i ];
+    int rounds = ( int ) ( operations / size );
+    if ( rounds < 1 ) {
+      rounds = 1;
+    }
+    // Each round of the chained table pays for its 65521 buckets.
+    int legacy_rounds = rounds < 100 ? rounds : 100;
+
+    result r;
+    run_legacy( size, legacy_rounds, &r );
+    print_result( "chained", size, legacy_rounds, &r );
+    run_open_addressing( size, 0, HASH_TABLE_LOCKED, rounds, &r );
+    print_result( "open_addressing", size, rounds, &r );
+    run_open_addressing( size, size, HASH_TABLE_LOCKED, rounds, &r );
+    print_result( "open_addressing_sized", size, rounds, &r );
+    run_open_addressing( size, 0, HASH_TABLE_UNLOCKED, rounds, &r );
+    print_result( "open_addressing_unlocked", size, rounds, &r );
+    run_open_addressing( size, 0, HASH_TABLE_CONCURRENT, rounds, &r );
+    print_result( "open_addressing_concurrent", size, rounds, &r );
+  }
+
+  xfree( absent_keys );
+  xfree( keys );
+
+  run_key_distribution( 65536 );
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
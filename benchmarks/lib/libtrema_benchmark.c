@@ -0,0 +1,747 @@
+/*
+ * Measures the library primitives that dominate the profiles of Trema
+ * applications: hash_table, match_table, buffer, packet parsing,
+ * OpenFlow message creation and validation, and byte order conversion.
+ *
+ * Each benchmark runs a fixed number of operations several times, and
+ * the median time per operation is reported as JSON. When a baseline
+ * written by an earlier run is given, each result is compared with it,
+ * and the program fails if any benchmark got slower by more than the
+ * threshold.
+ *
+ *   libtrema_benchmark > baseline.json
+ *   ( change src/lib )
+ *   libtrema_benchmark -b baseline.json
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ether.h"
+#include "ipv4.h"
+#include "trema.h"
+#include "udp.h"
+
+
+#define DEFAULT_OPERATIONS 200000
+#define DEFAULT_THRESHOLD 10.0
+#define ROUNDS 5
+#define MATCH_TABLE_RULES 1000
+#define MATCH_TABLE_PACKETS 4096
+#define MAX_BENCHMARK_NAME_LENGTH 64
+
+
+static uintptr_t sink = 0;
+
+
+static double
+elapsed_nsec( const struct timespec *begin ) {
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( double ) ( end.tv_sec - begin->tv_sec ) * 1e9 + ( double ) ( end.tv_nsec - begin->tv_nsec );
+}
+
+
+/********************************************************************************
+ * Fixtures.
+ ********************************************************************************/
+
+static buffer *
+create_udp_frame() {
+  const size_t frame_length = ETH_MINIMUM_LENGTH - ETH_FCS_LENGTH;
+  const size_t ether_length = sizeof( ether_header_t ) - ETH_PREPADLEN;
+  buffer *frame = alloc_buffer_with_length( frame_length );
+  char *data = append_back_buffer( frame, frame_length );
+  memset( data, 0, frame_length );
+
+  ether_header_t *eth = ( ether_header_t * ) ( data - ETH_PREPADLEN );
+  const uint8_t macda[ ETH_ADDRLEN ] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x02 };
+  const uint8_t macsa[ ETH_ADDRLEN ] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+  memcpy( eth->macda, macda, ETH_ADDRLEN );
+  memcpy( eth->macsa, macsa, ETH_ADDRLEN );
+  eth->type = htons( ETH_ETHTYPE_IPV4 );
+
+  ipv4_header_t *ip = ( ipv4_header_t * ) ( data + ether_length );
+  ip->version = 4;
+  ip->ihl = sizeof( ipv4_header_t ) / 4;
+  ip->tot_len = htons( ( uint16_t ) ( frame_length - ether_length ) );
+  ip->ttl = 64;
+  ip->protocol = IPPROTO_UDP;
+  ip->saddr = htonl( 0x0a000001 );
+  ip->daddr = htonl( 0x0a000002 );
+  ip->check = get_checksum( ( uint16_t * ) ip, sizeof( ipv4_header_t ) );
+
+  udp_header_t *udp = ( udp_header_t * ) ( ip + 1 );
+  udp->src_port = htons( 1024 );
+  udp->dst_port = htons( 53 );
+  udp->len = htons( ( uint16_t ) ( frame_length - ether_length - sizeof( ipv4_header_t ) ) );
+
+  return frame;
+}
+
+
+static buffer *
+create_parsed_udp_frame() {
+  buffer *frame = create_udp_frame();
+  if ( !parse_packet( frame ) ) {
+    fprintf( stderr, "Failed to parse a UDP frame.\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  return frame;
+}
+
+
+static buffer *
+create_flow_mod_message() {
+  struct ofp_match match;
+  buffer *frame = create_parsed_udp_frame();
+  set_match_from_packet( &match, 1, 0, frame );
+  free_buffer( frame );
+
+  openflow_actions *actions = create_actions();
+  append_action_output( actions, 2, UINT16_MAX );
+  buffer *flow_mod = create_flow_mod( 1, match, 0, OFPFC_ADD, 60, 0, UINT16_MAX, UINT32_MAX, OFPP_NONE, 0, actions );
+  delete_actions( actions );
+
+  return flow_mod;
+}
+
+
+/********************************************************************************
+ * hash_table.
+ ********************************************************************************/
+
+static uint32_t *
+create_keys( unsigned int operations ) {
+  uint32_t *keys = xmalloc( sizeof( uint32_t ) * operations );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    keys[ i ] = ( uint32_t ) random();
+  }
+
+  return keys;
+}
+
+
+static double
+benchmark_hash_table( unsigned int operations, int phase ) {
+  uint32_t *keys = create_keys( operations );
+  hash_table *table = create_hash( compare_uint32, hash_uint32 );
+  struct timespec begin;
+  double nsec = 0;
+
+  if ( phase == 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+  }
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+  }
+  if ( phase == 0 ) {
+    nsec = elapsed_nsec( &begin );
+  }
+
+  if ( phase == 1 ) {
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    for ( unsigned int i = 0; i < operations; i++ ) {
+      sink += ( uintptr_t ) lookup_hash_entry( table, &keys[ i ] );
+    }
+    nsec = elapsed_nsec( &begin );
+  }
+
+  if ( phase == 2 ) {
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+  }
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    delete_hash_entry( table, &keys[ i ] );
+  }
+  if ( phase == 2 ) {
+    nsec = elapsed_nsec( &begin );
+  }
+
+  delete_hash( table );
+  xfree( keys );
+
+  return nsec;
+}
+
+
+static double
+benchmark_hash_table_insert( unsigned int operations ) {
+  return benchmark_hash_table( operations, 0 );
+}
+
+
+static double
+benchmark_hash_table_lookup( unsigned int operations ) {
+  return benchmark_hash_table( operations, 1 );
+}
+
+
+static double
+benchmark_hash_table_delete( unsigned int operations ) {
+  return benchmark_hash_table( operations, 2 );
+}
+
+
+/********************************************************************************
+ * match_table.
+ ********************************************************************************/
+
+static void
+set_random_match( struct ofp_match *match ) {
+  memset( match, 0, sizeof( struct ofp_match ) );
+  match->in_port = ( uint16_t ) ( random() % 48 + 1 );
+  for ( int i = 0; i < OFP_ETH_ALEN; i++ ) {
+    match->dl_src[ i ] = ( uint8_t ) random();
+    match->dl_dst[ i ] = ( uint8_t ) random();
+  }
+  match->dl_vlan = UINT16_MAX;
+  match->dl_type = 0x0800;
+  match->nw_proto = ( uint8_t ) ( random() % 2 == 0 ? IPPROTO_TCP : IPPROTO_UDP );
+  match->nw_src = ( uint32_t ) random();
+  match->nw_dst = ( uint32_t ) random();
+  match->tp_src = ( uint16_t ) random();
+  match->tp_dst = ( uint16_t ) ( random() % 1024 );
+}
+
+
+// A mix of exact rules, destination prefixes, transport port rules and
+// per-port rules, as packetin_filter and routing applications install.
+static void
+set_rule( struct ofp_match *rule, const struct ofp_match *packet, unsigned int i ) {
+  *rule = *packet;
+  switch ( i % 4 ) {
+  case 0:
+    rule->wildcards = 0;
+    break;
+  case 1:
+    rule->wildcards = OFPFW_ALL & ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_DST_MASK );
+    rule->wildcards |= ( uint32_t ) 8 << OFPFW_NW_DST_SHIFT;
+    rule->nw_dst &= 0xffffff00;
+    break;
+  case 2:
+    rule->wildcards = OFPFW_ALL & ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_PROTO | OFPFW_TP_DST );
+    break;
+  default:
+    rule->wildcards = OFPFW_ALL & ~( uint32_t ) OFPFW_IN_PORT;
+    break;
+  }
+}
+
+
+static double
+benchmark_match_table_lookup( unsigned int operations ) {
+  struct ofp_match *packets = xmalloc( sizeof( struct ofp_match ) * MATCH_TABLE_PACKETS );
+  for ( unsigned int i = 0; i < MATCH_TABLE_PACKETS; i++ ) {
+    set_random_match( &packets[ i ] );
+  }
+
+  match_table *table = create_match_table();
+  for ( unsigned int i = 0; i < MATCH_TABLE_RULES; i++ ) {
+    struct ofp_match rule;
+    set_rule( &rule, &packets[ i % MATCH_TABLE_PACKETS ], i );
+    insert_match_entry_in( table, &rule, ( uint16_t ) ( random() % UINT16_MAX ), "benchmark" );
+  }
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    sink += ( uintptr_t ) lookup_match_entry_in( table, &packets[ i % MATCH_TABLE_PACKETS ] );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  delete_match_table( table );
+  xfree( packets );
+
+  return nsec;
+}
+
+
+/********************************************************************************
+ * buffer.
+ ********************************************************************************/
+
+static double
+benchmark_buffer_append_back( unsigned int operations ) {
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    buffer *buf = alloc_buffer_with_length( 128 );
+    sink += ( uintptr_t ) append_back_buffer( buf, 128 );
+    free_buffer( buf );
+  }
+
+  return elapsed_nsec( &begin );
+}
+
+
+static double
+benchmark_buffer_append_front( unsigned int operations ) {
+  buffer *buf = alloc_buffer_with_length( 128 );
+  append_back_buffer( buf, 128 );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    sink += ( uintptr_t ) append_front_buffer( buf, sizeof( openflow_service_header_t ) );
+    remove_front_buffer( buf, sizeof( openflow_service_header_t ) );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( buf );
+
+  return nsec;
+}
+
+
+static double
+benchmark_buffer_duplicate( unsigned int operations ) {
+  buffer *buf = alloc_buffer_with_length( 1500 );
+  append_back_buffer( buf, 1500 );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    buffer *duplicate = duplicate_buffer( buf );
+    sink += ( uintptr_t ) duplicate->data;
+    free_buffer( duplicate );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( buf );
+
+  return nsec;
+}
+
+
+static double
+benchmark_buffer_clone( unsigned int operations ) {
+  buffer *buf = alloc_buffer_with_length( 1500 );
+  append_back_buffer( buf, 1500 );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    buffer *clone = clone_buffer( buf );
+    sink += ( uintptr_t ) clone->data;
+    free_buffer( clone );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( buf );
+
+  return nsec;
+}
+
+
+/********************************************************************************
+ * Packet parsing.
+ ********************************************************************************/
+
+static double
+benchmark_parse_packet( unsigned int operations ) {
+  buffer *frame = create_udp_frame();
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    sink += parse_packet( frame );
+    ( *frame->user_data_free_function )( frame );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( frame );
+
+  return nsec;
+}
+
+
+static double
+benchmark_set_match_from_packet( unsigned int operations ) {
+  buffer *frame = create_parsed_udp_frame();
+  struct ofp_match match;
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    set_match_from_packet( &match, 1, 0, frame );
+    sink += match.nw_src;
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( frame );
+
+  return nsec;
+}
+
+
+/********************************************************************************
+ * OpenFlow messages.
+ ********************************************************************************/
+
+static double
+benchmark_create_flow_mod( unsigned int operations ) {
+  buffer *frame = create_parsed_udp_frame();
+  struct ofp_match match;
+  set_match_from_packet( &match, 1, 0, frame );
+  openflow_actions *actions = create_actions();
+  append_action_output( actions, 2, UINT16_MAX );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    buffer *flow_mod = create_flow_mod( i, match, 0, OFPFC_ADD, 60, 0, UINT16_MAX, UINT32_MAX, OFPP_NONE, 0, actions );
+    sink += flow_mod->length;
+    free_buffer( flow_mod );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  delete_actions( actions );
+  free_buffer( frame );
+
+  return nsec;
+}
+
+
+static double
+benchmark_create_packet_out( unsigned int operations ) {
+  buffer *frame = create_parsed_udp_frame();
+  openflow_actions *actions = create_actions();
+  append_action_output( actions, OFPP_FLOOD, UINT16_MAX );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    buffer *packet_out = create_packet_out( i, UINT32_MAX, 1, actions, frame );
+    sink += packet_out->length;
+    free_buffer( packet_out );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  delete_actions( actions );
+  free_buffer( frame );
+
+  return nsec;
+}
+
+
+static double
+benchmark_validate_openflow_message( unsigned int operations ) {
+  buffer *flow_mod = create_flow_mod_message();
+  if ( validate_openflow_message( flow_mod ) != 0 ) {
+    fprintf( stderr, "Failed to validate a flow_mod message.\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    sink += ( uintptr_t ) validate_openflow_message( flow_mod );
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( flow_mod );
+
+  return nsec;
+}
+
+
+/********************************************************************************
+ * Byte order conversion.
+ ********************************************************************************/
+
+static double
+benchmark_ntoh_match( unsigned int operations ) {
+  buffer *flow_mod = create_flow_mod_message();
+  const struct ofp_match *src = &( ( struct ofp_flow_mod * ) flow_mod->data )->match;
+  struct ofp_match dst;
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    ntoh_match( &dst, src );
+    sink += dst.nw_src;
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  free_buffer( flow_mod );
+
+  return nsec;
+}
+
+
+static double
+benchmark_ntoh_phy_port( unsigned int operations ) {
+  struct ofp_phy_port src, dst;
+  memset( &src, 0, sizeof( src ) );
+  src.port_no = htons( 1 );
+  strncpy( src.name, "eth1", sizeof( src.name ) );
+  src.config = htonl( OFPPC_NO_FLOOD );
+  src.curr = htonl( OFPPF_1GB_FD | OFPPF_COPPER );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    ntoh_phy_port( &dst, &src );
+    sink += dst.port_no;
+  }
+
+  return elapsed_nsec( &begin );
+}
+
+
+static double
+benchmark_ntoh_flow_stats( unsigned int operations ) {
+  const uint16_t length = ( uint16_t ) ( offsetof( struct ofp_flow_stats, actions ) + sizeof( struct ofp_action_output ) );
+  buffer *flow_mod = create_flow_mod_message();
+  struct ofp_flow_stats *src = xcalloc( 1, length );
+  struct ofp_flow_stats *dst = xcalloc( 1, length );
+  src->length = htons( length );
+  src->match = ( ( struct ofp_flow_mod * ) flow_mod->data )->match;
+  src->priority = htons( UINT16_MAX );
+  src->idle_timeout = htons( 60 );
+  src->packet_count = htonll( 1000 );
+  src->byte_count = htonll( 64000 );
+  struct ofp_action_output *output = ( struct ofp_action_output * ) src->actions;
+  output->type = htons( OFPAT_OUTPUT );
+  output->len = htons( sizeof( struct ofp_action_output ) );
+  output->port = htons( 2 );
+  output->max_len = htons( UINT16_MAX );
+
+  struct timespec begin;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < operations; i++ ) {
+    ntoh_flow_stats( dst, src );
+    sink += dst->length;
+  }
+  double nsec = elapsed_nsec( &begin );
+
+  xfree( dst );
+  xfree( src );
+  free_buffer( flow_mod );
+
+  return nsec;
+}
+
+
+/********************************************************************************
+ * Benchmark runner.
+ ********************************************************************************/
+
+typedef struct {
+  const char *name;
+  double ( *function )( unsigned int operations );
+} benchmark;
+
+
+static const benchmark benchmarks[] = {
+  { "hash_table.insert", benchmark_hash_table_insert },
+  { "hash_table.lookup", benchmark_hash_table_lookup },
+  { "hash_table.delete", benchmark_hash_table_delete },
+  { "match_table.lookup", benchmark_match_table_lookup },
+  { "buffer.append_back", benchmark_buffer_append_back },
+  { "buffer.append_front", benchmark_buffer_append_front },
+  { "buffer.duplicate", benchmark_buffer_duplicate },
+  { "buffer.clone", benchmark_buffer_clone },
+  { "packet_parser.parse_packet", benchmark_parse_packet },
+  { "openflow_message.set_match_from_packet", benchmark_set_match_from_packet },
+  { "openflow_message.create_flow_mod", benchmark_create_flow_mod },
+  { "openflow_message.create_packet_out", benchmark_create_packet_out },
+  { "openflow_message.validate_openflow_message", benchmark_validate_openflow_message },
+  { "byteorder.ntoh_match", benchmark_ntoh_match },
+  { "byteorder.ntoh_phy_port", benchmark_ntoh_phy_port },
+  { "byteorder.ntoh_flow_stats", benchmark_ntoh_flow_stats },
+};
+
+
+static int
+compare_double( const void *x, const void *y ) {
+  double a = *( const double * ) x;
+  double b = *( const double * ) y;
+
+  return a < b ? -1 : ( a > b ? 1 : 0 );
+}
+
+
+static double
+run_benchmark( const benchmark *b, unsigned int operations ) {
+  double nsec[ ROUNDS ];
+
+  for ( int i = 0; i < ROUNDS; i++ ) {
+    srandom( 1 );
+    nsec[ i ] = b->function( operations ) / operations;
+  }
+  qsort( nsec, ROUNDS, sizeof( double ), compare_double );
+
+  return nsec[ ROUNDS / 2 ];
+}
+
+
+/********************************************************************************
+ * Baseline.
+ ********************************************************************************/
+
+typedef struct {
+  char name[ MAX_BENCHMARK_NAME_LENGTH ];
+  double nsec_per_op;
+} baseline_entry;
+
+
+// Reads the benchmarks from the output of an earlier run. Each of them
+// is on a line of its own.
+static unsigned int
+read_baseline( const char *file, baseline_entry *entries, unsigned int max_entries ) {
+  FILE *fp = fopen( file, "r" );
+  if ( fp == NULL ) {
+    perror( file );
+    exit( EXIT_FAILURE );
+  }
+
+  unsigned int n = 0;
+  char line[ 256 ];
+  while ( n < max_entries && fgets( line, sizeof( line ), fp ) != NULL ) {
+    unsigned int operations;
+    if ( sscanf( line, " { \"name\": \"%63[^\"]\", \"operations\": %u, \"nsec_per_op\": %lf",
+                 entries[ n ].name, &operations, &entries[ n ].nsec_per_op ) == 3 ) {
+      n++;
+    }
+  }
+  fclose( fp );
+
+  return n;
+}
+
+
+static const baseline_entry *
+lookup_baseline( const baseline_entry *entries, unsigned int n, const char *name ) {
+  for ( unsigned int i = 0; i < n; i++ ) {
+    if ( strcmp( entries[ i ].name, name ) == 0 ) {
+      return &entries[ i ];
+    }
+  }
+
+  return NULL;
+}
+
+
+/********************************************************************************
+ * Main.
+ ********************************************************************************/
+
+static void
+print_usage( const char *program ) {
+  fprintf( stderr, "Usage: %s [-n operations] [-b baseline.json] [-t threshold_percent]\n", program );
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  unsigned int operations = DEFAULT_OPERATIONS;
+  const char *baseline_file = NULL;
+  double threshold = DEFAULT_THRESHOLD;
+
+  int c;
+  while ( ( c = getopt( argc, argv, "n:b:t:h" ) ) != -1 ) {
+    switch ( c ) {
+    case 'n':
+      operations = ( unsigned int ) strtoul( optarg, NULL, 10 );
+      break;
+    case 'b':
+      baseline_file = optarg;
+      break;
+    case 't':
+      threshold = strtod( optarg, NULL );
+      break;
+    default:
+      print_usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+  if ( operations == 0 || optind != argc ) {
+    print_usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int n_benchmarks = sizeof( benchmarks ) / sizeof( benchmarks[ 0 ] );
+  baseline_entry baseline[ n_benchmarks ];
+  unsigned int n_baseline = 0;
+  if ( baseline_file != NULL ) {
+    n_baseline = read_baseline( baseline_file, baseline, n_benchmarks );
+  }
+
+  // Message creation and parsing log at debug level, and the buffer
+  // pool counts its hits in statistics, as in init_trema().
+  char directory[] = "/tmp/libtrema_benchmark.XXXXXX";
+  if ( mkdtemp( directory ) == NULL ) {
+    perror( "mkdtemp" );
+    return EXIT_FAILURE;
+  }
+  init_log( "libtrema_benchmark", directory, false );
+  init_stat();
+  init_buffer_pool( DEFAULT_BUFFER_HEADROOM, DEFAULT_BUFFER_TAILROOM );
+
+  unsigned int regressions = 0;
+  printf( "{\n" );
+  printf( "  \"rounds\": %d,\n", ROUNDS );
+  printf( "  \"benchmarks\": [\n" );
+  for ( unsigned int i = 0; i < n_benchmarks; i++ ) {
+    const benchmark *b = &benchmarks[ i ];
+    double nsec_per_op = run_benchmark( b, operations );
+
+    printf( "    { \"name\": \"%s\", \"operations\": %u, \"nsec_per_op\": %.1f", b->name, operations, nsec_per_op );
+    const baseline_entry *base = lookup_baseline( baseline, n_baseline, b->name );
+    if ( base != NULL && base->nsec_per_op > 0 ) {
+      double change = ( nsec_per_op / base->nsec_per_op - 1.0 ) * 100.0;
+      bool regressed = change > threshold;
+      printf( ", \"baseline_nsec_per_op\": %.1f, \"change_percent\": %.1f, \"regressed\": %s",
+              base->nsec_per_op, change, regressed ? "true" : "false" );
+      if ( regressed ) {
+        regressions++;
+      }
+    }
+    printf( " }%s\n", i + 1 < n_benchmarks ? "," : "" );
+    fflush( stdout );
+  }
+  printf( "  ]" );
+  if ( baseline_file != NULL ) {
+    printf( ",\n  \"threshold_percent\": %.1f,\n  \"regressions\": %u", threshold, regressions );
+  }
+  printf( "\n}\n" );
+
+  finalize_buffer_pool();
+  finalize_stat();
+  finalize_log();
+  char log_file[ PATH_MAX ];
+  snprintf( log_file, sizeof( log_file ), "%s/libtrema_benchmark.log", directory );
+  unlink( log_file );
+  rmdir( directory );
+
+  return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
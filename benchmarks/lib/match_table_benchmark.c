@@ -0,0 +1,510 @@
+/*
+ * Compares the tuple space search of match_table with the linear walk
+ * of wildcard entries it replaced.
+ *
+ * For each number of rules, fills a table with wildcard rules of a
+ * mix of masks and random priorities, and reports the time to insert
+ * and delete a sample of rules in the full table, and the time per
+ * lookup of packets that hit a rule and of packets that miss all of
+ * them. Results of both implementations are checked against each
+ * other. Tuple space search is measured again with a microflow cache.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <limits.h>
+#include <net/ethernet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trema.h"
+
+
+#define DEFAULT_OPERATIONS 1000000
+#define SAMPLE_RULES 1000
+#define SERVICE_NAME "benchmark"
+
+
+/********************************************************************************
+ * The list of wildcard entries in descending order of priority, as it
+ * was before match_table moved to tuple space search.
+ ********************************************************************************/
+
+typedef struct {
+  struct ofp_match ofp_match;
+  uint16_t priority;
+} legacy_entry;
+
+
+static list_element *legacy_table = NULL;
+
+
+static void
+legacy_insert_entry( legacy_entry *new_entry ) {
+  list_element *element;
+  legacy_entry *entry = NULL;
+  for ( element = legacy_table; element != NULL; element = element->next ) {
+    entry = element->data;
+    if ( entry->priority == new_entry->priority
+         && ( ( entry->ofp_match.wildcards ^ new_entry->ofp_match.wildcards ) & OFPFW_ALL ) == 0
+         && compare_match( &entry->ofp_match, &new_entry->ofp_match ) ) {
+      return;
+    }
+    if ( entry->priority < new_entry->priority ) {
+      break;
+    }
+  }
+  if ( element == NULL ) {
+    append_to_tail( &legacy_table, new_entry );
+  }
+  else if ( element == legacy_table ) {
+    insert_in_front( &legacy_table, new_entry );
+  }
+  else {
+    insert_before( &legacy_table, element->data, new_entry );
+  }
+}
+
+
+static void
+legacy_delete_entry( legacy_entry *old_entry ) {
+  for ( list_element *element = legacy_table; element != NULL; element = element->next ) {
+    legacy_entry *entry = element->data;
+    if ( entry->priority == old_entry->priority
+         && ( ( entry->ofp_match.wildcards ^ old_entry->ofp_match.wildcards ) & OFPFW_ALL ) == 0
+         && compare_match( &entry->ofp_match, &old_entry->ofp_match ) ) {
+      delete_element( &legacy_table, entry );
+      return;
+    }
+  }
+}
+
+
+static legacy_entry *
+legacy_lookup_entry( struct ofp_match *ofp_match ) {
+  for ( list_element *element = legacy_table; element != NULL; element = element->next ) {
+    legacy_entry *entry = element->data;
+    if ( compare_match( &entry->ofp_match, ofp_match ) ) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+
+/********************************************************************************
+ * Rules and packets.
+ ********************************************************************************/
+
+static legacy_entry *rules = NULL;
+static struct ofp_match *hit_packets = NULL;
+static struct ofp_match *miss_packets = NULL;
+static unsigned int number_of_packets = 0;
+
+
+static uint32_t
+prefix_wildcards( uint32_t prefix_length, uint32_t shift ) {
+  return ( 32 - prefix_length ) << shift;
+}
+
+
+static void
+set_random_rule( legacy_entry *rule ) {
+  static const uint32_t prefix_lengths[] = { 8, 16, 24, 32 };
+  struct ofp_match *m = &rule->ofp_match;
+
+  memset( m, 0, sizeof( struct ofp_match ) );
+  m->in_port = ( uint16_t ) ( 1 + random() % 48 );
+  for ( int i = 0; i < OFP_ETH_ALEN; i++ ) {
+    m->dl_src[ i ] = ( uint8_t ) random();
+    m->dl_dst[ i ] = ( uint8_t ) random();
+  }
+  m->dl_type = ETHERTYPE_IP;
+  m->nw_proto = ( random() % 2 ) == 0 ? 6 : 17;
+  m->nw_src = ( uint32_t ) random();
+  m->nw_dst = ( uint32_t ) random();
+  m->tp_dst = ( uint16_t ) ( random() % 1024 );
+
+  uint32_t src_prefix = prefix_lengths[ random() % 4 ];
+  uint32_t dst_prefix = prefix_lengths[ random() % 4 ];
+  uint32_t all = ( OFPFW_ALL & ~( uint32_t ) ( OFPFW_NW_SRC_MASK | OFPFW_NW_DST_MASK ) )
+                 | OFPFW_NW_SRC_ALL | OFPFW_NW_DST_ALL;
+  switch ( random() % 6 ) {
+    case 0:
+      m->wildcards = ( all & ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_SRC_MASK ) )
+                     | prefix_wildcards( src_prefix, OFPFW_NW_SRC_SHIFT );
+      break;
+    case 1:
+      m->wildcards = ( all & ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_DST_MASK ) )
+                     | prefix_wildcards( dst_prefix, OFPFW_NW_DST_SHIFT );
+      break;
+    case 2:
+      m->wildcards = all & ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_PROTO | OFPFW_TP_DST );
+      break;
+    case 3:
+      m->wildcards = all & ~( uint32_t ) ( OFPFW_IN_PORT | OFPFW_DL_SRC );
+      break;
+    case 4:
+      m->wildcards = ( all & ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_PROTO | OFPFW_TP_DST
+                                             | OFPFW_NW_SRC_MASK | OFPFW_NW_DST_MASK ) )
+                     | prefix_wildcards( src_prefix, OFPFW_NW_SRC_SHIFT )
+                     | prefix_wildcards( dst_prefix, OFPFW_NW_DST_SHIFT );
+      break;
+    default:
+      m->wildcards = all & ~( uint32_t ) OFPFW_DL_DST;
+      break;
+  }
+  rule->priority = ( uint16_t ) random();
+}
+
+
+static void
+set_random_packet( struct ofp_match *packet ) {
+  memset( packet, 0, sizeof( struct ofp_match ) );
+  packet->in_port = ( uint16_t ) ( 1 + random() % 48 );
+  for ( int i = 0; i < OFP_ETH_ALEN; i++ ) {
+    packet->dl_src[ i ] = ( uint8_t ) random();
+    packet->dl_dst[ i ] = ( uint8_t ) random();
+  }
+  packet->dl_type = ETHERTYPE_IP;
+  packet->nw_proto = 6;
+  packet->nw_src = ( uint32_t ) random();
+  packet->nw_dst = ( uint32_t ) random();
+  packet->tp_src = ( uint16_t ) random();
+  packet->tp_dst = ( uint16_t ) ( 1024 + random() % 1024 );
+}
+
+
+static void
+set_hit_packet( struct ofp_match *packet, const legacy_entry *rule ) {
+  const struct ofp_match *m = &rule->ofp_match;
+  uint32_t src_mask = create_nw_src_mask( m->wildcards );
+  uint32_t dst_mask = create_nw_dst_mask( m->wildcards );
+
+  set_random_packet( packet );
+  if ( !( m->wildcards & OFPFW_IN_PORT ) ) {
+    packet->in_port = m->in_port;
+  }
+  if ( !( m->wildcards & OFPFW_DL_SRC ) ) {
+    memcpy( packet->dl_src, m->dl_src, OFP_ETH_ALEN );
+  }
+  if ( !( m->wildcards & OFPFW_DL_DST ) ) {
+    memcpy( packet->dl_dst, m->dl_dst, OFP_ETH_ALEN );
+  }
+  if ( !( m->wildcards & OFPFW_NW_PROTO ) ) {
+    packet->nw_proto = m->nw_proto;
+  }
+  if ( !( m->wildcards & OFPFW_TP_DST ) ) {
+    packet->tp_dst = m->tp_dst;
+  }
+  packet->nw_src = ( m->nw_src & src_mask ) | ( packet->nw_src & ~src_mask );
+  packet->nw_dst = ( m->nw_dst & dst_mask ) | ( packet->nw_dst & ~dst_mask );
+}
+
+
+static void
+create_rules_and_packets( unsigned int n ) {
+  rules = xmalloc( sizeof( legacy_entry ) * n );
+  for ( unsigned int i = 0; i < n; i++ ) {
+    set_random_rule( &rules[ i ] );
+  }
+
+  hit_packets = xmalloc( sizeof( struct ofp_match ) * number_of_packets );
+  miss_packets = xmalloc( sizeof( struct ofp_match ) * number_of_packets );
+  for ( unsigned int i = 0; i < number_of_packets; i++ ) {
+    set_hit_packet( &hit_packets[ i ], &rules[ ( unsigned int ) random() % n ] );
+    // Rules of case 0 with /8 prefixes catch a share of random
+    // packets. A fixed dl_type that no rule has misses them all.
+    set_random_packet( &miss_packets[ i ] );
+    miss_packets[ i ].dl_type = 0x88cc;
+  }
+}
+
+
+static void
+delete_rules_and_packets() {
+  xfree( miss_packets );
+  xfree( hit_packets );
+  xfree( rules );
+}
+
+
+/********************************************************************************
+ * Benchmark.
+ ********************************************************************************/
+
+typedef struct {
+  double insert_nsec;
+  double lookup_nsec;
+  double lookup_miss_nsec;
+  double delete_nsec;
+  unsigned int lookups;
+} result;
+
+
+static double
+elapsed_nsec( const struct timespec *begin ) {
+  struct timespec end;
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( double ) ( end.tv_sec - begin->tv_sec ) * 1e9 + ( double ) ( end.tv_nsec - begin->tv_nsec );
+}
+
+
+static int
+compare_rule_priority( const void *x, const void *y ) {
+  const legacy_entry *const *a = x;
+  const legacy_entry *const *b = y;
+
+  if ( ( *a )->priority != ( *b )->priority ) {
+    return ( *a )->priority > ( *b )->priority ? -1 : 1;
+  }
+  // Keeps the order of insertion among equal priorities.
+  return *a < *b ? -1 : ( *a > *b ? 1 : 0 );
+}
+
+
+static void
+run_legacy( unsigned int n, unsigned int lookups, result *r ) {
+  memset( r, 0, sizeof( result ) );
+  r->lookups = lookups;
+  struct timespec begin;
+  unsigned int sample = n < SAMPLE_RULES ? n : SAMPLE_RULES;
+  unsigned int prefilled = n - sample;
+
+  // Inserting one by one would take O(n^2) time, so the rules before
+  // the sample are sorted and linked up front.
+  legacy_entry **sorted = xmalloc( sizeof( legacy_entry * ) * ( prefilled + 1 ) );
+  for ( unsigned int i = 0; i < prefilled; i++ ) {
+    sorted[ i ] = &rules[ i ];
+  }
+  qsort( sorted, prefilled, sizeof( legacy_entry * ), compare_rule_priority );
+  create_list( &legacy_table );
+  for ( unsigned int i = prefilled; i > 0; i-- ) {
+    insert_in_front( &legacy_table, sorted[ i - 1 ] );
+  }
+  xfree( sorted );
+
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = prefilled; i < n; i++ ) {
+    legacy_insert_entry( &rules[ i ] );
+  }
+  r->insert_nsec = elapsed_nsec( &begin ) / sample;
+
+  uintptr_t sum = 0;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < lookups; i++ ) {
+    sum += ( uintptr_t ) legacy_lookup_entry( &hit_packets[ i % number_of_packets ] );
+  }
+  r->lookup_nsec = elapsed_nsec( &begin ) / lookups;
+
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < lookups; i++ ) {
+    sum += ( uintptr_t ) legacy_lookup_entry( &miss_packets[ i % number_of_packets ] );
+  }
+  r->lookup_miss_nsec = elapsed_nsec( &begin ) / lookups;
+
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = prefilled; i < n; i++ ) {
+    legacy_delete_entry( &rules[ i ] );
+  }
+  r->delete_nsec = elapsed_nsec( &begin ) / sample;
+
+  delete_list( legacy_table );
+  legacy_table = NULL;
+
+  if ( sum == 1 ) {
+    // Keeps the loops above from being optimized away.
+    printf( "#\n" );
+  }
+}
+
+
+static void
+run_tuple_space( unsigned int n, unsigned int lookups, unsigned int cache_entries, result *r ) {
+  memset( r, 0, sizeof( result ) );
+  r->lookups = lookups;
+  struct timespec begin;
+  unsigned int sample = n < SAMPLE_RULES ? n : SAMPLE_RULES;
+  unsigned int prefilled = n - sample;
+
+  init_match_table();
+  if ( cache_entries > 0 ) {
+    enable_microflow_cache( cache_entries );
+  }
+  for ( unsigned int i = 0; i < prefilled; i++ ) {
+    insert_match_entry( &rules[ i ].ofp_match, rules[ i ].priority, SERVICE_NAME );
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = prefilled; i < n; i++ ) {
+    insert_match_entry( &rules[ i ].ofp_match, rules[ i ].priority, SERVICE_NAME );
+  }
+  r->insert_nsec = elapsed_nsec( &begin ) / sample;
+
+  uintptr_t sum = 0;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < lookups; i++ ) {
+    sum += ( uintptr_t ) lookup_match_entry( &hit_packets[ i % number_of_packets ] );
+  }
+  r->lookup_nsec = elapsed_nsec( &begin ) / lookups;
+
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = 0; i < lookups; i++ ) {
+    sum += ( uintptr_t ) lookup_match_entry( &miss_packets[ i % number_of_packets ] );
+  }
+  r->lookup_miss_nsec = elapsed_nsec( &begin ) / lookups;
+
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  for ( unsigned int i = prefilled; i < n; i++ ) {
+    delete_match_entry( &rules[ i ].ofp_match, rules[ i ].priority, SERVICE_NAME );
+  }
+  r->delete_nsec = elapsed_nsec( &begin ) / sample;
+
+  finalize_match_table();
+
+  if ( sum == 1 ) {
+    printf( "#\n" );
+  }
+}
+
+
+/**
+ * Counts the packets for which both implementations disagree on the
+ * rule found.
+ */
+static unsigned int
+count_mismatches( unsigned int n ) {
+  create_list( &legacy_table );
+  init_match_table();
+  for ( unsigned int i = 0; i < n; i++ ) {
+    legacy_insert_entry( &rules[ i ] );
+    insert_match_entry( &rules[ i ].ofp_match, rules[ i ].priority, SERVICE_NAME );
+  }
+
+  unsigned int mismatches = 0;
+  for ( unsigned int i = 0; i < number_of_packets; i++ ) {
+    legacy_entry *expected = legacy_lookup_entry( &hit_packets[ i ] );
+    match_entry *found = lookup_match_entry( &hit_packets[ i ] );
+    if ( expected == NULL || found == NULL ) {
+      if ( expected != NULL || found != NULL ) {
+        mismatches++;
+      }
+      continue;
+    }
+    if ( expected->priority != found->priority
+         || memcmp( &expected->ofp_match, &found->ofp_match, sizeof( struct ofp_match ) ) != 0 ) {
+      mismatches++;
+    }
+  }
+
+  finalize_match_table();
+  delete_list( legacy_table );
+  legacy_table = NULL;
+
+  return mismatches;
+}
+
+
+static void
+print_result( const char *name, unsigned int n, const result *r ) {
+  printf( "- implementation: %s\n", name );
+  printf( "  rules: %u\n", n );
+  printf( "  lookups: %u\n", r->lookups );
+  printf( "  insert_nsec: %.1f\n", r->insert_nsec );
+  printf( "  lookup_nsec: %.1f\n", r->lookup_nsec );
+  printf( "  lookup_miss_nsec: %.1f\n", r->lookup_miss_nsec );
+  printf( "  delete_nsec: %.1f\n", r->delete_nsec );
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  unsigned int sizes[] = { 10, 1000, 100000 };
+  unsigned int n_sizes = sizeof( sizes ) / sizeof( sizes[ 0 ] );
+  unsigned long operations = DEFAULT_OPERATIONS;
+
+  if ( argc > 1 ) {
+    sizes[ 0 ] = ( unsigned int ) strtoul( argv[ 1 ], NULL, 10 );
+    n_sizes = 1;
+  }
+  if ( argc > 2 ) {
+    operations = strtoul( argv[ 2 ], NULL, 10 );
+  }
+  if ( sizes[ 0 ] == 0 || operations == 0 ) {
+    fprintf( stderr, "Usage: %s [rules] [lookups]\n", argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  // Hits and misses of the microflow cache are counted in statistics,
+  // which log.
+  char directory[] = "/tmp/match_table_benchmark.XXXXXX";
+  if ( mkdtemp( directory ) == NULL ) {
+    perror( "mkdtemp" );
+    return EXIT_FAILURE;
+  }
+  init_log( "match_table_benchmark", directory, false );
+  init_stat();
+
+  srandom( 1 );
+  for ( unsigned int i = 0; i < n_sizes; i++ ) {
+    unsigned int n = sizes[ i ];
+    number_of_packets = 4096;
+    create_rules_and_packets( n );
+
+    // A linear walk costs O(n) per lookup, so large tables get fewer.
+    unsigned long legacy_lookups = operations * 10 / n;
+    if ( legacy_lookups > operations ) {
+      legacy_lookups = operations;
+    }
+    if ( legacy_lookups < SAMPLE_RULES ) {
+      legacy_lookups = SAMPLE_RULES;
+    }
+
+    result r;
+    run_legacy( n, ( unsigned int ) legacy_lookups, &r );
+    print_result( "linear", n, &r );
+    run_tuple_space( n, ( unsigned int ) operations, 0, &r );
+    print_result( "tuple_space", n, &r );
+    printf( "  mismatches: %u\n", count_mismatches( n < 10000 ? n : 10000 ) );
+    // The cache holds every packet looked up, so all but the first
+    // lookup of each packet hit.
+    run_tuple_space( n, ( unsigned int ) operations, number_of_packets * 2, &r );
+    print_result( "tuple_space_cached", n, &r );
+
+    delete_rules_and_packets();
+  }
+
+  finalize_stat();
+  finalize_log();
+  char log_file[ PATH_MAX ];
+  snprintf( log_file, sizeof( log_file ), "%s/match_table_benchmark.log", directory );
+  unlink( log_file );
+  rmdir( directory );
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
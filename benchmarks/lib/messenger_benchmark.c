@@ -0,0 +1,583 @@
+/*
+ * Throughput and latency benchmark suite for messenger.
+ *
+ * A producer process talks to one or more consumer processes for each
+ * combination of mode, message length, fan-out and queue depth:
+ *
+ * - notify: the producer sends every message to each consumer with
+ *   send_message(). depth is the send queue limit in messages.
+ * - request: the producer spreads requests over the consumers with
+ *   send_request_message(), and they answer with send_reply_message().
+ *   depth is the number of outstanding requests.
+ *
+ * Latency is one way for notify, where messages carry their send time,
+ * and round trip for request. Results are printed as a YAML sequence
+ * with one entry per case, so that they can be compared across runs.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "timer.h"
+#include "trema.h"
+
+
+#define PRODUCER_NAME "benchmark_producer"
+#define CONSUMER_NAME_FORMAT "benchmark_consumer%d"
+#define DEFAULT_MESSAGE_COUNT 100000
+#define DEFAULT_REQUEST_COUNT 20000
+#define MAX_FAN_OUT 16
+#define MAX_SWEEP 16
+#define MESSAGE_OVERHEAD 16 // room for the messenger header in queue limits
+#define REQUEST_OVERHEAD ( MESSAGE_OVERHEAD + sizeof( messenger_context_handle ) + MESSENGER_SERVICE_NAME_LENGTH )
+
+enum {
+  MODE_NOTIFY,
+  MODE_REQUEST,
+};
+
+enum {
+  TAG_DATA,
+  TAG_QUIT,
+  TAG_DONE,
+};
+
+
+typedef struct sweep {
+  int values[ MAX_SWEEP ];
+  int count;
+} sweep;
+
+
+static const char *mode_names[] = { "notify", "request" };
+
+static sweep modes = { { MODE_NOTIFY, MODE_REQUEST }, 2 };
+static sweep message_lengths = { { 64, 512, 4096 }, 3 };
+static sweep fan_outs = { { 1, 4 }, 2 };
+static sweep depths = { { 1, 64, 4096 }, 3 };
+static uint64_t notify_count = DEFAULT_MESSAGE_COUNT;
+static uint64_t request_count = DEFAULT_REQUEST_COUNT;
+
+// State of the case being run.
+static int mode;
+static size_t message_length;
+static int fan_out;
+static int depth;
+static uint64_t message_count;
+static char *message = NULL;
+static char consumer_names[ MAX_FAN_OUT ][ MESSENGER_SERVICE_NAME_LENGTH ];
+
+// Producer.
+static uint64_t sent_counts[ MAX_FAN_OUT ];
+static uint64_t replied_count;
+static int quit_count;
+static int done_count;
+static struct timespec *request_times = NULL;
+static double *latencies = NULL;
+static uint64_t latency_count;
+
+// Consumer.
+static uint64_t received_count;
+
+
+static double
+elapsed_seconds( const struct timespec *begin, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - begin->tv_sec ) + ( double ) ( end->tv_nsec - begin->tv_nsec ) / 1e9;
+}
+
+
+static double
+elapsed_usec_since( const struct timespec *begin ) {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return elapsed_seconds( begin, &now ) * 1e6;
+}
+
+
+static int
+compare_double( const void *x, const void *y ) {
+  double a = *( const double * ) x;
+  double b = *( const double * ) y;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+
+static bool
+parse_sweep( const char *arg, sweep *values, int min, int max ) {
+  char *copy = xstrdup( arg );
+  char *saveptr = NULL;
+  values->count = 0;
+  for ( char *p = strtok_r( copy, ",", &saveptr ); p != NULL; p = strtok_r( NULL, ",", &saveptr ) ) {
+    int value = atoi( p );
+    if ( value < min || value > max || values->count == MAX_SWEEP ) {
+      xfree( copy );
+      return false;
+    }
+    values->values[ values->count++ ] = value;
+  }
+  xfree( copy );
+
+  return values->count > 0;
+}
+
+
+static bool
+parse_modes( const char *arg ) {
+  char *copy = xstrdup( arg );
+  char *saveptr = NULL;
+  modes.count = 0;
+  for ( char *p = strtok_r( copy, ",", &saveptr ); p != NULL && modes.count < MAX_SWEEP; p = strtok_r( NULL, ",", &saveptr ) ) {
+    if ( strcmp( p, mode_names[ MODE_NOTIFY ] ) == 0 ) {
+      modes.values[ modes.count++ ] = MODE_NOTIFY;
+    }
+    else if ( strcmp( p, mode_names[ MODE_REQUEST ] ) == 0 ) {
+      modes.values[ modes.count++ ] = MODE_REQUEST;
+    }
+    else {
+      xfree( copy );
+      return false;
+    }
+  }
+  xfree( copy );
+
+  return modes.count > 0;
+}
+
+
+static void
+init( const char *name, const char *directory ) {
+  init_log( name, directory, false );
+  // send_message() warns each time the queue is full, which is the
+  // normal state while this benchmark runs.
+  set_logging_level( "error" );
+  init_timer();
+  init_messenger( directory );
+}
+
+
+static void
+finalize( const char *name, const char *directory ) {
+  finalize_messenger();
+  finalize_timer();
+  finalize_log();
+
+  char log_file[ PATH_MAX ];
+  snprintf( log_file, sizeof( log_file ), "%s/%s.log", directory, name );
+  unlink( log_file );
+}
+
+
+/********************************************************************************
+ * Consumer.
+ ********************************************************************************/
+
+static void
+recv_consumer_message( uint16_t tag, void *data, size_t len ) {
+  UNUSED( len );
+
+  if ( tag == TAG_DATA ) {
+    struct timespec sent;
+    memcpy( &sent, data, sizeof( sent ) );
+    latencies[ received_count++ ] = elapsed_usec_since( &sent );
+  }
+  else if ( tag == TAG_QUIT ) {
+    send_message( PRODUCER_NAME, TAG_DONE, NULL, 0 );
+    flush_messenger();
+    stop_messenger();
+  }
+}
+
+
+static void
+recv_consumer_request( const messenger_context_handle *handle, uint16_t tag, void *data, size_t len ) {
+  UNUSED( tag );
+
+  send_reply_message( handle, TAG_DATA, data, len );
+}
+
+
+static void
+run_consumer( const char *directory, int index, int ready_fd, int result_fd ) {
+  const char *name = consumer_names[ index ];
+
+  // The latency buffer of the producer is inherited and large enough.
+  received_count = 0;
+
+  init( name, directory );
+  add_message_received_callback( name, recv_consumer_message );
+  add_message_requested_callback( name, recv_consumer_request );
+  if ( write( ready_fd, "x", 1 ) != 1 ) {
+    exit( EXIT_FAILURE );
+  }
+  close( ready_fd );
+
+  start_messenger();
+
+  delete_message_requested_callback( name, recv_consumer_request );
+  delete_message_received_callback( name, recv_consumer_message );
+  finalize( name, directory );
+
+  // Latencies of notifications are collected by the producer.
+  size_t len = sizeof( received_count );
+  bool ok = write( result_fd, &received_count, len ) == ( ssize_t ) len;
+  char *p = ( char * ) latencies;
+  len = received_count * sizeof( double );
+  while ( ok && len > 0 ) {
+    ssize_t written = write( result_fd, p, len );
+    ok = written > 0;
+    p += written;
+    len -= ( size_t ) written;
+  }
+  close( result_fd );
+
+  exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+
+/********************************************************************************
+ * Producer.
+ ********************************************************************************/
+
+static void
+send_quit() {
+  while ( quit_count < fan_out ) {
+    if ( !send_message( consumer_names[ quit_count ], TAG_QUIT, NULL, 0 ) ) {
+      return;
+    }
+    quit_count++;
+  }
+}
+
+
+static void
+send_notifications( void *user_data ) {
+  UNUSED( user_data );
+
+  bool all_sent = true;
+  for ( int i = 0; i < fan_out; i++ ) {
+    while ( sent_counts[ i ] < message_count ) {
+      clock_gettime( CLOCK_MONOTONIC, ( struct timespec * ) message );
+      if ( !send_message( consumer_names[ i ], TAG_DATA, message, message_length ) ) {
+        // Queue is full. Retry after it is drained.
+        all_sent = false;
+        break;
+      }
+      sent_counts[ i ]++;
+    }
+  }
+  if ( all_sent ) {
+    send_quit();
+    if ( quit_count == fan_out ) {
+      delete_timer_event_callback( send_notifications );
+    }
+  }
+}
+
+
+static void
+send_requests( void *user_data ) {
+  UNUSED( user_data );
+
+  if ( replied_count == message_count ) {
+    send_quit();
+    if ( quit_count == fan_out ) {
+      delete_timer_event_callback( send_requests );
+    }
+    return;
+  }
+  while ( sent_counts[ 0 ] < message_count && sent_counts[ 0 ] - replied_count < ( uint64_t ) depth ) {
+    uint64_t seq = sent_counts[ 0 ];
+    clock_gettime( CLOCK_MONOTONIC, &request_times[ seq ] );
+    if ( !send_request_message( consumer_names[ seq % ( uint64_t ) fan_out ], PRODUCER_NAME, TAG_DATA,
+                                message, message_length, ( void * ) ( uintptr_t ) seq ) ) {
+      return;
+    }
+    sent_counts[ 0 ]++;
+  }
+}
+
+
+static void
+recv_reply( uint16_t tag, void *data, size_t len, void *user_data ) {
+  UNUSED( tag );
+  UNUSED( data );
+  UNUSED( len );
+
+  uint64_t seq = ( uintptr_t ) user_data;
+  latencies[ latency_count++ ] = elapsed_usec_since( &request_times[ seq ] );
+  replied_count++;
+  send_requests( NULL );
+}
+
+
+static void
+recv_producer_message( uint16_t tag, void *data, size_t len ) {
+  UNUSED( data );
+  UNUSED( len );
+
+  if ( tag == TAG_DONE && ++done_count == fan_out ) {
+    stop_messenger();
+  }
+}
+
+
+static bool
+read_consumer_result( int fd ) {
+  uint64_t count;
+  if ( read( fd, &count, sizeof( count ) ) != ( ssize_t ) sizeof( count ) ) {
+    return false;
+  }
+  char *p = ( char * ) ( latencies + latency_count );
+  size_t len = count * sizeof( double );
+  while ( len > 0 ) {
+    ssize_t n = read( fd, p, len );
+    if ( n <= 0 ) {
+      return false;
+    }
+    p += n;
+    len -= ( size_t ) n;
+  }
+  latency_count += count;
+
+  return true;
+}
+
+
+static void
+print_result( double elapsed ) {
+  uint64_t messages = mode == MODE_NOTIFY ? message_count * ( uint64_t ) fan_out : message_count;
+
+  qsort( latencies, latency_count, sizeof( double ), compare_double );
+
+  printf( "- mode: %s\n", mode_names[ mode ] );
+  printf( "  message_length: %zu\n", message_length );
+  printf( "  fan_out: %d\n", fan_out );
+  printf( "  depth: %d\n", depth );
+  printf( "  messages: %" PRIu64 "\n", messages );
+  printf( "  elapsed_seconds: %.3f\n", elapsed );
+  printf( "  messages_per_second: %.0f\n", ( double ) messages / elapsed );
+  printf( "  megabytes_per_second: %.2f\n", ( double ) ( messages * message_length ) / elapsed / 1e6 );
+  printf( "  latency_p50_usec: %.1f\n", latencies[ latency_count / 2 ] );
+  printf( "  latency_p99_usec: %.1f\n", latencies[ latency_count * 99 / 100 ] );
+  printf( "  latency_p999_usec: %.1f\n", latencies[ latency_count * 999 / 1000 ] );
+  fflush( stdout );
+}
+
+
+static bool
+run_case( const char *directory ) {
+  pid_t pids[ MAX_FAN_OUT ];
+  int result_fds[ MAX_FAN_OUT ];
+  int ready_fds[ 2 ];
+
+  message_count = mode == MODE_NOTIFY ? notify_count : request_count;
+  latencies = xmalloc( sizeof( double ) * message_count * ( uint64_t ) fan_out );
+  latency_count = 0;
+  message = xcalloc( 1, message_length );
+  for ( int i = 0; i < fan_out; i++ ) {
+    snprintf( consumer_names[ i ], MESSENGER_SERVICE_NAME_LENGTH, CONSUMER_NAME_FORMAT, i );
+  }
+
+  // Consumers inherit the limits. Queues hold depth messages in notify
+  // mode, and never fill up in request mode.
+  size_t overhead = mode == MODE_NOTIFY ? MESSAGE_OVERHEAD : REQUEST_OVERHEAD;
+  size_t max_length = ( size_t ) depth * ( message_length + overhead );
+  messenger_queue_limits limits = { max_length, max_length / 4 * 3, max_length / 4 };
+  set_default_send_queue_limits( &limits );
+
+  if ( pipe( ready_fds ) != 0 ) {
+    perror( "pipe" );
+    return false;
+  }
+  fflush( stdout );
+  for ( int i = 0; i < fan_out; i++ ) {
+    int fds[ 2 ];
+    if ( pipe( fds ) != 0 ) {
+      perror( "pipe" );
+      return false;
+    }
+    pids[ i ] = fork();
+    if ( pids[ i ] < 0 ) {
+      perror( "fork" );
+      return false;
+    }
+    if ( pids[ i ] == 0 ) {
+      close( ready_fds[ 0 ] );
+      close( fds[ 0 ] );
+      run_consumer( directory, i, ready_fds[ 1 ], fds[ 1 ] );
+    }
+    close( fds[ 1 ] );
+    result_fds[ i ] = fds[ 0 ];
+  }
+  close( ready_fds[ 1 ] );
+  for ( int i = 0; i < fan_out; i++ ) {
+    char c;
+    if ( read( ready_fds[ 0 ], &c, 1 ) != 1 ) {
+      fprintf( stderr, "Failed to start consumers.\n" );
+      return false;
+    }
+  }
+  close( ready_fds[ 0 ] );
+
+  memset( sent_counts, 0, sizeof( sent_counts ) );
+  replied_count = 0;
+  quit_count = 0;
+  done_count = 0;
+
+  init( PRODUCER_NAME, directory );
+  add_message_received_callback( PRODUCER_NAME, recv_producer_message );
+
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = 0;
+  interval.it_interval.tv_nsec = 1000;
+  interval.it_value = interval.it_interval;
+  if ( mode == MODE_NOTIFY ) {
+    add_timer_event_callback( &interval, send_notifications, NULL );
+  }
+  else {
+    request_times = xmalloc( sizeof( struct timespec ) * message_count );
+    add_message_replied_callback( PRODUCER_NAME, recv_reply );
+    add_timer_event_callback( &interval, send_requests, NULL );
+  }
+
+  struct timespec begin, end;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  start_messenger();
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  if ( mode == MODE_REQUEST ) {
+    delete_message_replied_callback( PRODUCER_NAME, recv_reply );
+    xfree( request_times );
+    request_times = NULL;
+  }
+  delete_message_received_callback( PRODUCER_NAME, recv_producer_message );
+  finalize( PRODUCER_NAME, directory );
+
+  bool ok = true;
+  for ( int i = 0; i < fan_out; i++ ) {
+    if ( mode == MODE_NOTIFY && !read_consumer_result( result_fds[ i ] ) ) {
+      fprintf( stderr, "Failed to read results of %s.\n", consumer_names[ i ] );
+      ok = false;
+    }
+    close( result_fds[ i ] );
+    waitpid( pids[ i ], NULL, 0 );
+  }
+  if ( ok ) {
+    print_result( elapsed_seconds( &begin, &end ) );
+  }
+
+  xfree( message );
+  xfree( latencies );
+  message = NULL;
+  latencies = NULL;
+
+  return ok;
+}
+
+
+static void
+print_usage( const char *program ) {
+  fprintf( stderr,
+           "Usage: %s [OPTION]...\n"
+           "  -m MODES      comma separated list of notify and request (default: notify,request)\n"
+           "  -s LENGTHS    message lengths in bytes (default: 64,512,4096)\n"
+           "  -f FAN_OUTS   numbers of consumers, up to %d (default: 1,4)\n"
+           "  -d DEPTHS     queue depths in messages (default: 1,64,4096)\n"
+           "  -n COUNT      messages sent to each consumer in notify mode (default: %d)\n"
+           "  -r COUNT      requests in request mode (default: %d)\n",
+           program, MAX_FAN_OUT, DEFAULT_MESSAGE_COUNT, DEFAULT_REQUEST_COUNT );
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  int c;
+  while ( ( c = getopt( argc, argv, "m:s:f:d:n:r:h" ) ) != -1 ) {
+    bool ok = true;
+    switch ( c ) {
+    case 'm':
+      ok = parse_modes( optarg );
+      break;
+    case 's':
+      // Notifications carry their send time.
+      ok = parse_sweep( optarg, &message_lengths, ( int ) sizeof( struct timespec ), 65536 );
+      break;
+    case 'f':
+      ok = parse_sweep( optarg, &fan_outs, 1, MAX_FAN_OUT );
+      break;
+    case 'd':
+      ok = parse_sweep( optarg, &depths, 1, INT_MAX );
+      break;
+    case 'n':
+      notify_count = strtoull( optarg, NULL, 10 );
+      ok = notify_count > 0;
+      break;
+    case 'r':
+      request_count = strtoull( optarg, NULL, 10 );
+      ok = request_count > 0;
+      break;
+    default:
+      ok = false;
+      break;
+    }
+    if ( !ok ) {
+      print_usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  char directory[] = "/tmp/messenger_benchmark.XXXXXX";
+  if ( mkdtemp( directory ) == NULL ) {
+    perror( "mkdtemp" );
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  for ( int m = 0; m < modes.count && ok; m++ ) {
+    mode = modes.values[ m ];
+    for ( int s = 0; s < message_lengths.count && ok; s++ ) {
+      message_length = ( size_t ) message_lengths.values[ s ];
+      for ( int f = 0; f < fan_outs.count && ok; f++ ) {
+        fan_out = fan_outs.values[ f ];
+        for ( int d = 0; d < depths.count && ok; d++ ) {
+          depth = depths.values[ d ];
+          ok = run_case( directory );
+        }
+      }
+    }
+  }
+
+  rmdir( directory );
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
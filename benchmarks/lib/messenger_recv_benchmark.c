@@ -0,0 +1,158 @@
+/*
+ * Measures the cost of the messenger receive path.
+ *
+ * Sends messages of a given size to a local service and reports how
+ * many bytes are copied in user space per received message.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "timer.h"
+#include "trema.h"
+
+
+#define SERVICE_NAME "messenger_recv_benchmark"
+#define DEFAULT_MESSAGE_COUNT 1000000
+#define DEFAULT_MESSAGE_LENGTH 128 // roughly a packet_in with a short frame
+
+
+static uint64_t message_count = DEFAULT_MESSAGE_COUNT;
+static size_t message_length = DEFAULT_MESSAGE_LENGTH;
+static uint64_t sent_count = 0;
+static uint64_t received_count = 0;
+static uint64_t received_bytes = 0;
+static void *message = NULL;
+
+
+static void
+send_messages( void *user_data ) {
+  UNUSED( user_data );
+
+  while ( sent_count < message_count ) {
+    if ( !send_message( SERVICE_NAME, 0, message, message_length ) ) {
+      // Send queue is full. Retry after it is drained.
+      return;
+    }
+    sent_count++;
+  }
+  delete_timer_event_callback( send_messages );
+}
+
+
+static void
+recv_message( uint16_t tag, void *data, size_t len ) {
+  UNUSED( tag );
+  UNUSED( data );
+
+  received_bytes += len;
+  if ( ++received_count == message_count ) {
+    stop_messenger();
+  }
+}
+
+
+static double
+elapsed_seconds( const struct timespec *begin, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - begin->tv_sec ) + ( double ) ( end->tv_nsec - begin->tv_nsec ) / 1e9;
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  if ( argc > 1 ) {
+    message_count = strtoull( argv[ 1 ], NULL, 10 );
+  }
+  if ( argc > 2 ) {
+    message_length = ( size_t ) strtoul( argv[ 2 ], NULL, 10 );
+  }
+  if ( message_count == 0 || message_length == 0 ) {
+    fprintf( stderr, "Usage: %s [message count] [message length]\n", argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  char directory[] = "/tmp/messenger_recv_benchmark.XXXXXX";
+  if ( mkdtemp( directory ) == NULL ) {
+    perror( "mkdtemp" );
+    return EXIT_FAILURE;
+  }
+
+  init_log( "messenger_recv_benchmark", directory, false );
+  // send_message() warns each time the send queue is full, which is
+  // the normal state while this benchmark runs.
+  set_logging_level( "error" );
+  init_timer();
+  init_messenger( directory );
+
+  message = xcalloc( 1, message_length );
+  add_message_received_callback( SERVICE_NAME, recv_message );
+
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = 0;
+  interval.it_interval.tv_nsec = 1000;
+  interval.it_value = interval.it_interval;
+  add_timer_event_callback( &interval, send_messages, NULL );
+
+  struct timespec begin, end;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+  start_messenger();
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  messenger_queue_stats stats, send_stats;
+  get_receive_queue_stats( SERVICE_NAME, &stats );
+  get_send_queue_stats( SERVICE_NAME, &send_stats );
+
+  double elapsed = elapsed_seconds( &begin, &end );
+  printf( "messages: %" PRIu64 "\n", stats.messages );
+  printf( "message_length: %zu\n", message_length );
+  printf( "received_bytes: %" PRIu64 "\n", stats.bytes );
+  printf( "recv_calls: %" PRIu64 "\n", stats.syscalls );
+  printf( "send_calls: %" PRIu64 "\n", send_stats.syscalls );
+  printf( "send_calls_per_message: %.4f\n", ( double ) send_stats.syscalls / ( double ) send_stats.messages );
+  printf( "copied_bytes: %" PRIu64 "\n", stats.copied_bytes );
+  printf( "copied_bytes_per_message: %.2f\n", ( double ) stats.copied_bytes / ( double ) stats.messages );
+  printf( "elapsed_seconds: %.3f\n", elapsed );
+  printf( "messages_per_second: %.0f\n", ( double ) received_count / elapsed );
+  printf( "payload_megabytes_per_second: %.2f\n", ( double ) received_bytes / elapsed / 1e6 );
+
+  delete_message_received_callback( SERVICE_NAME, recv_message );
+  finalize_messenger();
+  finalize_timer();
+  xfree( message );
+
+  char log_file[ PATH_MAX ];
+  snprintf( log_file, sizeof( log_file ), "%s/messenger_recv_benchmark.log", directory );
+  finalize_log();
+  unlink( log_file );
+  rmdir( directory );
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
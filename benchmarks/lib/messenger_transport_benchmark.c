@@ -0,0 +1,303 @@
+/*
+ * Compares the socket and shared memory transports of messenger.
+ *
+ * A producer process sends messages of a given size to a consumer
+ * process, and then the two exchange ping-pong messages. Throughput is
+ * measured on the first phase and round trip latency on the second.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "timer.h"
+#include "trema.h"
+
+
+#define PRODUCER_NAME "transport_benchmark_producer"
+#define CONSUMER_NAME "transport_benchmark_consumer"
+#define DEFAULT_MESSAGE_COUNT 1000000
+#define DEFAULT_MESSAGE_LENGTH 128 // roughly a packet_in with a short frame
+#define DEFAULT_ROUND_TRIPS 10000
+#define WARMUP_ROUND_TRIPS 100
+
+enum {
+  TAG_DATA,
+  TAG_PING,
+  TAG_PONG,
+  TAG_QUIT,
+};
+
+
+static uint64_t message_count = DEFAULT_MESSAGE_COUNT;
+static size_t message_length = DEFAULT_MESSAGE_LENGTH;
+static int round_trips = DEFAULT_ROUND_TRIPS;
+static int transport = MESSENGER_TRANSPORT_SOCKET;
+static void *message = NULL;
+
+static uint64_t sent_count = 0;
+static uint64_t received_count = 0;
+static struct timespec first_received;
+static struct timespec last_received;
+static struct timespec ping_sent;
+static int pong_count = 0;
+static double *rtts = NULL;
+
+
+static double
+elapsed_seconds( const struct timespec *begin, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - begin->tv_sec ) + ( double ) ( end->tv_nsec - begin->tv_nsec ) / 1e9;
+}
+
+
+static int
+compare_double( const void *x, const void *y ) {
+  double a = *( const double * ) x;
+  double b = *( const double * ) y;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+
+static void
+send_messages( void *user_data ) {
+  UNUSED( user_data );
+
+  while ( sent_count < message_count ) {
+    if ( !send_message( CONSUMER_NAME, TAG_DATA, message, message_length ) ) {
+      // Queue is full. Retry after it is drained.
+      return;
+    }
+    sent_count++;
+  }
+  delete_timer_event_callback( send_messages );
+}
+
+
+static void
+recv_producer_message( uint16_t tag, void *data, size_t len ) {
+  if ( tag == TAG_PING ) {
+    send_message( CONSUMER_NAME, TAG_PONG, data, len );
+  }
+  else if ( tag == TAG_QUIT ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+send_ping() {
+  clock_gettime( CLOCK_MONOTONIC, &ping_sent );
+  send_message( PRODUCER_NAME, TAG_PING, message, message_length );
+}
+
+
+static void
+recv_consumer_message( uint16_t tag, void *data, size_t len ) {
+  UNUSED( data );
+  UNUSED( len );
+
+  if ( tag == TAG_DATA ) {
+    clock_gettime( CLOCK_MONOTONIC, &last_received );
+    if ( received_count++ == 0 ) {
+      first_received = last_received;
+    }
+    if ( received_count == message_count ) {
+      // The producer's service exists by now, so the send queue
+      // connects at once.
+      set_message_transport( PRODUCER_NAME, transport );
+      send_ping();
+    }
+  }
+  else if ( tag == TAG_PONG ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    if ( pong_count >= WARMUP_ROUND_TRIPS ) {
+      rtts[ pong_count - WARMUP_ROUND_TRIPS ] = elapsed_seconds( &ping_sent, &now ) * 1e6;
+    }
+    if ( ++pong_count < round_trips + WARMUP_ROUND_TRIPS ) {
+      send_ping();
+    }
+    else {
+      send_message( PRODUCER_NAME, TAG_QUIT, NULL, 0 );
+      flush_messenger();
+      stop_messenger();
+    }
+  }
+}
+
+
+static void
+init( const char *name, const char *directory ) {
+  init_log( name, directory, false );
+  // send_message() warns each time the queue is full, which is the
+  // normal state while this benchmark runs.
+  set_logging_level( "error" );
+  init_timer();
+  init_messenger( directory );
+}
+
+
+static void
+finalize( const char *name, const char *directory ) {
+  finalize_messenger();
+  finalize_timer();
+  finalize_log();
+
+  char log_file[ PATH_MAX ];
+  snprintf( log_file, sizeof( log_file ), "%s/%s.log", directory, name );
+  unlink( log_file );
+}
+
+
+static void
+run_producer( const char *directory, int ready_fd ) {
+  char c;
+  if ( read( ready_fd, &c, 1 ) != 1 ) {
+    exit( EXIT_FAILURE );
+  }
+
+  init( PRODUCER_NAME, directory );
+  add_message_received_callback( PRODUCER_NAME, recv_producer_message );
+  set_message_transport( CONSUMER_NAME, transport );
+
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = 0;
+  interval.it_interval.tv_nsec = 1000;
+  interval.it_value = interval.it_interval;
+  add_timer_event_callback( &interval, send_messages, NULL );
+
+  start_messenger();
+
+  delete_message_received_callback( PRODUCER_NAME, recv_producer_message );
+  finalize( PRODUCER_NAME, directory );
+  exit( EXIT_SUCCESS );
+}
+
+
+static bool
+run_benchmark( const char *name ) {
+  char directory[] = "/tmp/messenger_transport_benchmark.XXXXXX";
+  if ( mkdtemp( directory ) == NULL ) {
+    perror( "mkdtemp" );
+    return false;
+  }
+
+  int ready_fds[ 2 ];
+  if ( pipe( ready_fds ) != 0 ) {
+    perror( "pipe" );
+    return false;
+  }
+
+  fflush( stdout );
+  pid_t pid = fork();
+  if ( pid < 0 ) {
+    perror( "fork" );
+    return false;
+  }
+  if ( pid == 0 ) {
+    close( ready_fds[ 1 ] );
+    run_producer( directory, ready_fds[ 0 ] );
+  }
+  close( ready_fds[ 0 ] );
+
+  sent_count = 0;
+  received_count = 0;
+  pong_count = 0;
+
+  init( CONSUMER_NAME, directory );
+  add_message_received_callback( CONSUMER_NAME, recv_consumer_message );
+  if ( write( ready_fds[ 1 ], "x", 1 ) != 1 ) {
+    perror( "write" );
+    return false;
+  }
+  close( ready_fds[ 1 ] );
+
+  start_messenger();
+
+  messenger_queue_stats stats;
+  get_receive_queue_stats( CONSUMER_NAME, &stats );
+  bool shm = get_message_transport( PRODUCER_NAME ) == MESSENGER_TRANSPORT_SHM;
+
+  waitpid( pid, NULL, 0 );
+  delete_message_received_callback( CONSUMER_NAME, recv_consumer_message );
+  finalize( CONSUMER_NAME, directory );
+  rmdir( directory );
+
+  double elapsed = elapsed_seconds( &first_received, &last_received );
+  qsort( rtts, ( size_t ) round_trips, sizeof( double ), compare_double );
+
+  printf( "transport: %s%s\n", name, shm || transport == MESSENGER_TRANSPORT_SOCKET ? "" : " (fell back to socket)" );
+  printf( "  messages: %" PRIu64 "\n", received_count );
+  printf( "  message_length: %zu\n", message_length );
+  printf( "  messages_per_second: %.0f\n", ( double ) received_count / elapsed );
+  printf( "  payload_megabytes_per_second: %.2f\n", ( double ) ( received_count * message_length ) / elapsed / 1e6 );
+  printf( "  receive_syscalls_per_message: %.4f\n", ( double ) stats.syscalls / ( double ) stats.messages );
+  printf( "  round_trips: %d\n", round_trips );
+  printf( "  round_trip_p50_usec: %.1f\n", rtts[ round_trips / 2 ] );
+  printf( "  round_trip_p99_usec: %.1f\n", rtts[ round_trips * 99 / 100 ] );
+
+  return true;
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  if ( argc > 1 ) {
+    message_count = strtoull( argv[ 1 ], NULL, 10 );
+  }
+  if ( argc > 2 ) {
+    message_length = ( size_t ) strtoul( argv[ 2 ], NULL, 10 );
+  }
+  if ( argc > 3 ) {
+    round_trips = atoi( argv[ 3 ] );
+  }
+  if ( message_count == 0 || message_length == 0 || round_trips <= 0 ) {
+    fprintf( stderr, "Usage: %s [message count] [message length] [round trips]\n", argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  message = xcalloc( 1, message_length );
+  rtts = xcalloc( ( size_t ) round_trips, sizeof( double ) );
+
+  transport = MESSENGER_TRANSPORT_SOCKET;
+  if ( !run_benchmark( "socket" ) ) {
+    return EXIT_FAILURE;
+  }
+  transport = MESSENGER_TRANSPORT_SHM;
+  if ( !run_benchmark( "shm" ) ) {
+    return EXIT_FAILURE;
+  }
+
+  xfree( rtts );
+  xfree( message );
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
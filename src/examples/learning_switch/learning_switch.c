@@ -95,7 +95,7 @@ do_flooding( packet_in packet_in ) {
 
   buffer *packet_out;
   if ( packet_in.buffer_id == UINT32_MAX ) {
-    buffer *frame = duplicate_buffer( packet_in.data );
+    buffer *frame = clone_buffer( packet_in.data );
     fill_ether_padding( frame );
     packet_out = create_packet_out(
       get_transaction_id(),
@@ -146,7 +146,7 @@ send_packet( uint16_t destination_port, packet_in packet_in ) {
   free_buffer( flow_mod );
 
   if ( packet_in.buffer_id == UINT32_MAX ) {
-    buffer *frame = duplicate_buffer( packet_in.data );
+    buffer *frame = clone_buffer( packet_in.data );
     fill_ether_padding( frame );
     buffer *packet_out = create_packet_out(
       get_transaction_id(),
@@ -212,7 +212,7 @@ int
 main( int argc, char *argv[] ) {
   init_trema( &argc, &argv );
 
-  hash_table *forwarding_db = create_hash( compare_forwarding_entry, hash_forwarding_entry );
+  hash_table *forwarding_db = create_hash_with_concurrency( compare_forwarding_entry, hash_forwarding_entry, 0, HASH_TABLE_UNLOCKED );
   add_periodic_event_callback( AGING_INTERVAL, update_forwarding_db, forwarding_db );
   set_packet_in_handler( handle_packet_in, forwarding_db );
 
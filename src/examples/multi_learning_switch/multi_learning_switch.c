@@ -52,7 +52,7 @@ static known_switch *
 new_switch( uint64_t datapath_id ) {
   known_switch *sw = xmalloc( sizeof( known_switch ) );
   sw->datapath_id = datapath_id;
-  sw->forwarding_db = create_hash( compare_mac, hash_mac );
+  sw->forwarding_db = create_hash_with_concurrency( compare_mac, hash_mac, 0, HASH_TABLE_UNLOCKED );
   return sw;
 }
 
@@ -70,7 +70,7 @@ static void
 refresh( known_switch *sw ) {
   foreach_hash( sw->forwarding_db, delete_forwarding_entry, NULL );
   delete_hash( sw->forwarding_db );
-  sw->forwarding_db = create_hash( compare_mac, hash_mac );
+  sw->forwarding_db = create_hash_with_concurrency( compare_mac, hash_mac, 0, HASH_TABLE_UNLOCKED );
 }
 
 
@@ -173,7 +173,7 @@ do_flooding( packet_in packet_in ) {
 
   buffer *packet_out;
   if ( packet_in.buffer_id == UINT32_MAX ) {
-    buffer *frame = duplicate_buffer( packet_in.data );
+    buffer *frame = clone_buffer( packet_in.data );
     fill_ether_padding( frame );
     packet_out = create_packet_out(
       get_transaction_id(),
@@ -224,7 +224,7 @@ send_packet( uint16_t destination_port, packet_in packet_in ) {
   free_buffer( flow_mod );
 
   if ( packet_in.buffer_id == UINT32_MAX ) {
-    buffer *frame = duplicate_buffer( packet_in.data );
+    buffer *frame = clone_buffer( packet_in.data );
     fill_ether_padding( frame );
     buffer *packet_out = create_packet_out(
       get_transaction_id(),
@@ -276,7 +276,7 @@ int
 main( int argc, char *argv[] ) {
   init_trema( &argc, &argv );
 
-  hash_table *switch_db = create_hash( compare_datapath_id, hash_datapath_id );
+  hash_table *switch_db = create_hash_with_concurrency( compare_datapath_id, hash_datapath_id, 0, HASH_TABLE_UNLOCKED );
   add_periodic_event_callback( AGING_INTERVAL, update_all_switches, switch_db );
   set_switch_ready_handler( handle_switch_ready, switch_db );
   set_switch_disconnected_handler( handle_switch_disconnected, switch_db );
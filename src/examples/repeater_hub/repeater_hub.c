@@ -48,7 +48,7 @@ handle_packet_in( packet_in message ) {
   free_buffer( flow_mod );
 
   if ( message.buffer_id == UINT32_MAX ) {
-    buffer *frame = duplicate_buffer( message.data );
+    buffer *frame = clone_buffer( message.data );
     fill_ether_padding( frame );
     buffer *packet_out = create_packet_out(
       get_transaction_id(),
@@ -25,14 +25,41 @@
 #include <string.h>
 #include "buffer.h"
 #include "checks.h"
+#include "stat.h"
 #include "utility.h"
 #include "wrapper.h"
 
 
+#ifdef UNIT_TESTING
+
+#ifdef increment_stat_by
+#undef increment_stat_by
+#endif
+#define increment_stat_by mock_increment_stat_by
+void mock_increment_stat_by( const char *key, uint64_t value );
+
+#endif // UNIT_TESTING
+
+
+#define BUFFER_POOL_MIN_BLOCK_SHIFT 6
+#define BUFFER_POOL_CLASSES 12
+#define BUFFER_POOL_MIN_BLOCK_SIZE ( ( size_t ) 1 << BUFFER_POOL_MIN_BLOCK_SHIFT )
+#define BUFFER_POOL_MAX_BLOCK_SIZE ( BUFFER_POOL_MIN_BLOCK_SIZE << ( BUFFER_POOL_CLASSES - 1 ) )
+#define BUFFER_POOL_RETAINED_BYTES_PER_CLASS ( 1024 * 1024 )
+#define BUFFER_POOL_RETAINED_BUFFERS 4096
+#define BUFFER_POOL_STAT_INTERVAL 1024
+#define BUFFER_POOL_HITS_KEY "buffer_pool.hits"
+#define BUFFER_POOL_MISSES_KEY "buffer_pool.misses"
+#define LARGE_BLOCK_ALIGNMENT 4096
+
+
 /**
  * Defines an internal structure that is being used within the buffer.c file for handling
  * buffer allocation and management. Buffer being used by external functions (through buffer type) 
- * are assigned to a member element and support for locking is provided on it through this type. 
+ * are assigned to a member element through this type. The user data area
+ * starts in the middle of the allocated block so that headers can be
+ * prepended and payloads appended without moving it. Several buffers may
+ * view the same block (see clone_buffer()).
  * Design of this type is such to embed the externally visible buffer into a management layer. For
  * applications, this type is never directly accessed.
  * @see buffer
@@ -41,10 +68,222 @@ typedef struct private_buffer {
   buffer public; /*!<Externally visible buffer is embedded to this member*/
   size_t real_length; /*!<True length of allocated buffer */
   void *top; /*!<Pointer to the head of user data area. only valid if public.data is allocated.*/
-  pthread_mutex_t *mutex; /*!<mutual exclusion support for buffer access/modification*/
 } private_buffer;
 
 
+/**
+ * Header placed in front of the data area of every allocated block. The
+ * block is released when the last buffer referring to it is freed. front
+ * and back delimit the part of the data area that is in use by any of the
+ * buffers; a buffer may only grow into free space at either end if its
+ * data starts at front or ends at back respectively.
+ */
+typedef struct {
+  size_t references; /*!<Number of buffers referring to this block*/
+  size_t front; /*!<Offset of the first byte in use*/
+  size_t back; /*!<Offset one past the last byte in use*/
+} buffer_block;
+
+
+/**
+ * Free list of released objects of one size. Objects on the list are
+ * linked through their first word.
+ */
+typedef struct pooled_object {
+  struct pooled_object *next;
+} pooled_object;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pooled_object *free_list;
+  size_t length;
+  size_t max_length;
+} object_pool;
+
+
+#define OBJECT_POOL_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 }
+
+static object_pool block_pools[ BUFFER_POOL_CLASSES ] = { [ 0 ... BUFFER_POOL_CLASSES - 1 ] = OBJECT_POOL_INITIALIZER };
+static object_pool private_buffer_pool = OBJECT_POOL_INITIALIZER;
+static bool pool_enabled = false;
+static uint64_t pool_hits = 0;
+static uint64_t pool_misses = 0;
+static size_t default_headroom = DEFAULT_BUFFER_HEADROOM;
+static size_t default_tailroom = DEFAULT_BUFFER_TAILROOM;
+
+
+/**
+ * Counts a pool access and forwards it to the statistics collector once
+ * every BUFFER_POOL_STAT_INTERVAL accesses.
+ * @param counter Pointer to either pool_hits or pool_misses
+ * @param key Statistics key corresponding to the counter
+ * @return None
+ */
+static void
+count_pool_access( uint64_t *counter, const char *key ) {
+  if ( __atomic_add_fetch( counter, 1, __ATOMIC_RELAXED ) % BUFFER_POOL_STAT_INTERVAL == 0 ) {
+    increment_stat_by( key, BUFFER_POOL_STAT_INTERVAL );
+  }
+}
+
+
+/**
+ * Takes an object of the given size from a pool, or allocates a new one
+ * if the pool is disabled or empty.
+ * @param pool Pointer to object pool, or NULL if the size is not pooled
+ * @param size Size of the object
+ * @return void* Pointer to the object
+ */
+static void *
+alloc_object( object_pool *pool, size_t size ) {
+  if ( pool == NULL || !__atomic_load_n( &pool_enabled, __ATOMIC_ACQUIRE ) ) {
+    return xmalloc( size );
+  }
+
+  pthread_mutex_lock( &pool->mutex );
+  pooled_object *object = pool->free_list;
+  if ( object != NULL ) {
+    pool->free_list = object->next;
+    pool->length--;
+  }
+  pthread_mutex_unlock( &pool->mutex );
+
+  if ( object == NULL ) {
+    count_pool_access( &pool_misses, BUFFER_POOL_MISSES_KEY );
+    return xmalloc( size );
+  }
+  count_pool_access( &pool_hits, BUFFER_POOL_HITS_KEY );
+
+  return object;
+}
+
+
+/**
+ * Returns an object to a pool, or releases it if the pool is disabled or
+ * already holds as many objects as it may retain.
+ * @param pool Pointer to object pool, or NULL if the size is not pooled
+ * @param object Pointer to the object
+ * @return None
+ */
+static void
+free_object( object_pool *pool, void *object ) {
+  if ( pool == NULL || !__atomic_load_n( &pool_enabled, __ATOMIC_ACQUIRE ) ) {
+    xfree( object );
+    return;
+  }
+
+  pthread_mutex_lock( &pool->mutex );
+  // pool_enabled is checked again under the lock so that nothing is pushed
+  // after finalize_buffer_pool() has drained the list.
+  if ( __atomic_load_n( &pool_enabled, __ATOMIC_ACQUIRE ) && pool->length < pool->max_length ) {
+    pooled_object *pooled = object;
+    pooled->next = pool->free_list;
+    pool->free_list = pooled;
+    pool->length++;
+    object = NULL;
+  }
+  pthread_mutex_unlock( &pool->mutex );
+
+  if ( object != NULL ) {
+    xfree( object );
+  }
+}
+
+
+/**
+ * Releases every object held by a pool.
+ * @param pool Pointer to object pool
+ * @return None
+ */
+static void
+drain_object_pool( object_pool *pool ) {
+  pthread_mutex_lock( &pool->mutex );
+  pooled_object *object = pool->free_list;
+  pool->free_list = NULL;
+  pool->length = 0;
+  pthread_mutex_unlock( &pool->mutex );
+
+  while ( object != NULL ) {
+    pooled_object *next = object->next;
+    xfree( object );
+    object = next;
+  }
+}
+
+
+/**
+ * Rounds a requested data block size up to its size class. Blocks larger
+ * than the largest class are rounded up to LARGE_BLOCK_ALIGNMENT and are
+ * never pooled.
+ * @param size Requested size
+ * @return size_t Size of the block to allocate
+ */
+static size_t
+block_size_for( size_t size ) {
+  if ( size > BUFFER_POOL_MAX_BLOCK_SIZE ) {
+    return ( size + LARGE_BLOCK_ALIGNMENT - 1 ) & ~( size_t ) ( LARGE_BLOCK_ALIGNMENT - 1 );
+  }
+
+  size_t block_size = BUFFER_POOL_MIN_BLOCK_SIZE;
+  while ( block_size < size ) {
+    block_size <<= 1;
+  }
+
+  return block_size;
+}
+
+
+/**
+ * Finds the pool for data blocks of the given size.
+ * @param block_size Size of the block as returned by block_size_for()
+ * @return object_pool* Pointer to the pool, or NULL if the block is not pooled
+ */
+static object_pool *
+block_pool_of( size_t block_size ) {
+  if ( block_size > BUFFER_POOL_MAX_BLOCK_SIZE ) {
+    return NULL;
+  }
+
+  unsigned int index = 0;
+  while ( ( BUFFER_POOL_MIN_BLOCK_SIZE << index ) < block_size ) {
+    index++;
+  }
+  assert( ( BUFFER_POOL_MIN_BLOCK_SIZE << index ) == block_size );
+
+  return &block_pools[ index ];
+}
+
+
+/**
+ * Finds the header of the block a buffer refers to.
+ * @param pbuf Pointer to private buffer structure with data allocated
+ * @return buffer_block* Pointer to the block header
+ */
+static buffer_block *
+block_of( const private_buffer *pbuf ) {
+  assert( pbuf != NULL );
+  assert( pbuf->top != NULL );
+
+  return ( buffer_block * ) pbuf->top - 1;
+}
+
+
+/**
+ * Drops a reference to the block a buffer refers to and releases the block
+ * when no buffer refers to it any more.
+ * @param pbuf Pointer to private buffer structure with data allocated
+ * @return None
+ */
+static void
+release_block( private_buffer *pbuf ) {
+  buffer_block *block = block_of( pbuf );
+  if ( __atomic_sub_fetch( &block->references, 1, __ATOMIC_ACQ_REL ) == 0 ) {
+    free_object( block_pool_of( sizeof( buffer_block ) + pbuf->real_length ), block );
+  }
+  pbuf->top = NULL;
+}
+
+
 /**
  * Finds and returns the length of buffer which has already been consumed.
  * @param pbuf Pointer to private buffer structure which holds the buffer structure, which in turn points to allocated data
@@ -54,45 +293,116 @@ static size_t
 front_length_of( const private_buffer *pbuf ) {
   assert( pbuf != NULL );
 
+  if ( pbuf->top == NULL ) {
+    return 0;
+  }
+
   return ( size_t ) ( ( char * ) pbuf->public.data - ( char * ) pbuf->top );
 }
 
 
 /**
- * Checks if the buffer has already been allocated enough space to work in.
- * @param pbuf Private buffer type structure containing the allocated entry and length allocated
- * @param length Addition length of data to be accommodated in this buffer
- * @return bool True if allocated length of buffer is sufficient to accommodate required length, else False
+ * Finds and returns the length of unused space behind the user data.
+ * @param pbuf Pointer to private buffer structure
+ * @return size_t Length of the free space at the back of the buffer
  */
-static bool
-already_allocated( private_buffer *pbuf, size_t length ) {
+static size_t
+back_length_of( const private_buffer *pbuf ) {
   assert( pbuf != NULL );
 
-  size_t required_length = ( size_t ) front_length_of( pbuf ) + pbuf->public.length + length;
+  if ( pbuf->top == NULL ) {
+    return 0;
+  }
 
-  return ( pbuf->real_length >= required_length );
+  return pbuf->real_length - front_length_of( pbuf ) - pbuf->public.length;
 }
 
 
 /**
- * Allocates fresh buffer space.
- * @param pbuf Private buffer type structure representing this new allocation
- * @param length Absolute length of the expected buffer
- * @return private_buffer Pointer to the updated pbuf argument with allocation done
+ * Moves the user data into a new block which has at least the given
+ * amount of free space in front of and behind it, and releases the old
+ * block.
+ * @param pbuf Pointer to private_buffer type structure
+ * @param headroom Free space required in front of the user data
+ * @param tailroom Free space required behind the user data
+ * @return private_buffer Pointer to the updated pbuf argument
  */
 static private_buffer *
-alloc_new_data( private_buffer *pbuf, size_t length ) {
+reallocate_data( private_buffer *pbuf, size_t headroom, size_t tailroom ) {
   assert( pbuf != NULL );
 
-  pbuf->public.data = xmalloc( length );
-  pbuf->public.length = length;
-  pbuf->top = pbuf->public.data;
-  pbuf->real_length = length;
+  size_t block_size = block_size_for( sizeof( buffer_block ) + headroom + pbuf->public.length + tailroom );
+  buffer_block *block = alloc_object( block_pool_of( block_size ), block_size );
+  block->references = 1;
+  block->front = headroom;
+  block->back = headroom + pbuf->public.length;
+  void *top = block + 1;
+  void *data = ( char * ) top + headroom;
+  if ( pbuf->public.length > 0 ) {
+    memcpy( data, pbuf->public.data, pbuf->public.length );
+  }
+  if ( pbuf->top != NULL ) {
+    release_block( pbuf );
+  }
+
+  pbuf->public.data = data;
+  pbuf->top = top;
+  pbuf->real_length = block_size - sizeof( buffer_block );
 
   return pbuf;
 }
 
 
+/**
+ * Claims free space in front of the user data. If other buffers refer to
+ * the same block, the space is claimed only if no other buffer has
+ * claimed it before.
+ * @param pbuf Pointer to private buffer structure with data allocated
+ * @param length Length of space to claim
+ * @return bool True if the space is claimed, else False
+ */
+static bool
+claim_front( private_buffer *pbuf, size_t length ) {
+  size_t offset = front_length_of( pbuf );
+  if ( offset < length ) {
+    return false;
+  }
+
+  buffer_block *block = block_of( pbuf );
+  if ( __atomic_load_n( &block->references, __ATOMIC_ACQUIRE ) == 1 ) {
+    block->front = offset - length;
+    return true;
+  }
+
+  return __atomic_compare_exchange_n( &block->front, &offset, offset - length, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+}
+
+
+/**
+ * Claims free space behind the user data. If other buffers refer to the
+ * same block, the space is claimed only if no other buffer has claimed it
+ * before.
+ * @param pbuf Pointer to private buffer structure with data allocated
+ * @param length Length of space to claim
+ * @return bool True if the space is claimed, else False
+ */
+static bool
+claim_back( private_buffer *pbuf, size_t length ) {
+  if ( back_length_of( pbuf ) < length ) {
+    return false;
+  }
+
+  size_t offset = front_length_of( pbuf ) + pbuf->public.length;
+  buffer_block *block = block_of( pbuf );
+  if ( __atomic_load_n( &block->references, __ATOMIC_ACQUIRE ) == 1 ) {
+    block->back = offset + length;
+    return true;
+  }
+
+  return __atomic_compare_exchange_n( &block->back, &offset, offset + length, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+}
+
+
 /**
  * Allocates an empty private_buffer type, and initializes its members to 0 or
  * NULL (as per the case) before returning.
@@ -101,7 +411,7 @@ alloc_new_data( private_buffer *pbuf, size_t length ) {
  */
 static private_buffer *
 alloc_private_buffer() {
-  private_buffer *new_buf = xcalloc( 1, sizeof( private_buffer ) );
+  private_buffer *new_buf = alloc_object( &private_buffer_pool, sizeof( private_buffer ) );
 
   new_buf->public.data = NULL;
   new_buf->public.length = 0;
@@ -110,19 +420,16 @@ alloc_private_buffer() {
   new_buf->top = NULL;
   new_buf->real_length = 0;
 
-  pthread_mutexattr_t attr;
-  pthread_mutexattr_init( &attr );
-  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  new_buf->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( new_buf->mutex, &attr );
-
   return new_buf;
 }
 
 
 /**
  * Adds/Appends more data space at the front side of an already allocated
- * buffer. It is wrapped around by append_front_buffer.
+ * buffer. It is wrapped around by append_front_buffer. The user data is
+ * moved only if the free space in front of it is too short, in which case
+ * the default headroom is reserved again in front of the new space. Space
+ * that another buffer sharing the block has claimed is never reused.
  * @param pbuf Pointer to private_buffer type structure, containing old buffer to be appended
  * @param length Addition length of data to be appended at front of the present buffer
  * @return private_buffer Pointer to the updated private_buffer type structure, containing front appended buffer
@@ -133,13 +440,13 @@ static private_buffer *
 append_front( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  void *new_data = xmalloc( front_length_of( pbuf ) + pbuf->public.length + length );
-  memcpy( ( char * ) new_data + front_length_of( pbuf ) + length, pbuf->public.data, pbuf->public.length );
-  xfree( pbuf->top );
+  if ( pbuf->top == NULL || !claim_front( pbuf, length ) ) {
+    size_t tailroom = back_length_of( pbuf );
+    reallocate_data( pbuf, default_headroom + length, tailroom > default_tailroom ? tailroom : default_tailroom );
+  }
 
-  pbuf->public.data = ( char * ) new_data + front_length_of( pbuf );
-  pbuf->real_length = sizeof( new_data );
-  pbuf->top = new_data;
+  pbuf->public.data = ( char * ) pbuf->public.data - length;
+  pbuf->public.length += length;
 
   return pbuf;
 }
@@ -147,7 +454,8 @@ append_front( private_buffer *pbuf, size_t length ) {
 
 /**
  * Adds/Appends more data space at the back end of an already allocated buffer.
- * It is wrapped around by append_back_buffer.
+ * It is wrapped around by append_back_buffer. The user data is moved only
+ * if the free space behind it is too short.
  * @param pbuf Pointer to private_buffer type structure, containing the old buffer to be appended
  * @param length Addition length of data to be appended at back of the present buffer
  * @return private_buffer Pointer to the updated private_buffer type structure, containing back appended buffer
@@ -158,13 +466,14 @@ static private_buffer *
 append_back( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  void *new_data = xmalloc( front_length_of( pbuf ) + pbuf->public.length + length );
-  memcpy( ( char * ) new_data + front_length_of( pbuf ), pbuf->public.data, pbuf->public.length );
-  xfree( pbuf->top );
+  if ( pbuf->top == NULL ) {
+    reallocate_data( pbuf, default_headroom, default_tailroom + length );
+  }
+  else if ( !claim_back( pbuf, length ) ) {
+    reallocate_data( pbuf, front_length_of( pbuf ), default_tailroom + length );
+  }
 
-  pbuf->public.data = ( char * ) new_data + front_length_of( pbuf );
-  pbuf->real_length = sizeof( new_data );
-  pbuf->top = new_data;
+  pbuf->public.length += length;
 
   return pbuf;
 }
@@ -183,8 +492,8 @@ alloc_buffer() {
 
 
 /**
- * Allocates buffer type structure and assigns it length bytes of space. It
- * initializes all internal data members.
+ * Allocates buffer type structure and assigns it length bytes of space
+ * behind the default headroom. It initializes all internal data members.
  * @param length Length of allocated buffer requested
  * @return buffer Pointer to buffer type which holds the allocated area
  */
@@ -192,19 +501,8 @@ buffer *
 alloc_buffer_with_length( size_t length ) {
   assert( length != 0 );
 
-  private_buffer *new_buf = xcalloc( 1, sizeof( private_buffer ) );
-  new_buf->public.data = xmalloc( length );
-  new_buf->public.length = 0;
-  new_buf->public.user_data = NULL;
-  new_buf->public.user_data_free_function = NULL;
-  new_buf->top = new_buf->public.data;
-  new_buf->real_length = length;
-
-  pthread_mutexattr_t attr;
-  pthread_mutexattr_init( &attr );
-  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  new_buf->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( new_buf->mutex, &attr );
+  private_buffer *new_buf = alloc_private_buffer();
+  reallocate_data( new_buf, default_headroom, length + default_tailroom );
 
   return ( buffer * ) new_buf;
 }
@@ -225,15 +523,11 @@ free_buffer( buffer *buf ) {
     assert( buf->user_data == NULL );
     assert( buf->user_data_free_function == NULL );
   }
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
   private_buffer *delete_me = ( private_buffer * ) buf;
   if ( delete_me->top != NULL ) {
-    xfree( delete_me->top );
+    release_block( delete_me );
   }
-  pthread_mutex_unlock( delete_me->mutex );
-  pthread_mutex_destroy( delete_me->mutex );
-  xfree( delete_me->mutex );
-  xfree( delete_me );
+  free_object( &private_buffer_pool, delete_me );
 }
 
 
@@ -249,28 +543,11 @@ append_front_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
-
   private_buffer *pbuf = ( private_buffer * ) buf;
+  append_front( pbuf, length );
+  memset( pbuf->public.data, 0, length );
 
-  if ( pbuf->top == NULL ) {
-    alloc_new_data( pbuf, length );
-    pthread_mutex_unlock( pbuf->mutex );
-    return pbuf->public.data;
-  }
-
-  buffer *b = &( pbuf->public );
-  if ( already_allocated( pbuf, length ) ) {
-    memmove( ( char * ) b->data + length, b->data, b->length );
-    memset( b->data, 0, length );
-  } else {
-    append_front( pbuf, length );
-  }
-  b->length += length;
-
-  pthread_mutex_unlock( pbuf->mutex );
-
-  return b->data;
+  return pbuf->public.data;
 }
 
 
@@ -285,16 +562,12 @@ remove_front_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
-
   private_buffer *pbuf = ( private_buffer * ) buf;
   assert( pbuf->public.length >= length );
 
   pbuf->public.data = ( char * ) pbuf->public.data + length;
   pbuf->public.length -= length;
 
-  pthread_mutex_unlock( pbuf->mutex );
-
   return pbuf->public.data;
 }
 
@@ -311,32 +584,17 @@ append_back_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
-
   private_buffer *pbuf = ( private_buffer * ) buf;
+  append_back( pbuf, length );
 
-  if ( pbuf->real_length == 0 ) {
-    alloc_new_data( pbuf, length );
-    pthread_mutex_unlock( pbuf->mutex );
-    return ( char * ) pbuf->public.data;
-  }
- 
-  if ( !already_allocated( pbuf, length ) ) {
-    append_back( pbuf, length );
-  }
-
-  void *appended = ( char * ) pbuf->public.data + pbuf->public.length;
-  pbuf->public.length += length;
-
-  pthread_mutex_unlock( pbuf->mutex );
-
-  return appended;
+  return ( char * ) pbuf->public.data + pbuf->public.length - length;
 }
 
 
 /**
  * Makes exact replica of the buffer type passed as argument, includes copying
- * of the data and initializing the buffer type members.
+ * of the data and initializing the buffer type members. Only the user data
+ * is copied; the replica gets the default headroom and tailroom.
  * @param buf Pointer to buffer type which holds the allocated space and other members to manage this space
  * @return buffer* Pointer to freshly allocated buffer
  */
@@ -344,30 +602,188 @@ buffer *
 duplicate_buffer( const buffer *buf ) {
   assert( buf != NULL );
 
-  pthread_mutex_lock( ( ( const private_buffer * ) buf )->mutex );
-
   private_buffer *new_buffer = alloc_private_buffer();
   const private_buffer *old_buffer = ( const private_buffer * ) buf;
 
-  if ( old_buffer->real_length == 0 ) {
-    pthread_mutex_unlock( old_buffer->mutex );
+  if ( old_buffer->top == NULL ) {
     return ( buffer * ) new_buffer;
   }
 
-  alloc_new_data( new_buffer, old_buffer->real_length );
-  memcpy( new_buffer->top, old_buffer->top, old_buffer->real_length );
-
+  new_buffer->public.data = old_buffer->public.data;
   new_buffer->public.length = old_buffer->public.length;
+  reallocate_data( new_buffer, default_headroom, default_tailroom );
   new_buffer->public.user_data = old_buffer->public.user_data;
   new_buffer->public.user_data_free_function = NULL;
-  new_buffer->public.data = ( char * ) ( new_buffer->public.data ) + front_length_of( old_buffer );
 
-  pthread_mutex_unlock( old_buffer->mutex );
+  return ( buffer * ) new_buffer;
+}
+
+
+/**
+ * Creates a buffer that refers to the same data as the buffer passed as
+ * argument without copying it. Removing data from the front of either
+ * buffer or appending data to it does not affect the other, but the data
+ * itself is shared and must not be modified unless unshare_buffer() is
+ * called first. user_data is shared as in duplicate_buffer().
+ * @param buf Pointer to buffer type to refer to
+ * @return buffer* Pointer to freshly allocated buffer
+ * @see slice_buffer
+ */
+buffer *
+clone_buffer( const buffer *buf ) {
+  assert( buf != NULL );
+
+  buffer *clone = slice_buffer( buf, 0, buf->length );
+  clone->user_data = buf->user_data;
+
+  return clone;
+}
+
+
+/**
+ * Creates a buffer that refers to part of the data of the buffer passed
+ * as argument without copying it. The data is shared as in clone_buffer(),
+ * and user_data of the new buffer is NULL.
+ * @param buf Pointer to buffer type to refer to
+ * @param offset Offset of the first byte of the part
+ * @param length Length of the part
+ * @return buffer* Pointer to freshly allocated buffer
+ * @see clone_buffer
+ */
+buffer *
+slice_buffer( const buffer *buf, size_t offset, size_t length ) {
+  assert( buf != NULL );
+  assert( offset + length <= buf->length );
+
+  private_buffer *new_buffer = alloc_private_buffer();
+  const private_buffer *old_buffer = ( const private_buffer * ) buf;
+
+  if ( old_buffer->top == NULL ) {
+    return ( buffer * ) new_buffer;
+  }
+
+  buffer_block *block = block_of( old_buffer );
+  if ( __atomic_load_n( &block->references, __ATOMIC_ACQUIRE ) == 1 ) {
+    // Nobody else refers to the block, so claims left by released buffers
+    // can be dropped.
+    block->front = front_length_of( old_buffer );
+    block->back = block->front + old_buffer->public.length;
+  }
+  __atomic_add_fetch( &block->references, 1, __ATOMIC_ACQ_REL );
+  new_buffer->public.data = ( char * ) old_buffer->public.data + offset;
+  new_buffer->public.length = length;
+  new_buffer->top = old_buffer->top;
+  new_buffer->real_length = old_buffer->real_length;
 
   return ( buffer * ) new_buffer;
 }
 
 
+/**
+ * Makes the data of a buffer safe to modify by copying it if it is shared
+ * with other buffers. The free space in front of and behind the data is
+ * kept.
+ * @param buf Pointer to buffer type
+ * @return void* Pointer to the data of the buffer
+ * @see clone_buffer
+ */
+void *
+unshare_buffer( buffer *buf ) {
+  assert( buf != NULL );
+
+  private_buffer *pbuf = ( private_buffer * ) buf;
+  if ( pbuf->top != NULL && __atomic_load_n( &block_of( pbuf )->references, __ATOMIC_ACQUIRE ) > 1 ) {
+    reallocate_data( pbuf, front_length_of( pbuf ), back_length_of( pbuf ) );
+  }
+
+  return buf->data;
+}
+
+
+/**
+ * Enables pooling of buffers and of their data blocks, and sets the
+ * default free space reserved in front of and behind the user data of
+ * new buffers. Data blocks are pooled in power-of-two size classes from
+ * BUFFER_POOL_MIN_BLOCK_SIZE up to BUFFER_POOL_MAX_BLOCK_SIZE, and each
+ * class retains at most BUFFER_POOL_RETAINED_BYTES_PER_CLASS bytes. Pool
+ * hits and misses are added to the "buffer_pool.hits" and
+ * "buffer_pool.misses" statistics, so the statistics collector must be
+ * initialized first.
+ * @param headroom Default free space in front of the user data
+ * @param tailroom Default free space behind the user data
+ * @return None
+ */
+void
+init_buffer_pool( size_t headroom, size_t tailroom ) {
+  if ( __atomic_load_n( &pool_enabled, __ATOMIC_ACQUIRE ) ) {
+    finalize_buffer_pool();
+  }
+
+  default_headroom = headroom;
+  default_tailroom = tailroom;
+  for ( unsigned int i = 0; i < BUFFER_POOL_CLASSES; i++ ) {
+    pthread_mutex_lock( &block_pools[ i ].mutex );
+    block_pools[ i ].max_length = BUFFER_POOL_RETAINED_BYTES_PER_CLASS / ( BUFFER_POOL_MIN_BLOCK_SIZE << i );
+    pthread_mutex_unlock( &block_pools[ i ].mutex );
+  }
+  pthread_mutex_lock( &private_buffer_pool.mutex );
+  private_buffer_pool.max_length = BUFFER_POOL_RETAINED_BUFFERS;
+  pthread_mutex_unlock( &private_buffer_pool.mutex );
+  __atomic_store_n( &pool_hits, 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &pool_misses, 0, __ATOMIC_RELAXED );
+
+  __atomic_store_n( &pool_enabled, true, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * Disables pooling, releases every pooled object and reports the pool
+ * accesses that have not been added to the statistics yet. Buffers that
+ * are still in use may be released after this call.
+ * @param None
+ * @return None
+ */
+void
+finalize_buffer_pool() {
+  if ( !__atomic_exchange_n( &pool_enabled, false, __ATOMIC_ACQ_REL ) ) {
+    return;
+  }
+
+  for ( unsigned int i = 0; i < BUFFER_POOL_CLASSES; i++ ) {
+    drain_object_pool( &block_pools[ i ] );
+  }
+  drain_object_pool( &private_buffer_pool );
+
+  uint64_t hits = __atomic_load_n( &pool_hits, __ATOMIC_RELAXED ) % BUFFER_POOL_STAT_INTERVAL;
+  if ( hits > 0 ) {
+    increment_stat_by( BUFFER_POOL_HITS_KEY, hits );
+  }
+  uint64_t misses = __atomic_load_n( &pool_misses, __ATOMIC_RELAXED ) % BUFFER_POOL_STAT_INTERVAL;
+  if ( misses > 0 ) {
+    increment_stat_by( BUFFER_POOL_MISSES_KEY, misses );
+  }
+  default_headroom = DEFAULT_BUFFER_HEADROOM;
+  default_tailroom = DEFAULT_BUFFER_TAILROOM;
+}
+
+
+/**
+ * Retrieves the number of allocations served from and missed by the
+ * buffer pool since init_buffer_pool() was called.
+ * @param hits Pointer to location to store the number of hits
+ * @param misses Pointer to location to store the number of misses
+ * @return None
+ */
+void
+get_buffer_pool_stats( uint64_t *hits, uint64_t *misses ) {
+  assert( hits != NULL );
+  assert( misses != NULL );
+
+  *hits = __atomic_load_n( &pool_hits, __ATOMIC_RELAXED );
+  *misses = __atomic_load_n( &pool_misses, __ATOMIC_RELAXED );
+}
+
+
 /**
  * Provides pluggable method for printing/dumping buffer onto a I/O stream
  * (like terminal). It can accept as argument a function pointer which defines
@@ -380,8 +796,6 @@ void
 dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) ) {
   assert( dump_function != NULL );
 
-  pthread_mutex_lock( ( ( const private_buffer * ) buf )->mutex );
-
   char *hex = xmalloc( sizeof( char ) * ( buf->length * 2 + 1 ) );
   char *datap = buf->data;
   char *hexp = hex;
@@ -391,8 +805,6 @@ dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) )
   ( *dump_function )( "%s", hex );
 
   xfree( hex );
-
-  pthread_mutex_unlock( ( ( const private_buffer * ) buf )->mutex );
 }
 
 
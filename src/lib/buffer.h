@@ -36,6 +36,9 @@
  * // Duplicates buffer
  * body = duplicate_buffer( data );
  * ...
+ * // Refers to part of a buffer without copying it
+ * body = slice_buffer( data, offset, length );
+ * ...
  * // Removes some space from the top part of an already allocated buffer
  * remove_front_buffer( body, offsetof( struct ofp_error_msg, data ) );
  * ...
@@ -49,6 +52,20 @@
 
 
 #include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Default free space reserved in front of the user data of a buffer, so
+ * that an openflow_service_header_t and a service name can be prepended
+ * without moving the data.
+ */
+#define DEFAULT_BUFFER_HEADROOM 64
+
+/**
+ * Default free space reserved behind the user data of a buffer.
+ */
+#define DEFAULT_BUFFER_TAILROOM 0
 
 
 /**
@@ -71,8 +88,15 @@ void *append_front_buffer( buffer *buf, size_t length );
 void *remove_front_buffer( buffer *buf, size_t length );
 void *append_back_buffer( buffer *buf, size_t length );
 buffer *duplicate_buffer( const buffer *buf );
+buffer *clone_buffer( const buffer *buf );
+buffer *slice_buffer( const buffer *buf, size_t offset, size_t length );
+void *unshare_buffer( buffer *buf );
 void dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) );
 
+void init_buffer_pool( size_t headroom, size_t tailroom );
+void finalize_buffer_pool( void );
+void get_buffer_pool_stats( uint64_t *hits, uint64_t *misses );
+
 
 #endif // BUFFER_H
 
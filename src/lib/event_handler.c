@@ -0,0 +1,389 @@
+/*
+ * Event handler for file descriptors.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "event_handler.h"
+#include "log.h"
+#include "wrapper.h"
+
+
+#ifdef UNIT_TESTING
+
+#ifdef error
+#undef error
+#endif
+#define error mock_error
+extern void mock_error( const char *format, ... );
+
+#ifdef debug
+#undef debug
+#endif
+#define debug mock_debug
+extern void mock_debug( const char *format, ... );
+
+#ifdef warn
+#undef warn
+#endif
+#define warn mock_warn
+extern void mock_warn( const char *format, ... );
+
+#define static
+
+#endif // UNIT_TESTING
+
+
+/**
+ * Per file descriptor registration
+ */
+typedef struct event_fd {
+  bool registered;
+  uint32_t events;
+  event_fd_callback read_callback;
+  void *read_data;
+  event_fd_callback write_callback;
+  void *write_data;
+} event_fd;
+
+
+#define EVENT_HANDLER_MAX_EVENTS 256
+#define EVENT_HANDLER_INITIAL_FDS 1024
+
+static int epoll_fd = -1;
+static event_fd *event_fds = NULL;
+static int event_fds_size = 0;
+
+
+/**
+ * Initializes the event handler by creating an epoll instance.
+ * @param None
+ * @return bool True on success, else False
+ */
+bool
+init_event_handler() {
+  if ( epoll_fd >= 0 ) {
+    warn( "Event handler is already initialized." );
+    return true;
+  }
+
+  epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( epoll_fd < 0 ) {
+    error( "Failed to create an epoll instance ( %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+
+  event_fds_size = EVENT_HANDLER_INITIAL_FDS;
+  event_fds = xcalloc( ( size_t ) event_fds_size, sizeof( event_fd ) );
+
+  return true;
+}
+
+
+/**
+ * Releases the epoll instance and all registrations.
+ * @param None
+ * @return bool True on success, else False
+ */
+bool
+finalize_event_handler() {
+  if ( epoll_fd < 0 ) {
+    warn( "Event handler is not initialized yet." );
+    return false;
+  }
+
+  close( epoll_fd );
+  epoll_fd = -1;
+
+  xfree( event_fds );
+  event_fds = NULL;
+  event_fds_size = 0;
+
+  return true;
+}
+
+
+/**
+ * Grows the registration table so that fd can be used as an index.
+ * @param fd File descriptor
+ * @return None
+ */
+static void
+reserve_event_fds( int fd ) {
+  if ( fd < event_fds_size ) {
+    return;
+  }
+
+  int new_size = event_fds_size;
+  while ( new_size <= fd ) {
+    new_size *= 2;
+  }
+
+  event_fd *new_fds = xcalloc( ( size_t ) new_size, sizeof( event_fd ) );
+  memcpy( new_fds, event_fds, sizeof( event_fd ) * ( size_t ) event_fds_size );
+  xfree( event_fds );
+  event_fds = new_fds;
+  event_fds_size = new_size;
+}
+
+
+/**
+ * Applies the interest set of a registration to the epoll instance.
+ * The kernel silently drops closed descriptors, so both ADD and MOD
+ * are tried before giving up.
+ * @param fd File descriptor
+ * @param events New interest set
+ * @return None
+ */
+static void
+update_epoll_interest( int fd, uint32_t events ) {
+  struct epoll_event ev;
+
+  memset( &ev, 0, sizeof( ev ) );
+  ev.events = events;
+  ev.data.fd = fd;
+
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_MOD, fd, &ev ) == 0 ) {
+    return;
+  }
+  if ( errno == ENOENT && epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == 0 ) {
+    return;
+  }
+
+  error( "Failed to update epoll interest ( fd = %d, events = %#x, errno = %s [%d] ).",
+         fd, events, strerror( errno ), errno );
+}
+
+
+/**
+ * Registers read/write callbacks for a file descriptor. Both read and
+ * write events are disabled until set_readable()/set_writable() is called.
+ * Registering an fd which is already registered replaces its callbacks.
+ * @param fd File descriptor
+ * @param read_callback Callback called when fd is readable
+ * @param read_data User data passed to read_callback
+ * @param write_callback Callback called when fd is writable
+ * @param write_data User data passed to write_callback
+ * @return None
+ */
+void
+set_fd_handler( int fd, event_fd_callback read_callback, void *read_data, event_fd_callback write_callback, void *write_data ) {
+  assert( epoll_fd >= 0 );
+  assert( fd >= 0 );
+
+  debug( "Setting a fd handler ( fd = %d, read_callback = %p, read_data = %p, write_callback = %p, write_data = %p ).",
+         fd, read_callback, read_data, write_callback, write_data );
+
+  reserve_event_fds( fd );
+
+  event_fd *efd = &event_fds[ fd ];
+  efd->read_callback = read_callback;
+  efd->read_data = read_data;
+  efd->write_callback = write_callback;
+  efd->write_data = write_data;
+  efd->events = 0;
+
+  if ( efd->registered ) {
+    // update_epoll_interest() re-adds the fd if the kernel dropped it.
+    update_epoll_interest( fd, 0 );
+    return;
+  }
+
+  struct epoll_event ev;
+  memset( &ev, 0, sizeof( ev ) );
+  ev.events = 0;
+  ev.data.fd = fd;
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &ev ) < 0 ) {
+    if ( errno != EEXIST ) {
+      error( "Failed to add a fd to epoll ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+      return;
+    }
+    update_epoll_interest( fd, 0 );
+  }
+  efd->registered = true;
+}
+
+
+/**
+ * Unregisters a file descriptor. This must be called before the file
+ * descriptor is closed.
+ * @param fd File descriptor
+ * @return None
+ */
+void
+delete_fd_handler( int fd ) {
+  assert( fd >= 0 );
+
+  debug( "Deleting a fd handler ( fd = %d ).", fd );
+
+  if ( epoll_fd < 0 || fd >= event_fds_size || !event_fds[ fd ].registered ) {
+    return;
+  }
+
+  // Errors are ignored since the fd may have been closed already.
+  struct epoll_event ev;
+  memset( &ev, 0, sizeof( ev ) );
+  epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, &ev );
+
+  memset( &event_fds[ fd ], 0, sizeof( event_fd ) );
+}
+
+
+/**
+ * Enables or disables an event type on a registered file descriptor.
+ * @param fd File descriptor
+ * @param event EPOLLIN or EPOLLOUT
+ * @param state True to enable, False to disable
+ * @return None
+ */
+static void
+set_event_state( int fd, uint32_t event, bool state ) {
+  assert( fd >= 0 );
+
+  if ( fd >= event_fds_size || !event_fds[ fd ].registered ) {
+    error( "No fd handler registered ( fd = %d ).", fd );
+    return;
+  }
+
+  event_fd *efd = &event_fds[ fd ];
+  uint32_t events = state ? ( efd->events | event ) : ( efd->events & ~event );
+  if ( events == efd->events ) {
+    return;
+  }
+  efd->events = events;
+  update_epoll_interest( fd, events );
+}
+
+
+/**
+ * Enables or disables read events of a file descriptor.
+ * @param fd File descriptor
+ * @param state True to enable, False to disable
+ * @return None
+ */
+void
+set_readable( int fd, bool state ) {
+  set_event_state( fd, EPOLLIN, state );
+}
+
+
+/**
+ * Enables or disables write events of a file descriptor.
+ * @param fd File descriptor
+ * @param state True to enable, False to disable
+ * @return None
+ */
+void
+set_writable( int fd, bool state ) {
+  set_event_state( fd, EPOLLOUT, state );
+}
+
+
+/**
+ * Checks whether read events are enabled for a file descriptor.
+ * @param fd File descriptor
+ * @return bool True if enabled, else False
+ */
+bool
+readable( int fd ) {
+  if ( fd < 0 || fd >= event_fds_size || !event_fds[ fd ].registered ) {
+    return false;
+  }
+  return ( event_fds[ fd ].events & EPOLLIN ) != 0;
+}
+
+
+/**
+ * Checks whether write events are enabled for a file descriptor.
+ * @param fd File descriptor
+ * @return bool True if enabled, else False
+ */
+bool
+writable( int fd ) {
+  if ( fd < 0 || fd >= event_fds_size || !event_fds[ fd ].registered ) {
+    return false;
+  }
+  return ( event_fds[ fd ].events & EPOLLOUT ) != 0;
+}
+
+
+/**
+ * Waits for events and calls the registered callbacks of ready file
+ * descriptors. Callbacks may register or delete any file descriptor;
+ * events for descriptors deleted in the meantime are skipped.
+ * @param timeout_msec Maximum time to wait in milliseconds, -1 to wait forever
+ * @return int Number of ready file descriptors (0 on timeout or interruption), -1 on error
+ */
+int
+run_event_handler_once( int timeout_msec ) {
+  assert( epoll_fd >= 0 );
+
+  struct epoll_event events[ EVENT_HANDLER_MAX_EVENTS ];
+
+  int n = epoll_wait( epoll_fd, events, EVENT_HANDLER_MAX_EVENTS, timeout_msec );
+  if ( n < 0 ) {
+    if ( errno == EINTR ) {
+      return 0;
+    }
+    error( "Failed to epoll_wait ( errno = %s [%d] ).", strerror( errno ), errno );
+    return -1;
+  }
+
+  for ( int i = 0; i < n; i++ ) {
+    int fd = events[ i ].data.fd;
+    uint32_t revents = events[ i ].events;
+
+    // Errors and hangups are reported to whichever side is interested,
+    // so that the owner notices them on its next read or write.
+    if ( ( revents & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) != 0 ) {
+      if ( fd < event_fds_size && ( event_fds[ fd ].events & EPOLLIN ) != 0
+           && event_fds[ fd ].read_callback != NULL ) {
+        event_fds[ fd ].read_callback( fd, event_fds[ fd ].read_data );
+      }
+    }
+    if ( ( revents & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) != 0 ) {
+      if ( fd < event_fds_size && ( event_fds[ fd ].events & EPOLLOUT ) != 0
+           && event_fds[ fd ].write_callback != NULL ) {
+        event_fds[ fd ].write_callback( fd, event_fds[ fd ].write_data );
+      }
+    }
+
+    // epoll reports errors and hangups regardless of the interest set.
+    // Drop such a descriptor from the kernel side until its owner asks
+    // for events again, otherwise every epoll_wait() returns immediately.
+    if ( ( revents & ( EPOLLERR | EPOLLHUP ) ) != 0 && fd < event_fds_size
+         && event_fds[ fd ].registered && event_fds[ fd ].events == 0 ) {
+      struct epoll_event ev;
+      memset( &ev, 0, sizeof( ev ) );
+      epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, &ev );
+    }
+  }
+
+  return n;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,75 @@
+/*
+ * Event handler for file descriptors.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ *
+ * @brief epoll based file descriptor event handler
+ *
+ * Registrations are persistent: a file descriptor is added once and
+ * only its interest in read/write readiness is toggled afterwards, so
+ * the cost of each loop iteration is proportional to the number of
+ * ready file descriptors rather than to the number of registered ones.
+ * @code
+ * // Initializes event handler.
+ * init_event_handler();
+ * // Registers a file descriptor and enables read events.
+ * set_fd_handler( fd, on_readable, read_data, on_writable, write_data );
+ * set_readable( fd, true );
+ * // Enables write events while there is data to send.
+ * set_writable( fd, true );
+ * // Waits for events up to 100 milliseconds and dispatches them.
+ * run_event_handler_once( 100 );
+ * // Unregisters the file descriptor before closing it.
+ * delete_fd_handler( fd );
+ * // Finalizes event handler.
+ * finalize_event_handler();
+ * @endcode
+ */
+
+#ifndef EVENT_HANDLER_H
+#define EVENT_HANDLER_H
+
+
+#include "bool.h"
+
+
+typedef void ( *event_fd_callback )( int fd, void *data );
+
+
+bool init_event_handler( void );
+bool finalize_event_handler( void );
+int run_event_handler_once( int timeout_msec );
+void set_fd_handler( int fd, event_fd_callback read_callback, void *read_data, event_fd_callback write_callback, void *write_data );
+void delete_fd_handler( int fd );
+void set_readable( int fd, bool state );
+void set_writable( int fd, bool state );
+bool readable( int fd );
+bool writable( int fd );
+
+
+#endif // EVENT_HANDLER_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
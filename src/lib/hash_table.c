@@ -20,17 +20,69 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "hash_table.h"
 #include "wrapper.h"
 
 
-static const unsigned int default_hash_size = 65521;
+static const unsigned int minimum_number_of_buckets = 8;
+static const unsigned int rehash_step = 16;
+static const unsigned int number_of_concurrent_segments = 16;
+static const unsigned int concurrent_segment_shift = 28; // top 4 bits select one of 16 segments
+
+// Key of a slot whose entry has been deleted (a tombstone).
+static char deleted_key[ 1 ];
+
+
+/*
+ * Entries are stored inline in an array of slots and collisions are
+ * resolved by linear probing. A slot is empty if its key is NULL.
+ */
+typedef struct {
+  hash_entry entry;
+  unsigned int hash;
+} hash_slot;
+
+
+typedef struct {
+  unsigned int number_of_buckets;
+  hash_slot slot[];
+} slot_array;
+
+
+/*
+ * A table is split into segments by hash value, each with its own
+ * slots and writer lock. Only concurrent tables have more than one.
+ *
+ * When a segment grows, entries are moved from old_slots to slots a
+ * few at a time by each following insertion or deletion, so that no
+ * single call pays for rehashing the whole segment. Slots are moved in
+ * order from rehash_start, which follows an empty slot. Concurrent
+ * tables cannot do this under lock-free readers; they rehash at once
+ * instead, publish the new slots and free the old ones when the
+ * readers that may still see them have left (see wait_for_readers()).
+ */
+typedef struct {
+  slot_array *slots;
+  unsigned int used; // live entries and tombstones in slots
+  unsigned int length;
+  slot_array *old_slots;
+  unsigned int rehash_start;
+  unsigned int rehashed;
+  unsigned int epoch;
+  unsigned int readers[ 2 ];
+  pthread_mutex_t mutex;
+} hash_segment;
 
 
 typedef struct {
   hash_table public;
-  pthread_mutex_t *mutex;
+  int concurrency;
+  unsigned int number_of_segments;
+  hash_segment *segments;
 } private_hash_table;
 
 
@@ -54,90 +106,426 @@ compare_atom( const void *x, const void *y ) {
  * case a custom function for creating hashes is required, same should
  * be passed to create_hash function.
  * @param key Pointer to a address, for which hash key is generated
- * @return unsigned int Key value after right shifting by 2 bits
+ * @return unsigned int Hash value of the address
  * @see create_hash
  */
 unsigned int
 hash_atom( const void *key ) {
-  return ( unsigned int ) ( ( unsigned long ) key >> 2 );
+  uintptr_t address = ( uintptr_t ) key;
+  return hash_bytes( &address, sizeof( address ) );
+}
+
+
+static bool
+is_live_slot( const hash_slot *slot ) {
+  return slot->entry.key != NULL && slot->entry.key != deleted_key;
 }
 
 
 /**
- * Creates a hash table and initialize it to NULL.
+ * Returns the smallest number of buckets which holds the given number
+ * of entries without exceeding the maximum load factor (3/4).
+ * @param entries Number of entries
+ * @return unsigned int Number of buckets (a power of two)
+ */
+static unsigned int
+number_of_buckets_for( unsigned int entries ) {
+  unsigned int number_of_buckets = minimum_number_of_buckets;
+  while ( number_of_buckets / 4 * 3 < entries ) {
+    number_of_buckets *= 2;
+  }
+  return number_of_buckets;
+}
+
+
+/**
+ * Returns the slot where probing for a hash value starts. The hash
+ * value is mixed first, since the number of buckets is a power of two
+ * and only the low bits of the mixed value are used.
+ * @param hash Hash value of a key
+ * @param number_of_buckets Number of slots
+ * @return unsigned int Index of slot
+ */
+static unsigned int
+get_bucket_index( unsigned int hash, unsigned int number_of_buckets ) {
+  unsigned int mixed = hash * 2654435769U;
+  return ( mixed ^ ( mixed >> 16 ) ) & ( number_of_buckets - 1 );
+}
+
+
+
+
+static hash_segment *
+get_segment( const private_hash_table *table, unsigned int hash ) {
+  if ( table->number_of_segments == 1 ) {
+    return &table->segments[ 0 ];
+  }
+  return &table->segments[ ( hash * 2654435769U ) >> concurrent_segment_shift ];
+}
+
+
+static void
+lock_segment( const private_hash_table *table, hash_segment *segment ) {
+  if ( table->concurrency != HASH_TABLE_UNLOCKED ) {
+    pthread_mutex_lock( &segment->mutex );
+  }
+}
+
+
+static void
+unlock_segment( const private_hash_table *table, hash_segment *segment ) {
+  if ( table->concurrency != HASH_TABLE_UNLOCKED ) {
+    pthread_mutex_unlock( &segment->mutex );
+  }
+}
+
+
+static void
+lock_all_segments( const private_hash_table *table ) {
+  unsigned int i;
+  for ( i = 0; i < table->number_of_segments; i++ ) {
+    lock_segment( table, &table->segments[ i ] );
+  }
+}
+
+
+static void
+unlock_all_segments( const private_hash_table *table ) {
+  unsigned int i;
+  for ( i = table->number_of_segments; i > 0; i-- ) {
+    unlock_segment( table, &table->segments[ i - 1 ] );
+  }
+}
+
+
+/**
+ * Marks the beginning of a lock-free read of a segment. A reader
+ * counts itself in the half of readers selected by the current epoch,
+ * and retries if the epoch changes meanwhile.
+ * @param segment Pointer to segment to read
+ * @return unsigned int Epoch to be passed to leave_segment()
+ */
+static unsigned int
+enter_segment( hash_segment *segment ) {
+  for ( ;; ) {
+    unsigned int epoch = __atomic_load_n( &segment->epoch, __ATOMIC_SEQ_CST );
+    __atomic_add_fetch( &segment->readers[ epoch & 1 ], 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &segment->epoch, __ATOMIC_SEQ_CST ) == epoch ) {
+      return epoch;
+    }
+    __atomic_sub_fetch( &segment->readers[ epoch & 1 ], 1, __ATOMIC_SEQ_CST );
+  }
+}
+
+
+static void
+leave_segment( hash_segment *segment, unsigned int epoch ) {
+  __atomic_sub_fetch( &segment->readers[ epoch & 1 ], 1, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * Waits until no reader can still see the slots replaced before this
+ * call. Readers entering after the epoch is advanced count themselves
+ * in the other half, so only the readers of the previous epoch are
+ * waited for. Must be called with the segment locked.
+ * @param segment Pointer to segment whose slots were replaced
+ * @return None
+ */
+static void
+wait_for_readers( hash_segment *segment ) {
+  unsigned int epoch = __atomic_fetch_add( &segment->epoch, 1, __ATOMIC_SEQ_CST );
+  while ( __atomic_load_n( &segment->readers[ epoch & 1 ], __ATOMIC_SEQ_CST ) > 0 ) {
+    sched_yield();
+  }
+}
+
+
+static void
+add_length( private_hash_table *table, int delta ) {
+  if ( table->concurrency == HASH_TABLE_CONCURRENT ) {
+    __atomic_add_fetch( &table->public.length, ( unsigned int ) delta, __ATOMIC_RELAXED );
+  }
+  else {
+    table->public.length += ( unsigned int ) delta;
+  }
+}
+
+
+static slot_array *
+create_slot_array( unsigned int number_of_buckets ) {
+  slot_array *slots = xcalloc( 1, offsetof( slot_array, slot ) + sizeof( hash_slot ) * number_of_buckets );
+  slots->number_of_buckets = number_of_buckets;
+  return slots;
+}
+
+
+/**
+ * Returns the slot where probing old_slots starts. Probing skips the
+ * slots that have been moved already; since moving started right
+ * after an empty slot, no entry remaining in old_slots is found before
+ * the first unmoved slot.
+ * @param segment Pointer to segment being rehashed
+ * @param hash Hash value of a key
+ * @return unsigned int Index of slot in old_slots
+ */
+static unsigned int
+get_old_bucket_index( const hash_segment *segment, unsigned int hash ) {
+  unsigned int mask = segment->old_slots->number_of_buckets - 1;
+  unsigned int i = get_bucket_index( hash, segment->old_slots->number_of_buckets );
+  if ( ( ( i - segment->rehash_start ) & mask ) < segment->rehashed ) {
+    i = ( segment->rehash_start + segment->rehashed ) & mask;
+  }
+  return i;
+}
+
+
+/**
+ * Probes slots for the key. Keys are loaded atomically, since lookups
+ * of concurrent tables run while a writer fills in slots.
+ * @param table Pointer to hash table
+ * @param slots Pointer to slots to search
+ * @param i Index of slot where probing starts
+ * @param key Pointer to constant key identifier
+ * @param hash Hash value of the key
+ * @return hash_slot* Pointer to slot holding the key, else NULL
+ */
+static hash_slot *
+find_slot( const hash_table *table, slot_array *slots, unsigned int i, const void *key, unsigned int hash ) {
+  unsigned int mask = slots->number_of_buckets - 1;
+  unsigned int n;
+  for ( n = 0; n < slots->number_of_buckets; n++ ) {
+    hash_slot *slot = &slots->slot[ i ];
+    void *slot_key = __atomic_load_n( &slot->entry.key, __ATOMIC_ACQUIRE );
+    if ( slot_key == NULL ) {
+      break;
+    }
+    if ( slot->hash == hash && slot_key != deleted_key && ( *table->compare )( key, slot_key ) ) {
+      return slot;
+    }
+    i = ( i + 1 ) & mask;
+  }
+  return NULL;
+}
+
+
+/**
+ * Searches for the slot holding the key, first in the current slots
+ * and then in the slots being rehashed. Must be called with the
+ * segment locked.
+ * @param table Pointer to hash table in which key is to be searched
+ * @param segment Pointer to segment where key belongs
+ * @param key Pointer to constant key identifier
+ * @param hash Hash value of the key
+ * @return hash_slot* Pointer to slot holding the key, else NULL
+ */
+static hash_slot *
+find_entry( const private_hash_table *table, const hash_segment *segment, const void *key, unsigned int hash ) {
+  hash_slot *slot = find_slot( &table->public, segment->slots,
+                               get_bucket_index( hash, segment->slots->number_of_buckets ), key, hash );
+  if ( slot == NULL && segment->old_slots != NULL ) {
+    slot = find_slot( &table->public, segment->old_slots, get_old_bucket_index( segment, hash ), key, hash );
+  }
+  return slot;
+}
+
+
+/**
+ * Stores an entry whose key is not in the slots yet. The key is stored
+ * last so that a lock-free reader finding it also sees the value.
+ * Tombstones are not reused for concurrent tables, since a reader may
+ * have matched the deleted key and not yet loaded its value.
+ * @param slots Pointer to slots
+ * @param key Pointer to key
+ * @param value Pointer to associated data
+ * @param hash Hash value of the key
+ * @param reuse_tombstones Whether the entry may replace a tombstone
+ * @return bool True if an empty slot was used, else False
+ */
+static bool
+put_slot( slot_array *slots, void *key, void *value, unsigned int hash, bool reuse_tombstones ) {
+  unsigned int mask = slots->number_of_buckets - 1;
+  unsigned int i = get_bucket_index( hash, slots->number_of_buckets );
+  while ( slots->slot[ i ].entry.key != NULL && ( !reuse_tombstones || slots->slot[ i ].entry.key != deleted_key ) ) {
+    i = ( i + 1 ) & mask;
+  }
+  hash_slot *slot = &slots->slot[ i ];
+  bool empty = slot->entry.key == NULL;
+  slot->hash = hash;
+  __atomic_store_n( &slot->entry.value, value, __ATOMIC_RELEASE );
+  __atomic_store_n( &slot->entry.key, key, __ATOMIC_RELEASE );
+  return empty;
+}
+
+
+/**
+ * Moves up to count slots from old_slots to the current slots, and
+ * releases old_slots once all of them are moved.
+ * @param segment Pointer to segment being rehashed
+ * @param count Maximum number of slots to move
+ * @return None
+ */
+static void
+rehash_slots( hash_segment *segment, unsigned int count ) {
+  unsigned int mask = segment->old_slots->number_of_buckets - 1;
+  for ( ; count > 0 && segment->rehashed < segment->old_slots->number_of_buckets; count-- ) {
+    hash_slot *slot = &segment->old_slots->slot[ ( segment->rehash_start + segment->rehashed ) & mask ];
+    if ( is_live_slot( slot ) && put_slot( segment->slots, slot->entry.key, slot->entry.value, slot->hash, true ) ) {
+      segment->used++;
+    }
+    segment->rehashed++;
+  }
+
+  if ( segment->rehashed == segment->old_slots->number_of_buckets ) {
+    xfree( segment->old_slots );
+    segment->old_slots = NULL;
+  }
+}
+
+
+static void
+finish_rehash( hash_segment *segment ) {
+  if ( segment->old_slots != NULL ) {
+    rehash_slots( segment, segment->old_slots->number_of_buckets );
+  }
+}
+
+
+/**
+ * Replaces the slots of a segment with new ones sized for twice the
+ * number of live entries, dropping tombstones. The segment shrinks to
+ * half its size at most, so that moving entries incrementally finishes
+ * long before the new slots fill up.
+ * @param table Pointer to hash table
+ * @param segment Pointer to segment to be rehashed
+ * @return None
+ */
+static void
+start_rehash( private_hash_table *table, hash_segment *segment ) {
+  finish_rehash( segment );
+
+  unsigned int old_number_of_buckets = segment->slots->number_of_buckets;
+  unsigned int number_of_buckets = number_of_buckets_for( segment->length * 2 );
+  if ( number_of_buckets < old_number_of_buckets / 2 ) {
+    number_of_buckets = old_number_of_buckets / 2;
+  }
+  slot_array *slots = create_slot_array( number_of_buckets );
+
+  if ( table->concurrency == HASH_TABLE_CONCURRENT ) {
+    __atomic_add_fetch( &table->public.number_of_buckets, number_of_buckets - old_number_of_buckets, __ATOMIC_RELAXED );
+    slot_array *old_slots = segment->slots;
+    segment->used = 0;
+    unsigned int i;
+    for ( i = 0; i < old_number_of_buckets; i++ ) {
+      hash_slot *slot = &old_slots->slot[ i ];
+      if ( is_live_slot( slot ) && put_slot( slots, slot->entry.key, slot->entry.value, slot->hash, false ) ) {
+        segment->used++;
+      }
+    }
+    __atomic_store_n( &segment->slots, slots, __ATOMIC_SEQ_CST );
+    wait_for_readers( segment );
+    xfree( old_slots );
+    return;
+  }
+
+  table->public.number_of_buckets += number_of_buckets - old_number_of_buckets;
+  segment->old_slots = segment->slots;
+  unsigned int i = 0;
+  while ( segment->old_slots->slot[ i ].entry.key != NULL ) {
+    i++;
+  }
+  segment->rehash_start = ( i + 1 ) & ( old_number_of_buckets - 1 );
+  segment->rehashed = 0;
+  segment->slots = slots;
+  segment->used = 0;
+}
+
+
+/**
+ * Creates a hash table sized for the expected number of entries, with
+ * the given concurrency model:
+ * - HASH_TABLE_LOCKED: every call takes a recursive mutex.
+ * - HASH_TABLE_UNLOCKED: no locking at all. The table must be used by
+ *   a single thread only.
+ * - HASH_TABLE_CONCURRENT: lookups never block and take no lock. The
+ *   table is split into segments by hash value, and insertions and
+ *   deletions lock only the segment of the key.
+ *
+ * In a concurrent table, a lookup running at the same time as an
+ * insertion or deletion of the same key returns either the old or the
+ * new value. foreach_hash() locks out all writers while it runs, but
+ * iterators do not, so they must not be used while other threads
+ * modify the table. The table never frees keys or values; a value
+ * deleted by one thread may still be in use by a thread which looked
+ * it up just before.
  * @param compare Function pointer to compare_function
  * @param hash Function pointer to hash_function
+ * @param size Expected number of entries
+ * @param concurrency Concurrency model
  * @return hash_table* Pointer to created hash table
  */
 hash_table *
-create_hash( const compare_function compare, const hash_function hash ) {
+create_hash_with_concurrency( const compare_function compare, const hash_function hash, unsigned int size, int concurrency ) {
+  assert( concurrency == HASH_TABLE_LOCKED || concurrency == HASH_TABLE_UNLOCKED || concurrency == HASH_TABLE_CONCURRENT );
+
   private_hash_table *table = xmalloc( sizeof( private_hash_table ) );
 
-  table->public.number_of_buckets = default_hash_size;
+  table->concurrency = concurrency;
+  table->number_of_segments = concurrency == HASH_TABLE_CONCURRENT ? number_of_concurrent_segments : 1;
+  table->segments = xcalloc( table->number_of_segments, sizeof( hash_segment ) );
+  table->public.number_of_buckets = 0;
   table->public.compare = compare ? compare : compare_atom;
   table->public.hash = hash ? hash : hash_atom;
   table->public.length = 0;
-  table->public.buckets = xmalloc( sizeof( dlist_element * ) * default_hash_size );
-  unsigned int i;
-  for ( i = 0; i < table->public.number_of_buckets; i++ ) {
-    table->public.buckets[ i ] = create_dlist();
-    assert( table->public.buckets[ i ] != NULL );
-  }
-  table->public.nonempty_bucket_index = create_dlist();
-  assert( table->public.nonempty_bucket_index != NULL );
 
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  table->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( table->mutex, &attr );
+
+  unsigned int i;
+  for ( i = 0; i < table->number_of_segments; i++ ) {
+    hash_segment *segment = &table->segments[ i ];
+    segment->slots = create_slot_array( number_of_buckets_for( size / table->number_of_segments ) );
+    table->public.number_of_buckets += segment->slots->number_of_buckets;
+    if ( concurrency != HASH_TABLE_UNLOCKED ) {
+      pthread_mutex_init( &segment->mutex, &attr );
+    }
+  }
 
   return ( hash_table * ) table;
 }
 
 
 /**
- * Returns the index of hash bucket pointed to be the key in the
- * hash_table table.
- * @param table Pointer to hash table for which bucket index is needed
- * @param key Pointer to constant key identifier
- * @return unsigned int Index of hash bucket
+ * Creates a hash table sized for the expected number of entries. The
+ * table grows as needed, so the size is only a hint.
+ * @param compare Function pointer to compare_function
+ * @param hash Function pointer to hash_function
+ * @param size Expected number of entries
+ * @return hash_table* Pointer to created hash table
  */
-static unsigned int
-get_bucket_index( const hash_table *table, const void *key ) {
-  assert( table != NULL );
-  assert( key != NULL );
-
-  return ( *table->hash )( key ) % table->number_of_buckets;
+hash_table *
+create_hash_with_size( const compare_function compare, const hash_function hash, unsigned int size ) {
+  return create_hash_with_concurrency( compare, hash, size, HASH_TABLE_LOCKED );
 }
 
 
 /**
- * Searches for an element in the bucket pointed by the key.
- * @param table Pointer to hash table in which element is to be searched
- * @param key Pointer to constant key identifier
- * @return void* Pointer to identified element in the bucket
+ * Creates a hash table and initialize it to NULL.
+ * @param compare Function pointer to compare_function
+ * @param hash Function pointer to hash_function
+ * @return hash_table* Pointer to created hash table
  */
-static void *
-find_list_element_from_buckets( const hash_table *table, const void *key ) {
-  assert( table != NULL );
-  assert( key != NULL );
-
-  dlist_element *e = NULL;
-  unsigned int i = get_bucket_index( table, key );
-  for ( e = table->buckets[ i ]->next; e; e = e->next ) {
-    if ( ( *table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
-      break;
-    }
-  }
-  return e;
+hash_table *
+create_hash( const compare_function compare, const hash_function hash ) {
+  return create_hash_with_concurrency( compare, hash, 0, HASH_TABLE_LOCKED );
 }
 
 
 /**
- * Inserts a new element into an existing hash table. In case the hash
- * entry matches an existing entry, pointer to it is returned, else
- * NULL is returned.
+ * Inserts a new element into an existing hash table. In case the key
+ * matches an existing entry, the entry is replaced and its old value
+ * is returned, else NULL is returned.
  * @param table Pointer to hash table in which element is to be inserted
  * @param key Pointer to new element's key
  * @param value Pointer to associated data
@@ -148,29 +536,45 @@ insert_hash_entry( hash_table *table, void *key, void *value ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-
-  unsigned int i = get_bucket_index( table, key );
-  if ( table->buckets[ i ]->next == NULL ) {
-    table->buckets[ i ]->data = insert_after_dlist( table->nonempty_bucket_index, ( void * ) ( unsigned long ) i );
+  private_hash_table *private = ( private_hash_table * ) table;
+  unsigned int hash = ( *table->hash )( key );
+  hash_segment *segment = get_segment( private, hash );
+  lock_segment( private, segment );
+
+  void *old_value = NULL;
+  hash_slot *slot = find_slot( table, segment->slots, get_bucket_index( hash, segment->slots->number_of_buckets ), key, hash );
+  if ( slot != NULL ) {
+    old_value = slot->entry.value;
+    __atomic_store_n( &slot->entry.value, value, __ATOMIC_RELEASE );
+    __atomic_store_n( &slot->entry.key, key, __ATOMIC_RELEASE );
+  }
+  else {
+    if ( segment->old_slots != NULL ) {
+      slot = find_slot( table, segment->old_slots, get_old_bucket_index( segment, hash ), key, hash );
+    }
+    if ( slot != NULL ) {
+      old_value = slot->entry.value;
+      slot->entry.key = deleted_key;
+    }
+    else {
+      segment->length++;
+      add_length( private, 1 );
+    }
+    if ( put_slot( segment->slots, key, value, hash, private->concurrency != HASH_TABLE_CONCURRENT ) ) {
+      segment->used++;
+    }
   }
 
-  dlist_element *old_elem = find_list_element_from_buckets( table, key );
-
-  hash_entry *new_entry = xmalloc( sizeof( hash_entry ) );
-  new_entry->key = key;
-  new_entry->value = value;
-  insert_after_dlist( table->buckets[ i ], new_entry );
-  table->length++;
-
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-
-  if ( old_elem == NULL ) {
-    return NULL;
+  if ( segment->old_slots != NULL ) {
+    rehash_slots( segment, rehash_step );
   }
-  else {
-    return ( ( hash_entry * ) old_elem->data )->value;
+  if ( segment->used > segment->slots->number_of_buckets / 4 * 3 ) {
+    start_rehash( private, segment );
   }
+
+  unlock_segment( private, segment );
+
+  return old_value;
 }
 
 
@@ -186,21 +590,38 @@ lookup_hash_entry( hash_table *table, const void *key ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private = ( private_hash_table * ) table;
+  unsigned int hash = ( *table->hash )( key );
+  hash_segment *segment = get_segment( private, hash );
+
+  void *value = NULL;
+  if ( private->concurrency == HASH_TABLE_CONCURRENT ) {
+    unsigned int epoch = enter_segment( segment );
+    slot_array *slots = __atomic_load_n( &segment->slots, __ATOMIC_SEQ_CST );
+    hash_slot *slot = find_slot( table, slots, get_bucket_index( hash, slots->number_of_buckets ), key, hash );
+    if ( slot != NULL ) {
+      value = __atomic_load_n( &slot->entry.value, __ATOMIC_ACQUIRE );
+    }
+    leave_segment( segment, epoch );
+    return value;
+  }
 
-  dlist_element *e = find_list_element_from_buckets( table, key );
-  if ( e != NULL ) {
-    pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-    return ( ( hash_entry * ) e->data )->value;
+  lock_segment( private, segment );
+  hash_slot *slot = find_entry( private, segment, key, hash );
+  if ( slot != NULL ) {
+    value = slot->entry.value;
   }
+  unlock_segment( private, segment );
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-  return NULL;
+  return value;
 }
 
 
 /**
- * Deletes an entry referred to by the key in the hash table.
+ * Deletes an entry referred to by the key in the hash table. Deleting
+ * entries never moves other entries, so that the entry just returned
+ * by iterate_hash_next() or passed to the function of foreach_hash()
+ * can be deleted while iterating.
  * @param table Pointer to hash table from which element is to be deleted
  * @param key Pointer to element's key which is to be deleted
  * @return void* Pointer to data that was associated with the key, else NULL
@@ -210,26 +631,27 @@ delete_hash_entry( hash_table *table, const void *key ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-
-  unsigned int i = get_bucket_index( table, key );
-  dlist_element *e = find_list_element_from_buckets( table, key );
-  if ( e != NULL ) {
-    hash_entry *delete_me = e->data;
-    void *deleted = delete_me->value;
-    delete_dlist_element( e );
-    xfree( delete_me );
-    if ( table->buckets[ i ]->next == NULL ) {
-      delete_dlist_element( table->buckets[ i ]->data );
-      table->buckets[ i ]->data = NULL;
-    }
-    table->length--;
-    pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-    return deleted;
+  private_hash_table *private = ( private_hash_table * ) table;
+  unsigned int hash = ( *table->hash )( key );
+  hash_segment *segment = get_segment( private, hash );
+  lock_segment( private, segment );
+
+  void *deleted = NULL;
+  hash_slot *slot = find_entry( private, segment, key, hash );
+  if ( slot != NULL ) {
+    deleted = slot->entry.value;
+    __atomic_store_n( &slot->entry.key, ( void * ) deleted_key, __ATOMIC_RELEASE );
+    segment->length--;
+    add_length( private, -1 );
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-  return NULL;
+  if ( segment->old_slots != NULL ) {
+    rehash_slots( segment, rehash_step );
+  }
+
+  unlock_segment( private, segment );
+
+  return deleted;
 }
 
 
@@ -252,26 +674,46 @@ delete_hash_entry( hash_table *table, const void *key ) {
 void
 map_hash( hash_table *table, const void *key, void function( void *value, void *user_data ), void *user_data ) {
   assert( table != NULL );
+  assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-
-  unsigned int i = get_bucket_index( table, key );
-  dlist_element *e = NULL;
-  for ( e = table->buckets[ i ]->next; e; e = e->next ) {
-    if ( ( table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
-      function( ( ( hash_entry * ) e->data )->value, user_data );
+  private_hash_table *private = ( private_hash_table * ) table;
+  unsigned int hash = ( *table->hash )( key );
+  hash_segment *segment = get_segment( private, hash );
+
+  if ( private->concurrency == HASH_TABLE_CONCURRENT ) {
+    // The function may modify the table, which would wait for this
+    // reader if it were called inside the read.
+    bool found = false;
+    void *value = NULL;
+    unsigned int epoch = enter_segment( segment );
+    slot_array *slots = __atomic_load_n( &segment->slots, __ATOMIC_SEQ_CST );
+    hash_slot *slot = find_slot( table, slots, get_bucket_index( hash, slots->number_of_buckets ), key, hash );
+    if ( slot != NULL ) {
+      found = true;
+      value = __atomic_load_n( &slot->entry.value, __ATOMIC_ACQUIRE );
+    }
+    leave_segment( segment, epoch );
+    if ( found ) {
+      function( value, user_data );
     }
+    return;
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  lock_segment( private, segment );
+  hash_slot *slot = find_entry( private, segment, key, hash );
+  if ( slot != NULL ) {
+    function( slot->entry.value, user_data );
+  }
+  unlock_segment( private, segment );
 }
 
 
 /**
  * Iterates over each hash entry in the hash_Table. Takes as argument
- * a function pointer which is called once for each bucket of the
- * table being pointed to by passed argument. It is used as an
- * iterator over each hash entry belonging to each bucket.
+ * a function pointer which is called once for each entry of the
+ * table being pointed to by passed argument. The function may delete
+ * the entry it is called for, but must not insert new entries. Other
+ * threads cannot modify the table until the iteration finishes.
  * Example:
  * @code
  *     // Create a Hash Table
@@ -294,21 +736,23 @@ void
 foreach_hash( hash_table *table, void function( void *key, void *value, void *user_data ), void *user_data ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-
-  dlist_element *nonempty = NULL;
-  for ( nonempty = table->nonempty_bucket_index->next; nonempty; ) {
-    int i = ( int ) ( unsigned long ) nonempty->data;
-    nonempty = nonempty->next;
-    dlist_element *e = NULL;
-    for ( e = table->buckets[ i ]->next; e; ) {
-      hash_entry *he = e->data;
-      e = e->next;
-      function( he->key, he->value, user_data );
+  private_hash_table *private = ( private_hash_table * ) table;
+  lock_all_segments( private );
+
+  unsigned int i;
+  for ( i = 0; i < private->number_of_segments; i++ ) {
+    hash_segment *segment = &private->segments[ i ];
+    finish_rehash( segment );
+    unsigned int j;
+    for ( j = 0; j < segment->slots->number_of_buckets; j++ ) {
+      hash_slot *slot = &segment->slots->slot[ j ];
+      if ( is_live_slot( slot ) ) {
+        function( slot->entry.key, slot->entry.value, user_data );
+      }
     }
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  unlock_all_segments( private );
 }
 
 
@@ -327,23 +771,26 @@ init_hash_iterator( hash_table *table, hash_iterator *iter ) {
   assert( table != NULL );
   assert( iter != NULL );
 
-  iter->buckets = table->buckets;
-  if ( table->nonempty_bucket_index->next ) {
-    iter->bucket_index = table->nonempty_bucket_index->next;
-    iter->next_bucket_index = iter->bucket_index->next;
-    iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ]->next;
-  }
-  else {
-    iter->bucket_index = NULL;
-    iter->element = NULL;
+  private_hash_table *private = ( private_hash_table * ) table;
+  lock_all_segments( private );
+  unsigned int i;
+  for ( i = 0; i < private->number_of_segments; i++ ) {
+    finish_rehash( &private->segments[ i ] );
   }
+  unlock_all_segments( private );
+
+  iter->table = table;
+  iter->segment = 0;
+  iter->index = 0;
 }
 
 
 /**
  * Moves the hash iterator forward to next hash entry. It uses the
  * iterator initialized by init_hash_iterator. It can be used to fetch
- * the data associated with each hash entry.
+ * the data associated with each hash entry. The entry returned may be
+ * deleted before moving forward, but no entry may be inserted until
+ * the iteration finishes.
  * Example:
  * @code
  *     // Assuming a hash table pointed to by hashtable_p
@@ -358,7 +805,7 @@ init_hash_iterator( hash_table *table, hash_iterator *iter ) {
  *         dump(p->value);
  *         ...
  *     }
- * @endcode        
+ * @endcode
  * @param iter Pointer to hash_iterator to move forward
  * @return hash_entry* Pointer to valid hash entry, else NULL
  * @see init_hash_iterator
@@ -367,32 +814,106 @@ hash_entry *
 iterate_hash_next( hash_iterator *iter ) {
   assert( iter != NULL );
 
-  for ( ;; ) {
-    if ( iter->bucket_index == NULL ) {
-      return NULL;
+  private_hash_table *table = ( private_hash_table * ) iter->table;
+  while ( iter->segment < table->number_of_segments ) {
+    slot_array *slots = table->segments[ iter->segment ].slots;
+    while ( iter->index < slots->number_of_buckets ) {
+      hash_slot *slot = &slots->slot[ iter->index++ ];
+      if ( is_live_slot( slot ) ) {
+        return &slot->entry;
+      }
     }
+    iter->segment++;
+    iter->index = 0;
+  }
+  return NULL;
+}
+
+
+static int
+compare_hash_value( const void *x, const void *y ) {
+  unsigned int a = *( const unsigned int * ) x;
+  unsigned int b = *( const unsigned int * ) y;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+
+/**
+ * Collects statistics on how keys are distributed over the slots, so
+ * that the hash function can be checked against real keys. Probe
+ * lengths count the slots examined to find an entry, which is one for
+ * an entry in its home slot. Writers are locked out while the table
+ * is examined.
+ * @param table Pointer to hash table
+ * @param stats Pointer to hash_table_stats to be filled in
+ * @return None
+ */
+void
+get_hash_table_stats( hash_table *table, hash_table_stats *stats ) {
+  assert( table != NULL );
+  assert( stats != NULL );
+
+  private_hash_table *private = ( private_hash_table * ) table;
+  lock_all_segments( private );
 
-    dlist_element *e = iter->element;
-    if ( e == NULL ) { 
-      if ( iter->next_bucket_index != NULL ) {
-        iter->bucket_index = iter->next_bucket_index;
-        iter->next_bucket_index = iter->next_bucket_index->next;
-        iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ]->next;
+  memset( stats, 0, sizeof( hash_table_stats ) );
+  unsigned int *hashes = xmalloc( sizeof( unsigned int ) * ( table->length + 1 ) );
+  unsigned long total_probe_length = 0;
+
+  unsigned int i;
+  for ( i = 0; i < private->number_of_segments; i++ ) {
+    hash_segment *segment = &private->segments[ i ];
+    finish_rehash( segment );
+    slot_array *slots = segment->slots;
+    unsigned int mask = slots->number_of_buckets - 1;
+    stats->number_of_buckets += slots->number_of_buckets;
+
+    unsigned int cluster_length = 0;
+    unsigned int j;
+    // Goes around twice so that a cluster wrapping around the end is
+    // counted in full.
+    for ( j = 0; j < slots->number_of_buckets * 2; j++ ) {
+      hash_slot *slot = &slots->slot[ j & mask ];
+      if ( slot->entry.key == NULL ) {
+        cluster_length = 0;
+        continue;
+      }
+      if ( ++cluster_length > stats->max_cluster_length && cluster_length <= slots->number_of_buckets ) {
+        stats->max_cluster_length = cluster_length;
+      }
+      if ( j > mask || !is_live_slot( slot ) ) {
+        continue;
       }
-      else {
-        return NULL;
+      unsigned int probe_length = ( ( j - get_bucket_index( slot->hash, slots->number_of_buckets ) ) & mask ) + 1;
+      if ( probe_length > 1 ) {
+        stats->displaced_entries++;
       }
+      if ( probe_length > stats->max_probe_length ) {
+        stats->max_probe_length = probe_length;
+      }
+      total_probe_length += probe_length;
+      hashes[ stats->entries++ ] = slot->hash;
     }
-    else {
-      iter->element = e->next;
-      return e->data;
+  }
+
+  unlock_all_segments( private );
+
+  if ( stats->entries > 0 ) {
+    stats->average_probe_length = ( double ) total_probe_length / stats->entries;
+  }
+  qsort( hashes, stats->entries, sizeof( unsigned int ), compare_hash_value );
+  for ( i = 1; i < stats->entries; i++ ) {
+    if ( hashes[ i ] == hashes[ i - 1 ] ) {
+      stats->hash_collisions++;
     }
   }
+  xfree( hashes );
 }
 
 
 /**
- * Releases all the memory held by the hash table.
+ * Releases all the memory held by the hash table. No other thread may
+ * use the table any more.
  * @param hash_table Pointer to hash table which needs to be deleted
  * @return None
  */
@@ -400,36 +921,20 @@ void
 delete_hash( hash_table *table ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-  pthread_mutex_t *mutex = ( ( private_hash_table * ) table )->mutex;
-
-  bool dlist_deleted = false;
-
+  private_hash_table *private = ( private_hash_table * ) table;
   unsigned int i;
-  for ( i = 0; i < table->number_of_buckets; i++ ) {
-    dlist_element *e = NULL;
-    for ( e = table->buckets[ i ]->next; e != NULL; ) {
-      dlist_element *delete_me = e;
-      e = e->next;
-      xfree( delete_me->data );
+  for ( i = 0; i < private->number_of_segments; i++ ) {
+    hash_segment *segment = &private->segments[ i ];
+    xfree( segment->slots );
+    if ( segment->old_slots != NULL ) {
+      xfree( segment->old_slots );
     }
-    if ( table->buckets[ i ]->data != NULL ) {
-      dlist_deleted = delete_dlist_element( table->buckets[ i ]->data );
-      assert( dlist_deleted == true );
+    if ( private->concurrency != HASH_TABLE_UNLOCKED ) {
+      pthread_mutex_destroy( &segment->mutex );
     }
-    table->buckets[ i ]->data = NULL;
-    dlist_deleted = delete_dlist( table->buckets[ i ] );
-    assert( dlist_deleted == true );
   }
-  xfree( table->buckets );
-
-  dlist_deleted = delete_dlist( table->nonempty_bucket_index );
-  assert( dlist_deleted == true );
-
-  xfree( table );
-
-  pthread_mutex_unlock( mutex );
-  xfree( mutex );
+  xfree( private->segments );
+  xfree( private );
 }
 
 
@@ -29,6 +29,12 @@
  * // Create a hash table with default hash and compare function
  * hash_table *table = create_hash( NULL, NULL );
  *
+ * // Or, if the number of entries is known in advance
+ * hash_table *table = create_hash_with_size( NULL, NULL, 1024 );
+ *
+ * // Or, for a table owned by a single thread
+ * hash_table *table = create_hash_with_concurrency( NULL, NULL, 0, HASH_TABLE_UNLOCKED );
+ *
  * // Insert key:value pairs into the created hash table
  * insert_hash_entry( table, "A", "Apple" );
  * insert_hash_entry( table, "B", "Bat" );
@@ -48,7 +54,7 @@
 #define HASH_TABLE_H
 
 
-#include "doubly_linked_list.h"
+#include "bool.h"
 
 
 typedef unsigned int ( *hash_function )( const void *key );
@@ -68,12 +74,10 @@ typedef struct {
  * Parameters associated with a hash table
  */
 typedef struct {
-  unsigned int number_of_buckets; /*!<Total number of buckets allocated in hash table*/
+  unsigned int number_of_buckets; /*!<Total number of slots allocated in hash table*/
   compare_function compare; /*!<Function pointer to compare items*/
   hash_function hash; /*!<Pointer to hash function*/
   unsigned int length; /*!<Total number of entries in hash table*/
-  dlist_element **buckets; /*!<Pointer to buckets in hash table*/
-  dlist_element *nonempty_bucket_index; /*!<List of non-empty buckets in hash table*/
 } hash_table;
 
 
@@ -81,14 +85,39 @@ typedef struct {
  * Parameters used to iterate over hash table
  */
 typedef struct {
-  dlist_element **buckets; /*!<Pointer to buckets in hash table*/
-  dlist_element *bucket_index; /*!<Pointer to non-empty bucket index */
-  dlist_element *next_bucket_index; /*!<Pointer to next non-empty bucket index*/
-  dlist_element *element; /*!<Pointer to hash entries in a bucket*/
+  hash_table *table; /*!<Pointer to hash table being iterated over*/
+  unsigned int segment; /*!<Index of segment being iterated over*/
+  unsigned int index; /*!<Index of next slot to examine in the segment*/
 } hash_iterator;
 
 
+/**
+ * Distribution of keys in a hash table (see get_hash_table_stats)
+ */
+typedef struct {
+  unsigned int entries; /*!<Number of entries*/
+  unsigned int number_of_buckets; /*!<Number of slots*/
+  unsigned int displaced_entries; /*!<Entries not in the slot their hash value points to*/
+  unsigned int max_probe_length; /*!<Most slots examined to find an entry*/
+  double average_probe_length; /*!<Average slots examined to find an entry*/
+  unsigned int max_cluster_length; /*!<Longest run of occupied slots, examined to find a missing key*/
+  unsigned int hash_collisions; /*!<Entries whose hash value equals that of an earlier entry*/
+} hash_table_stats;
+
+
+/**
+ * Concurrency models of a hash table (see create_hash_with_concurrency)
+ */
+enum {
+  HASH_TABLE_LOCKED,
+  HASH_TABLE_UNLOCKED,
+  HASH_TABLE_CONCURRENT,
+};
+
+
 hash_table *create_hash( const compare_function compare, const hash_function hash );
+hash_table *create_hash_with_size( const compare_function compare, const hash_function hash, unsigned int size );
+hash_table *create_hash_with_concurrency( const compare_function compare, const hash_function hash, unsigned int size, int concurrency );
 void *insert_hash_entry( hash_table *table, void *key, void *value );
 void *lookup_hash_entry( hash_table *table, const void *key );
 void *delete_hash_entry( hash_table *table, const void *key );
@@ -97,6 +126,7 @@ void foreach_hash( hash_table * table, void function( void *key, void *value, vo
 void init_hash_iterator( hash_table *table, hash_iterator *iter );
 hash_entry *iterate_hash_next( hash_iterator *iter );
 void delete_hash( hash_table *table );
+void get_hash_table_stats( hash_table *table, hash_table_stats *stats );
 
 bool compare_atom( const void *x, const void *y );
 unsigned int hash_atom( const void *key );
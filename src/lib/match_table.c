@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <openflow.h>
@@ -27,19 +28,122 @@
 #include "match_table.h"
 #include "match.h"
 #include "log.h"
+#include "stat.h"
 #include "wrapper.h"
 
 
 #ifdef UNIT_TESTING
+
 #define static
+
+#ifdef increment_stat_by
+#undef increment_stat_by
+#endif
+#define increment_stat_by mock_increment_stat_by
+void mock_increment_stat_by( const char *key, uint64_t value );
+
 #endif // UNIT_TESTING
 
 
-typedef struct match_table {
+#define MICROFLOW_CACHE_WAYS 4
+#define MICROFLOW_CACHE_STAT_INTERVAL 1024
+#define MICROFLOW_CACHE_HITS_KEY "match_table.microflow_cache_hits"
+#define MICROFLOW_CACHE_MISSES_KEY "match_table.microflow_cache_misses"
+
+
+/**
+ * Updates are serialized by the mutex, while lookups take no lock.
+ * Whatever a lookup may still see is only freed once every lookup that
+ * started before it was unlinked has finished (see wait_for_readers()).
+ */
+struct match_table {
   hash_table *exact_table; // no wildcards are set
-  list_element *wildcard_table; // wildcard flags are set
+  struct tuple_set *wildcard_table; // tuples of wildcard entries, NULL if there is none
   pthread_mutex_t *mutex;
-} match_table;
+  uint64_t next_sequence;
+  unsigned int epoch;
+  unsigned int readers[ 2 ]; // lookups in progress, by parity of epoch
+  struct microflow_cache *cache; // NULL unless enabled
+  uint64_t generation; // advanced by every update, invalidating the cache
+};
+
+
+/**
+ * A result of classification cached for an exact match. Lookups read
+ * slots without locks: a writer makes sequence odd while it rewrites
+ * the slot, and a reader retries elsewhere if sequence changed under it.
+ */
+typedef struct {
+  unsigned int sequence;
+  unsigned int referenced; // set by hits, cleared by the clock hand
+  uint64_t generation; // generation of the table the result belongs to
+  struct ofp_match ofp_match;
+  match_entry *entry; // NULL if no entry matches
+} microflow_slot;
+
+
+typedef struct {
+  unsigned int hand; // next way the clock considers for eviction
+  microflow_slot way[ MICROFLOW_CACHE_WAYS ];
+} microflow_set;
+
+
+/**
+ * Bounded cache of exact matches in front of classification. A match
+ * may only be cached in the set its hash selects, and evicts a slot of
+ * the set that was not hit since the clock hand last passed it.
+ */
+typedef struct microflow_cache {
+  unsigned int number_of_sets; // power of two
+  unsigned int unreported_hits;
+  unsigned int unreported_misses;
+  microflow_set set[];
+} microflow_cache;
+
+
+typedef struct private_match_entry {
+  match_entry public;
+  uint64_t sequence; // order of insertion, which breaks ties of priority
+  struct private_match_entry *next; // next entry of the same match_group
+} private_match_entry;
+
+
+/**
+ * Entries of a tuple with the same masked match, which differ only in
+ * priority. The first entry is the one a lookup finds.
+ */
+typedef struct {
+  struct ofp_match masked_match;
+  private_match_entry *entries; // in descending order of priority, then insertion
+} match_group;
+
+
+/**
+ * Wildcard entries that share a wildcard mask (including the prefix
+ * lengths of nw_src and nw_dst) form a tuple. Fields of the entries
+ * that the mask wildcards are cleared, so each tuple is an exact table
+ * looked up with a packet cleared in the same way.
+ */
+typedef struct {
+  uint32_t wildcards;
+  hash_table *groups; // masked match -> match_group
+} match_tuple;
+
+
+typedef struct {
+  match_tuple *tuple;
+  uint16_t max_priority; // highest priority of the entries in the tuple
+} ranked_tuple;
+
+
+/**
+ * All tuples of a table in descending order of max_priority. A set is
+ * never changed once published; updates replace the whole set.
+ */
+typedef struct tuple_set {
+  unsigned int length;
+  ranked_tuple tuple[];
+} tuple_set;
 
 
 static match_table match_table_head;
@@ -71,45 +175,58 @@ compare_match_entry( const void *x, const void *y ) {
 static unsigned int
 hash_match_entry( const void *key ) {
   const struct ofp_match *ofp_match = key;
-  unsigned int hash = 0;
 
   assert( ofp_match->wildcards == 0 );
 
-  hash ^= ( unsigned int ) ( ofp_match->in_port << 16 );
-  hash ^= ( unsigned int ) hash_mac( ofp_match->dl_src );
-  hash ^= ( unsigned int ) hash_mac( ofp_match->dl_dst );
-  hash ^= ofp_match->dl_vlan;
-  hash ^= ( unsigned int ) ( ofp_match->dl_vlan_pcp << 24 );
-  hash ^= ( unsigned int ) ( ofp_match->dl_type << 8 );
-  hash ^= ofp_match->nw_tos;
-  hash ^= ( unsigned int ) ( ofp_match->nw_proto << 24 );
-  hash ^= ofp_match->nw_src;
-  hash ^= ofp_match->nw_dst;
-  hash ^= ( unsigned int ) ( ofp_match->tp_src << 16 );
-  hash ^= ofp_match->tp_dst;
+  // Fields are packed first, since padding in ofp_match is not
+  // compared and may hold anything.
+  uint8_t fields[ sizeof( struct ofp_match ) ];
+  uint8_t *p = fields;
+  memcpy( p, &ofp_match->in_port, sizeof( ofp_match->in_port ) );
+  p += sizeof( ofp_match->in_port );
+  memcpy( p, ofp_match->dl_src, sizeof( ofp_match->dl_src ) );
+  p += sizeof( ofp_match->dl_src );
+  memcpy( p, ofp_match->dl_dst, sizeof( ofp_match->dl_dst ) );
+  p += sizeof( ofp_match->dl_dst );
+  memcpy( p, &ofp_match->dl_vlan, sizeof( ofp_match->dl_vlan ) );
+  p += sizeof( ofp_match->dl_vlan );
+  *p++ = ofp_match->dl_vlan_pcp;
+  memcpy( p, &ofp_match->dl_type, sizeof( ofp_match->dl_type ) );
+  p += sizeof( ofp_match->dl_type );
+  *p++ = ofp_match->nw_tos;
+  *p++ = ofp_match->nw_proto;
+  memcpy( p, &ofp_match->nw_src, sizeof( ofp_match->nw_src ) );
+  p += sizeof( ofp_match->nw_src );
+  memcpy( p, &ofp_match->nw_dst, sizeof( ofp_match->nw_dst ) );
+  p += sizeof( ofp_match->nw_dst );
+  memcpy( p, &ofp_match->tp_src, sizeof( ofp_match->tp_src ) );
+  p += sizeof( ofp_match->tp_src );
+  memcpy( p, &ofp_match->tp_dst, sizeof( ofp_match->tp_dst ) );
+  p += sizeof( ofp_match->tp_dst );
 
-  return hash;
+  return hash_bytes( fields, ( size_t ) ( p - fields ) );
 }
 
 
 /**
  * Allocates space to structure of type match entry.
+ * @param table Pointer to match table the entry is added to
  * @param ofp_match Pointer to structure containing fields to match against flows
  * @param priority Priority order
- * @param service_name Pointer to application service name of messenger
- * @param entry_name Pointer to name of match entry
  * @return match_entry* Pointer to newly allocated match entry
  */
 static match_entry *
-allocate_match_entry( struct ofp_match *ofp_match, uint16_t priority ) {
-  match_entry *new_entry;
+allocate_match_entry( match_table *table, struct ofp_match *ofp_match, uint16_t priority ) {
+  private_match_entry *new_entry;
 
-  new_entry = xmalloc( sizeof( match_entry ) );
-  new_entry->ofp_match = *ofp_match;
-  new_entry->priority = priority;
-  create_list( &new_entry->services_name );
+  new_entry = xmalloc( sizeof( private_match_entry ) );
+  new_entry->public.ofp_match = *ofp_match;
+  new_entry->public.priority = priority;
+  create_list( &new_entry->public.services_name );
+  new_entry->sequence = table->next_sequence++;
+  new_entry->next = NULL;
 
-  return new_entry;
+  return &new_entry->public;
 }
 
 
@@ -177,193 +294,738 @@ free_match_table_walker( void *key, void *value, void *user_data ) {
 }
 
 
+static void
+free_match_group_walker( void *key, void *value, void *user_data ) {
+  match_group *group = value;
+
+  UNUSED( key );
+  UNUSED( user_data );
+
+  private_match_entry *next;
+  for ( private_match_entry *entry = group->entries; entry != NULL; entry = next ) {
+    next = entry->next;
+    free_match_entry( &entry->public );
+  }
+  xfree( group );
+}
+
+
+static void
+free_match_tuple( match_tuple *tuple ) {
+  foreach_hash( tuple->groups, free_match_group_walker, NULL );
+  delete_hash( tuple->groups );
+  xfree( tuple );
+}
+
+
 /**
- * Initializes match_table_head (of type match_table) i.e, creates an exact table,
- * wildcard table and initialize all there members to NULL. 
- * @param None
+ * Marks the start of a lookup.
+ * @param table Pointer to match table looked up
+ * @return unsigned int Epoch to be passed to leave_match_table()
+ */
+static unsigned int
+enter_match_table( match_table *table ) {
+  for ( ;; ) {
+    unsigned int epoch = __atomic_load_n( &table->epoch, __ATOMIC_SEQ_CST );
+    __atomic_add_fetch( &table->readers[ epoch & 1 ], 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &table->epoch, __ATOMIC_SEQ_CST ) == epoch ) {
+      return epoch;
+    }
+    __atomic_sub_fetch( &table->readers[ epoch & 1 ], 1, __ATOMIC_SEQ_CST );
+  }
+}
+
+
+static void
+leave_match_table( match_table *table, unsigned int epoch ) {
+  __atomic_sub_fetch( &table->readers[ epoch & 1 ], 1, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * Waits until no lookup can still see what was unlinked before this
+ * call, so that it can be freed. Must be called with the table locked.
+ * @param table Pointer to match table updated
  * @return None
  */
-void
-init_match_table( void ) {
-  match_table_head.exact_table = create_hash( compare_match_entry, hash_match_entry );
-  create_list( &match_table_head.wildcard_table );
+static void
+wait_for_readers( match_table *table ) {
+  unsigned int epoch = __atomic_fetch_add( &table->epoch, 1, __ATOMIC_SEQ_CST );
+  while ( __atomic_load_n( &table->readers[ epoch & 1 ], __ATOMIC_SEQ_CST ) > 0 ) {
+    sched_yield();
+  }
+}
+
+
+/**
+ * Makes every cached result stale. Must be called after an update is
+ * visible to lookups and before anything it unlinked is freed.
+ * @param table Pointer to match table updated
+ * @return None
+ */
+static void
+invalidate_microflow_cache( match_table *table ) {
+  __atomic_add_fetch( &table->generation, 1, __ATOMIC_SEQ_CST );
+}
+
+
+/**
+ * Clears the fields of a match that the wildcards of a tuple ignore,
+ * so that matches which the tuple cannot tell apart compare equal.
+ * @param masked Pointer to the masked match to fill in
+ * @param ofp_match Pointer to the match to mask
+ * @param wildcards Wildcards of the tuple
+ * @return None
+ */
+static void
+mask_match( struct ofp_match *masked, const struct ofp_match *ofp_match, uint32_t wildcards ) {
+  memset( masked, 0, sizeof( struct ofp_match ) );
+  if ( !( wildcards & OFPFW_IN_PORT ) ) {
+    masked->in_port = ofp_match->in_port;
+  }
+  if ( !( wildcards & OFPFW_DL_SRC ) ) {
+    memcpy( masked->dl_src, ofp_match->dl_src, sizeof( masked->dl_src ) );
+  }
+  if ( !( wildcards & OFPFW_DL_DST ) ) {
+    memcpy( masked->dl_dst, ofp_match->dl_dst, sizeof( masked->dl_dst ) );
+  }
+  if ( !( wildcards & OFPFW_DL_VLAN ) ) {
+    masked->dl_vlan = ofp_match->dl_vlan;
+  }
+  if ( !( wildcards & OFPFW_DL_VLAN_PCP ) ) {
+    masked->dl_vlan_pcp = ofp_match->dl_vlan_pcp;
+  }
+  if ( !( wildcards & OFPFW_DL_TYPE ) ) {
+    masked->dl_type = ofp_match->dl_type;
+  }
+  if ( !( wildcards & OFPFW_NW_TOS ) ) {
+    masked->nw_tos = ofp_match->nw_tos;
+  }
+  if ( !( wildcards & OFPFW_NW_PROTO ) ) {
+    masked->nw_proto = ofp_match->nw_proto;
+  }
+  masked->nw_src = ofp_match->nw_src & create_nw_src_mask( wildcards );
+  masked->nw_dst = ofp_match->nw_dst & create_nw_dst_mask( wildcards );
+  if ( !( wildcards & OFPFW_TP_SRC ) ) {
+    masked->tp_src = ofp_match->tp_src;
+  }
+  if ( !( wildcards & OFPFW_TP_DST ) ) {
+    masked->tp_dst = ofp_match->tp_dst;
+  }
+}
+
+
+static ranked_tuple *
+lookup_match_tuple( match_table *table, uint32_t wildcards ) {
+  tuple_set *set = table->wildcard_table;
+  if ( set == NULL ) {
+    return NULL;
+  }
+  for ( unsigned int i = 0; i < set->length; i++ ) {
+    if ( set->tuple[ i ].tuple->wildcards == wildcards ) {
+      return &set->tuple[ i ];
+    }
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Publishes a new set of tuples, where a tuple is added, removed, or
+ * moved to the place of its new max_priority.
+ * @param table Pointer to match table updated
+ * @param tuple Pointer to the tuple to put in place
+ * @param max_priority Highest priority of the entries in the tuple
+ * @param remove Whether the tuple is removed instead
+ * @return tuple_set* Pointer to the set replaced, to be freed after wait_for_readers()
+ */
+static tuple_set *
+replace_tuple_set( match_table *table, match_tuple *tuple, uint16_t max_priority, bool remove ) {
+  tuple_set *old_set = table->wildcard_table;
+  unsigned int old_length = old_set != NULL ? old_set->length : 0;
+
+  tuple_set *new_set = xmalloc( sizeof( tuple_set ) + sizeof( ranked_tuple ) * ( old_length + 1 ) );
+  new_set->length = 0;
+  bool placed = remove;
+  for ( unsigned int i = 0; i < old_length; i++ ) {
+    if ( old_set->tuple[ i ].tuple == tuple ) {
+      continue;
+    }
+    if ( !placed && old_set->tuple[ i ].max_priority < max_priority ) {
+      new_set->tuple[ new_set->length ].tuple = tuple;
+      new_set->tuple[ new_set->length++ ].max_priority = max_priority;
+      placed = true;
+    }
+    new_set->tuple[ new_set->length++ ] = old_set->tuple[ i ];
+  }
+  if ( !placed ) {
+    new_set->tuple[ new_set->length ].tuple = tuple;
+    new_set->tuple[ new_set->length++ ].max_priority = max_priority;
+  }
+  if ( new_set->length == 0 ) {
+    xfree( new_set );
+    new_set = NULL;
+  }
+
+  __atomic_store_n( &table->wildcard_table, new_set, __ATOMIC_RELEASE );
+
+  return old_set;
+}
+
+
+static void
+max_priority_walker( void *key, void *value, void *user_data ) {
+  match_group *group = value;
+  uint16_t *max_priority = user_data;
+
+  UNUSED( key );
+
+  if ( group->entries->public.priority > *max_priority ) {
+    *max_priority = group->entries->public.priority;
+  }
+}
+
+
+static match_entry *
+insert_wildcard_match_entry( match_table *table, struct ofp_match *ofp_match, uint16_t priority ) {
+  uint32_t wildcards = ofp_match->wildcards & OFPFW_ALL;
+  ranked_tuple *ranked = lookup_match_tuple( table, wildcards );
+  match_tuple *tuple;
+  if ( ranked == NULL ) {
+    tuple = xmalloc( sizeof( match_tuple ) );
+    tuple->wildcards = wildcards;
+    tuple->groups = create_hash_with_concurrency( compare_match_entry, hash_match_entry, 0, HASH_TABLE_CONCURRENT );
+  }
+  else {
+    tuple = ranked->tuple;
+  }
+
+  struct ofp_match masked_match;
+  mask_match( &masked_match, ofp_match, wildcards );
+  match_group *group = lookup_hash_entry( tuple->groups, &masked_match );
+  if ( group == NULL ) {
+    group = xmalloc( sizeof( match_group ) );
+    group->masked_match = masked_match;
+    group->entries = NULL;
+    insert_hash_entry( tuple->groups, &group->masked_match, group );
+  }
+
+  private_match_entry **link;
+  for ( link = &group->entries; *link != NULL; link = &( *link )->next ) {
+    if ( ( *link )->public.priority == priority ) {
+      return &( *link )->public;
+    }
+    if ( ( *link )->public.priority < priority ) {
+      break;
+    }
+  }
+  private_match_entry *entry = ( private_match_entry * ) allocate_match_entry( table, ofp_match, priority );
+  entry->next = *link;
+  __atomic_store_n( link, entry, __ATOMIC_RELEASE );
+
+  if ( ranked == NULL || ranked->max_priority < priority ) {
+    tuple_set *old_set = replace_tuple_set( table, tuple, priority, false );
+    if ( old_set != NULL ) {
+      wait_for_readers( table );
+      xfree( old_set );
+    }
+  }
+
+  return &entry->public;
+}
+
+
+static void
+delete_wildcard_match_entry( match_table *table, struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+  ranked_tuple *ranked = lookup_match_tuple( table, ofp_match->wildcards & OFPFW_ALL );
+  if ( ranked == NULL ) {
+    return;
+  }
+  match_tuple *tuple = ranked->tuple;
+
+  struct ofp_match masked_match;
+  mask_match( &masked_match, ofp_match, tuple->wildcards );
+  match_group *group = lookup_hash_entry( tuple->groups, &masked_match );
+  if ( group == NULL ) {
+    return;
+  }
+
+  private_match_entry **link;
+  for ( link = &group->entries; *link != NULL; link = &( *link )->next ) {
+    if ( ( *link )->public.priority == priority ) {
+      break;
+    }
+  }
+  private_match_entry *entry = *link;
+  if ( entry == NULL ) {
+    return;
+  }
+
+  delete_service_name( &entry->public, service_name );
+  if ( services_name_length_of( &entry->public ) > 0 ) {
+    return;
+  }
+
+  __atomic_store_n( link, entry->next, __ATOMIC_RELEASE );
+  bool group_deleted = false;
+  if ( group->entries == NULL ) {
+    delete_hash_entry( tuple->groups, &group->masked_match );
+    group_deleted = true;
+  }
+
+  bool tuple_deleted = false;
+  tuple_set *old_set = NULL;
+  if ( tuple->groups->length == 0 ) {
+    old_set = replace_tuple_set( table, tuple, 0, true );
+    tuple_deleted = true;
+  }
+  else if ( priority == ranked->max_priority ) {
+    uint16_t max_priority = 0;
+    foreach_hash( tuple->groups, max_priority_walker, &max_priority );
+    if ( max_priority != ranked->max_priority ) {
+      old_set = replace_tuple_set( table, tuple, max_priority, false );
+    }
+  }
+
+  invalidate_microflow_cache( table );
+  wait_for_readers( table );
+  free_match_entry( &entry->public );
+  if ( group_deleted ) {
+    xfree( group );
+  }
+  if ( tuple_deleted ) {
+    free_match_tuple( tuple );
+  }
+  if ( old_set != NULL ) {
+    xfree( old_set );
+  }
+}
+
+
+static match_entry *
+lookup_wildcard_match_entry( match_table *table, struct ofp_match *ofp_match ) {
+  tuple_set *set = __atomic_load_n( &table->wildcard_table, __ATOMIC_ACQUIRE );
+  if ( set == NULL ) {
+    return NULL;
+  }
+
+  // Tuples are visited in descending order of max_priority, so that
+  // the search stops at the first tuple that cannot beat the entry
+  // found so far. Ties go to the entry inserted first.
+  private_match_entry *found = NULL;
+  for ( unsigned int i = 0; i < set->length; i++ ) {
+    if ( found != NULL && set->tuple[ i ].max_priority < found->public.priority ) {
+      break;
+    }
+    match_tuple *tuple = set->tuple[ i ].tuple;
+    struct ofp_match masked_match;
+    mask_match( &masked_match, ofp_match, tuple->wildcards );
+    match_group *group = lookup_hash_entry( tuple->groups, &masked_match );
+    if ( group == NULL ) {
+      continue;
+    }
+    private_match_entry *candidate = __atomic_load_n( &group->entries, __ATOMIC_ACQUIRE );
+    if ( candidate == NULL ) {
+      continue;
+    }
+    if ( found == NULL
+         || candidate->public.priority > found->public.priority
+         || ( candidate->public.priority == found->public.priority && candidate->sequence < found->sequence ) ) {
+      found = candidate;
+    }
+  }
+
+  return found != NULL ? &found->public : NULL;
+}
+
+
+static bool
+lookup_microflow_cache( microflow_set *set, struct ofp_match *ofp_match, uint64_t generation, match_entry **entry ) {
+  for ( unsigned int i = 0; i < MICROFLOW_CACHE_WAYS; i++ ) {
+    microflow_slot *slot = &set->way[ i ];
+    unsigned int sequence = __atomic_load_n( &slot->sequence, __ATOMIC_ACQUIRE );
+    if ( ( sequence & 1 ) != 0 || slot->generation != generation ) {
+      continue;
+    }
+    struct ofp_match cached_match = slot->ofp_match;
+    match_entry *cached_entry = slot->entry;
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if ( __atomic_load_n( &slot->sequence, __ATOMIC_RELAXED ) != sequence ) {
+      continue;
+    }
+    if ( compare_match_entry( &cached_match, ofp_match ) ) {
+      if ( __atomic_load_n( &slot->referenced, __ATOMIC_RELAXED ) == 0 ) {
+        __atomic_store_n( &slot->referenced, 1, __ATOMIC_RELAXED );
+      }
+      *entry = cached_entry;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static void
+insert_microflow_cache( microflow_set *set, struct ofp_match *ofp_match, match_entry *entry, uint64_t generation ) {
+  // Stale slots go first, then the clock picks a slot not hit lately.
+  microflow_slot *victim = NULL;
+  for ( unsigned int i = 0; i < MICROFLOW_CACHE_WAYS && victim == NULL; i++ ) {
+    if ( set->way[ i ].generation != generation ) {
+      victim = &set->way[ i ];
+    }
+  }
+  unsigned int hand = __atomic_load_n( &set->hand, __ATOMIC_RELAXED );
+  for ( unsigned int i = 0; i < MICROFLOW_CACHE_WAYS * 2 && victim == NULL; i++ ) {
+    microflow_slot *slot = &set->way[ hand++ % MICROFLOW_CACHE_WAYS ];
+    if ( __atomic_load_n( &slot->referenced, __ATOMIC_RELAXED ) == 0 ) {
+      victim = slot;
+    }
+    else {
+      __atomic_store_n( &slot->referenced, 0, __ATOMIC_RELAXED );
+    }
+  }
+  __atomic_store_n( &set->hand, hand, __ATOMIC_RELAXED );
+  if ( victim == NULL ) {
+    victim = &set->way[ hand % MICROFLOW_CACHE_WAYS ];
+  }
+
+  // Another lookup rewriting the same slot wins; this result is dropped.
+  unsigned int sequence = __atomic_load_n( &victim->sequence, __ATOMIC_RELAXED );
+  if ( ( sequence & 1 ) != 0
+       || !__atomic_compare_exchange_n( &victim->sequence, &sequence, sequence + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ) {
+    return;
+  }
+  victim->ofp_match = *ofp_match;
+  victim->entry = entry;
+  victim->generation = generation;
+  victim->referenced = 0;
+  __atomic_store_n( &victim->sequence, sequence + 2, __ATOMIC_RELEASE );
+}
+
+
+static void
+count_microflow_lookup( microflow_cache *cache, bool hit ) {
+  unsigned int *counter = hit ? &cache->unreported_hits : &cache->unreported_misses;
+  if ( __atomic_add_fetch( counter, 1, __ATOMIC_RELAXED ) < MICROFLOW_CACHE_STAT_INTERVAL ) {
+    return;
+  }
+  unsigned int count = __atomic_exchange_n( counter, 0, __ATOMIC_RELAXED );
+  if ( count > 0 ) {
+    increment_stat_by( hit ? MICROFLOW_CACHE_HITS_KEY : MICROFLOW_CACHE_MISSES_KEY, count );
+  }
+}
+
+
+static void
+disable_cache( match_table *table ) {
+  microflow_cache *cache = table->cache;
+  if ( cache == NULL ) {
+    return;
+  }
+  __atomic_store_n( &table->cache, NULL, __ATOMIC_RELEASE );
+  wait_for_readers( table );
+  // Report lookups counted since the last batch.
+  if ( cache->unreported_hits > 0 ) {
+    increment_stat_by( MICROFLOW_CACHE_HITS_KEY, cache->unreported_hits );
+  }
+  if ( cache->unreported_misses > 0 ) {
+    increment_stat_by( MICROFLOW_CACHE_MISSES_KEY, cache->unreported_misses );
+  }
+  xfree( cache );
+}
+
+
+static void
+init_table( match_table *table ) {
+  table->exact_table = create_hash_with_concurrency( compare_match_entry, hash_match_entry, 0, HASH_TABLE_CONCURRENT );
+  table->wildcard_table = NULL;
+  table->next_sequence = 0;
+  table->epoch = 0;
+  table->readers[ 0 ] = 0;
+  table->readers[ 1 ] = 0;
+  table->cache = NULL;
+  table->generation = 0;
 
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  match_table_head.mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( match_table_head.mutex, &attr );
+  table->mutex = xmalloc( sizeof( pthread_mutex_t ) );
+  pthread_mutex_init( table->mutex, &attr );
+}
+
+
+static void
+finalize_table( match_table *table ) {
+  pthread_mutex_lock( table->mutex );
+
+  disable_cache( table );
+
+  foreach_hash( table->exact_table, free_match_table_walker, NULL );
+  delete_hash( table->exact_table );
+  table->exact_table = NULL;
+
+  tuple_set *set = table->wildcard_table;
+  if ( set != NULL ) {
+    for ( unsigned int i = 0; i < set->length; i++ ) {
+      free_match_tuple( set->tuple[ i ].tuple );
+    }
+    xfree( set );
+  }
+  table->wildcard_table = NULL;
+
+  pthread_mutex_unlock( table->mutex );
+  pthread_mutex_destroy( table->mutex );
+  xfree( table->mutex );
+  table->mutex = NULL;
 }
 
 
 /**
- * Finalizes match table (of type match_table) i.e, it frees all the memory
- * allocated to the associated match_table_head structure (of type match_table).
+ * Creates a match table. Lookups in the table take no lock and never
+ * wait for updates, which may be made from other threads.
  * @param None
- * @return None
+ * @return match_table* Pointer to newly created match table
  */
-void
-finalize_match_table( void ) {
-  list_element *list;
-
-  pthread_mutex_lock( match_table_head.mutex );
+match_table *
+create_match_table( void ) {
+  match_table *table = xmalloc( sizeof( match_table ) );
+  init_table( table );
+  return table;
+}
 
-  foreach_hash( match_table_head.exact_table, free_match_table_walker, NULL );
-  delete_hash( match_table_head.exact_table );
-  match_table_head.exact_table = NULL;
 
-  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
-    free_match_entry( list->data );
-  }
-  delete_list( match_table_head.wildcard_table );
-  match_table_head.wildcard_table = NULL;
+/**
+ * Deletes a match table and all the entries in it. No lookup may be in
+ * progress.
+ * @param table Pointer to match table to delete
+ * @return None
+ */
+void
+delete_match_table( match_table *table ) {
+  assert( table != NULL );
 
-  pthread_mutex_unlock( match_table_head.mutex );
-  pthread_mutex_destroy( match_table_head.mutex );
-  xfree( match_table_head.mutex );
-  match_table_head.mutex = NULL;
+  finalize_table( table );
+  xfree( table );
 }
 
 
 /**
- * Inserts a new match entry (of type match_entry) in a flow table.
+ * Inserts a new match entry (of type match_entry) in a match table.
+ * @param table Pointer to match table
  * @param ofp_match Pointer to structure containing fields to match against flows
  * @param priority Priority order
  * @param service_name Pointer to application service name of messenger
- * @param entry_name Pointer to name of match entry
  * @return None
  */
 void
-insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+insert_match_entry_in( match_table *table, struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+  assert( table != NULL );
   assert( ofp_match != NULL );
   assert( service_name != NULL );
 
-
-  pthread_mutex_lock( match_table_head.mutex );
+  pthread_mutex_lock( table->mutex );
   match_entry *entry = NULL;
   if ( !ofp_match->wildcards ) {
-    entry = lookup_hash_entry( match_table_head.exact_table, ofp_match );
+    entry = lookup_hash_entry( table->exact_table, ofp_match );
     if ( entry == NULL ) {
-      entry = allocate_match_entry( ofp_match, 0 );
-      insert_hash_entry( match_table_head.exact_table, &entry->ofp_match, entry );
+      entry = allocate_match_entry( table, ofp_match, 0 );
+      insert_hash_entry( table->exact_table, &entry->ofp_match, entry );
     }
   }
   else {
     // wildcard flags are set
-    list_element *element;
-    for ( element = match_table_head.wildcard_table; element != NULL; element = element->next ) {
-      entry = element->data;
-      if ( entry->priority == priority
-           && ( ( entry->ofp_match.wildcards ^ ofp_match->wildcards ) & OFPFW_ALL ) == 0
-           && compare_match( &entry->ofp_match, ofp_match ) ) {
-        break;
-      }
-      if ( entry->priority < priority ) {
-        entry = NULL;
-        break;
-      }
-    }
-    if ( entry == NULL || element == NULL ) {
-      entry = allocate_match_entry( ofp_match, priority );
-      if ( element == NULL ) {
-        // tail
-        append_to_tail( &match_table_head.wildcard_table, entry );
-      }
-      else if ( element == match_table_head.wildcard_table ) {
-        // head
-        insert_in_front( &match_table_head.wildcard_table, entry );
-      }
-      else {
-        // insert brefore
-        insert_before( &match_table_head.wildcard_table, element->data, entry );
-      }
-    }
+    entry = insert_wildcard_match_entry( table, ofp_match, priority );
   }
   add_service_name( entry, service_name );
-  pthread_mutex_unlock( match_table_head.mutex );
+  invalidate_microflow_cache( table );
+  pthread_mutex_unlock( table->mutex );
 }
 
 
 /**
- * Deletes a match entry referred by the ofp_match in the flow table.
+ * Deletes a service name from a match entry in a match table, and the
+ * entry itself once no service name is left.
+ * @param table Pointer to match table
  * @param ofp_match Pointer to structure containing fields to match against flows
+ * @param priority Priority order
+ * @param service_name Pointer to application service name of messenger
  * @return None
  */
 void
-delete_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+delete_match_entry_in( match_table *table, struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+  assert( table != NULL );
   assert( ofp_match != NULL );
   assert( service_name != NULL );
 
-  pthread_mutex_lock( match_table_head.mutex );
-  match_entry *entry = NULL;
+  pthread_mutex_lock( table->mutex );
   if ( !ofp_match->wildcards ) {
-    entry = lookup_hash_entry( match_table_head.exact_table, ofp_match );
-    if ( entry == NULL ) {
-      pthread_mutex_unlock( match_table_head.mutex );
-      return;
+    match_entry *entry = lookup_hash_entry( table->exact_table, ofp_match );
+    if ( entry != NULL ) {
+      delete_service_name( entry, service_name );
+      if ( services_name_length_of( entry ) == 0 ) {
+        delete_hash_entry( table->exact_table, ofp_match );
+        invalidate_microflow_cache( table );
+        wait_for_readers( table );
+        free_match_entry( entry );
+      }
     }
   }
   else {
     // wildcard flags are set
-    list_element *element;
-    for ( element = match_table_head.wildcard_table; element != NULL; element = element->next ) {
-      entry = element->data;
-      if ( entry->priority == priority 
-           && ( ( entry->ofp_match.wildcards ^ ofp_match->wildcards ) & OFPFW_ALL ) == 0
-           && compare_match( &entry->ofp_match, ofp_match ) ) {
-        break;
-      }
-    }
-    if ( element == NULL ) {
-      pthread_mutex_unlock( match_table_head.mutex );
-      return;
-    }
+    delete_wildcard_match_entry( table, ofp_match, priority, service_name );
   }
-  delete_service_name( entry, service_name );
-  if ( services_name_length_of( entry ) == 0 ) {
-    if ( !ofp_match->wildcards ) {
-      delete_hash_entry( match_table_head.exact_table, ofp_match );
-    }
-    else {
-      delete_element( &match_table_head.wildcard_table, entry );
-    }
-    free_match_entry( entry );
-  }
-  pthread_mutex_unlock( match_table_head.mutex );
-  return;
+  pthread_mutex_unlock( table->mutex );
 }
 
 
 /**
  * Performs lookup for a value associated with match entry (of type match_entry)
- * in flow table.
+ * in a match table, without taking any lock.
+ * @param table Pointer to match table
  * @param ofp_match Pointer to structure containing fields to match against flows
- * @return match_entry* Pointer to found match entry else NULL
+ * @return match_entry* Pointer to found match entry else NULL. The entry stays valid until it is deleted.
  */
 match_entry *
-lookup_match_entry( struct ofp_match *ofp_match ) {
-  match_entry *entry;
-  list_element *list;
+lookup_match_entry_in( match_table *table, struct ofp_match *ofp_match ) {
+  assert( table != NULL );
+  assert( ofp_match != NULL );
 
-  pthread_mutex_lock( match_table_head.mutex );
+  unsigned int epoch = enter_match_table( table );
 
-  entry = lookup_hash_entry( match_table_head.exact_table, ofp_match );
-  if ( entry != NULL ) {
-    pthread_mutex_unlock( match_table_head.mutex );
-    return entry;
+  match_entry *entry = NULL;
+  microflow_cache *cache = __atomic_load_n( &table->cache, __ATOMIC_ACQUIRE );
+  microflow_set *set = NULL;
+  uint64_t generation = 0;
+  if ( cache != NULL ) {
+    // The generation is read first, so that a result computed while an
+    // update is in progress is cached as already stale.
+    generation = __atomic_load_n( &table->generation, __ATOMIC_ACQUIRE );
+    set = &cache->set[ hash_match_entry( ofp_match ) & ( cache->number_of_sets - 1 ) ];
+    if ( lookup_microflow_cache( set, ofp_match, generation, &entry ) ) {
+      count_microflow_lookup( cache, true );
+      leave_match_table( table, epoch );
+      return entry;
+    }
   }
 
-  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
-    entry = list->data;
-    if ( compare_match( &entry->ofp_match, ofp_match ) ) {
-      pthread_mutex_unlock( match_table_head.mutex );
-      return entry;
+  entry = lookup_hash_entry( table->exact_table, ofp_match );
+  if ( entry == NULL ) {
+    entry = lookup_wildcard_match_entry( table, ofp_match );
+  }
+
+  if ( cache != NULL ) {
+    insert_microflow_cache( set, ofp_match, entry, generation );
+    count_microflow_lookup( cache, false );
+  }
+
+  leave_match_table( table, epoch );
+
+  return entry;
+}
+
+
+/**
+ * Puts a cache of exact matches in front of classification, or resizes
+ * it. Lookups of a match that hits the cache skip classification. Hits
+ * and misses are added to the "match_table.microflow_cache_hits" and
+ * "match_table.microflow_cache_misses" statistics in batches.
+ * @param table Pointer to match table
+ * @param entries Number of matches the cache holds at most
+ * @return None
+ */
+void
+enable_microflow_cache_in( match_table *table, unsigned int entries ) {
+  assert( table != NULL );
+  assert( entries > 0 );
+
+  unsigned int number_of_sets = 1;
+  while ( number_of_sets * MICROFLOW_CACHE_WAYS < entries ) {
+    number_of_sets <<= 1;
+  }
+  microflow_cache *cache = xcalloc( 1, sizeof( microflow_cache ) + sizeof( microflow_set ) * number_of_sets );
+  cache->number_of_sets = number_of_sets;
+  for ( unsigned int i = 0; i < number_of_sets; i++ ) {
+    for ( unsigned int j = 0; j < MICROFLOW_CACHE_WAYS; j++ ) {
+      // Never current, since the generation starts at zero and grows.
+      cache->set[ i ].way[ j ].generation = UINT64_MAX;
     }
   }
 
-  pthread_mutex_unlock( match_table_head.mutex );
+  pthread_mutex_lock( table->mutex );
+  disable_cache( table );
+  __atomic_store_n( &table->cache, cache, __ATOMIC_RELEASE );
+  pthread_mutex_unlock( table->mutex );
+}
+
 
-  return NULL;
+/**
+ * Removes the cache of exact matches, if any.
+ * @param table Pointer to match table
+ * @return None
+ */
+void
+disable_microflow_cache_in( match_table *table ) {
+  assert( table != NULL );
+
+  pthread_mutex_lock( table->mutex );
+  disable_cache( table );
+  pthread_mutex_unlock( table->mutex );
+}
+
+
+/**
+ * Initializes match_table_head (of type match_table), the match table
+ * used by the functions below that take no table.
+ * @param None
+ * @return None
+ */
+void
+init_match_table( void ) {
+  init_table( &match_table_head );
+}
+
+
+/**
+ * Finalizes match table (of type match_table) i.e, it frees all the memory
+ * allocated to the associated match_table_head structure (of type match_table).
+ * @param None
+ * @return None
+ */
+void
+finalize_match_table( void ) {
+  finalize_table( &match_table_head );
+}
+
+
+void
+insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+  insert_match_entry_in( &match_table_head, ofp_match, priority, service_name );
+}
+
+
+void
+delete_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name ) {
+  delete_match_entry_in( &match_table_head, ofp_match, priority, service_name );
+}
+
+
+match_entry *
+lookup_match_entry( struct ofp_match *ofp_match ) {
+  return lookup_match_entry_in( &match_table_head, ofp_match );
+}
+
+
+void
+enable_microflow_cache( unsigned int entries ) {
+  enable_microflow_cache_in( &match_table_head, entries );
+}
+
+
+void
+disable_microflow_cache( void ) {
+  disable_microflow_cache_in( &match_table_head );
 }
 
 
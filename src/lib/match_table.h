@@ -40,6 +40,13 @@
  * ...
  * // Finalize match table
  * finalize_match_table();
+ *
+ * // Tables other than the one above are created and passed explicitly
+ * match_table *table = create_match_table();
+ * insert_match_entry_in( table, &ofp_match, priority, service_name );
+ * match_entry *match_entry = lookup_match_entry_in( table, &ofp_match );
+ * delete_match_entry_in( table, &ofp_match, priority, service_name );
+ * delete_match_table( table );
  * @endcode
  */
 
@@ -62,12 +69,30 @@ typedef struct match_entry {
 } match_entry;
 
 
+/**
+ * Classifier of match entries. Lookups take no lock, and updates are
+ * published atomically.
+ */
+typedef struct match_table match_table;
+
+
 void init_match_table( void );
 void finalize_match_table( void );
 void insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name );
 void delete_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name );
 match_entry *lookup_match_entry( struct ofp_match *match );
 
+match_table *create_match_table( void );
+void delete_match_table( match_table *table );
+void insert_match_entry_in( match_table *table, struct ofp_match *ofp_match, uint16_t priority, const char *service_name );
+void delete_match_entry_in( match_table *table, struct ofp_match *ofp_match, uint16_t priority, const char *service_name );
+match_entry *lookup_match_entry_in( match_table *table, struct ofp_match *match );
+
+void enable_microflow_cache( unsigned int entries );
+void disable_microflow_cache( void );
+void enable_microflow_cache_in( match_table *table, unsigned int entries );
+void disable_microflow_cache_in( match_table *table );
+
 
 #endif // MATCH_TABLE_H
 
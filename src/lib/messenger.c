@@ -23,16 +23,20 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include "doubly_linked_list.h"
+#include "event_handler.h"
 #include "hash_table.h"
 #include "log.h"
 #include "messenger.h"
+#include "shm_ring.h"
 #include "timer.h"
 #include "wrapper.h"
 
@@ -72,12 +76,6 @@ extern int mock_close( int fd );
 #define connect mock_connect
 extern int mock_connect( int sockfd, const struct sockaddr *addr, socklen_t addrlen );
 
-#ifdef select
-#undef select
-#endif
-#define select mock_select
-extern int mock_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout );
-
 #ifdef accept
 #undef accept
 #endif
@@ -90,11 +88,17 @@ extern int mock_accept( int sockfd, struct sockaddr *addr, socklen_t *addrlen );
 #define recv mock_recv
 extern ssize_t mock_recv( int sockfd, void *buf, size_t len, int flags );
 
-#ifdef send
-#undef send
+#ifdef recvmsg
+#undef recvmsg
+#endif
+#define recvmsg mock_recvmsg
+extern ssize_t mock_recvmsg( int sockfd, struct msghdr *msg, int flags );
+
+#ifdef sendmsg
+#undef sendmsg
 #endif
-#define send mock_send
-extern ssize_t mock_send( int sockfd, const void *buf, size_t len, int flags );
+#define sendmsg mock_sendmsg
+extern ssize_t mock_sendmsg( int sockfd, const struct msghdr *msg, int flags );
 
 #ifdef setsockopt
 #undef setsockopt
@@ -138,6 +142,12 @@ extern bool mock_add_periodic_event_callback( const time_t seconds, void ( *call
 #define execute_timer_events mock_execute_timer_events
 extern void mock_execute_timer_events( void );
 
+#ifdef get_next_timer_event_timeout
+#undef get_next_timer_event_timeout
+#endif
+#define get_next_timer_event_timeout mock_get_next_timer_event_timeout
+extern bool mock_get_next_timer_event_timeout( struct timespec *timeout );
+
 #endif // UNIT_TESTING
 
 
@@ -145,6 +155,19 @@ enum {
   MESSAGE_TYPE_NOTIFY,
   MESSAGE_TYPE_REQUEST,
   MESSAGE_TYPE_REPLY,
+  // Control messages of the shared memory transport. They are handled
+  // by messenger itself and never passed to callbacks.
+  MESSAGE_TYPE_SHM_SETUP,
+  MESSAGE_TYPE_SHM_ACK,
+  MESSAGE_TYPE_SHM_WAKEUP,
+  // Type of batch received callbacks. Never sent on the wire.
+  MESSAGE_TYPE_NOTIFY_BATCH = 0xff,
+};
+
+enum {
+  SHM_STATE_NONE,
+  SHM_STATE_PENDING,
+  SHM_STATE_ACTIVE,
 };
 
 /**
@@ -173,6 +196,8 @@ typedef struct message_buffer {
  */
 typedef struct messenger_socket {
   int fd;
+  struct receive_queue *rq;
+  shm_ring *ring;
 } messenger_socket;
 
 /**
@@ -180,7 +205,10 @@ typedef struct messenger_socket {
  */
 typedef struct messenger_context {
   uint32_t transaction_id;
-  int life_count;
+  uint16_t tag;
+  struct timespec deadline;
+  size_t heap_index;
+  callback_request_timeout timeout_callback;
   void *user_data;
 } messenger_context;
 
@@ -202,8 +230,39 @@ typedef struct receive_queue {
   struct sockaddr_un listen_addr;
   dlist_element *client_sockets;
   message_buffer *buffer;
+  bool dispatching;
+  bool paused;
+  messenger_queue_stats stats;
+  int notify_callback_count;
+  int batch_callback_count;
+  messenger_message *batch;
+  size_t batch_count;
+  size_t batch_size;
 } receive_queue;
 
+/**
+ * Chunk of a send queue. Messages never span chunks, so that each
+ * chunk can be handed to the kernel as it is.
+ */
+typedef struct send_queue_chunk {
+  struct send_queue_chunk *next;
+  size_t size;
+  size_t head;
+  size_t tail;
+  char data[ 0 ];
+} send_queue_chunk;
+
+/**
+ * Priority lane of a send queue. Messages of a lane are sent in order,
+ * and lanes of higher priority are drained first.
+ */
+typedef struct send_queue_lane {
+  send_queue_chunk *head_chunk;
+  send_queue_chunk *tail_chunk;
+  size_t data_length;
+  messenger_lane_stats stats;
+} send_queue_lane;
+
 /**
  * Send Queue description
  */
@@ -213,14 +272,50 @@ typedef struct send_queue {
   int refused_count;
   struct timespec reconnect_at;
   struct sockaddr_un server_addr;
-  message_buffer *buffer;
+  send_queue_lane lanes[ MESSENGER_PRIORITY_LANES ];
+  send_queue_chunk *free_chunks;
+  int free_chunk_count;
+  size_t data_length;
+  dlist_element *reconnect_element;
+  messenger_queue_stats stats;
+  int transport;
+  int shm_state;
+  shm_ring *ring;
+  dlist_element *publish_element;
+  dlist_element *hold_element;
+  messenger_queue_limits limits;
+  bool congested;
 } send_queue;
 
+/**
+ * Send handle. The send queue is looked up by name once and cached
+ * until any send queue is deleted.
+ */
+struct messenger_send_handle {
+  char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+  send_queue *sq;
+  uint32_t generation;
+};
+
+/**
+ * Callback description for send queue pressure
+ */
+typedef struct send_queue_pressure_callback {
+  callback_send_queue_pressure function;
+  void *user_data;
+} send_queue_pressure_callback;
+
 
+// Maximum length of a packet on messenger sockets. Receivers always
+// provide this much space to recv(), and senders never coalesce more.
 #define MESSENGER_RECV_BUFFER 100000
-static const uint32_t messenger_send_queue_length = 100000;
+#define MESSENGER_SEND_CHUNK_SIZE 16384
+#define MESSENGER_SEND_IOV_MAX 64
+#define MESSENGER_SEND_FREE_CHUNKS 8
+#define MESSENGER_SHM_RING_SIZE 1048576
+#define MESSENGER_SHM_PRESSURE_POLL_MSEC 1
 static const uint32_t messenger_recv_queue_length = 200000;
-static const uint32_t messenger_recv_queue_reserved = 2000;
+static const int messenger_max_timeout_msec = 1000;
 
 char socket_directory[ PATH_MAX ];
 static bool running = false;
@@ -229,14 +324,163 @@ static bool finalized = false;
 static hash_table *receive_queues = NULL;
 static hash_table *send_queues = NULL;
 static hash_table *context_db = NULL;
+static dlist_element *reconnecting_send_queues = NULL;
+static dlist_element *publishing_send_queues = NULL;
+static dlist_element *holding_send_queues = NULL;
+static dlist_element *send_queue_pressure_callbacks = NULL;
+static int congested_shm_send_queues = 0;
+static uint32_t send_queue_generation = 0;
+static messenger_context **context_heap = NULL;
+static size_t context_heap_count = 0;
+static size_t context_heap_size = 0;
+static struct timespec default_request_timeout = { 100, 0 };
+static messenger_queue_limits default_send_queue_limits = { 100000, 75000, 25000 };
+static uint8_t tag_priorities[ UINT16_MAX + 1 ];
 static char *_dump_service_name = NULL;
 static char *_dump_app_name = NULL;
 static void ( *external_fd_set )( fd_set *read_set, fd_set *write_set ) = NULL;
 static void ( *external_check_fd_isset )( fd_set *read_set, fd_set *write_set ) = NULL;
+static fd_set external_read_set;
+static fd_set external_write_set;
+static fd_set external_ready_read_set;
+static fd_set external_ready_write_set;
 static uint32_t last_transaction_id = 0;
 static void ( *external_callback )( void ) = NULL;
 
 
+static void on_accept( int fd, void *data );
+static void on_recv( int fd, void *data );
+static void on_send( int fd, void *data );
+static void on_send_queue_readable( int fd, void *data );
+static void on_shm_recv( int fd, void *data );
+
+
+/**
+ * Compares the deadlines of two contexts.
+ * @param x Context
+ * @param y Context
+ * @return bool True if x expires before y, else False
+ */
+static bool
+context_expires_before( const messenger_context *x, const messenger_context *y ) {
+  if ( x->deadline.tv_sec != y->deadline.tv_sec ) {
+    return x->deadline.tv_sec < y->deadline.tv_sec;
+  }
+  return x->deadline.tv_nsec < y->deadline.tv_nsec;
+}
+
+
+/**
+ * Places a context at a position of the deadline heap.
+ * @param index Position
+ * @param context Context
+ * @return None
+ */
+static void
+set_context_heap_entry( size_t index, messenger_context *context ) {
+  context_heap[ index ] = context;
+  context->heap_index = index;
+}
+
+
+/**
+ * Moves a context towards the top of the deadline heap until its
+ * parent expires no later than it.
+ * @param index Position of context
+ * @return None
+ */
+static void
+sift_context_up( size_t index ) {
+  messenger_context *context = context_heap[ index ];
+  while ( index > 0 ) {
+    size_t parent = ( index - 1 ) / 2;
+    if ( !context_expires_before( context, context_heap[ parent ] ) ) {
+      break;
+    }
+    set_context_heap_entry( index, context_heap[ parent ] );
+    index = parent;
+  }
+  set_context_heap_entry( index, context );
+}
+
+
+/**
+ * Moves a context towards the bottom of the deadline heap until no
+ * child expires before it.
+ * @param index Position of context
+ * @return None
+ */
+static void
+sift_context_down( size_t index ) {
+  messenger_context *context = context_heap[ index ];
+  while ( true ) {
+    size_t child = index * 2 + 1;
+    if ( child >= context_heap_count ) {
+      break;
+    }
+    if ( child + 1 < context_heap_count && context_expires_before( context_heap[ child + 1 ], context_heap[ child ] ) ) {
+      child++;
+    }
+    if ( !context_expires_before( context_heap[ child ], context ) ) {
+      break;
+    }
+    set_context_heap_entry( index, context_heap[ child ] );
+    index = child;
+  }
+  set_context_heap_entry( index, context );
+}
+
+
+/**
+ * Adds a context to the deadline heap.
+ * @param context Context
+ * @return None
+ */
+static void
+push_context_heap( messenger_context *context ) {
+  assert( context != NULL );
+
+  if ( context_heap_count == context_heap_size ) {
+    size_t size = context_heap_size == 0 ? 64 : context_heap_size * 2;
+    messenger_context **heap = xmalloc( sizeof( messenger_context * ) * size );
+    if ( context_heap != NULL ) {
+      memcpy( heap, context_heap, sizeof( messenger_context * ) * context_heap_count );
+      xfree( context_heap );
+    }
+    context_heap = heap;
+    context_heap_size = size;
+  }
+  set_context_heap_entry( context_heap_count++, context );
+  sift_context_up( context->heap_index );
+}
+
+
+/**
+ * Removes a context from the deadline heap.
+ * @param context Context
+ * @return None
+ */
+static void
+remove_context_heap( messenger_context *context ) {
+  assert( context != NULL );
+  assert( context->heap_index < context_heap_count );
+  assert( context_heap[ context->heap_index ] == context );
+
+  size_t index = context->heap_index;
+  messenger_context *last = context_heap[ --context_heap_count ];
+  if ( last == context ) {
+    return;
+  }
+  set_context_heap_entry( index, last );
+  if ( index > 0 && context_expires_before( last, context_heap[ ( index - 1 ) / 2 ] ) ) {
+    sift_context_up( index );
+  }
+  else {
+    sift_context_down( index );
+  }
+}
+
+
 /**
  * Deletes context from the Message context Hash Table.
  * @param key Transaction ID which is used as key for deletion
@@ -251,9 +495,11 @@ _delete_context( void *key, void *value, void *user_data ) {
   UNUSED( user_data );
   messenger_context *context = value;
 
-  debug( "Deleting a context ( transaction_id = %#x, life_count = %d, user_data = %p ).",
-         context->transaction_id, context->life_count, context->user_data );
+  debug( "Deleting a context ( transaction_id = %#x, deadline = %d.%09d, user_data = %p ).",
+         context->transaction_id, ( int ) context->deadline.tv_sec, ( int ) context->deadline.tv_nsec,
+         context->user_data );
 
+  remove_context_heap( context );
   delete_hash_entry( context_db, &context->transaction_id );
   xfree( context );
 }
@@ -273,37 +519,41 @@ delete_context( messenger_context *context ) {
 
 
 /**
- * Removing contexts from Hash table if they have expired.
- * @param key Transaction ID
- * @param value Messenger context
- * @param user_data User Data
+ * Expires the contexts whose deadline has passed, earliest first, and
+ * calls their timeout callbacks. Only expired contexts are visited.
+ * @param None
  * @return None
  */
 static void
-_age_context( void *key, void *value, void *user_data ) {
-  assert( value != NULL );
-  UNUSED( key );
-  UNUSED( user_data );
-  messenger_context *context = value;
-  context->life_count--;
-  if ( context->life_count <= 0 ) {
-    delete_context( context );
+expire_contexts( void ) {
+  if ( context_heap_count == 0 ) {
+    return;
   }
-}
 
+  struct timespec now;
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    return;
+  }
 
-/**
- * Aging the contexts stored in Context Hash DB.
- * @param user_data User Data
- * @return None
- */
-static void
-age_context_db( void *user_data ) {
-  UNUSED( user_data );
+  while ( context_heap_count > 0 ) {
+    messenger_context *context = context_heap[ 0 ];
+    if ( context->deadline.tv_sec > now.tv_sec
+         || ( context->deadline.tv_sec == now.tv_sec && context->deadline.tv_nsec > now.tv_nsec ) ) {
+      break;
+    }
 
-  debug( "Aging context database ( context_db = %p ).", context_db );
+    debug( "A request is timed out ( transaction_id = %#x, tag = %#x, user_data = %p ).",
+           context->transaction_id, context->tag, context->user_data );
 
-  foreach_hash( context_db, _age_context, NULL );
+    callback_request_timeout callback = context->timeout_callback;
+    uint16_t tag = context->tag;
+    void *user_data = context->user_data;
+    delete_context( context );
+    if ( callback != NULL ) {
+      callback( tag, user_data );
+    }
+  }
 }
 
 
@@ -323,9 +573,23 @@ init_messenger( const char *working_directory ) {
 
   strcpy( socket_directory, working_directory );
 
-  receive_queues = create_hash( compare_string, hash_string );
-  send_queues = create_hash( compare_string, hash_string );
-  context_db = create_hash( compare_uint32, hash_uint32 );
+  if ( !init_event_handler() ) {
+    error( "Failed to initialize event handler." );
+    return false;
+  }
+
+  receive_queues = create_hash_with_concurrency( compare_string, hash_string, 0, HASH_TABLE_UNLOCKED );
+  send_queues = create_hash_with_concurrency( compare_string, hash_string, 0, HASH_TABLE_UNLOCKED );
+  context_db = create_hash_with_concurrency( compare_uint32, hash_uint32, 0, HASH_TABLE_UNLOCKED );
+  reconnecting_send_queues = create_dlist();
+  publishing_send_queues = create_dlist();
+  holding_send_queues = create_dlist();
+  send_queue_pressure_callbacks = create_dlist();
+
+  FD_ZERO( &external_read_set );
+  FD_ZERO( &external_write_set );
+  FD_ZERO( &external_ready_read_set );
+  FD_ZERO( &external_ready_write_set );
 
   initialized = true;
   finalized = false;
@@ -348,6 +612,12 @@ delete_context_db( void ) {
     delete_hash( context_db );
     context_db = NULL;
   }
+  if ( context_heap != NULL ) {
+    xfree( context_heap );
+    context_heap = NULL;
+  }
+  context_heap_count = 0;
+  context_heap_size = 0;
 }
 
 
@@ -376,6 +646,68 @@ get_message_buffer_head( message_buffer *buf ) {
 }
 
 
+/**
+ * Releases all chunks of a send queue.
+ * @param sq Pointer to send queue
+ * @return None
+ */
+static void
+free_send_queue_chunks( send_queue *sq ) {
+  assert( sq != NULL );
+
+  send_queue_chunk *chunk, *next;
+
+  for ( chunk = sq->free_chunks; chunk != NULL; chunk = next ) {
+    next = chunk->next;
+    xfree( chunk );
+  }
+  for ( int i = 0; i < MESSENGER_PRIORITY_LANES; i++ ) {
+    send_queue_lane *lane = &sq->lanes[ i ];
+    for ( chunk = lane->head_chunk; chunk != NULL; chunk = next ) {
+      next = chunk->next;
+      xfree( chunk );
+    }
+    lane->head_chunk = NULL;
+    lane->tail_chunk = NULL;
+    lane->data_length = 0;
+    lane->stats.queued_messages = 0;
+    lane->stats.queued_bytes = 0;
+  }
+  sq->free_chunks = NULL;
+  sq->free_chunk_count = 0;
+  sq->data_length = 0;
+}
+
+
+/**
+ * Releases the shared memory ring of a send queue. Messages which are
+ * still in the ring are lost together with the connection.
+ * @param sq Pointer to send queue
+ * @return None
+ */
+static void
+stop_shm_transport( send_queue *sq ) {
+  assert( sq != NULL );
+
+  if ( sq->ring != NULL ) {
+    delete_shm_ring( sq->ring );
+    sq->ring = NULL;
+  }
+  if ( sq->publish_element != NULL ) {
+    delete_dlist_element( sq->publish_element );
+    sq->publish_element = NULL;
+  }
+  if ( sq->hold_element != NULL ) {
+    delete_dlist_element( sq->hold_element );
+    sq->hold_element = NULL;
+  }
+  if ( sq->congested && sq->shm_state == SHM_STATE_ACTIVE ) {
+    congested_shm_send_queues--;
+  }
+  sq->shm_state = SHM_STATE_NONE;
+}
+
+
 /**
  * Deletes a send queue.
  * @param sq Pointer to send queue
@@ -387,16 +719,24 @@ delete_send_queue( send_queue *sq ) {
 
   debug( "Deleting a send queue ( service_name = %s, fd = %d ).", sq->service_name, sq->server_socket );
 
-  free_message_buffer( sq->buffer );
+  free_send_queue_chunks( sq );
+  stop_shm_transport( sq );
   if ( sq->server_socket != -1 ) {
+    delete_fd_handler( sq->server_socket );
     close( sq->server_socket );
   }
+  if ( sq->reconnect_element != NULL ) {
+    delete_dlist_element( sq->reconnect_element );
+    sq->reconnect_element = NULL;
+  }
   if ( send_queues != NULL ) {
     delete_hash_entry( send_queues, sq->service_name );
   }
   else {
     error( "All send queues are already deleted or not created yet." );
   }
+  // Invalidates the send queues cached in send handles.
+  send_queue_generation++;
   xfree( sq );
 }
 
@@ -524,14 +864,22 @@ delete_receive_queue( void *service_name, void *_rq, void *user_data ) {
 
     debug( "Closing a client socket ( fd = %d ).", client_socket->fd );
 
+    delete_fd_handler( client_socket->fd );
     close( client_socket->fd );
+    if ( client_socket->ring != NULL ) {
+      delete_shm_ring( client_socket->ring );
+    }
     xfree( client_socket );
     send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
   }
   delete_dlist( rq->client_sockets );
 
+  delete_fd_handler( rq->listen_socket );
   close( rq->listen_socket );
   free_message_buffer( rq->buffer );
+  if ( rq->batch != NULL ) {
+    xfree( rq->batch );
+  }
   unlink( rq->listen_addr.sun_path );
 
   if ( receive_queues != NULL ) {
@@ -594,9 +942,31 @@ finalize_messenger() {
   if ( context_db != NULL ) {
     delete_context_db();
   }
+  if ( reconnecting_send_queues != NULL ) {
+    delete_dlist( reconnecting_send_queues );
+    reconnecting_send_queues = NULL;
+  }
+  if ( publishing_send_queues != NULL ) {
+    delete_dlist( publishing_send_queues );
+    publishing_send_queues = NULL;
+  }
+  if ( holding_send_queues != NULL ) {
+    delete_dlist( holding_send_queues );
+    holding_send_queues = NULL;
+  }
+  if ( send_queue_pressure_callbacks != NULL ) {
+    dlist_element *e;
+    for ( e = send_queue_pressure_callbacks->next; e != NULL; e = e->next ) {
+      xfree( e->data );
+    }
+    delete_dlist( send_queue_pressure_callbacks );
+    send_queue_pressure_callbacks = NULL;
+  }
+  congested_shm_send_queues = 0;
 
   set_fd_set_callback( NULL );
   set_check_fd_isset_callback( NULL );
+  finalize_event_handler();
 
   running = false;
   initialized = false;
@@ -625,6 +995,36 @@ create_message_buffer( size_t size ) {
 }
 
 
+/**
+ * Registers a file descriptor owned by messenger to the event handler.
+ * Any stale registration made on behalf of the external fd_set
+ * callbacks for the same (reused) descriptor number is forgotten.
+ * @param fd File descriptor
+ * @param read_callback Callback called when fd is readable
+ * @param write_callback Callback called when fd is writable
+ * @param data User data passed to callbacks
+ * @return None
+ */
+static void
+set_messenger_fd_handler( int fd, event_fd_callback read_callback, event_fd_callback write_callback, void *data ) {
+  assert( fd >= 0 );
+
+  if ( fd < FD_SETSIZE ) {
+    /*
+     * A hacky workaround to avoid the bug of glibc (#431)
+     * See also: http://www.linuxquestions.org/questions/programming-9/impossible-to-use-gcc-with-wconversion-and-standard-socket-macros-841935/
+     */
+#define sizeof( X ) ( ( int ) sizeof( X ) )
+    FD_CLR( fd, &external_read_set );
+    FD_CLR( fd, &external_write_set );
+#undef sizeof
+  }
+
+  set_fd_handler( fd, read_callback, data, write_callback, data );
+  set_readable( fd, true );
+}
+
+
 /**
  * Creates receive queue.
  * @param service_name Name of service
@@ -692,9 +1092,19 @@ create_receive_queue( const char *service_name ) {
   rq->message_callbacks = create_dlist();
   rq->client_sockets = create_dlist();
   rq->buffer = create_message_buffer( messenger_recv_queue_length );
+  rq->dispatching = false;
+  rq->paused = false;
+  memset( &rq->stats, 0, sizeof( messenger_queue_stats ) );
+  rq->notify_callback_count = 0;
+  rq->batch_callback_count = 0;
+  rq->batch = NULL;
+  rq->batch_count = 0;
+  rq->batch_size = 0;
 
   insert_hash_entry( receive_queues, rq->service_name, rq );
 
+  set_messenger_fd_handler( rq->listen_socket, on_accept, NULL, rq );
+
   return rq;
 }
 
@@ -729,6 +1139,12 @@ add_message_callback( const char *service_name, uint8_t message_type, void *call
   cb->message_type = message_type;
   cb->function = callback;
   insert_after_dlist( rq->message_callbacks, cb );
+  if ( message_type == MESSAGE_TYPE_NOTIFY ) {
+    rq->notify_callback_count++;
+  }
+  else if ( message_type == MESSAGE_TYPE_NOTIFY_BATCH ) {
+    rq->batch_callback_count++;
+  }
 
   return true;
 }
@@ -753,6 +1169,26 @@ add_message_received_callback( const char *service_name, const callback_message_
 }
 
 
+/**
+ * Adds callback which receives all messages drained from the queue at
+ * once. It is called after the per-message callbacks of the same messages.
+ * @param service_name Name of service
+ * @param callback Callback function
+ * @return bool True when message is successfully added, else False
+ * @see add_message_callback
+ */
+bool
+add_message_batch_received_callback( const char *service_name, const callback_message_batch_received callback ) {
+  assert( service_name != NULL );
+  assert( callback != NULL );
+
+  debug( "Adding a message batch received callback (service_name = %s, callback = %p).",
+         service_name, callback );
+
+  return add_message_callback( service_name, MESSAGE_TYPE_NOTIFY_BATCH, callback );
+}
+
+
 /**
  * Adds callback for message request event.
  * @param service_name Name of service
@@ -822,6 +1258,12 @@ delete_message_callback( const char *service_name, uint8_t message_type, void (
         debug( "Deleting a callback ( message_type = %#x, callback = %p ).", message_type, callback );
         xfree( cb );
         delete_dlist_element( e );
+        if ( message_type == MESSAGE_TYPE_NOTIFY ) {
+          rq->notify_callback_count--;
+        }
+        else if ( message_type == MESSAGE_TYPE_NOTIFY_BATCH ) {
+          rq->batch_callback_count--;
+        }
         if ( rq->message_callbacks->next == NULL ) {
           debug( "No more callback for message_type = %#x.", message_type );
           delete_receive_queue( rq->service_name, rq, NULL );
@@ -856,6 +1298,25 @@ delete_message_received_callback( const char *service_name, void ( *callback )(
 }
 
 
+/**
+ * Deletes message batch received callback from message callback list.
+ * @param service_name Name of service
+ * @param callback Callback function
+ * @return bool True when message is successfully deleted, else False
+ * @see delete_message_callback
+ */
+bool
+delete_message_batch_received_callback( const char *service_name, const callback_message_batch_received callback ) {
+  assert( service_name != NULL );
+  assert( callback != NULL );
+
+  debug( "Deleting a message batch received callback ( service_name = %s, callback = %p ).",
+         service_name, callback );
+
+  return delete_message_callback( service_name, MESSAGE_TYPE_NOTIFY_BATCH, callback );
+}
+
+
 /**
  * Deletes message request callback from message_callback list.
  * @param service_name Name of service
@@ -936,62 +1397,168 @@ rename_message_received_callback( const char *old_service_name, const char *new_
 
 
 /**
- * Calculates remaining bytes of message buffer.
+ * Calculates contiguous free bytes following the data in message buffer.
  * @param message_buffer Message buffer
- * @return size_t Remaining bytes
+ * @return size_t Free bytes at the tail
  */
 static size_t
-message_buffer_remain_bytes( message_buffer *buf ) {
+message_buffer_tail_bytes( message_buffer *buf ) {
   assert( buf != NULL );
 
-  return buf->size - buf->data_length;
+  return buf->size - buf->head_offset - buf->data_length;
 }
 
 
 /**
- * Connects the Send queue of a service.
- * @param sq Pointer to send queue
- * @return int -1:error, 0:refused (retry), 1:connected
+ * Moves unconsumed data to the beginning of message buffer so that
+ * all free space is available at the tail.
+ * @param message_buffer Message buffer
+ * @return size_t Number of bytes moved
  */
-static int
-send_queue_connect( send_queue *sq ) {
-  assert( sq != NULL );
-
-  if ( ( sq->server_socket = socket( AF_UNIX, SOCK_SEQPACKET, 0 ) ) == -1 ) {
-    error( "Failed to call socket ( errno = %s [%d] ).", strerror( errno ), errno );
-    return -1;
-  }
+static size_t
+compact_message_buffer( message_buffer *buf ) {
+  assert( buf != NULL );
 
-  if ( geteuid() == 0 ) {
-    int wmem_size = 1048576;
-    int ret = setsockopt( sq->server_socket, SOL_SOCKET, SO_SNDBUFFORCE, ( const void * ) &wmem_size, ( socklen_t ) sizeof( wmem_size ) );
-    if ( ret < 0 ) {
-      error( "Failed to set SO_SNDBUFFORCE to %d ( %s [%d] ).", wmem_size, strerror( errno ), errno );
-      close( sq->server_socket );
-      sq->server_socket = -1;
-      return -1;
-    }
+  if ( buf->head_offset == 0 ) {
+    return 0;
   }
-  int ret = fcntl( sq->server_socket, F_SETFL, O_NONBLOCK );
-  if ( ret < 0 ) {
-    error( "Failed to set O_NONBLOCK ( %s [%d] ).", strerror( errno ), errno );
-    close( sq->server_socket );
-    sq->server_socket = -1;
-    return -1;
+  if ( buf->data_length > 0 ) {
+    memmove( buf->buffer, get_message_buffer_head( buf ), buf->data_length );
   }
+  buf->head_offset = 0;
 
-  if ( connect( sq->server_socket, ( struct sockaddr * ) &sq->server_addr, sizeof( struct sockaddr_un ) ) == -1 ) {
-    struct timespec now;
-
-    if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
-      error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
-      close( sq->server_socket );
-      sq->server_socket = -1;
-      return -1;
-    }
+  return buf->data_length;
+}
 
-    debug( "Connection refused ( service_name = %s, sun_path = %s, fd = %d, errno = %s [%d] ).",
-           sq->service_name, sq->server_addr.sun_path, sq->server_socket, strerror( errno ), errno );
+
+/**
+ * Sends a control message of the shared memory transport.
+ * @param fd Socket
+ * @param message_type Type of control message
+ * @param tag Tag
+ * @param passed_fd File descriptor passed to the peer, or -1
+ * @return bool True if the message is sent, else False
+ */
+static bool
+send_control_message( int fd, uint8_t message_type, uint16_t tag, int passed_fd ) {
+  assert( fd >= 0 );
+
+  message_header header;
+  struct iovec iov;
+  struct msghdr msg;
+  union {
+    struct cmsghdr align;
+    char buf[ CMSG_SPACE( sizeof( int ) ) ];
+  } control;
+
+  header.version = 0;
+  header.message_type = message_type;
+  header.tag = tag;
+  header.message_length = sizeof( message_header );
+  iov.iov_base = &header;
+  iov.iov_len = sizeof( message_header );
+
+  memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if ( passed_fd >= 0 ) {
+    memset( &control, 0, sizeof( control ) );
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof( control.buf );
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+    memcpy( CMSG_DATA( cmsg ), &passed_fd, sizeof( int ) );
+  }
+
+  if ( sendmsg( fd, &msg, MSG_DONTWAIT ) != ( ssize_t ) sizeof( message_header ) ) {
+    debug( "Failed to send a control message ( fd = %d, message_type = %#x, errno = %s [%d] ).",
+           fd, message_type, strerror( errno ), errno );
+    return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * Offers a shared memory ring to the service of a send queue. Messages
+ * are held in the send queue until the service answers, and the socket
+ * transport is kept if the ring cannot be set up.
+ * @param sq Pointer to send queue
+ * @return None
+ */
+static void
+start_shm_transport( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->server_socket != -1 );
+  assert( sq->shm_state == SHM_STATE_NONE );
+
+  debug( "Setting up shared memory transport ( service_name = %s ).", sq->service_name );
+
+  sq->ring = create_shm_ring( MESSENGER_SHM_RING_SIZE );
+  if ( sq->ring == NULL ) {
+    warn( "Failed to create a shared memory ring. Using socket transport ( service_name = %s ).", sq->service_name );
+    return;
+  }
+
+  sq->stats.syscalls++;
+  if ( !send_control_message( sq->server_socket, MESSAGE_TYPE_SHM_SETUP, 0, get_shm_ring_fd( sq->ring ) ) ) {
+    warn( "Failed to offer a shared memory ring. Using socket transport ( service_name = %s ).", sq->service_name );
+    stop_shm_transport( sq );
+    return;
+  }
+
+  sq->shm_state = SHM_STATE_PENDING;
+  set_writable( sq->server_socket, false );
+}
+
+
+/**
+ * Connects the Send queue of a service.
+ * @param sq Pointer to send queue
+ * @return int -1:error, 0:refused (retry), 1:connected
+ */
+static int
+send_queue_connect( send_queue *sq ) {
+  assert( sq != NULL );
+
+  if ( ( sq->server_socket = socket( AF_UNIX, SOCK_SEQPACKET, 0 ) ) == -1 ) {
+    error( "Failed to call socket ( errno = %s [%d] ).", strerror( errno ), errno );
+    return -1;
+  }
+
+  if ( geteuid() == 0 ) {
+    int wmem_size = 1048576;
+    int ret = setsockopt( sq->server_socket, SOL_SOCKET, SO_SNDBUFFORCE, ( const void * ) &wmem_size, ( socklen_t ) sizeof( wmem_size ) );
+    if ( ret < 0 ) {
+      error( "Failed to set SO_SNDBUFFORCE to %d ( %s [%d] ).", wmem_size, strerror( errno ), errno );
+      close( sq->server_socket );
+      sq->server_socket = -1;
+      return -1;
+    }
+  }
+  int ret = fcntl( sq->server_socket, F_SETFL, O_NONBLOCK );
+  if ( ret < 0 ) {
+    error( "Failed to set O_NONBLOCK ( %s [%d] ).", strerror( errno ), errno );
+    close( sq->server_socket );
+    sq->server_socket = -1;
+    return -1;
+  }
+
+  if ( connect( sq->server_socket, ( struct sockaddr * ) &sq->server_addr, sizeof( struct sockaddr_un ) ) == -1 ) {
+    struct timespec now;
+
+    if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+      error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+      close( sq->server_socket );
+      sq->server_socket = -1;
+      return -1;
+    }
+
+    debug( "Connection refused ( service_name = %s, sun_path = %s, fd = %d, errno = %s [%d] ).",
+           sq->service_name, sq->server_addr.sun_path, sq->server_socket, strerror( errno ), errno );
 
     send_dump_message( MESSENGER_DUMP_SEND_REFUSED, sq->service_name, NULL, 0 );
     close( sq->server_socket );
@@ -1001,6 +1568,10 @@ send_queue_connect( send_queue *sq ) {
 
     debug( "refused_count = %d, reconnect_at = %u.", sq->refused_count, sq->reconnect_at.tv_sec );
 
+    if ( sq->reconnect_element == NULL ) {
+      sq->reconnect_element = insert_after_dlist( reconnecting_send_queues, sq );
+    }
+
     return 0;
   }
 
@@ -1011,6 +1582,19 @@ send_queue_connect( send_queue *sq ) {
   sq->reconnect_at.tv_sec = 0;
   sq->reconnect_at.tv_nsec = 0;
 
+  if ( sq->reconnect_element != NULL ) {
+    delete_dlist_element( sq->reconnect_element );
+    sq->reconnect_element = NULL;
+  }
+
+  set_messenger_fd_handler( sq->server_socket, on_send_queue_readable, on_send, sq );
+  if ( sq->data_length > 0 ) {
+    set_writable( sq->server_socket, true );
+  }
+  if ( sq->transport == MESSENGER_TRANSPORT_SHM ) {
+    start_shm_transport( sq );
+  }
+
   send_dump_message( MESSENGER_DUMP_SEND_CONNECTED, sq->service_name, NULL, 0 );
 
   return 1;
@@ -1020,10 +1604,11 @@ send_queue_connect( send_queue *sq ) {
 /**
  * Creates a Send queue and connects to specified service name.
  * @param service_name Name of service
+ * @param transport MESSENGER_TRANSPORT_SOCKET or MESSENGER_TRANSPORT_SHM
  * @return send_queue* Pointer to send queue
  */
 static send_queue *
-create_send_queue( const char *service_name ) {
+create_send_queue( const char *service_name, int transport ) {
   assert( service_name != NULL );
 
   debug( "Creating a send queue ( service_name = %s ).", service_name );
@@ -1052,6 +1637,19 @@ create_send_queue( const char *service_name ) {
   sq->refused_count = 0;
   sq->reconnect_at.tv_sec = 0;
   sq->reconnect_at.tv_nsec = 0;
+  sq->reconnect_element = NULL;
+  memset( sq->lanes, 0, sizeof( sq->lanes ) );
+  sq->free_chunks = NULL;
+  sq->free_chunk_count = 0;
+  sq->data_length = 0;
+  memset( &sq->stats, 0, sizeof( messenger_queue_stats ) );
+  sq->transport = transport;
+  sq->shm_state = SHM_STATE_NONE;
+  sq->ring = NULL;
+  sq->publish_element = NULL;
+  sq->hold_element = NULL;
+  sq->limits = default_send_queue_limits;
+  sq->congested = false;
 
   if ( send_queue_connect( sq ) == -1 ) {
     xfree( sq );
@@ -1059,8 +1657,6 @@ create_send_queue( const char *service_name ) {
     return NULL;
   }
 
-  sq->buffer = create_message_buffer( messenger_send_queue_length );
-
   insert_hash_entry( send_queues, sq->service_name, sq );
 
   return sq;
@@ -1068,855 +1664,2472 @@ create_send_queue( const char *service_name ) {
 
 
 /**
- * Writes data to message buffer.
- * @param buf Message buffer
- * @param data Data to be written 
- * @param len length of data
- * @return bool True when message is written to buffer, else False
+ * Returns the chunk to which a message of a given length is appended.
+ * A new chunk is taken from the free list, or allocated, when the last
+ * chunk has no room. Messages longer than a chunk get a dedicated one.
+ * @param sq Pointer to send queue
+ * @param lane Lane of the send queue
+ * @param len Length of message including header
+ * @return send_queue_chunk* Pointer to chunk with at least len bytes free at the tail
  */
-static bool
-write_message_buffer( message_buffer *buf, const void *data, size_t len ) {
-  assert( buf != NULL );
+static send_queue_chunk *
+reserve_send_queue_chunk( send_queue *sq, send_queue_lane *lane, size_t len ) {
+  assert( sq != NULL );
+  assert( lane != NULL );
 
-  if ( message_buffer_remain_bytes( buf ) < len ) {
-    return false;
+  send_queue_chunk *chunk = lane->tail_chunk;
+  if ( chunk != NULL && chunk->size - chunk->tail >= len ) {
+    return chunk;
   }
 
-  if ( ( buf->head_offset + buf->data_length + len ) <= buf->size ) {
-    memcpy( ( char * ) get_message_buffer_head( buf ) + buf->data_length, data, len );
+  if ( len <= MESSENGER_SEND_CHUNK_SIZE && sq->free_chunks != NULL ) {
+    chunk = sq->free_chunks;
+    sq->free_chunks = chunk->next;
+    sq->free_chunk_count--;
   }
   else {
-    memmove( buf->buffer, ( char * ) get_message_buffer_head( buf ), buf->data_length );
-    buf->head_offset = 0;
-    memcpy( ( char * ) buf->buffer + buf->data_length, data, len );
+    size_t size = len > MESSENGER_SEND_CHUNK_SIZE ? len : MESSENGER_SEND_CHUNK_SIZE;
+    chunk = xmalloc( offsetof( send_queue_chunk, data ) + size );
+    chunk->size = size;
   }
-  buf->data_length += len;
+  chunk->next = NULL;
+  chunk->head = 0;
+  chunk->tail = 0;
 
-  return true;
+  if ( lane->tail_chunk != NULL ) {
+    lane->tail_chunk->next = chunk;
+  }
+  else {
+    lane->head_chunk = chunk;
+  }
+  lane->tail_chunk = chunk;
+
+  return chunk;
 }
 
 
 /**
- * Pushes message to send queue.
- * @param service_name Name of service
- * @param message_type Type of message
- * @param tag Tag
- * @param data Data to be pushed
- * @param len Length of data
- * @return bool True when message is successfully pushed, else False
+ * Consumes sent messages from the head of a lane of a send queue.
+ * Emptied chunks go back to the free list so that no memory is
+ * allocated or moved while the queue is busy. Chunks beyond
+ * MESSENGER_SEND_FREE_CHUNKS are released, so that a burst does not
+ * pin memory.
+ * @param sq Pointer to send queue
+ * @param lane Lane of the send queue
+ * @param len Number of bytes to consume
+ * @param messages Number of messages in len bytes
+ * @return None
  */
-static bool
-push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
-  assert( service_name != NULL );
-
-  debug( "Pushing a message to send queue ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
-         service_name, message_type, tag, data, len );
+static void
+consume_send_queue( send_queue *sq, send_queue_lane *lane, size_t len, uint64_t messages ) {
+  assert( sq != NULL );
+  assert( lane != NULL );
+  assert( len <= lane->data_length );
+  assert( messages <= lane->stats.queued_messages );
+
+  sq->data_length -= len;
+  lane->data_length -= len;
+  lane->stats.queued_bytes = lane->data_length;
+  lane->stats.queued_messages -= messages;
+  while ( lane->head_chunk != NULL ) {
+    send_queue_chunk *chunk = lane->head_chunk;
+    size_t chunk_len = chunk->tail - chunk->head;
+    if ( len < chunk_len ) {
+      chunk->head += len;
+      return;
+    }
+    len -= chunk_len;
+    if ( chunk == lane->tail_chunk ) {
+      chunk->head = 0;
+      chunk->tail = 0;
+      return;
+    }
+    lane->head_chunk = chunk->next;
+    if ( chunk->size == MESSENGER_SEND_CHUNK_SIZE && sq->free_chunk_count < MESSENGER_SEND_FREE_CHUNKS ) {
+      chunk->next = sq->free_chunks;
+      sq->free_chunks = chunk;
+      sq->free_chunk_count++;
+    }
+    else {
+      xfree( chunk );
+    }
+  }
+}
 
-  message_header header;
 
-  if ( send_queues == NULL ) {
-    error( "All send queues are already deleted or not created yet." );
-    return false;
+/**
+ * Calculates the total length of message body segments.
+ * @param segments Array of segments
+ * @param count Number of segments
+ * @return size_t Total length
+ */
+static size_t
+get_segments_length( const messenger_segment *segments, size_t count ) {
+  size_t len = 0;
+  for ( size_t i = 0; i < count; i++ ) {
+    len += segments[ i ].len;
   }
 
-  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  return len;
+}
 
-  if ( NULL == sq ) {
-    sq = create_send_queue( service_name );
-    assert( sq != NULL );
+
+/**
+ * Copies message body segments to a contiguous area.
+ * @param p Pointer to destination
+ * @param segments Array of segments
+ * @param count Number of segments
+ * @return None
+ */
+static void
+gather_segments( char *p, const messenger_segment *segments, size_t count ) {
+  for ( size_t i = 0; i < count; i++ ) {
+    if ( segments[ i ].len > 0 ) {
+      memcpy( p, segments[ i ].data, segments[ i ].len );
+      p += segments[ i ].len;
+    }
   }
+}
 
-  header.version = 0;
-  header.message_type = message_type;
-  header.tag = tag;
-  header.message_length = ( uint32_t ) ( sizeof( message_header ) + len );
 
-  if ( message_buffer_remain_bytes( sq->buffer ) < header.message_length ) {
-    warn( "Could not write a message to send queue due to overflow ( service_name = %s ).", sq->service_name );
-    send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+/**
+ * Writes a message to the shared memory ring of a send queue. The
+ * message becomes visible to the service when the ring is published
+ * before the event loop waits, so that a burst of messages costs at
+ * most one wakeup.
+ * @param sq Pointer to send queue
+ * @param header Message header
+ * @param segments Segments of message body
+ * @param count Number of segments
+ * @return bool True when message is written, False if the ring is full
+ */
+static bool
+write_message_to_shm_ring( send_queue *sq, const message_header *header, const messenger_segment *segments, size_t count ) {
+  assert( sq != NULL );
+  assert( sq->ring != NULL );
+  assert( header != NULL );
+
+  char *p = reserve_shm_ring( sq->ring, header->message_length );
+  if ( p == NULL ) {
     return false;
   }
+  memcpy( p, header, sizeof( message_header ) );
+  gather_segments( p + sizeof( message_header ), segments, count );
+  sq->stats.messages++;
+  sq->stats.bytes += header->message_length;
+  if ( sq->publish_element == NULL ) {
+    sq->publish_element = insert_after_dlist( publishing_send_queues, sq );
+  }
 
-  write_message_buffer( sq->buffer, &header, sizeof( message_header ) );
-  write_message_buffer( sq->buffer, data, len );
+  if ( messenger_dump_enabled() ) {
+    send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, p, header->message_length );
+  }
 
   return true;
 }
 
 
 /**
- * Sends message by pushing to send queue.
- * @param service_name Name of service
- * @param tag Tag
- * @param data Data to send
- * @param len Data length
- * @return bool True when message is successfully pushed, else False
+ * Makes messages written to the shared memory ring visible to the
+ * service, and wakes it up if it is sleeping.
+ * @param sq Pointer to send queue
+ * @return None
  */
-bool
-send_message( const char *service_name, const uint16_t tag, const void *data, size_t len ) {
-  assert( service_name != NULL );
-
-  debug( "Sending a message ( service_name = %s, tag = %#x, data = %p, len = %u ).",
-         service_name, tag, data, len );
+static void
+publish_shm_transport( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->ring != NULL );
 
-  return push_message_to_send_queue( service_name, MESSAGE_TYPE_NOTIFY, tag, data, len );
+  if ( sq->publish_element != NULL ) {
+    delete_dlist_element( sq->publish_element );
+    sq->publish_element = NULL;
+  }
+  if ( !publish_shm_ring( sq->ring ) ) {
+    return;
+  }
+  // A full socket buffer means that wakeups are already pending.
+  sq->stats.syscalls++;
+  if ( !send_control_message( sq->server_socket, MESSAGE_TYPE_SHM_WAKEUP, 0, -1 )
+       && errno != EAGAIN && errno != EWOULDBLOCK ) {
+    error( "Failed to wake up a service ( service_name = %s, errno = %s [%d] ).",
+           sq->service_name, strerror( errno ), errno );
+  }
 }
 
 
 /**
- * Inserts a new context into hash table.
- * @param user_data User Data
- * @return messenger_context* Pointer to message context
+ * Moves messages held in the lanes of a send queue to its shared
+ * memory ring, higher priority lanes first, until the ring is full.
+ * The send queue is polled until the service makes room for the rest.
+ * @param sq Pointer to send queue
+ * @return None
  */
-static messenger_context *
-insert_context( void *user_data ) {
-  messenger_context *context = xmalloc( sizeof( messenger_context ) );
-
-  context->transaction_id = ++last_transaction_id;
-  context->life_count = 10;
-  context->user_data = user_data;
-
-  debug( "Inserting a new context ( transaction_id = %#x, life_count = %d, user_data = %p ).",
-         context->transaction_id, context->life_count, context->user_data );
-
-  insert_hash_entry( context_db, &context->transaction_id, context );
+static void
+move_send_queue_to_shm_ring( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->shm_state == SHM_STATE_ACTIVE );
+
+  for ( int i = MESSENGER_PRIORITY_LANES - 1; i >= 0; i-- ) {
+    send_queue_lane *lane = &sq->lanes[ i ];
+    while ( lane->data_length > 0 ) {
+      send_queue_chunk *chunk = lane->head_chunk;
+      message_header *header = ( message_header * ) ( chunk->data + chunk->head );
+      messenger_segment body = { header->value, header->message_length - sizeof( message_header ) };
+      if ( !write_message_to_shm_ring( sq, header, &body, 1 ) ) {
+        if ( sq->hold_element == NULL ) {
+          sq->hold_element = insert_after_dlist( holding_send_queues, sq );
+        }
+        return;
+      }
+      lane->stats.messages++;
+      consume_send_queue( sq, lane, header->message_length, 1 );
+    }
+  }
 
-  return context;
+  if ( sq->hold_element != NULL ) {
+    delete_dlist_element( sq->hold_element );
+    sq->hold_element = NULL;
+  }
 }
 
 
 /**
- * Sends request message and pushes the message to send queue.
- * @param to_service_name Name of service to which message is send
- * @param from_service_name Name of service from where message is received
- * @param tag Tag
- * @param data Data to send
- * @param len Length of data
- * @param user_data User Data
- * @return bool True when message is successfully pushed, else False 
+ * Completes the setup of the shared memory transport when the service
+ * answers. Messages held in the send queue during the setup are moved
+ * to the ring, so that they are delivered in order.
+ * @param sq Pointer to send queue
+ * @param accepted True if the service has attached to the ring
+ * @return None
  */
-bool
-send_request_message( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data ) {
-  assert( to_service_name != NULL );
-  assert( from_service_name != NULL );
+static void
+finish_shm_transport_setup( send_queue *sq, bool accepted ) {
+  assert( sq != NULL );
+  assert( sq->shm_state == SHM_STATE_PENDING );
 
-  debug( "Sending a request message ( to_service_name = %s, from_service_name = %s, tag = %#x, data = %p, len = %u, user_data = %p ).",
-         to_service_name, from_service_name, tag, data, len, user_data );
+  if ( !accepted ) {
+    warn( "Shared memory ring is refused. Using socket transport ( service_name = %s ).", sq->service_name );
+    stop_shm_transport( sq );
+    if ( sq->data_length > 0 ) {
+      set_writable( sq->server_socket, true );
+    }
+    return;
+  }
 
-  char *request_data, *p;
-  size_t from_service_name_len = strlen( from_service_name ) + 1;
-  size_t handle_len = sizeof( messenger_context_handle ) + from_service_name_len;
-  messenger_context *context;
-  messenger_context_handle *handle;
-  bool return_value;
+  debug( "Shared memory transport is established ( service_name = %s ).", sq->service_name );
 
-  context = insert_context( user_data );
+  sq->shm_state = SHM_STATE_ACTIVE;
+  move_send_queue_to_shm_ring( sq );
+  if ( sq->congested ) {
+    congested_shm_send_queues++;
+  }
+}
 
-  request_data = xmalloc( handle_len + len );
-  handle = ( messenger_context_handle * ) request_data;
-  handle->transaction_id = htonl( context->transaction_id );
-  handle->service_name_len = htons( ( uint16_t ) from_service_name_len );
-  strcpy( handle->service_name, from_service_name );
-  p = request_data + handle_len;
-  memcpy( p, data, len );
 
-  return_value = push_message_to_send_queue( to_service_name, MESSAGE_TYPE_REQUEST, tag, request_data, handle_len + len );
+/**
+ * Returns the number of bytes queued in a send queue, including those
+ * in its shared memory ring which the service has not consumed yet.
+ * @param sq Pointer to send queue
+ * @return size_t Queued bytes
+ */
+static size_t
+get_send_queue_length( send_queue *sq ) {
+  assert( sq != NULL );
 
-  xfree( request_data );
+  size_t len = sq->data_length;
+  if ( sq->ring != NULL && sq->shm_state == SHM_STATE_ACTIVE ) {
+    len += shm_ring_used( sq->ring );
+  }
 
-  return return_value;
+  return len;
 }
 
 
 /**
- * Creates a reply message and pushes the message to send queue.
- * @param handle Message handle
- * @param tag Tag
- * @param data Data to send as reply
- * @param len Length of data
- * @return bool True when message is successfully pushed, else False
+ * Changes the congestion state of a send queue and calls the pressure
+ * callbacks. Callbacks may add or delete callbacks, and send messages.
+ * @param sq Pointer to send queue
+ * @param congested New state
+ * @return None
  */
-bool
-send_reply_message( const messenger_context_handle *handle, const uint16_t tag, const void *data, size_t len ) {
-  assert( handle != NULL );
+static void
+set_send_queue_congested( send_queue *sq, bool congested ) {
+  assert( sq != NULL );
 
-  debug( "Sending a reply message ( handle = [ transaction_id = %#x, service_name_len = %u, service_name = %s ], "
-         "tag = %#x, data = %p, len = %u ).",
-         handle->transaction_id, handle->service_name_len, handle->service_name, tag, data, len );
+  if ( sq->congested == congested ) {
+    return;
+  }
 
-  char *reply_data;
-  messenger_context_handle *reply_handle;
-  bool return_value;
-
-  reply_data = xmalloc( sizeof( messenger_context_handle ) + len );
-  reply_handle = ( messenger_context_handle * ) reply_data;
-  reply_handle->transaction_id = htonl( handle->transaction_id );
-  reply_handle->service_name_len = htons( 0 );
-  memcpy( reply_handle->service_name, data, len );
+  debug( "Send queue pressure is %s ( service_name = %s, length = %zu ).",
+         congested ? "high" : "low", sq->service_name, get_send_queue_length( sq ) );
 
-  return_value = push_message_to_send_queue( handle->service_name, MESSAGE_TYPE_REPLY, tag, reply_data, sizeof( messenger_context_handle ) + len );
+  sq->congested = congested;
+  if ( sq->shm_state == SHM_STATE_ACTIVE ) {
+    congested_shm_send_queues += congested ? 1 : -1;
+  }
 
-  xfree( reply_data );
+  if ( send_queue_pressure_callbacks == NULL ) {
+    return;
+  }
 
-  return return_value;
+  dlist_element *e, *next;
+  for ( e = send_queue_pressure_callbacks->next; e != NULL; e = next ) {
+    next = e->next;
+    send_queue_pressure_callback *cb = e->data;
+    cb->function( sq->service_name, congested, cb->user_data );
+  }
 }
 
 
 /**
- * Checks queue status.
- * @param connected_count Number of queues connected 
- * @param sending_count Number of queues sending
- * @param reconnecting_count Number of queues reconnecting
- * @param closed_count Number of queues closed
+ * Compares the queued bytes of a send queue with its watermarks.
+ * @param sq Pointer to send queue
  * @return None
  */
 static void
-number_of_send_queue( int *connected_count, int *sending_count, int *reconnecting_count, int *closed_count ) {
-  assert( connected_count != NULL );
-  assert( sending_count != NULL );
-  assert( reconnecting_count != NULL );
-  assert( closed_count != NULL );
-
-  debug( "Checking queue statuses." );
-
-  hash_iterator iter;
-  hash_entry *e;
-
-  *connected_count = 0;
-  *sending_count = 0;
-  *reconnecting_count = 0;
-  *closed_count = 0;
+update_send_queue_pressure( send_queue *sq ) {
+  assert( sq != NULL );
 
-  if ( send_queues == NULL ) {
-    error( "All send queues are already deleted or not created yet." );
-    return;
+  size_t len = get_send_queue_length( sq );
+  if ( !sq->congested && len >= sq->limits.high_watermark ) {
+    set_send_queue_congested( sq, true );
   }
-
-  init_hash_iterator( send_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    send_queue *sq = e->value;
-    if ( sq->server_socket != -1 ) {
-      if ( sq->buffer->data_length == 0 ) {
-          ( *connected_count )++;
-      }
-      else {
-        if ( sq->refused_count > 0 ) {
-            ( *reconnecting_count )++;
-        }
-        else {
-            ( *sending_count )++;
-        }
-      }
-    }
-    else {
-        ( *closed_count )++;
-    }
+  else if ( sq->congested && len <= sq->limits.low_watermark ) {
+    set_send_queue_congested( sq, false );
   }
-
-  debug( "connected_count = %d, reconnecting_count = %d, sending_count = %d, closed_count = %d.",
-         *connected_count, *reconnecting_count, *sending_count, *closed_count );
 }
 
 
 /**
- * Initializing the pipe for communicating for Receive Queue.
- * @param read_set Pointer to fd_set
+ * Re-evaluates congested send queues on the shared memory transport.
+ * Their services consume the rings without telling the sender, so
+ * this is polled while any of them is congested.
+ * @param None
  * @return None
  */
 static void
-set_recv_queue_fd_set( fd_set *read_set ) {
-  assert( read_set != NULL );
-
-  debug( "Setting fds to a fd_set ( read_set = %p ).", read_set );
+update_shm_send_queue_pressure( void ) {
+  if ( congested_shm_send_queues == 0 ) {
+    return;
+  }
 
   hash_iterator iter;
   hash_entry *e;
-
-  assert( receive_queues != NULL );
-
-  init_hash_iterator( receive_queues, &iter );
+  init_hash_iterator( send_queues, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    receive_queue *rq = e->value;
-    dlist_element *element;
-    /*
-     * A hacky workaround to avoid the bug of glibc (#431)
-     * See also: http://www.linuxquestions.org/questions/programming-9/impossible-to-use-gcc-with-wconversion-and-standard-socket-macros-841935/
-     */
-    debug( "Setting a fd ( %d ) to fd_set ( read_set = %p ).", rq->listen_socket, read_set );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-    FD_SET( rq->listen_socket, read_set );
-#undef sizeof
-    for ( element = rq->client_sockets->next; element; element = element->next ) {
-      messenger_socket *socket_item = element->data;
-      debug( "Setting a fd ( %d ) to fd_set ( read_set = %p ).", socket_item->fd, read_set );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-      FD_SET( socket_item->fd, read_set );
-#undef sizeof
+    send_queue *sq = e->value;
+    if ( sq->congested && sq->shm_state == SHM_STATE_ACTIVE ) {
+      update_send_queue_pressure( sq );
     }
   }
 }
 
 
 /**
- * Adds a client file descriptor receive queue.
- * @param rq Pointer to receive queue
- * @param fd File descriptor  
- * @return None
+ * Refuses a message which does not fit in a send queue.
+ * @param sq Pointer to send queue
+ * @param queue Description of the queue in log messages
+ * @return bool Always False
  */
-static void
-add_recv_queue_client_fd( receive_queue *rq, int fd ) {
-  assert( rq != NULL );
-  assert( fd >= 0 );
-
-  debug( "Adding a client fd to receive queue ( fd = %d, service_name = %s ).", fd, rq->service_name );
+static bool
+drop_message( send_queue *sq, const char *queue ) {
+  assert( sq != NULL );
 
-  messenger_socket *socket;
+  warn( "Could not write a message to %s due to overflow ( service_name = %s ).", queue, sq->service_name );
+  sq->stats.dropped++;
+  send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+  set_send_queue_congested( sq, true );
 
-  socket = xmalloc( sizeof( messenger_socket ) );
-  socket->fd = fd;
-  insert_after_dlist( rq->client_sockets, socket );
+  return false;
 }
 
 
 /**
- * Accepts and sets SO_RCV_BUFFORCE or O_NONBLOCK to the provided File Descriptor (fd).
- * @param rq Pointer to receive queue
- * @param fd File descriptor
- * @return None
+ * Pushes message to a lane of a send queue which is already looked up.
+ * The message body is gathered from segments while it is copied to the
+ * send queue.
+ * @param sq Pointer to send queue
+ * @param priority Priority of message
+ * @param message_type Type of message
+ * @param tag Tag
+ * @param segments Segments of data to be pushed
+ * @param count Number of segments
+ * @return bool True when message is successfully pushed, else False
  */
-static void
-on_accept( int fd, receive_queue *rq ) {
-  assert( rq != NULL );
+static bool
+write_message_to_send_queue_lane( send_queue *sq, int priority, const uint8_t message_type, const uint16_t tag, const messenger_segment *segments, size_t count ) {
+  assert( sq != NULL );
+  assert( priority >= 0 && priority < MESSENGER_PRIORITY_LANES );
+  assert( segments != NULL || count == 0 );
+
+  size_t len = get_segments_length( segments, count );
+  if ( len > MESSENGER_RECV_BUFFER - sizeof( message_header ) ) {
+    // The receiver could never take it in a single recv().
+    error( "Too long message ( service_name = %s, tag = %#x, len = %zu ).", sq->service_name, tag, len );
+    sq->stats.dropped++;
+    return false;
+  }
 
-  int client_fd;
-  struct sockaddr_un addr;
+  debug( "Pushing a message to send queue ( service_name = %s, priority = %d, message_type = %#x, tag = %#x, segments = %u, len = %u ).",
+         sq->service_name, priority, message_type, tag, count, len );
 
-  socklen_t addr_len = sizeof( struct sockaddr_un );
+  message_header header;
 
-  if ( ( client_fd = accept( fd, ( struct sockaddr * ) &addr, &addr_len ) ) == -1 ) {
-    error( "Failed to accept ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
-    return;
+  header.version = 0;
+  header.message_type = message_type;
+  header.tag = tag;
+  header.message_length = ( uint32_t ) ( sizeof( message_header ) + len );
+
+  size_t queued = get_send_queue_length( sq );
+  if ( queued > sq->limits.max_length || sq->limits.max_length - queued < header.message_length ) {
+    return drop_message( sq, "send queue" );
   }
 
-  if ( geteuid() == 0 ) {
-    int rmem_size = 1048576;
-    int ret = setsockopt( client_fd, SOL_SOCKET, SO_RCVBUFFORCE, ( const void * ) &rmem_size, ( socklen_t ) sizeof( rmem_size ) );
-    if ( ret < 0 ) {
-      error( "Failed to set SO_RCVBUFFORCE to %d ( %s [%d] ).", rmem_size, strerror( errno ), errno );
-      close( client_fd );
-      return;
+  send_queue_lane *lane = &sq->lanes[ priority ];
+  if ( sq->shm_state == SHM_STATE_ACTIVE && sq->hold_element == NULL ) {
+    // No message waits in the send queue, so there is nothing to
+    // overtake.
+    if ( write_message_to_shm_ring( sq, &header, segments, count ) ) {
+      lane->stats.messages++;
+      update_send_queue_pressure( sq );
+      return true;
     }
+    // The ring is full. The message waits in the send queue.
+    sq->hold_element = insert_after_dlist( holding_send_queues, sq );
   }
-  int ret = fcntl( client_fd, F_SETFL, O_NONBLOCK );
-  if ( ret < 0 ) {
-    error( "Failed to set O_NONBLOCK ( %s [%d] ).", strerror( errno ), errno );
-    close( client_fd );
-    return;
+
+  send_queue_chunk *chunk = reserve_send_queue_chunk( sq, lane, header.message_length );
+  memcpy( chunk->data + chunk->tail, &header, sizeof( message_header ) );
+  gather_segments( chunk->data + chunk->tail + sizeof( message_header ), segments, count );
+  chunk->tail += header.message_length;
+  sq->data_length += header.message_length;
+  lane->data_length += header.message_length;
+  lane->stats.queued_messages++;
+  lane->stats.queued_bytes = lane->data_length;
+  if ( lane->stats.queued_bytes > lane->stats.max_queued_bytes ) {
+    lane->stats.max_queued_bytes = lane->stats.queued_bytes;
   }
 
-  add_recv_queue_client_fd( rq, client_fd );
-  send_dump_message( MESSENGER_DUMP_RECV_CONNECTED, rq->service_name, NULL, 0 );
+  // Messages are held while the shared memory transport is being set up.
+  if ( sq->server_socket != -1 && sq->shm_state == SHM_STATE_NONE ) {
+    set_writable( sq->server_socket, true );
+  }
+  update_send_queue_pressure( sq );
+
+  return true;
 }
 
 
 /**
- * Deletes client file descriptor from receive queue. 
- * @param rq Pointer to receive queue
- * @param fd File descriptor
- * @return int 0 when successfully deleted receive queue, else 1 
+ * Pushes message to a send queue which is already looked up. The lane
+ * is selected by the priority of the tag.
+ * @param sq Pointer to send queue
+ * @param message_type Type of message
+ * @param tag Tag
+ * @param data Data to be pushed
+ * @param len Length of data
+ * @return bool True when message is successfully pushed, else False
  */
-static int
-del_recv_queue_client_fd( receive_queue *rq, int fd ) {
-  assert( rq != NULL );
-  assert( fd >= 0 );
-
-  messenger_socket *socket;
-  dlist_element *element;
-
-  debug( "Deleting a client fd from receive queue ( fd = %d, service_name = %s ).", fd, rq->service_name );
-
-  for ( element = rq->client_sockets->next; element; element = element->next ) {
-    socket = element->data;
-    if ( socket->fd == fd ) {
-      debug( "Deleting fd ( %d ).", fd );
-      delete_dlist_element( element );
-      xfree( socket );
-      return 1;
-    }
-  }
-
-  return 0;
+static bool
+write_message_to_send_queue( send_queue *sq, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
+  messenger_segment body = { data, len };
+  return write_message_to_send_queue_lane( sq, tag_priorities[ tag ], message_type, tag, &body, 1 );
 }
 
 
 /**
- * Truncates message buffer.
- * @param buf Message buffer
- * @param len Length of message buffer
- * @return None
+ * Looks up the send queue for a service, and creates it if it does
+ * not exist.
+ * @param service_name Name of service
+ * @return send_queue* Pointer to send queue, or NULL if send queues are not available
  */
-static void
-truncate_message_buffer( message_buffer *buf, size_t len ) {
-  assert( buf != NULL );
+static send_queue *
+get_send_queue( const char *service_name ) {
+  assert( service_name != NULL );
 
-  if ( len == 0 || buf->data_length == 0 ) {
-    return;
+  if ( send_queues == NULL ) {
+    error( "All send queues are already deleted or not created yet." );
+    return NULL;
   }
 
-  if ( len > buf->data_length ) {
-    len = buf->data_length;
-  }
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
 
-  if ( ( buf->head_offset + len ) <= buf->size ) {
-    buf->head_offset += len;
-  }
-  else {
-    memmove( buf->buffer, ( char * ) buf->buffer + buf->head_offset + len, buf->data_length - len );
-    buf->head_offset = 0;
+  if ( NULL == sq ) {
+    sq = create_send_queue( service_name, MESSENGER_TRANSPORT_SOCKET );
+    assert( sq != NULL );
   }
-  buf->data_length -= len;
+
+  return sq;
 }
 
 
 /**
- * Pulls message data from receive queue.
- * @param rq Pointer to receive queue
+ * Pushes message to send queue.
+ * @param service_name Name of service
  * @param message_type Type of message
  * @param tag Tag
- * @param data Data to pull
+ * @param data Data to be pushed
  * @param len Length of data
- * @param maxlen max data length
- * @returns 1 if succeeded, else 0.
+ * @return bool True when message is successfully pushed, else False
  */
-static int
-pull_from_recv_queue( receive_queue *rq, uint8_t *message_type, uint16_t *tag, void *data, size_t *len, size_t maxlen ) {
-  assert( rq != NULL );
-  assert( message_type != NULL );
-  assert( tag != NULL );
-  assert( data != NULL );
-  assert( len != NULL );
-
-  debug( "Pulling a message from receive queue ( service_name = %s ).", rq->service_name );
-
-  message_header *header;
-
-  if ( rq->buffer->data_length < sizeof( message_header ) ) {
-    debug( "Queue length is smaller than a message header ( queue length = %u ).", rq->buffer->data_length );
-    return 0;
-  }
-
-  header = ( message_header * ) get_message_buffer_head( rq->buffer );
+static bool
+push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
+  assert( service_name != NULL );
 
-  assert( header->message_length != 0 );
-  assert( header->message_length < messenger_recv_queue_length );
-  if ( rq->buffer->data_length < header->message_length ) {
-    debug( "Queue length is smaller than message length ( queue length = %u, message length = %u ).",
-           rq->buffer->data_length, header->message_length );
-    return 0;
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
   }
 
-  *message_type = header->message_type;
-  *tag = header->tag;
-  *len = header->message_length - sizeof( message_header );
-  memcpy( data, header->value, *len > maxlen ? maxlen : *len );
-  truncate_message_buffer( rq->buffer, header->message_length );
-
-  debug( "A message is retrieved from receive queue ( message_type = %#x, tag = %#x, len = %u, data = %p ).",
-         *message_type, *tag, *len, data );
-
-  return 1;
+  return write_message_to_send_queue( sq, message_type, tag, data, len );
 }
 
 
 /**
- * Lookup a context from hash entry.
- * @param transaction_id Transaction ID
- * @return messenger_context* Pointer to message context
+ * Returns the send queue of a send handle. The cached send queue is
+ * used unless a send queue has been deleted since it was looked up.
+ * @param handle Send handle
+ * @return send_queue* Pointer to send queue, or NULL if send queues are not available
  */
-static messenger_context *
-get_context( uint32_t transaction_id ) {
-  debug( "Looking up a context ( transaction_id = %#x ).", transaction_id );
+static send_queue *
+resolve_send_handle( messenger_send_handle *handle ) {
+  assert( handle != NULL );
 
-  return lookup_hash_entry( context_db, &transaction_id );
+  if ( handle->sq == NULL || handle->generation != send_queue_generation ) {
+    handle->sq = get_send_queue( handle->service_name );
+    handle->generation = send_queue_generation;
+  }
+
+  return handle->sq;
 }
 
 
 /**
- * Calls message callbacks. Selects from message type and respective callback is issued.
- * @param rq Pointer to receive queue
- * @param message_type Type of message
+ * Sends message by pushing to send queue.
+ * @param service_name Name of service
  * @param tag Tag
- * @param data Data 
+ * @param data Data to send
  * @param len Data length
- * @return None
+ * @return bool True when message is successfully pushed, else False
+ */
+bool
+send_message( const char *service_name, const uint16_t tag, const void *data, size_t len ) {
+  assert( service_name != NULL );
+
+  debug( "Sending a message ( service_name = %s, tag = %#x, data = %p, len = %u ).",
+         service_name, tag, data, len );
+
+  return push_message_to_send_queue( service_name, MESSAGE_TYPE_NOTIFY, tag, data, len );
+}
+
+
+/**
+ * Sends message whose body is given as segments, for example a header
+ * and a payload in separate buffers. The segments are gathered while
+ * the message is copied to the send queue, so the payload is copied only
+ * once.
+ * @param service_name Name of service
+ * @param tag Tag
+ * @param segments Array of segments
+ * @param count Number of segments
+ * @return bool True when message is successfully pushed, else False
+ * @see send_message
+ */
+bool
+send_message_segments( const char *service_name, const uint16_t tag, const messenger_segment *segments, size_t count ) {
+  assert( service_name != NULL );
+
+  debug( "Sending a message ( service_name = %s, tag = %#x, segments = %u ).",
+         service_name, tag, count );
+
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  return write_message_to_send_queue_lane( sq, tag_priorities[ tag ], MESSAGE_TYPE_NOTIFY, tag, segments, count );
+}
+
+
+/**
+ * Sends message with an explicit priority regardless of its tag.
+ * @param service_name Name of service
+ * @param tag Tag
+ * @param data Data to send
+ * @param len Length of data
+ * @param priority MESSENGER_PRIORITY_NORMAL or MESSENGER_PRIORITY_HIGH
+ * @return bool True when message is successfully pushed, else False
+ * @see send_message
+ */
+bool
+send_message_with_priority( const char *service_name, const uint16_t tag, const void *data, size_t len, int priority ) {
+  assert( service_name != NULL );
+
+  debug( "Sending a message ( service_name = %s, tag = %#x, data = %p, len = %u, priority = %d ).",
+         service_name, tag, data, len, priority );
+
+  if ( priority < 0 || priority >= MESSENGER_PRIORITY_LANES ) {
+    error( "Invalid message priority ( %d ).", priority );
+    return false;
+  }
+
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  messenger_segment body = { data, len };
+  return write_message_to_send_queue_lane( sq, priority, MESSAGE_TYPE_NOTIFY, tag, &body, 1 );
+}
+
+
+/**
+ * Inserts a new context into hash table and the deadline heap.
+ * @param tag Tag of request
+ * @param user_data User Data
+ * @param timeout Time to wait for the reply, or NULL for the default
+ * @param timeout_callback Function called if no reply arrives in time, or NULL
+ * @return messenger_context* Pointer to message context
+ */
+static messenger_context *
+insert_context( uint16_t tag, void *user_data, const struct timespec *timeout, callback_request_timeout timeout_callback ) {
+  struct timespec now;
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    now.tv_sec = 0;
+    now.tv_nsec = 0;
+  }
+  if ( timeout == NULL ) {
+    timeout = &default_request_timeout;
+  }
+
+  messenger_context *context = xmalloc( sizeof( messenger_context ) );
+
+  context->transaction_id = ++last_transaction_id;
+  context->tag = tag;
+  context->deadline.tv_sec = now.tv_sec + timeout->tv_sec;
+  context->deadline.tv_nsec = now.tv_nsec + timeout->tv_nsec;
+  if ( context->deadline.tv_nsec >= 1000000000 ) {
+    context->deadline.tv_sec++;
+    context->deadline.tv_nsec -= 1000000000;
+  }
+  context->timeout_callback = timeout_callback;
+  context->user_data = user_data;
+
+  debug( "Inserting a new context ( transaction_id = %#x, deadline = %d.%09d, user_data = %p ).",
+         context->transaction_id, ( int ) context->deadline.tv_sec, ( int ) context->deadline.tv_nsec,
+         context->user_data );
+
+  insert_hash_entry( context_db, &context->transaction_id, context );
+  push_context_heap( context );
+
+  return context;
+}
+
+
+/**
+ * Creates a request message and pushes it to a send queue which is
+ * already looked up.
+ * @param sq Pointer to send queue
+ * @param from_service_name Name of service to which the reply is sent
+ * @param tag Tag
+ * @param data Data to send
+ * @param len Length of data
+ * @param user_data User data passed to the reply callback
+ * @param timeout Time to wait for the reply, or NULL for the default
+ * @param timeout_callback Function called if no reply arrives in time, or NULL
+ * @return bool True when message is successfully pushed, else False
+ */
+static bool
+write_request_message( send_queue *sq, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data,
+                       const struct timespec *timeout, callback_request_timeout timeout_callback ) {
+  assert( sq != NULL );
+  assert( from_service_name != NULL );
+
+  size_t from_service_name_len = strlen( from_service_name ) + 1;
+  size_t handle_len = sizeof( messenger_context_handle ) + from_service_name_len;
+  messenger_context *context;
+  messenger_context_handle *handle;
+  bool return_value;
+
+  context = insert_context( tag, user_data, timeout, timeout_callback );
+
+  handle = xmalloc( handle_len );
+  handle->transaction_id = htonl( context->transaction_id );
+  handle->service_name_len = htons( ( uint16_t ) from_service_name_len );
+  strcpy( handle->service_name, from_service_name );
+
+  messenger_segment segments[] = { { handle, handle_len }, { data, len } };
+  return_value = write_message_to_send_queue_lane( sq, tag_priorities[ tag ], MESSAGE_TYPE_REQUEST, tag, segments, 2 );
+
+  xfree( handle );
+
+  return return_value;
+}
+
+
+/**
+ * Sends request message and pushes the message to send queue.
+ * @param to_service_name Name of service to which message is send
+ * @param from_service_name Name of service from where message is received
+ * @param tag Tag
+ * @param data Data to send
+ * @param len Length of data
+ * @param user_data User Data
+ * @return bool True when message is successfully pushed, else False 
+ */
+bool
+send_request_message( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data ) {
+  assert( to_service_name != NULL );
+  assert( from_service_name != NULL );
+
+  debug( "Sending a request message ( to_service_name = %s, from_service_name = %s, tag = %#x, data = %p, len = %u, user_data = %p ).",
+         to_service_name, from_service_name, tag, data, len, user_data );
+
+  send_queue *sq = get_send_queue( to_service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  return write_request_message( sq, from_service_name, tag, data, len, user_data, NULL, NULL );
+}
+
+
+/**
+ * Sends request message with its own reply timeout.
+ * @param to_service_name Name of service to which message is send
+ * @param from_service_name Name of service from where message is received
+ * @param tag Tag
+ * @param data Data to send
+ * @param len Length of data
+ * @param user_data User Data
+ * @param timeout Time to wait for the reply, or NULL for the default
+ * @param timeout_callback Function called with tag and user_data if no reply arrives in time, or NULL
+ * @return bool True when message is successfully pushed, else False
+ */
+bool
+send_request_message_with_timeout( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data,
+                                   const struct timespec *timeout, callback_request_timeout timeout_callback ) {
+  assert( to_service_name != NULL );
+  assert( from_service_name != NULL );
+
+  if ( timeout != NULL && ( timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000 ) ) {
+    error( "Invalid request timeout ( tv_sec = %d, tv_nsec = %d ).", ( int ) timeout->tv_sec, ( int ) timeout->tv_nsec );
+    return false;
+  }
+
+  debug( "Sending a request message ( to_service_name = %s, from_service_name = %s, tag = %#x, data = %p, len = %u, user_data = %p, timeout_callback = %p ).",
+         to_service_name, from_service_name, tag, data, len, user_data, timeout_callback );
+
+  send_queue *sq = get_send_queue( to_service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  return write_request_message( sq, from_service_name, tag, data, len, user_data, timeout, timeout_callback );
+}
+
+
+/**
+ * Sets how long request contexts wait for replies when no timeout is
+ * given.
+ * @param timeout Default timeout
+ * @return bool True when the timeout is valid, else False
+ */
+bool
+set_default_request_timeout( const struct timespec *timeout ) {
+  assert( timeout != NULL );
+
+  if ( timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000 ) {
+    error( "Invalid request timeout ( tv_sec = %d, tv_nsec = %d ).", ( int ) timeout->tv_sec, ( int ) timeout->tv_nsec );
+    return false;
+  }
+
+  default_request_timeout = *timeout;
+
+  return true;
+}
+
+
+/**
+ * Creates a reply message and pushes the message to send queue.
+ * @param handle Message handle
+ * @param tag Tag
+ * @param data Data to send as reply
+ * @param len Length of data
+ * @return bool True when message is successfully pushed, else False
+ */
+bool
+send_reply_message( const messenger_context_handle *handle, const uint16_t tag, const void *data, size_t len ) {
+  assert( handle != NULL );
+
+  debug( "Sending a reply message ( handle = [ transaction_id = %#x, service_name_len = %u, service_name = %s ], "
+         "tag = %#x, data = %p, len = %u ).",
+         handle->transaction_id, handle->service_name_len, handle->service_name, tag, data, len );
+
+  char *reply_data;
+  messenger_context_handle *reply_handle;
+  bool return_value;
+
+  reply_data = xmalloc( sizeof( messenger_context_handle ) + len );
+  reply_handle = ( messenger_context_handle * ) reply_data;
+  reply_handle->transaction_id = htonl( handle->transaction_id );
+  reply_handle->service_name_len = htons( 0 );
+  memcpy( reply_handle->service_name, data, len );
+
+  return_value = push_message_to_send_queue( handle->service_name, MESSAGE_TYPE_REPLY, tag, reply_data, sizeof( messenger_context_handle ) + len );
+
+  xfree( reply_data );
+
+  return return_value;
+}
+
+
+/**
+ * Creates a send handle for a service. The send queue is resolved when
+ * the handle is first used, so that steady-state sends through the
+ * handle neither hash nor compare service names.
+ * @param service_name Name of service
+ * @return messenger_send_handle* Send handle, or NULL if the service name is too long
+ */
+messenger_send_handle *
+create_send_handle( const char *service_name ) {
+  assert( service_name != NULL );
+
+  debug( "Creating a send handle ( service_name = %s ).", service_name );
+
+  if ( strlen( service_name ) >= MESSENGER_SERVICE_NAME_LENGTH ) {
+    error( "Too long service name ( %s ).", service_name );
+    return NULL;
+  }
+
+  messenger_send_handle *handle = xmalloc( sizeof( messenger_send_handle ) );
+  memset( handle->service_name, 0, MESSENGER_SERVICE_NAME_LENGTH );
+  strncpy( handle->service_name, service_name, MESSENGER_SERVICE_NAME_LENGTH );
+  handle->sq = NULL;
+  handle->generation = 0;
+
+  return handle;
+}
+
+
+/**
+ * Deletes a send handle. The send queue stays as it is.
+ * @param handle Send handle
+ * @return None
+ */
+void
+delete_send_handle( messenger_send_handle *handle ) {
+  assert( handle != NULL );
+
+  debug( "Deleting a send handle ( service_name = %s ).", handle->service_name );
+
+  xfree( handle );
+}
+
+
+/**
+ * Retrieves the service name of a send handle.
+ * @param handle Send handle
+ * @return const char* Name of service
+ */
+const char *
+get_send_handle_service_name( const messenger_send_handle *handle ) {
+  assert( handle != NULL );
+
+  return handle->service_name;
+}
+
+
+/**
+ * Sends message through a send handle.
+ * @param handle Send handle
+ * @param tag Tag
+ * @param data Data to send
+ * @param len Data length
+ * @return bool True when message is successfully pushed, else False
+ * @see send_message
+ */
+bool
+send_message_by_handle( messenger_send_handle *handle, const uint16_t tag, const void *data, size_t len ) {
+  assert( handle != NULL );
+
+  send_queue *sq = resolve_send_handle( handle );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  return write_message_to_send_queue( sq, MESSAGE_TYPE_NOTIFY, tag, data, len );
+}
+
+
+/**
+ * Sends request message through a send handle.
+ * @param handle Send handle
+ * @param from_service_name Name of service to which the reply is sent
+ * @param tag Tag
+ * @param data Data to send
+ * @param len Length of data
+ * @param user_data User Data
+ * @return bool True when message is successfully pushed, else False
+ * @see send_request_message
+ */
+bool
+send_request_message_by_handle( messenger_send_handle *handle, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data ) {
+  assert( handle != NULL );
+  assert( from_service_name != NULL );
+
+  send_queue *sq = resolve_send_handle( handle );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  return write_request_message( sq, from_service_name, tag, data, len, user_data, NULL, NULL );
+}
+
+
+/**
+ * Checks queue status.
+ * @param connected_count Number of queues connected 
+ * @param sending_count Number of queues sending
+ * @param reconnecting_count Number of queues reconnecting
+ * @param closed_count Number of queues closed
+ * @return None
+ */
+static void
+number_of_send_queue( int *connected_count, int *sending_count, int *reconnecting_count, int *closed_count ) {
+  assert( connected_count != NULL );
+  assert( sending_count != NULL );
+  assert( reconnecting_count != NULL );
+  assert( closed_count != NULL );
+
+  debug( "Checking queue statuses." );
+
+  hash_iterator iter;
+  hash_entry *e;
+
+  *connected_count = 0;
+  *sending_count = 0;
+  *reconnecting_count = 0;
+  *closed_count = 0;
+
+  if ( send_queues == NULL ) {
+    error( "All send queues are already deleted or not created yet." );
+    return;
+  }
+
+  init_hash_iterator( send_queues, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    send_queue *sq = e->value;
+    if ( sq->server_socket != -1 ) {
+      if ( sq->data_length == 0 ) {
+          ( *connected_count )++;
+      }
+      else {
+        if ( sq->refused_count > 0 ) {
+            ( *reconnecting_count )++;
+        }
+        else {
+            ( *sending_count )++;
+        }
+      }
+    }
+    else {
+        ( *closed_count )++;
+    }
+  }
+
+  debug( "connected_count = %d, reconnecting_count = %d, sending_count = %d, closed_count = %d.",
+         *connected_count, *reconnecting_count, *sending_count, *closed_count );
+}
+
+
+/**
+ * Adds a client file descriptor receive queue.
+ * @param rq Pointer to receive queue
+ * @param fd File descriptor  
+ * @return None
+ */
+static void
+add_recv_queue_client_fd( receive_queue *rq, int fd ) {
+  assert( rq != NULL );
+  assert( fd >= 0 );
+
+  debug( "Adding a client fd to receive queue ( fd = %d, service_name = %s ).", fd, rq->service_name );
+
+  messenger_socket *socket;
+
+  socket = xmalloc( sizeof( messenger_socket ) );
+  socket->fd = fd;
+  socket->rq = rq;
+  socket->ring = NULL;
+  insert_after_dlist( rq->client_sockets, socket );
+}
+
+
+/**
+ * Accepts and sets SO_RCV_BUFFORCE or O_NONBLOCK to the provided File Descriptor (fd).
+ * @param fd File descriptor
+ * @param data Pointer to receive queue
+ * @return None
+ */
+static void
+on_accept( int fd, void *data ) {
+  receive_queue *rq = data;
+  assert( rq != NULL );
+
+  int client_fd;
+  struct sockaddr_un addr;
+
+  socklen_t addr_len = sizeof( struct sockaddr_un );
+
+  if ( ( client_fd = accept( fd, ( struct sockaddr * ) &addr, &addr_len ) ) == -1 ) {
+    error( "Failed to accept ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+    return;
+  }
+
+  if ( geteuid() == 0 ) {
+    int rmem_size = 1048576;
+    int ret = setsockopt( client_fd, SOL_SOCKET, SO_RCVBUFFORCE, ( const void * ) &rmem_size, ( socklen_t ) sizeof( rmem_size ) );
+    if ( ret < 0 ) {
+      error( "Failed to set SO_RCVBUFFORCE to %d ( %s [%d] ).", rmem_size, strerror( errno ), errno );
+      close( client_fd );
+      return;
+    }
+  }
+  int ret = fcntl( client_fd, F_SETFL, O_NONBLOCK );
+  if ( ret < 0 ) {
+    error( "Failed to set O_NONBLOCK ( %s [%d] ).", strerror( errno ), errno );
+    close( client_fd );
+    return;
+  }
+
+  add_recv_queue_client_fd( rq, client_fd );
+  set_messenger_fd_handler( client_fd, on_recv, NULL, rq );
+  if ( rq->paused ) {
+    set_readable( client_fd, false );
+  }
+  send_dump_message( MESSENGER_DUMP_RECV_CONNECTED, rq->service_name, NULL, 0 );
+}
+
+
+/**
+ * Deletes client file descriptor from receive queue. 
+ * @param rq Pointer to receive queue
+ * @param fd File descriptor
+ * @return int 0 when successfully deleted receive queue, else 1 
+ */
+static int
+del_recv_queue_client_fd( receive_queue *rq, int fd ) {
+  assert( rq != NULL );
+  assert( fd >= 0 );
+
+  messenger_socket *socket;
+  dlist_element *element;
+
+  debug( "Deleting a client fd from receive queue ( fd = %d, service_name = %s ).", fd, rq->service_name );
+
+  for ( element = rq->client_sockets->next; element; element = element->next ) {
+    socket = element->data;
+    if ( socket->fd == fd ) {
+      debug( "Deleting fd ( %d ).", fd );
+      delete_dlist_element( element );
+      if ( socket->ring != NULL ) {
+        delete_shm_ring( socket->ring );
+      }
+      xfree( socket );
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * Truncates message buffer.
+ * @param buf Message buffer
+ * @param len Length of message buffer
+ * @return None
+ */
+static void
+truncate_message_buffer( message_buffer *buf, size_t len ) {
+  assert( buf != NULL );
+
+  if ( len == 0 || buf->data_length == 0 ) {
+    return;
+  }
+
+  if ( len > buf->data_length ) {
+    len = buf->data_length;
+  }
+
+  if ( ( buf->head_offset + len ) <= buf->size ) {
+    buf->head_offset += len;
+  }
+  else {
+    memmove( buf->buffer, ( char * ) buf->buffer + buf->head_offset + len, buf->data_length - len );
+    buf->head_offset = 0;
+  }
+  buf->data_length -= len;
+}
+
+
+/**
+ * Pulls a message from receive queue without copying it. The message
+ * is left in place and stays valid until the next compaction of the
+ * buffer, which never happens while the queue is being dispatched.
+ * @param rq Pointer to receive queue
+ * @return message_header* Pointer to message in the buffer, or NULL if no complete message is queued
+ */
+static message_header *
+pull_from_recv_queue( receive_queue *rq ) {
+  assert( rq != NULL );
+
+  debug( "Pulling a message from receive queue ( service_name = %s ).", rq->service_name );
+
+  message_header *header;
+
+  if ( rq->buffer->data_length < sizeof( message_header ) ) {
+    debug( "Queue length is smaller than a message header ( queue length = %u ).", rq->buffer->data_length );
+    return NULL;
+  }
+
+  header = ( message_header * ) get_message_buffer_head( rq->buffer );
+
+  assert( header->message_length != 0 );
+  assert( header->message_length < messenger_recv_queue_length );
+  if ( rq->buffer->data_length < header->message_length ) {
+    debug( "Queue length is smaller than message length ( queue length = %u, message length = %u ).",
+           rq->buffer->data_length, header->message_length );
+    return NULL;
+  }
+
+  truncate_message_buffer( rq->buffer, header->message_length );
+  rq->stats.messages++;
+
+  debug( "A message is retrieved from receive queue ( message_type = %#x, tag = %#x, len = %u, data = %p ).",
+         header->message_type, header->tag, header->message_length - sizeof( message_header ), header->value );
+
+  return header;
+}
+
+
+/**
+ * Lookup a context from hash entry.
+ * @param transaction_id Transaction ID
+ * @return messenger_context* Pointer to message context
+ */
+static messenger_context *
+get_context( uint32_t transaction_id ) {
+  debug( "Looking up a context ( transaction_id = %#x ).", transaction_id );
+
+  return lookup_hash_entry( context_db, &transaction_id );
+}
+
+
+/**
+ * Calls message callbacks. Selects from message type and respective callback is issued.
+ * @param rq Pointer to receive queue
+ * @param message_type Type of message
+ * @param tag Tag
+ * @param data Data 
+ * @param len Data length
+ * @return None
+ */
+static void
+call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uint16_t tag, void *data, size_t len ) {
+  assert( rq != NULL );
+
+  dlist_element *element;
+  receive_queue_callback *cb;
+
+  debug( "Calling message callbacks ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
+         rq->service_name, message_type, tag, data, len );
+
+  for ( element = rq->message_callbacks->next; element; element = element->next ) {
+    cb = element->data;
+    if ( cb->message_type != message_type ) {
+      continue;
+    }
+    switch ( message_type ) {
+    case MESSAGE_TYPE_NOTIFY:
+      {
+        void ( *received_callback )( uint16_t tag, void *data, size_t len );
+        received_callback = cb->function;
+
+        debug( "Calling a callback ( %p ) for MESSAGE_TYPE_NOTIFY (%#x) ( tag = %#x, data = %p, len = %u ).",
+               cb->function, message_type, tag, data, len );
+
+        received_callback( tag, data, len );
+      }
+      break;
+    case MESSAGE_TYPE_REQUEST:
+      {
+        void ( *requested_callback )( const messenger_context_handle *handle, uint16_t tag, void *data, size_t len );
+        messenger_context_handle *handle;
+        char *requested_data;
+        size_t header_len;
+
+        requested_callback = cb->function;
+        handle = ( messenger_context_handle * ) data;
+        handle->transaction_id = ntohl( handle->transaction_id );
+        handle->service_name_len = ntohs( handle->service_name_len );
+        header_len = sizeof( messenger_context_handle ) + handle->service_name_len;
+        requested_data = ( ( char * ) data ) + header_len;
+
+        debug( "Calling a callback ( %p ) for MESSAGE_TYPE_REQUEST (%#x) ( handle = %p, tag = %#x, requested_data = %p, len = %u ).",
+               cb->function, message_type, handle, tag, requested_data, len - header_len );
+
+        requested_callback( handle, tag, ( void * ) requested_data, len - header_len );
+      }
+      break;
+    case MESSAGE_TYPE_REPLY:
+      {
+        debug( "Calling a callback ( %p ) for MESSAGE_TYPE_REPLY (%#x).", cb->function, message_type );
+
+        void ( *replied_callback )( uint16_t tag, void *data, size_t len, void *user_data );
+        messenger_context_handle *reply_handle;
+        messenger_context *context;
+
+        replied_callback = cb->function;
+        reply_handle = data;
+        reply_handle->transaction_id = ntohl( reply_handle->transaction_id );
+        reply_handle->service_name_len = ntohs( reply_handle->service_name_len );
+
+        context = get_context( reply_handle->transaction_id );
+
+        if ( NULL != context ) {
+          debug( "tag = %#x, data = %p, len = %u, user_data = %p.",
+                 tag, reply_handle->service_name, len - sizeof( messenger_context_handle ), context->user_data );
+          replied_callback( tag, reply_handle->service_name, len - sizeof( messenger_context_handle ), context->user_data );
+          delete_context( context );
+        }
+        else {
+          warn( "No context found." );
+        }
+      }
+      break;
+    default:
+      error( "Unknown message type ( %#x ).", message_type );
+      assert( 0 );
+    }
+  }
+}
+
+
+/**
+ * Passes a received message to the callbacks. Notifications are only
+ * collected for batch callbacks here and delivered by
+ * flush_message_batch(), so the message must stay in place until then.
+ * @param rq Pointer to receive queue
+ * @param header Message
+ * @return None
+ */
+static void
+dispatch_message( receive_queue *rq, message_header *header ) {
+  assert( rq != NULL );
+  assert( header != NULL );
+
+  size_t len = header->message_length - sizeof( message_header );
+
+  send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, header, header->message_length );
+  if ( header->message_type != MESSAGE_TYPE_NOTIFY ) {
+    call_message_callbacks( rq, header->message_type, header->tag, header->value, len );
+    return;
+  }
+
+  if ( rq->notify_callback_count > 0 ) {
+    call_message_callbacks( rq, header->message_type, header->tag, header->value, len );
+  }
+  if ( rq->batch_callback_count > 0 ) {
+    if ( rq->batch_count == rq->batch_size ) {
+      size_t size = rq->batch_size == 0 ? 64 : rq->batch_size * 2;
+      messenger_message *batch = xmalloc( sizeof( messenger_message ) * size );
+      if ( rq->batch != NULL ) {
+        memcpy( batch, rq->batch, sizeof( messenger_message ) * rq->batch_count );
+        xfree( rq->batch );
+      }
+      rq->batch = batch;
+      rq->batch_size = size;
+    }
+    messenger_message *message = &rq->batch[ rq->batch_count++ ];
+    message->tag = header->tag;
+    message->data = header->value;
+    message->len = len;
+  }
+}
+
+
+/**
+ * Calls batch received callbacks with the notifications collected by
+ * dispatch_message().
+ * @param rq Pointer to receive queue
+ * @return None
+ */
+static void
+flush_message_batch( receive_queue *rq ) {
+  assert( rq != NULL );
+
+  if ( rq->batch_count == 0 ) {
+    return;
+  }
+
+  debug( "Calling batch received callbacks ( service_name = %s, count = %u ).", rq->service_name, rq->batch_count );
+
+  dlist_element *element;
+  for ( element = rq->message_callbacks->next; element; element = element->next ) {
+    receive_queue_callback *cb = element->data;
+    if ( cb->message_type == MESSAGE_TYPE_NOTIFY_BATCH ) {
+      callback_message_batch_received batch_callback = cb->function;
+      batch_callback( rq->batch, rq->batch_count );
+    }
+  }
+  rq->batch_count = 0;
+}
+
+
+/**
+ * Dispatches complete messages in the receive queue buffer in place.
+ * @param rq Pointer to receive queue
+ * @return None
+ */
+static void
+dispatch_recv_queue( receive_queue *rq ) {
+  assert( rq != NULL );
+
+  message_header *header;
+
+  if ( rq->dispatching ) {
+    // Messages received by a nested call are dispatched by the outer one.
+    return;
+  }
+
+  rq->dispatching = true;
+  while ( !rq->paused && ( header = pull_from_recv_queue( rq ) ) != NULL ) {
+    dispatch_message( rq, header );
+  }
+  flush_message_batch( rq );
+  rq->dispatching = false;
+
+  if ( rq->buffer->data_length == 0 ) {
+    rq->buffer->head_offset = 0;
+  }
+}
+
+
+/**
+ * Closes a client socket of a receive queue.
+ * @param rq Pointer to receive queue
+ * @param fd File descriptor
+ * @return None
+ */
+static void
+close_recv_queue_client_fd( receive_queue *rq, int fd ) {
+  assert( rq != NULL );
+
+  send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
+  del_recv_queue_client_fd( rq, fd );
+  delete_fd_handler( fd );
+  close( fd );
+}
+
+
+/**
+ * Consumes all messages in the shared memory ring of a client socket
+ * and then lets the sender know that a wakeup is needed.
+ * @param socket Client socket
+ * @return None
+ */
+static void
+drain_shm_ring( messenger_socket *socket ) {
+  assert( socket != NULL );
+  assert( socket->ring != NULL );
+
+  receive_queue *rq = socket->rq;
+  message_header *header;
+  size_t len;
+
+  rq->dispatching = true;
+  do {
+    while ( !rq->paused && ( header = peek_shm_ring( socket->ring, &len ) ) != NULL ) {
+      if ( len < sizeof( message_header ) || header->message_length != len ) {
+        error( "Invalid message in shared memory ring ( service_name = %s, fd = %d, len = %u ).",
+               rq->service_name, socket->fd, len );
+        skip_shm_ring( socket->ring );
+        continue;
+      }
+      rq->stats.messages++;
+      rq->stats.bytes += len;
+      dispatch_message( rq, header );
+      if ( rq->batch_count > 0 ) {
+        // Records collected for batch callbacks are released after the
+        // batch is delivered.
+        skip_shm_ring( socket->ring );
+      }
+      else {
+        release_shm_ring( socket->ring );
+      }
+    }
+    flush_message_batch( rq );
+    release_shm_ring( socket->ring );
+    // A paused queue asks for no wakeup, so that the sender sees the
+    // ring fill up.
+  } while ( !rq->paused && !wait_shm_ring( socket->ring ) );
+  rq->dispatching = false;
+}
+
+
+/**
+ * Attaches a client socket to the shared memory ring offered by the
+ * sender, and answers whether the ring is accepted. From then on the
+ * socket only carries wakeups.
+ * @param rq Pointer to receive queue
+ * @param fd File descriptor
+ * @param ring_fd File descriptor of the ring
+ * @param header Message which came with ring_fd
+ * @param len Length of the message
+ * @return None
+ */
+static void
+accept_shm_transport( receive_queue *rq, int fd, int ring_fd, const message_header *header, size_t len ) {
+  assert( rq != NULL );
+  assert( header != NULL );
+
+  messenger_socket *socket = NULL;
+  dlist_element *element;
+
+  for ( element = rq->client_sockets->next; element != NULL; element = element->next ) {
+    if ( ( ( messenger_socket * ) element->data )->fd == fd ) {
+      socket = element->data;
+      break;
+    }
+  }
+
+  if ( socket != NULL && socket->ring == NULL && len == sizeof( message_header )
+       && header->message_type == MESSAGE_TYPE_SHM_SETUP ) {
+    socket->ring = attach_shm_ring( ring_fd );
+  }
+  if ( socket == NULL || socket->ring == NULL ) {
+    warn( "Refusing a shared memory ring ( service_name = %s, fd = %d ).", rq->service_name, fd );
+    close( ring_fd );
+    send_control_message( fd, MESSAGE_TYPE_SHM_ACK, 0, -1 );
+    return;
+  }
+
+  debug( "Attached to a shared memory ring ( service_name = %s, fd = %d ).", rq->service_name, fd );
+
+  // The sender holds its messages until it gets the answer, so the
+  // ring is still empty and the first message always comes with a wakeup.
+  wait_shm_ring( socket->ring );
+  set_messenger_fd_handler( fd, on_shm_recv, NULL, socket );
+  if ( rq->paused ) {
+    set_readable( fd, false );
+  }
+  if ( !send_control_message( fd, MESSAGE_TYPE_SHM_ACK, 1, -1 ) ) {
+    error( "Failed to accept a shared memory ring ( service_name = %s, fd = %d ).", rq->service_name, fd );
+  }
+}
+
+
+/**
+ * Returns a file descriptor passed with a received message.
+ * @param msg Received message
+ * @return int File descriptor, or -1 if none is passed
+ */
+static int
+get_passed_fd( struct msghdr *msg ) {
+  assert( msg != NULL );
+
+  struct cmsghdr *cmsg;
+  int passed_fd = -1;
+
+  for ( cmsg = CMSG_FIRSTHDR( msg ); cmsg != NULL; cmsg = CMSG_NXTHDR( msg, cmsg ) ) {
+    if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+         && cmsg->cmsg_len == CMSG_LEN( sizeof( int ) ) ) {
+      memcpy( &passed_fd, CMSG_DATA( cmsg ), sizeof( int ) );
+    }
+  }
+
+  return passed_fd;
+}
+
+
+/**
+ * Receives data from remote directly into the receive queue and
+ * dispatches complete messages in place. Callbacks get pointers into
+ * the queue buffer, so the buffer is compacted at most once per call
+ * and never while callbacks are running.
+ * @param fd File descriptor 
+ * @param data Pointer to receive queue
+ * @return None
+ */
+static void
+on_recv( int fd, void *data ) {
+  receive_queue *rq = data;
+  assert( rq != NULL );
+  assert( fd >= 0 );
+
+  if ( rq->paused ) {
+    return;
+  }
+
+  debug( "Receiving data from remote ( fd = %d, service_name = %s ).", fd, rq->service_name );
+
+  ssize_t recv_len;
+  void *tail;
+  struct iovec iov;
+  struct msghdr msg;
+  union {
+    struct cmsghdr align;
+    char buf[ CMSG_SPACE( sizeof( int ) ) ];
+  } control;
+
+  if ( !rq->dispatching && message_buffer_tail_bytes( rq->buffer ) < MESSENGER_RECV_BUFFER ) {
+    rq->stats.copied_bytes += compact_message_buffer( rq->buffer );
+  }
+
+  // A packet may carry several messages. Only read while a packet of
+  // the maximum length fits, since recv() truncates a packet otherwise.
+  while ( message_buffer_tail_bytes( rq->buffer ) >= MESSENGER_RECV_BUFFER ) {
+    tail = ( char * ) get_message_buffer_head( rq->buffer ) + rq->buffer->data_length;
+    iov.iov_base = tail;
+    iov.iov_len = MESSENGER_RECV_BUFFER;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof( control.buf );
+    recv_len = recvmsg( fd, &msg, MSG_CMSG_CLOEXEC );
+    rq->stats.syscalls++;
+    if ( recv_len == -1 ) {
+      if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+        error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+        close_recv_queue_client_fd( rq, fd );
+      }
+      else {
+        debug( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+      }
+      break;
+    }
+    else if ( recv_len == 0 ) {
+      debug( "Connection closed ( fd = %d, service_name = %s ).", fd, rq->service_name );
+      close_recv_queue_client_fd( rq, fd );
+      break;
+    }
+
+    int ring_fd = msg.msg_controllen > 0 ? get_passed_fd( &msg ) : -1;
+    if ( ring_fd >= 0 ) {
+      // Set up packets are not queued. Anything after them arrives
+      // through the ring.
+      accept_shm_transport( rq, fd, ring_fd, tail, ( size_t ) recv_len );
+      break;
+    }
+
+    rq->buffer->data_length += ( size_t ) recv_len;
+    rq->stats.bytes += ( uint64_t ) recv_len;
+
+    debug( "Pushing messages to receive queue ( service_name = %s, len = %u ).", rq->service_name, recv_len );
+  }
+
+  dispatch_recv_queue( rq );
+}
+
+
+/**
+ * Receives wakeups of the shared memory transport and dispatches the
+ * messages in the ring in place.
+ * @param fd File descriptor
+ * @param data Client socket
+ * @return None
+ */
+static void
+on_shm_recv( int fd, void *data ) {
+  messenger_socket *socket = data;
+  assert( socket != NULL );
+  assert( socket->ring != NULL );
+
+  receive_queue *rq = socket->rq;
+  if ( rq->dispatching || rq->paused ) {
+    // The socket stays readable, so the ring is drained once the outer
+    // dispatch returns.
+    return;
+  }
+
+  message_header header;
+  ssize_t recv_len = recv( fd, &header, sizeof( header ), 0 );
+  rq->stats.syscalls++;
+  bool closed = recv_len == 0 || ( recv_len == -1 && errno != EAGAIN && errno != EWOULDBLOCK );
+
+  drain_shm_ring( socket );
+  if ( closed ) {
+    debug( "Connection closed ( fd = %d, service_name = %s ).", fd, rq->service_name );
+    close_recv_queue_client_fd( rq, fd );
+  }
+  dispatch_recv_queue( rq );
+}
+
+/**
+ * Closes the connection of a send queue and schedules reconnection.
+ * @param sq Pointer to send queue
+ * @return None
  */
 static void
-call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uint16_t tag, void *data, size_t len ) {
-  assert( rq != NULL );
+close_send_queue_socket( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->server_socket != -1 );
+
+  send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
+  delete_fd_handler( sq->server_socket );
+  close( sq->server_socket );
+  sq->server_socket = -1;
+  stop_shm_transport( sq );
+
+  if ( sq->reconnect_element == NULL ) {
+    sq->reconnect_element = insert_after_dlist( reconnecting_send_queues, sq );
+  }
+}
+
+
+/**
+ * Builds an I/O vector covering whole messages at the heads of the
+ * lanes of a send queue, higher priority lanes first. A lane of lower
+ * priority is only taken once the lanes above it fit entirely. The
+ * total length never exceeds MESSENGER_RECV_BUFFER so that the receiver
+ * can take the packet in a single recv().
+ * @param sq Pointer to send queue
+ * @param iov I/O vector to be filled in
+ * @param iovcnt Number of I/O vector elements filled in
+ * @param lengths Number of bytes covered in each lane
+ * @param messages Number of messages covered in each lane
+ * @return size_t Total length of the I/O vector
+ */
+static size_t
+collect_send_queue_iovec( send_queue *sq, struct iovec *iov, int *iovcnt, size_t *lengths, uint64_t *messages ) {
+  assert( sq != NULL );
+  assert( iov != NULL );
+  assert( iovcnt != NULL );
+  assert( lengths != NULL );
+  assert( messages != NULL );
+
+  send_queue_chunk *chunk;
+  size_t total = 0;
+  bool full = false;
+
+  *iovcnt = 0;
+  for ( int i = MESSENGER_PRIORITY_LANES - 1; i >= 0; i-- ) {
+    lengths[ i ] = 0;
+    messages[ i ] = 0;
+    for ( chunk = sq->lanes[ i ].head_chunk; chunk != NULL && !full; chunk = chunk->next ) {
+      if ( *iovcnt == MESSENGER_SEND_IOV_MAX ) {
+        full = true;
+        break;
+      }
+      size_t offset = chunk->head;
+      while ( offset < chunk->tail ) {
+        message_header *header = ( message_header * ) ( chunk->data + offset );
+        if ( total + ( offset - chunk->head ) + header->message_length > MESSENGER_RECV_BUFFER ) {
+          break;
+        }
+        offset += header->message_length;
+        messages[ i ]++;
+      }
+      if ( offset > chunk->head ) {
+        iov[ *iovcnt ].iov_base = chunk->data + chunk->head;
+        iov[ *iovcnt ].iov_len = offset - chunk->head;
+        total += iov[ *iovcnt ].iov_len;
+        lengths[ i ] += iov[ *iovcnt ].iov_len;
+        ( *iovcnt )++;
+      }
+      if ( offset < chunk->tail ) {
+        full = true;
+      }
+    }
+  }
+
+  return total;
+}
+
+
+/**
+ * Sends a dump message for each message in an I/O vector.
+ * @param sq Pointer to send queue
+ * @param iov I/O vector
+ * @param iovcnt Number of I/O vector elements
+ * @return None
+ */
+static void
+dump_sent_messages( send_queue *sq, const struct iovec *iov, int iovcnt ) {
+  for ( int i = 0; i < iovcnt; i++ ) {
+    size_t offset = 0;
+    while ( offset < iov[ i ].iov_len ) {
+      message_header *header = ( message_header * ) ( ( char * ) iov[ i ].iov_base + offset );
+      send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, header, header->message_length );
+      offset += header->message_length;
+    }
+  }
+}
+
+
+/**
+ * Drops all messages in a send queue.
+ * @param sq Pointer to send queue
+ * @return None
+ */
+static void
+drop_send_queue_data( send_queue *sq ) {
+  assert( sq != NULL );
+
+  for ( int i = 0; i < MESSENGER_PRIORITY_LANES; i++ ) {
+    send_queue_lane *lane = &sq->lanes[ i ];
+    sq->stats.dropped += lane->stats.queued_messages;
+    consume_send_queue( sq, lane, lane->data_length, lane->stats.queued_messages );
+  }
+  update_send_queue_pressure( sq );
+}
+
+
+/**
+ * Sends data to remote. All pending messages, up to the size of a
+ * packet, are written with a single sendmsg() call.
+ * @param fd File descriptor
+ * @param data Pointer to send queue
+ * @return None
+ */
+static void
+on_send( int fd, void *data ) {
+  send_queue *sq = data;
+  assert( sq != NULL );
+  assert( fd >= 0 );
+
+  debug( "Sending data to remote ( fd = %d, service_name = %s, data_length = %u ).",
+         fd, sq->service_name, sq->data_length );
+
+  if ( sq->data_length == 0 ) {
+    set_writable( fd, false );
+    return;
+  }
+
+  struct iovec iov[ MESSENGER_SEND_IOV_MAX ];
+  struct msghdr msg;
+  int iovcnt;
+  size_t lengths[ MESSENGER_PRIORITY_LANES ];
+  uint64_t messages[ MESSENGER_PRIORITY_LANES ];
+  size_t send_len = collect_send_queue_iovec( sq, iov, &iovcnt, lengths, messages );
+  if ( iovcnt == 0 ) {
+    // No message at the head fits in a packet, so nothing would ever be
+    // sent.
+    error( "Dropping %u bytes data in send queue ( service_name = %s ).", sq->data_length, sq->service_name );
+    drop_send_queue_data( sq );
+    set_writable( fd, false );
+    return;
+  }
+
+  memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = iov;
+  msg.msg_iovlen = ( size_t ) iovcnt;
+
+  ssize_t sent_len = sendmsg( fd, &msg, MSG_DONTWAIT );
+  sq->stats.syscalls++;
+  if ( sent_len == -1 ) {
+    int err = errno;
+    if ( err == EAGAIN || err == EWOULDBLOCK ) {
+      return;
+    }
+    error( "Failed to send ( service_name = %s, fd = %d, errno = %s [%d] ).",
+           sq->service_name, fd, strerror( err ), err );
+    close_send_queue_socket( sq );
+    sq->refused_count = 0;
+    if ( err == EMSGSIZE || err == ENOBUFS || err == ENOMEM ) {
+      warn( "Dropping %u bytes data in send queue ( service_name = %s ).", sq->data_length, sq->service_name );
+      drop_send_queue_data( sq );
+    }
+    return;
+  }
+  // Packets are sent atomically on SOCK_SEQPACKET sockets.
+  assert( ( size_t ) sent_len == send_len );
+
+  if ( messenger_dump_enabled() ) {
+    dump_sent_messages( sq, iov, iovcnt );
+  }
+  for ( int i = 0; i < MESSENGER_PRIORITY_LANES; i++ ) {
+    if ( lengths[ i ] > 0 ) {
+      sq->lanes[ i ].stats.messages += messages[ i ];
+      sq->stats.messages += messages[ i ];
+      consume_send_queue( sq, &sq->lanes[ i ], lengths[ i ], messages[ i ] );
+    }
+  }
+  sq->stats.bytes += ( uint64_t ) sent_len;
+  if ( sq->congested ) {
+    update_send_queue_pressure( sq );
+  }
+
+  if ( sq->data_length == 0 ) {
+    set_writable( fd, false );
+  }
+}
+
+
+/**
+ * Detects disconnection of a send queue. The only data peers send
+ * over a send queue connection is the answer to a shared memory ring
+ * setup, so readability means otherwise that the peer has gone.
+ * @param fd File descriptor
+ * @param data Pointer to send queue
+ * @return None
+ */
+static void
+on_send_queue_readable( int fd, void *data ) {
+  send_queue *sq = data;
+  assert( sq != NULL );
+
+  message_header header;
+  ssize_t len = recv( fd, &header, sizeof( header ), 0 );
+  if ( len <= 0 ) {
+    close_send_queue_socket( sq );
+    return;
+  }
+
+  if ( len == ( ssize_t ) sizeof( header ) && header.message_type == MESSAGE_TYPE_SHM_ACK
+       && sq->shm_state == SHM_STATE_PENDING ) {
+    finish_shm_transport_setup( sq, header.tag != 0 );
+    return;
+  }
+
+  warn( "Unexpected data on a send queue ( service_name = %s, fd = %d ).", sq->service_name, fd );
+}
+
+
+/**
+ * Retries connecting send queues whose reconnection time has come.
+ * Only disconnected send queues are visited.
+ * @param None
+ * @return None
+ */
+static void
+reconnect_send_queues( void ) {
+  struct timespec now;
+  dlist_element *element, *next_element;
+
+  if ( reconnecting_send_queues == NULL || reconnecting_send_queues->next == NULL ) {
+    return;
+  }
+
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    return;
+  }
+
+  for ( element = reconnecting_send_queues->next; element != NULL; element = next_element ) {
+    next_element = element->next;
+    send_queue *sq = element->data;
+
+    if ( ( sq->refused_count > 0 ) && ( sq->reconnect_at.tv_sec > now.tv_sec ) ) {
+      continue;
+    }
+    if ( send_queue_connect( sq ) == -1 ) {
+      return;
+    }
+  }
+}
+
+
+/**
+ * Moves messages held in send queues to their shared memory rings as
+ * far as the services have made room.
+ * @param None
+ * @return None
+ */
+static void
+move_held_send_queues( void ) {
+  dlist_element *e, *next;
+  for ( e = holding_send_queues->next; e != NULL; e = next ) {
+    next = e->next;
+    move_send_queue_to_shm_ring( e->data );
+  }
+}
+
+
+/**
+ * Publishes the shared memory rings which have been written since the
+ * last iteration of the event loop.
+ * @param None
+ * @return None
+ */
+static void
+publish_shm_transports( void ) {
+  while ( publishing_send_queues != NULL && publishing_send_queues->next != NULL ) {
+    publish_shm_transport( publishing_send_queues->next->data );
+  }
+}
+
+
+/**
+ * Calculates how long the event loop may block.
+ * @param None
+ * @return int Timeout in milliseconds
+ */
+static int
+get_run_once_timeout( void ) {
+  int timeout_msec = messenger_max_timeout_msec;
+  struct timespec timeout;
+
+  if ( external_callback != NULL ) {
+    return 0;
+  }
+
+  if ( get_next_timer_event_timeout( &timeout ) ) {
+    if ( timeout.tv_sec < messenger_max_timeout_msec / 1000 ) {
+      int msec = ( int ) timeout.tv_sec * 1000 + ( int ) ( ( timeout.tv_nsec + 999999 ) / 1000000 );
+      if ( msec < timeout_msec ) {
+        timeout_msec = msec;
+      }
+    }
+  }
+
+  if ( ( congested_shm_send_queues > 0 || holding_send_queues->next != NULL )
+       && timeout_msec > MESSENGER_SHM_PRESSURE_POLL_MSEC ) {
+    timeout_msec = MESSENGER_SHM_PRESSURE_POLL_MSEC;
+  }
+
+  if ( context_heap_count > 0 ) {
+    struct timespec now;
+    if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+      return 0;
+    }
+    const struct timespec *deadline = &context_heap[ 0 ]->deadline;
+    if ( deadline->tv_sec < now.tv_sec || ( deadline->tv_sec == now.tv_sec && deadline->tv_nsec <= now.tv_nsec ) ) {
+      return 0;
+    }
+    if ( deadline->tv_sec - now.tv_sec < messenger_max_timeout_msec / 1000 + 1 ) {
+      int msec = ( int ) ( deadline->tv_sec - now.tv_sec ) * 1000 + ( int ) ( ( deadline->tv_nsec - now.tv_nsec + 999999 ) / 1000000 );
+      if ( msec < timeout_msec ) {
+        timeout_msec = msec;
+      }
+    }
+  }
+
+  if ( reconnecting_send_queues != NULL && reconnecting_send_queues->next != NULL ) {
+    struct timespec now;
+    if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+      return 0;
+    }
+    dlist_element *element;
+    for ( element = reconnecting_send_queues->next; element != NULL; element = element->next ) {
+      send_queue *sq = element->data;
+      if ( sq->refused_count == 0 || sq->reconnect_at.tv_sec <= now.tv_sec ) {
+        return 0;
+      }
+      if ( sq->reconnect_at.tv_sec - now.tv_sec < messenger_max_timeout_msec / 1000 ) {
+        int msec = ( int ) ( sq->reconnect_at.tv_sec - now.tv_sec ) * 1000;
+        if ( msec < timeout_msec ) {
+          timeout_msec = msec;
+        }
+      }
+    }
+  }
+
+  return timeout_msec;
+}
+
+
+/**
+ * Marks a file descriptor of the external fd_set callbacks as readable.
+ * @param fd File descriptor
+ * @param data Unused
+ * @return None
+ */
+static void
+on_external_fd_readable( int fd, void *data ) {
+  UNUSED( data );
+
+#define sizeof( X ) ( ( int ) sizeof( X ) )
+  FD_SET( fd, &external_ready_read_set );
+#undef sizeof
+}
+
+
+/**
+ * Marks a file descriptor of the external fd_set callbacks as writable.
+ * @param fd File descriptor
+ * @param data Unused
+ * @return None
+ */
+static void
+on_external_fd_writable( int fd, void *data ) {
+  UNUSED( data );
+
+#define sizeof( X ) ( ( int ) sizeof( X ) )
+  FD_SET( fd, &external_ready_write_set );
+#undef sizeof
+}
+
+
+/**
+ * Compatibility shim for set_fd_set_callback(). Asks the external
+ * callback for its fd_sets and mirrors any difference from the previous
+ * iteration into the event handler. Nothing is touched unless the sets
+ * have changed.
+ * @param None
+ * @return None
+ */
+static void
+update_external_fds( void ) {
+  fd_set read_set, write_set;
+
+  FD_ZERO( &read_set );
+  FD_ZERO( &write_set );
+  if ( external_fd_set != NULL ) {
+    external_fd_set( &read_set, &write_set );
+  }
+
+  if ( memcmp( &read_set, &external_read_set, sizeof( fd_set ) ) == 0
+       && memcmp( &write_set, &external_write_set, sizeof( fd_set ) ) == 0 ) {
+    return;
+  }
+
+  for ( int fd = 0; fd < FD_SETSIZE; fd++ ) {
+    bool was_read = FD_ISSET( fd, &external_read_set );
+    bool was_write = FD_ISSET( fd, &external_write_set );
+    bool is_read = FD_ISSET( fd, &read_set );
+    bool is_write = FD_ISSET( fd, &write_set );
+
+    if ( was_read == is_read && was_write == is_write ) {
+      continue;
+    }
+    if ( !is_read && !is_write ) {
+      delete_fd_handler( fd );
+      continue;
+    }
+    if ( !was_read && !was_write ) {
+      set_fd_handler( fd, on_external_fd_readable, NULL, on_external_fd_writable, NULL );
+    }
+    set_readable( fd, is_read );
+    set_writable( fd, is_write );
+  }
+
+  memcpy( &external_read_set, &read_set, sizeof( fd_set ) );
+  memcpy( &external_write_set, &write_set, sizeof( fd_set ) );
+}
+
+
+/**
+ * Runs one iteration of the event loop. Waits until a registered file
+ * descriptor becomes ready or the next timer event expires.
+ * @param None
+ * @return bool True on success, else False
+ */
+static bool
+run_once( void ) {
+  int ready_count;
+
+  execute_timer_events();
+  expire_contexts();
+
+  if ( external_callback != NULL ) {
+    // Cleared first, so that the callback may set itself again.
+    void ( *callback )( void ) = external_callback;
+    external_callback = NULL;
+    callback();
+  }
+
+  reconnect_send_queues();
+  move_held_send_queues();
+  publish_shm_transports();
+  update_shm_send_queue_pressure();
+  update_external_fds();
+
+  ready_count = run_event_handler_once( get_run_once_timeout() );
+  if ( ready_count == -1 ) {
+    error( "Failed to run event handler." );
+    running = false;
+    return false;
+  }
+  if ( ready_count == 0 ) {
+    return true;
+  }
+
+  if ( external_check_fd_isset != NULL ) {
+    external_check_fd_isset( &external_ready_read_set, &external_ready_write_set );
+    FD_ZERO( &external_ready_read_set );
+    FD_ZERO( &external_ready_write_set );
+  }
+
+  return true;
+}
+
+
+/**
+ * Flushes the messenger.
+ * @param None
+ * @return None
+ */
+int
+flush_messenger() {
+  int connected_count, sending_count, reconnecting_count, closed_count;
+
+  debug( "Flushing send queues." );
 
-  dlist_element *element;
-  receive_queue_callback *cb;
+  publish_shm_transports();
+  while ( true ) {
+    number_of_send_queue( &connected_count, &sending_count, &reconnecting_count, &closed_count );
+    if ( sending_count == 0 ) {
+      return reconnecting_count;
+    }
+    run_once();
+  }
+}
 
-  debug( "Calling message callbacks ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
-         rq->service_name, message_type, tag, data, len );
 
-  for ( element = rq->message_callbacks->next; element; element = element->next ) {
-    cb = element->data;
-    if ( cb->message_type != message_type ) {
-      continue;
+/**
+ * Starts messenger.
+ * @param None
+ * @return None
+ */
+bool
+start_messenger() {
+  debug( "Starting messenger." );
+
+  running = true;
+  while ( running ) {
+    if ( !run_once() ) {
+      error( "Failed to run main loop." );
+      return false;
     }
-    switch ( message_type ) {
-    case MESSAGE_TYPE_NOTIFY:
-      {
-        void ( *received_callback )( uint16_t tag, void *data, size_t len );
-        received_callback = cb->function;
+  }
 
-        debug( "Calling a callback ( %p ) for MESSAGE_TYPE_NOTIFY (%#x) ( tag = %#x, data = %p, len = %u ).",
-               cb->function, message_type, tag, data, len );
+  debug( "Messenger terminated." );
 
-        received_callback( tag, data, len );
-      }
-      break;
-    case MESSAGE_TYPE_REQUEST:
-      {
-        void ( *requested_callback )( const messenger_context_handle *handle, uint16_t tag, void *data, size_t len );
-        messenger_context_handle *handle;
-        char *requested_data;
-        size_t header_len;
+  return true;
+}
 
-        requested_callback = cb->function;
-        handle = ( messenger_context_handle * ) data;
-        handle->transaction_id = ntohl( handle->transaction_id );
-        handle->service_name_len = ntohs( handle->service_name_len );
-        header_len = sizeof( messenger_context_handle ) + handle->service_name_len;
-        requested_data = ( ( char * ) data ) + header_len;
 
-        debug( "Calling a callback ( %p ) for MESSAGE_TYPE_REQUEST (%#x) ( handle = %p, tag = %#x, requested_data = %p, len = %u ).",
-               cb->function, message_type, handle, tag, requested_data, len - header_len );
+/**
+ * Terminates the messenger.
+ * @param None
+ * @return None
+ */
+bool
+stop_messenger() {
+  running = false;
 
-        requested_callback( handle, tag, ( void * ) requested_data, len - header_len );
-      }
-      break;
-    case MESSAGE_TYPE_REPLY:
-      {
-        debug( "Calling a callback ( %p ) for MESSAGE_TYPE_REPLY (%#x).", cb->function, message_type );
+  debug( "Terminating messenger." );
 
-        void ( *replied_callback )( uint16_t tag, void *data, size_t len, void *user_data );
-        messenger_context_handle *reply_handle;
-        messenger_context *context;
+  return true;
+}
 
-        replied_callback = cb->function;
-        reply_handle = data;
-        reply_handle->transaction_id = ntohl( reply_handle->transaction_id );
-        reply_handle->service_name_len = ntohs( reply_handle->service_name_len );
 
-        context = get_context( reply_handle->transaction_id );
+/**
+ * Starts messenger dump.
+ * @param dump_app_name Dump application name
+ * @param dump_service_name Dump service name
+ * @return None
+ */
+void
+start_messenger_dump( const char *dump_app_name, const char *dump_service_name ) {
+  assert( dump_app_name != NULL );
+  assert( dump_service_name != NULL );
 
-        if ( NULL != context ) {
-          debug( "tag = %#x, data = %p, len = %u, user_data = %p.",
-                 tag, reply_handle->service_name, len - sizeof( messenger_context_handle ), context->user_data );
-          replied_callback( tag, reply_handle->service_name, len - sizeof( messenger_context_handle ), context->user_data );
-          delete_context( context );
-        }
-        else {
-          warn( "No context found." );
-        }
-      }
-      break;
-    default:
-      error( "Unknown message type ( %#x ).", message_type );
-      assert( 0 );
-    }
+  debug( "Starting a message dumper ( dhead of the unconsumed part of the messagedump_service_name = %s ).",
+         dump_app_name, dump_service_name );
+
+  if ( messenger_dump_enabled() ) {
+    stop_messenger_dump();
   }
+  _dump_service_name = xstrdup( dump_service_name );
+  _dump_app_name = xstrdup( dump_app_name );
 }
 
 
 /**
- * Receives data from remote.
- * @param fd File descriptor 
- * @param rq Pointer to receive queue
+ * Stops messenger dump.
+ * @param None
  * @return None
  */
-static void
-on_recv( int fd, receive_queue *rq ) {
-  assert( rq != NULL );
-  assert( fd >= 0 );
+void
+stop_messenger_dump( void ) {
+  assert( _dump_service_name != NULL );
+  assert( _dump_app_name != NULL );
 
-  debug( "Receiving data from remote ( fd = %d, service_name = %s ).", fd, rq->service_name );
+  debug( "Terminating a message dumper ( dump_app_name = %s, dump_service_name = %s ).",
+         _dump_app_name, _dump_service_name );
 
-  uint8_t buf[ MESSENGER_RECV_BUFFER ];
-  ssize_t recv_len;
-  size_t buf_len;
-  uint8_t message_type;
-  uint16_t tag;
+  assert( send_queues != NULL );
+  send_queue *sq = lookup_hash_entry( send_queues, _dump_service_name );
+  if ( sq != NULL ) {
+    delete_send_queue( sq );
+  }
 
-  while ( ( buf_len = message_buffer_remain_bytes( rq->buffer ) ) > messenger_recv_queue_reserved ) {
-    if ( buf_len > sizeof( buf ) ) {
-      buf_len = sizeof( buf );
-    }
-    recv_len = recv( fd, buf, buf_len, 0 );
-    if ( recv_len == -1 ) {
-      if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
-        error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
-        send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
-        del_recv_queue_client_fd( rq, fd );
-        close( fd );
-      }
-      else {
-        debug( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
-      }
-      break;
-    }
-    else if ( recv_len == 0 ) {
-      debug( "Connection closed ( fd = %d, service_name = %s ).", fd, rq->service_name );
-      send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
-      del_recv_queue_client_fd( rq, fd );
-      close( fd );
-      break;
-    }
+  xfree( _dump_service_name );
+  _dump_service_name = NULL;
 
-    if ( !write_message_buffer( rq->buffer, buf, ( size_t ) recv_len ) ) {
-      warn( "Could not write a message to receive queue due to overflow ( service_name = %s, len = %u ).", rq->service_name, recv_len );
-      send_dump_message( MESSENGER_DUMP_RECV_OVERFLOW, rq->service_name, buf, ( uint32_t ) recv_len );
-    }
-    else {
-      debug( "Pushing a message to receive queue ( service_name = %s, len = %u ).", rq->service_name, recv_len );
-      send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, buf, ( uint32_t ) recv_len );
-    }
-  }
+  xfree( _dump_app_name );
+  _dump_app_name = NULL;
+}
 
-  while ( pull_from_recv_queue( rq, &message_type, &tag, buf, &buf_len, sizeof( buf ) ) == 1 ) {
-    call_message_callbacks( rq, message_type, tag, buf, buf_len );
+
+/**
+ * Enables messenger dump.
+ * @param None
+ * @return bool
+ */
+bool
+messenger_dump_enabled( void ) {
+  if ( _dump_service_name != NULL && _dump_app_name != NULL ) {
+    return true;
   }
+
+  return false;
 }
 
+
 /**
- * Checks fd_set for data received from remote.
- * @param read_set Pointer to read set
+ * Sets external fd_set callback.
+ * @param callback Callback function
  * @return None
  */
-static void
-check_recv_queue_fd_isset( fd_set *read_set ) {
-  assert( read_set != NULL );
+void
+set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
+  debug( "Setting an external FD_SET callback ( callback = %p ).", callback );
 
-  hash_iterator iter;
-  hash_entry *e;
+  external_fd_set = callback;
+}
 
-  debug( "Checking a fd_set for receiving data from remotes ( read_set = %p ).", read_set );
 
-  assert( receive_queues != NULL );
+/**
+ * Sets external fd_isset callback.
+ * @param callback Callback function
+ * @return None
+ */
+void
+set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
+  debug( "Setting an external FD_ISSET callback ( callback = %p ).", callback );
 
-  init_hash_iterator( receive_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    receive_queue *rq = e->value;
-    if ( FD_ISSET( rq->listen_socket, read_set ) ) {
-      on_accept( rq->listen_socket, rq );
-    }
-    dlist_element *element = rq->client_sockets->next, *next_element;
-    while ( element != NULL ) {
-      next_element = element->next;
-      messenger_socket *socket_item = element->data;
-      if ( FD_ISSET( socket_item->fd, read_set ) ) {
-        on_recv( socket_item->fd, rq );
-      }
-      element = next_element;
-    }
+  external_check_fd_isset = callback;
+}
+
+
+/**
+ * Sets external callback which can be called when the Messenger initializes or terminates.
+ * @param callback Callback function
+ * @return bool
+ */
+bool
+set_external_callback( void ( *callback ) ( void ) ) {
+  if ( external_callback != NULL ) {
+    return false;
   }
+
+  external_callback = callback;
+
+  return true;
 }
 
 
 /**
- * Sets send queue to fd_set.
- * @param read_set Pointer to read set
- * @param write_set Pointer to write set
- * @return None
+ * Retrieves statistics of a receive queue.
+ * @param service_name Name of service
+ * @param stats Pointer to statistics to be filled in
+ * @return bool True if the receive queue is found, else False
  */
-static void
-set_send_queue_fd_set( fd_set *read_set, fd_set *write_set ) {
-  hash_iterator iter;
-  hash_entry *e;
+bool
+get_receive_queue_stats( const char *service_name, messenger_queue_stats *stats ) {
+  assert( service_name != NULL );
+  assert( stats != NULL );
 
-  debug( "Setting fds to fd_sets ( read_set = %p, write_set = %p ).", read_set, write_set );
+  if ( receive_queues == NULL ) {
+    return false;
+  }
 
-  assert( send_queues != NULL );
+  receive_queue *rq = lookup_hash_entry( receive_queues, service_name );
+  if ( rq == NULL ) {
+    debug( "No receive queue found ( service_name = %s ).", service_name );
+    return false;
+  }
 
-  init_hash_iterator( send_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    send_queue *sq = e->value;
-    int ret_val = 1;
-    struct timespec now;
+  memcpy( stats, &rq->stats, sizeof( messenger_queue_stats ) );
 
-    assert( clock_gettime( CLOCK_MONOTONIC, &now ) == 0 );
+  return true;
+}
 
-    if ( ( sq->refused_count > 0 ) && ( sq->reconnect_at.tv_sec > now.tv_sec ) ) {
-      continue;
-    }
 
-    if ( sq->server_socket == -1 ) {
-      ret_val = send_queue_connect( sq );
-    }
-    switch ( ret_val ) {
-    case 0: // refused
-      break;
+/**
+ * Stops or resumes receiving messages for a service. While paused,
+ * client sockets are not read, so that senders see their send queues
+ * fill up and get congested. Messages already received are delivered
+ * when receiving is resumed.
+ * @param service_name Name of service
+ * @param paused True to stop receiving, False to resume
+ * @return bool True if the receive queue is found, else False
+ */
+bool
+set_receive_queue_paused( const char *service_name, bool paused ) {
+  assert( service_name != NULL );
+
+  if ( receive_queues == NULL ) {
+    return false;
+  }
+
+  receive_queue *rq = lookup_hash_entry( receive_queues, service_name );
+  if ( rq == NULL ) {
+    debug( "No receive queue found ( service_name = %s ).", service_name );
+    return false;
+  }
+  if ( rq->paused == paused ) {
+    return true;
+  }
+
+  debug( "%s receiving messages ( service_name = %s ).", paused ? "Pausing" : "Resuming", service_name );
 
-    case 1: // connected
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-      FD_SET( sq->server_socket, read_set ); // for disconnect detection.
-#undef sizeof
-      if ( sq->buffer->data_length > 0 ) {
-        debug( "Adding a fd ( %d ) to fd_sets.", sq->server_socket );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-        FD_SET( sq->server_socket, write_set );
-#undef sizeof
-      }
-      break;
+  rq->paused = paused;
+  dlist_element *element;
+  for ( element = rq->client_sockets->next; element != NULL; element = element->next ) {
+    set_readable( ( ( messenger_socket * ) element->data )->fd, !paused );
+  }
+  if ( paused || rq->dispatching ) {
+    // A dispatch in progress goes on by itself once resumed.
+    return true;
+  }
 
-    case -1: // error
-      return;
+  for ( element = rq->client_sockets->next; element != NULL && !rq->paused; element = element->next ) {
+    messenger_socket *socket = element->data;
+    if ( socket->ring != NULL ) {
+      drain_shm_ring( socket );
     }
   }
+  dispatch_recv_queue( rq );
+
+  return true;
 }
 
 
 /**
- * Sends data to remote.
- * @param fd File descriptor
- * @param sq Pointer to send queue
- * @return None
+ * Retrieves statistics of a send queue. syscalls / messages gives the
+ * number of send system calls per message.
+ * @param service_name Name of service
+ * @param stats Pointer to statistics to be filled in
+ * @return bool True if the send queue is found, else False
  */
-static void
-on_send( int fd, send_queue *sq ) {
-  assert( sq != NULL );
-  assert( fd >= 0 );
-
-  debug( "Sending data to remote ( fd = %d, service_name = %s, buffer = %p, data_length = %u ).",
-         fd, sq->service_name, get_message_buffer_head( sq->buffer ), sq->buffer->data_length );
+bool
+get_send_queue_stats( const char *service_name, messenger_queue_stats *stats ) {
+  assert( service_name != NULL );
+  assert( stats != NULL );
 
-  if ( sq->buffer->data_length < sizeof( message_header ) ) {
-    return;
+  if ( send_queues == NULL ) {
+    return false;
   }
 
-  message_header *header;
-  size_t send_len;
-  ssize_t sent_len;
-  size_t sent_total = 0;
-  int sent_count = 0;
-
-  while ( ( ( sq->buffer->data_length - sent_total ) >= sizeof( message_header ) ) && ( sent_count < 128 ) ) {
-    header = ( message_header * ) ( ( char * ) get_message_buffer_head( sq->buffer ) + sent_total );
-    send_len = ( size_t ) header->message_length;
-    sent_len = send( fd, header, send_len, MSG_DONTWAIT );
-    if ( sent_len == -1 ) {
-      int err = errno;
-      if ( err != EAGAIN && err != EWOULDBLOCK ) {
-        error( "Failed to send ( service_name = %s, fd = %d, errno = %s [%d] ).",
-               sq->service_name, fd, strerror( err ), err );
-        send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
-        close( sq->server_socket );
-        sq->server_socket = -1;
-        sq->refused_count = 0;
-      }
-      truncate_message_buffer( sq->buffer, sent_total );
-      if ( err == EMSGSIZE || err == ENOBUFS || err == ENOMEM ) {
-        warn( "Dropping %u bytes data in send queue ( service_name = %s ).", sq->buffer->data_length, sq->service_name );
-        truncate_message_buffer( sq->buffer, sq->buffer->data_length );
-      }
-      return;
-    }
-    assert( sent_len != 0 );
-    send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, header, ( uint32_t ) sent_len );
-    sent_total += ( size_t ) sent_len;
-    sent_count++;
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( sq == NULL ) {
+    debug( "No send queue found ( service_name = %s ).", service_name );
+    return false;
   }
-  truncate_message_buffer( sq->buffer, sent_total );
+
+  memcpy( stats, &sq->stats, sizeof( messenger_queue_stats ) );
+
+  return true;
 }
 
 
 /**
- * Checks fd_sets for send/receive data to/from remote.
- * @param read_set Pointer to read set
- * @param write_set Pointer to write set
- * @return None
+ * Retrieves statistics of a lane of a send queue. max_queued_bytes
+ * bounds how long messages of the lane have waited behind each other.
+ * @param service_name Name of service
+ * @param priority Priority of the lane
+ * @param stats Pointer to statistics to be filled in
+ * @return bool True if the send queue is found, else False
  */
-static void
-check_send_queue_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  hash_iterator iter;
-  hash_entry *e;
-
-  debug( "Checking fd_sets for sending/receiving data to/from remotes ( read_set = %p, write_set = %p ).", read_set, write_set );
+bool
+get_send_queue_lane_stats( const char *service_name, int priority, messenger_lane_stats *stats ) {
+  assert( service_name != NULL );
+  assert( stats != NULL );
 
-  assert( send_queues != NULL );
+  if ( priority < 0 || priority >= MESSENGER_PRIORITY_LANES ) {
+    error( "Invalid message priority ( %d ).", priority );
+    return false;
+  }
+  if ( send_queues == NULL ) {
+    return false;
+  }
 
-  init_hash_iterator( send_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    send_queue *sq = e->value;
-    if ( sq->server_socket == -1 ) {
-      continue;
-    }
-    if ( FD_ISSET( sq->server_socket, read_set ) ) {
-      char buf[ 256 ];
-      if ( recv( sq->server_socket, buf, sizeof( buf ), 0 ) <= 0 ) {
-        send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
-        close( sq->server_socket );
-        sq->server_socket = -1;
-        continue;
-      }
-    }
-    if ( FD_ISSET( sq->server_socket, write_set ) ) {
-      on_send( sq->server_socket, sq );
-    }
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( sq == NULL ) {
+    debug( "No send queue found ( service_name = %s ).", service_name );
+    return false;
   }
+
+  memcpy( stats, &sq->lanes[ priority ].stats, sizeof( messenger_lane_stats ) );
+
+  return true;
 }
 
 
 /**
- * Function which is used for flushing all pending events.
- * @param None
- * @return None
+ * Sets the priority of messages with a tag. Messages sent without an
+ * explicit priority use the priority of their tag, which is
+ * MESSENGER_PRIORITY_NORMAL unless set otherwise.
+ * @param tag Tag
+ * @param priority MESSENGER_PRIORITY_NORMAL or MESSENGER_PRIORITY_HIGH
+ * @return bool True if the priority is valid, else False
  */
-static bool
-run_once( void ) {
-  fd_set read_set, write_set;
-  struct timeval timeout;
-  int set_count;
+bool
+set_message_tag_priority( const uint16_t tag, int priority ) {
+  if ( priority < 0 || priority >= MESSENGER_PRIORITY_LANES ) {
+    error( "Invalid message priority ( %d ).", priority );
+    return false;
+  }
 
-  execute_timer_events();
+  tag_priorities[ tag ] = ( uint8_t ) priority;
 
-  if ( external_callback != NULL ) {
-    external_callback();
-    external_callback = NULL;
-  }
+  return true;
+}
 
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  set_recv_queue_fd_set( &read_set );
-  set_send_queue_fd_set( &read_set, &write_set );
-  if ( external_fd_set ) {
-    external_fd_set( &read_set, &write_set );
-  }
 
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 100 * 1000;
+/**
+ * Returns the priority of messages with a tag.
+ * @param tag Tag
+ * @return int Priority
+ */
+int
+get_message_tag_priority( const uint16_t tag ) {
+  return tag_priorities[ tag ];
+}
 
-  set_count = select( FD_SETSIZE, &read_set, &write_set, NULL, &timeout );
 
-  if ( set_count == -1 ) {
-    if ( errno == EINTR ) {
-      return true;
-    }
-    error( "Failed to select ( errno = %s [%d] ).", strerror( errno ), errno );
-    running = false;
+/**
+ * Selects the transport for messages sent to a service. When the
+ * shared memory transport is selected, a ring is offered to the service
+ * when the send queue connects, or immediately if it is connected and
+ * idle. The socket transport is used until the service accepts the
+ * ring, and whenever the ring cannot be set up. Going back to the socket
+ * transport takes effect when the send queue reconnects.
+ * @param service_name Name of service
+ * @param transport MESSENGER_TRANSPORT_SOCKET or MESSENGER_TRANSPORT_SHM
+ * @return bool True if the transport is selected, else False
+ */
+bool
+set_message_transport( const char *service_name, int transport ) {
+  assert( service_name != NULL );
+
+  debug( "Setting a message transport ( service_name = %s, transport = %d ).", service_name, transport );
+
+  if ( transport != MESSENGER_TRANSPORT_SOCKET && transport != MESSENGER_TRANSPORT_SHM ) {
+    error( "Invalid transport ( service_name = %s, transport = %d ).", service_name, transport );
     return false;
   }
-  else if ( set_count == 0 ) {
-    // timed out
-    return true;
+  if ( send_queues == NULL ) {
+    error( "All send queues are already deleted or not created yet." );
+    return false;
+  }
+
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( sq == NULL ) {
+    return create_send_queue( service_name, transport ) != NULL;
   }
 
-  check_send_queue_fd_isset( &read_set, &write_set );
-  check_recv_queue_fd_isset( &read_set );
-  if ( external_check_fd_isset ) {
-    external_check_fd_isset( &read_set, &write_set );
+  sq->transport = transport;
+  if ( transport == MESSENGER_TRANSPORT_SHM && sq->server_socket != -1
+       && sq->shm_state == SHM_STATE_NONE && sq->data_length == 0 ) {
+    start_shm_transport( sq );
   }
 
   return true;
@@ -1924,173 +4137,213 @@ run_once( void ) {
 
 
 /**
- * Flushes the messenger.
- * @param None
- * @return None
+ * Retrieves the transport which is in use for a service.
+ * @param service_name Name of service
+ * @return int MESSENGER_TRANSPORT_SHM if messages go through a shared memory ring, else MESSENGER_TRANSPORT_SOCKET
  */
 int
-flush_messenger() {
-  int connected_count, sending_count, reconnecting_count, closed_count;
+get_message_transport( const char *service_name ) {
+  assert( service_name != NULL );
 
-  debug( "Flushing send queues." );
+  if ( send_queues == NULL ) {
+    return MESSENGER_TRANSPORT_SOCKET;
+  }
 
-  while ( true ) {
-    number_of_send_queue( &connected_count, &sending_count, &reconnecting_count, &closed_count );
-    if ( sending_count == 0 ) {
-      return reconnecting_count;
-    }
-    run_once();
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( sq == NULL || sq->shm_state != SHM_STATE_ACTIVE ) {
+    return MESSENGER_TRANSPORT_SOCKET;
   }
+
+  return MESSENGER_TRANSPORT_SHM;
 }
 
 
 /**
- * Starts messenger.
- * @param None
- * @return None
+ * Validates send queue limits.
+ * @param limits Limits
+ * @return bool True if the limits are consistent, else False
  */
-bool
-start_messenger() {
-  debug( "Starting messenger." );
-
-  add_periodic_event_callback( 10, age_context_db, NULL );
+static bool
+valid_send_queue_limits( const messenger_queue_limits *limits ) {
+  assert( limits != NULL );
 
-  running = true;
-  while ( running ) {
-    if ( !run_once() ) {
-      error( "Failed to run main loop." );
-      return false;
-    }
+  if ( limits->max_length < sizeof( message_header ) || limits->high_watermark > limits->max_length
+       || limits->low_watermark > limits->high_watermark ) {
+    error( "Invalid send queue limits ( max_length = %zu, high_watermark = %zu, low_watermark = %zu ).",
+           limits->max_length, limits->high_watermark, limits->low_watermark );
+    return false;
   }
 
-  debug( "Messenger terminated." );
-
   return true;
 }
 
 
 /**
- * Terminates the messenger.
- * @param None
- * @return None
+ * Sets the limits of send queues created afterwards.
+ * @param limits Limits
+ * @return bool True if the limits are set, else False
  */
 bool
-stop_messenger() {
-  running = false;
+set_default_send_queue_limits( const messenger_queue_limits *limits ) {
+  assert( limits != NULL );
 
-  debug( "Terminating messenger." );
+  if ( !valid_send_queue_limits( limits ) ) {
+    return false;
+  }
+  default_send_queue_limits = *limits;
 
   return true;
 }
 
 
 /**
- * Starts messenger dump.
- * @param dump_app_name Dump application name
- * @param dump_service_name Dump service name
- * @return None
+ * Sets the limits of the send queue for a service. The send queue is
+ * created if it does not exist. Lowering max_length below the queued
+ * bytes does not drop queued messages; new ones are refused until the
+ * queue drains.
+ * @param service_name Name of service
+ * @param limits Limits
+ * @return bool True if the limits are set, else False
  */
-void
-start_messenger_dump( const char *dump_app_name, const char *dump_service_name ) {
-  assert( dump_app_name != NULL );
-  assert( dump_service_name != NULL );
+bool
+set_send_queue_limits( const char *service_name, const messenger_queue_limits *limits ) {
+  assert( service_name != NULL );
+  assert( limits != NULL );
 
-  debug( "Starting a message dumper ( dhead of the unconsumed part of the messagedump_service_name = %s ).",
-         dump_app_name, dump_service_name );
+  debug( "Setting send queue limits ( service_name = %s, max_length = %zu, high_watermark = %zu, low_watermark = %zu ).",
+         service_name, limits->max_length, limits->high_watermark, limits->low_watermark );
 
-  if ( messenger_dump_enabled() ) {
-    stop_messenger_dump();
+  if ( !valid_send_queue_limits( limits ) ) {
+    return false;
   }
-  _dump_service_name = xstrdup( dump_service_name );
-  _dump_app_name = xstrdup( dump_app_name );
+  if ( send_queues == NULL ) {
+    error( "All send queues are already deleted or not created yet." );
+    return false;
+  }
+
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( sq == NULL ) {
+    sq = create_send_queue( service_name, MESSENGER_TRANSPORT_SOCKET );
+    if ( sq == NULL ) {
+      return false;
+    }
+  }
+
+  sq->limits = *limits;
+  update_send_queue_pressure( sq );
+
+  return true;
 }
 
 
 /**
- * Stops messenger dump.
- * @param None
- * @return None
+ * Retrieves the limits of the send queue for a service.
+ * @param service_name Name of service
+ * @param limits Pointer to limits to be filled in
+ * @return bool True if the send queue is found, else False
  */
-void
-stop_messenger_dump( void ) {
-  assert( _dump_service_name != NULL );
-  assert( _dump_app_name != NULL );
+bool
+get_send_queue_limits( const char *service_name, messenger_queue_limits *limits ) {
+  assert( service_name != NULL );
+  assert( limits != NULL );
 
-  debug( "Terminating a message dumper ( dump_app_name = %s, dump_service_name = %s ).",
-         _dump_app_name, _dump_service_name );
+  if ( send_queues == NULL ) {
+    return false;
+  }
 
-  assert( send_queues != NULL );
-  send_queue *sq = lookup_hash_entry( send_queues, _dump_service_name );
-  if ( sq != NULL ) {
-    delete_send_queue( sq );
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( sq == NULL ) {
+    debug( "No send queue found ( service_name = %s ).", service_name );
+    return false;
   }
 
-  xfree( _dump_service_name );
-  _dump_service_name = NULL;
+  *limits = sq->limits;
 
-  xfree( _dump_app_name );
-  _dump_app_name = NULL;
+  return true;
 }
 
 
 /**
- * Enables messenger dump.
- * @param None
- * @return bool
+ * Tells whether the send queue for a service has reached its high
+ * watermark and not yet drained to its low watermark.
+ * @param service_name Name of service
+ * @return bool True if the send queue is congested, else False
  */
 bool
-messenger_dump_enabled( void ) {
-  if ( _dump_service_name != NULL && _dump_app_name != NULL ) {
-    return true;
+is_send_queue_congested( const char *service_name ) {
+  assert( service_name != NULL );
+
+  if ( send_queues == NULL ) {
+    return false;
   }
 
-  return false;
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+
+  return sq != NULL && sq->congested;
 }
 
 
 /**
- * Sets external fd_set callback.
+ * Adds a callback which is called when any send queue becomes
+ * congested, and again when it drains. Producers use it to stop
+ * taking input instead of losing messages.
  * @param callback Callback function
- * @return None
+ * @param user_data User data passed to the callback
+ * @return bool True if the callback is added, else False
  */
-void
-set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  debug( "Setting an external FD_SET callback ( callback = %p ).", callback );
+bool
+add_send_queue_pressure_callback( callback_send_queue_pressure callback, void *user_data ) {
+  assert( callback != NULL );
 
-  external_fd_set = callback;
-}
+  debug( "Adding a send queue pressure callback ( callback = %p, user_data = %p ).", callback, user_data );
 
+  if ( send_queue_pressure_callbacks == NULL ) {
+    error( "Messenger is not initialized yet." );
+    return false;
+  }
 
-/**
- * Sets external fd_isset callback.
- * @param callback Callback function
- * @return None
- */
-void
-set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  debug( "Setting an external FD_ISSET callback ( callback = %p ).", callback );
+  send_queue_pressure_callback *cb = xmalloc( sizeof( send_queue_pressure_callback ) );
+  cb->function = callback;
+  cb->user_data = user_data;
+  insert_after_dlist( send_queue_pressure_callbacks, cb );
 
-  external_check_fd_isset = callback;
+  return true;
 }
 
 
 /**
- * Sets external callback which can be called when the Messenger initializes or terminates.
+ * Deletes a send queue pressure callback.
  * @param callback Callback function
- * @return bool
+ * @return bool True if the callback is deleted, else False
  */
 bool
-set_external_callback( void ( *callback ) ( void ) ) {
-  if ( external_callback != NULL ) {
+delete_send_queue_pressure_callback( callback_send_queue_pressure callback ) {
+  assert( callback != NULL );
+
+  debug( "Deleting a send queue pressure callback ( callback = %p ).", callback );
+
+  if ( send_queue_pressure_callbacks == NULL ) {
+    error( "Messenger is not initialized yet." );
     return false;
   }
 
-  external_callback = callback;
+  dlist_element *e;
+  for ( e = send_queue_pressure_callbacks->next; e != NULL; e = e->next ) {
+    send_queue_pressure_callback *cb = e->data;
+    if ( cb->function == callback ) {
+      xfree( cb );
+      delete_dlist_element( e );
+      return true;
+    }
+  }
 
-  return true;
+  error( "No registered callback found." );
+
+  return false;
 }
 
 
+
 /*
  * Local variables:
  * c-basic-offset: 2
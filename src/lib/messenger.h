@@ -31,9 +31,20 @@
  * // Adds, deletes, renames callbacks and sends message
  * add_message_callback( service_name, MESSAGE_TYPE, callback );
  * add_message_received_callback( service_name, callback_hello );
+ * // Receives all messages drained in one go as an array.
+ * add_message_batch_received_callback( service_name, callback_batch );
  * delete_message_callback( service_name, MESSAGE_TYPE, callback );
  * rename_message_received_callback( "Trema service name", new_service_name );
  * send_message( remote_service_name, MESSENGER_TYPE, buffer->data, buffer->length );
+ * // Resolves a service name once for frequent sends.
+ * messenger_send_handle *handle = create_send_handle( remote_service_name );
+ * send_message_by_handle( handle, MESSENGER_TYPE, buffer->data, buffer->length );
+ * // Sends control messages ahead of queued bulk messages.
+ * set_message_tag_priority( MESSENGER_TYPE, MESSENGER_PRIORITY_HIGH );
+ * // Sends messages to a service on the same host through shared memory.
+ * set_message_transport( remote_service_name, MESSENGER_TRANSPORT_SHM );
+ * // Gets notified when a send queue fills up, and when it drains again.
+ * add_send_queue_pressure_callback( callback_pressure, user_data );
  * // Finalizes OpenFlow messenger.
  * finalize_messenger();
  * @endcode
@@ -90,24 +101,128 @@ enum {
 };
 
 
+/* Transports between a sender and a service. With
+ * MESSENGER_TRANSPORT_SHM, messages are written to a shared memory
+ * ring and the socket only carries connection setup and wakeups. The
+ * socket transport is used whenever the ring cannot be set up.
+ */
+enum {
+  MESSENGER_TRANSPORT_SOCKET,
+  MESSENGER_TRANSPORT_SHM,
+};
+
+
+/* Per queue statistics. copied_bytes counts data moved within the
+ * queue buffer in user space, not including the copy done by the kernel.
+ * dropped counts messages refused because the queue was full.
+ */
+typedef struct messenger_queue_stats {
+  uint64_t messages;
+  uint64_t bytes;
+  uint64_t syscalls;
+  uint64_t copied_bytes;
+  uint64_t dropped;
+} messenger_queue_stats;
+
+
+/* Priorities of messages. Each send queue has a lane per priority, and
+ * queued messages of a higher priority are sent before those of lower
+ * priorities, so messages of different priorities may be reordered.
+ */
+enum {
+  MESSENGER_PRIORITY_NORMAL,
+  MESSENGER_PRIORITY_HIGH,
+  MESSENGER_PRIORITY_LANES,
+};
+
+
+/* Per lane statistics. messages counts messages sent through the lane.
+ * queued_messages and queued_bytes are the current depth of the lane,
+ * and max_queued_bytes is the largest depth seen.
+ */
+typedef struct messenger_lane_stats {
+  uint64_t messages;
+  uint64_t queued_messages;
+  uint64_t queued_bytes;
+  uint64_t max_queued_bytes;
+} messenger_lane_stats;
+
+
+/* Limits of a send queue in bytes. The queue grows on demand and
+ * refuses messages once max_length bytes are queued. Pressure callbacks
+ * are called when the queued bytes reach high_watermark, and again when
+ * they fall to low_watermark.
+ */
+typedef struct messenger_queue_limits {
+  size_t max_length;
+  size_t high_watermark;
+  size_t low_watermark;
+} messenger_queue_limits;
+
+
+/* Send handles resolve a service name once, so that sending through
+ * them does no per-message name lookup.
+ */
+typedef struct messenger_send_handle messenger_send_handle;
+
+
+/* A received message as seen by batch callbacks. data points into the
+ * receive buffer and is only valid until the callback returns.
+ */
+typedef struct messenger_message {
+  uint16_t tag;
+  void *data;
+  size_t len;
+} messenger_message;
+
+
+/* A part of a message body. See send_message_segments(). */
+typedef struct messenger_segment {
+  const void *data;
+  size_t len;
+} messenger_segment;
+
+
+/* Requests wait for their replies until a deadline, 100 seconds by
+ * default. A timeout callback, if given, is called with the tag and
+ * user data of a request that got no reply in time.
+ */
+typedef void ( *callback_request_timeout )( uint16_t tag, void *user_data );
+
+
 typedef void ( *callback_message_received )( uint16_t tag, void *data, size_t len );
+typedef void ( *callback_message_batch_received )( const messenger_message *messages, size_t count );
+typedef void ( *callback_send_queue_pressure )( const char *service_name, bool congested, void *user_data );
 
 
 bool init_messenger( const char *working_directory );
 bool add_message_received_callback( const char *service_name, const callback_message_received function );
+bool add_message_batch_received_callback( const char *service_name, const callback_message_batch_received callback );
 bool add_message_requested_callback( const char *service_name, void ( *callback )( const messenger_context_handle *handle, uint16_t tag, void *data, size_t len ) );
 bool add_message_replied_callback( const char *service_name, void ( *callback )( uint16_t tag, void *data, size_t len, void *user_data ) );
 bool add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data );
 bool add_periodic_event_callback( const time_t seconds, void ( *callback )( void *user_data ), void *user_data );
 bool delete_message_received_callback( const char *service_name, void ( *callback )( uint16_t tag, void *data, size_t len ) );
+bool delete_message_batch_received_callback( const char *service_name, const callback_message_batch_received callback );
 bool delete_message_requested_callback( const char *service_name, void ( *callback )( const messenger_context_handle *handle, uint16_t tag, void *data, size_t len ) );
 bool delete_message_replied_callback( const char *service_name, void ( *callback )( uint16_t tag, void *data, size_t len, void *user_data ) );
 bool delete_timer_event_callback( void ( *callback )( void *user_data ) );
 bool delete_periodic_event_callback( void ( *callback )( void *user_data ) );
 bool rename_message_received_callback( const char *old_service_name, const char *new_service_name );
 bool send_message( const char *service_name, const uint16_t tag, const void *data, size_t len );
+bool send_message_segments( const char *service_name, const uint16_t tag, const messenger_segment *segments, size_t count );
+bool send_message_with_priority( const char *service_name, const uint16_t tag, const void *data, size_t len, int priority );
+bool set_message_tag_priority( const uint16_t tag, int priority );
+int get_message_tag_priority( const uint16_t tag );
 bool send_request_message( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data );
+bool send_request_message_with_timeout( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data, const struct timespec *timeout, callback_request_timeout timeout_callback );
+bool set_default_request_timeout( const struct timespec *timeout );
 bool send_reply_message( const messenger_context_handle *handle, const uint16_t tag, const void *data, size_t len );
+messenger_send_handle *create_send_handle( const char *service_name );
+void delete_send_handle( messenger_send_handle *handle );
+const char *get_send_handle_service_name( const messenger_send_handle *handle );
+bool send_message_by_handle( messenger_send_handle *handle, const uint16_t tag, const void *data, size_t len );
+bool send_request_message_by_handle( messenger_send_handle *handle, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data );
 int flush_messenger( void );
 bool start_messenger( void );
 bool stop_messenger( void );
@@ -118,6 +233,18 @@ bool messenger_dump_enabled( void );
 void set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
 void set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
 bool set_external_callback( void ( *callback ) ( void ) );
+bool get_receive_queue_stats( const char *service_name, messenger_queue_stats *stats );
+bool set_receive_queue_paused( const char *service_name, bool paused );
+bool get_send_queue_stats( const char *service_name, messenger_queue_stats *stats );
+bool get_send_queue_lane_stats( const char *service_name, int priority, messenger_lane_stats *stats );
+bool set_message_transport( const char *service_name, int transport );
+int get_message_transport( const char *service_name );
+bool set_default_send_queue_limits( const messenger_queue_limits *limits );
+bool set_send_queue_limits( const char *service_name, const messenger_queue_limits *limits );
+bool get_send_queue_limits( const char *service_name, messenger_queue_limits *limits );
+bool is_send_queue_congested( const char *service_name );
+bool add_send_queue_pressure_callback( callback_send_queue_pressure callback, void *user_data );
+bool delete_send_queue_pressure_callback( callback_send_queue_pressure callback );
 
 
 #endif // MESSENGER_H
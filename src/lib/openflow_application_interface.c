@@ -49,6 +49,30 @@ const char *mock_get_trema_name( void );
 #define send_message mock_send_message
 bool mock_send_message( char *service_name, uint16_t tag, void *data, size_t len );
 
+#ifdef create_send_handle
+#undef create_send_handle
+#endif
+#define create_send_handle mock_create_send_handle
+messenger_send_handle *mock_create_send_handle( const char *service_name );
+
+#ifdef delete_send_handle
+#undef delete_send_handle
+#endif
+#define delete_send_handle mock_delete_send_handle
+void mock_delete_send_handle( messenger_send_handle *handle );
+
+#ifdef get_send_handle_service_name
+#undef get_send_handle_service_name
+#endif
+#define get_send_handle_service_name mock_get_send_handle_service_name
+const char *mock_get_send_handle_service_name( const messenger_send_handle *handle );
+
+#ifdef send_message_by_handle
+#undef send_message_by_handle
+#endif
+#define send_message_by_handle mock_send_message_by_handle
+bool mock_send_message_by_handle( messenger_send_handle *handle, uint16_t tag, void *data, size_t len );
+
 #ifdef send_request_message
 #undef send_request_message
 #endif
@@ -143,6 +167,7 @@ extern void mock_critical( const char *format, ... );
 static bool openflow_application_interface_initialized = false;
 static openflow_event_handlers_t event_handlers;
 static char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+static hash_table *switch_send_handles = NULL;
 
 
 static void handle_message( uint16_t message_type, void *data, size_t length );
@@ -159,6 +184,15 @@ enum {
 };
 
 
+/**
+ * Send handle to the switch daemon of a datapath.
+ */
+typedef struct {
+  uint64_t datapath_id;
+  messenger_send_handle *handle;
+} switch_send_handle;
+
+
 /**
  * Check whether OpenFlow Application Interface was initialized by the Application before being used.
  * @param None
@@ -185,6 +219,80 @@ maybe_init_openflow_application_interface() {
 }
 
 
+/**
+ * Deletes all cached send handles to switch daemons.
+ * @param None
+ * @return None
+ */
+static void
+delete_switch_send_handles() {
+  if ( switch_send_handles == NULL ) {
+    return;
+  }
+
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( switch_send_handles, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    switch_send_handle *entry = e->value;
+    delete_send_handle( entry->handle );
+    xfree( entry );
+  }
+  delete_hash( switch_send_handles );
+  switch_send_handles = NULL;
+}
+
+
+/**
+ * Retrieves the send handle to the switch daemon of a datapath. The
+ * remote service name is formatted only when a datapath is seen first.
+ * @param datapath_id Datapath unique ID
+ * @return messenger_send_handle* Send handle
+ */
+static messenger_send_handle *
+get_switch_send_handle( uint64_t datapath_id ) {
+  if ( switch_send_handles == NULL ) {
+    switch_send_handles = create_hash( compare_datapath_id, hash_datapath_id );
+  }
+
+  switch_send_handle *entry = lookup_hash_entry( switch_send_handles, &datapath_id );
+  if ( entry != NULL ) {
+    return entry->handle;
+  }
+
+  char remote_service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+  memset( remote_service_name, '\0', sizeof( remote_service_name ) );
+  snprintf( remote_service_name, sizeof( remote_service_name ),
+            "switch.%" PRIx64, datapath_id );
+
+  entry = xmalloc( sizeof( switch_send_handle ) );
+  entry->datapath_id = datapath_id;
+  entry->handle = create_send_handle( remote_service_name );
+  insert_hash_entry( switch_send_handles, &entry->datapath_id, entry );
+
+  return entry->handle;
+}
+
+
+/**
+ * Deletes the send handle to the switch daemon of a datapath.
+ * @param datapath_id Datapath unique ID
+ * @return None
+ */
+static void
+delete_switch_send_handle( uint64_t datapath_id ) {
+  if ( switch_send_handles == NULL ) {
+    return;
+  }
+
+  switch_send_handle *entry = delete_hash_entry( switch_send_handles, &datapath_id );
+  if ( entry != NULL ) {
+    delete_send_handle( entry->handle );
+    xfree( entry );
+  }
+}
+
+
 /**
  * Initializes OpenFlow application interface. 
  * @param custome_service_name Pointer to string containing name of trema application
@@ -214,6 +322,9 @@ init_openflow_application_interface( const char *custom_service_name ) {
 
   init_openflow_message();
 
+  delete_switch_send_handles();
+  switch_send_handles = create_hash( compare_datapath_id, hash_datapath_id );
+
   add_message_received_callback( service_name, handle_message );
   add_message_replied_callback( service_name, handle_list_switches_reply );
 
@@ -237,6 +348,7 @@ finalize_openflow_application_interface() {
 
   delete_message_received_callback( service_name, handle_message );
   delete_message_replied_callback( service_name, handle_list_switches_reply );
+  delete_switch_send_handles();
 
   memset( &event_handlers, 0, sizeof( openflow_event_handlers_t ) );
   memset( service_name, '\0', sizeof( service_name ) );
@@ -623,8 +735,8 @@ handle_error( const uint64_t datapath_id, buffer *data ) {
   type = ntohs( error_msg->type );
   code = ntohs( error_msg->code );
 
-  body = duplicate_buffer( data );
-  remove_front_buffer( body, offsetof( struct ofp_error_msg, data ) );
+  body = slice_buffer( data, offsetof( struct ofp_error_msg, data ),
+                       data->length - offsetof( struct ofp_error_msg, data ) );
 
   debug( "An error message is received from %#lx "
          "( transaction_id = %#x, type = %u, code = %u, data length = %u ).",
@@ -686,8 +798,8 @@ handle_vendor( const uint64_t datapath_id, buffer *data ) {
   }
 
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
-    remove_front_buffer( body, sizeof( struct ofp_vendor_header ) );
+    body = slice_buffer( data, sizeof( struct ofp_vendor_header ),
+                         data->length - sizeof( struct ofp_vendor_header ) );
   }
   else {
     body = NULL;
@@ -894,8 +1006,8 @@ handle_packet_in( const uint64_t datapath_id, buffer *data ) {
 
   buffer *body = NULL;
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
-    remove_front_buffer( body, offsetof( struct ofp_packet_in, data ) );
+    body = slice_buffer( data, offsetof( struct ofp_packet_in, data ),
+                         data->length - offsetof( struct ofp_packet_in, data ) );
     bool parse_ok = parse_packet( body );
     if ( !parse_ok ) {
       error( "Failed to parse a packet." );
@@ -1097,8 +1209,8 @@ handle_stats_reply( const uint64_t datapath_id, buffer *data ) {
   }
 
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
-    remove_front_buffer( body, offsetof( struct ofp_stats_reply, body ) );
+    body = slice_buffer( data, offsetof( struct ofp_stats_reply, body ),
+                         data->length - offsetof( struct ofp_stats_reply, body ) );
   }
 
   if ( body != NULL ) {
@@ -1483,6 +1595,7 @@ handle_switch_events( uint16_t type, void *data, size_t length ) {
     else {
       debug( "Callback function for switch disconnected events is not set." );
     }
+    delete_switch_send_handle( datapath_id );
     break;
   default:
     error( "Unhandled switch event ( type = %u ).", type );
@@ -1805,7 +1918,7 @@ bool
 send_openflow_message( const uint64_t datapath_id, buffer *message ) {
   bool ret;
   void *data;
-  char remote_service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+  messenger_send_handle *remote;
   uint16_t header_length;
   buffer *buffer;
   struct ofp_header *ofp;
@@ -1820,7 +1933,7 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
   }
 
   ofp = ( struct ofp_header * ) message->data;
-  buffer = duplicate_buffer( message );
+  buffer = clone_buffer( message );
 
   assert( buffer != NULL );
 
@@ -1836,18 +1949,16 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
   memcpy( ( char * ) data + sizeof( openflow_service_header_t ),
           service_name, strlen( service_name ) );
 
-  memset( remote_service_name, '\0', sizeof( remote_service_name ) );
-  snprintf( remote_service_name, sizeof( remote_service_name ),
-            "switch.%" PRIx64, datapath_id );
+  remote = get_switch_send_handle( datapath_id );
 
   debug( "Sending an OpenFlow message to %#" PRIx64
          " ( service_name = %s, remote_service_name = %s, "
          "ofp_header = [version = %#x, type = %#x, length = %u, transaction_id = %#x] ).",
-         datapath_id, service_name, remote_service_name,
+         datapath_id, service_name, get_send_handle_service_name( remote ),
          ofp->version, ofp->type, ntohs( ofp->length ), ntohl( ofp->xid ) );
 
-  ret =  send_message( remote_service_name, MESSENGER_OPENFLOW_MESSAGE,
-                       buffer->data, buffer->length );
+  ret = send_message_by_handle( remote, MESSENGER_OPENFLOW_MESSAGE,
+                                buffer->data, buffer->length );
 
   free_buffer( buffer );
 
@@ -0,0 +1,415 @@
+/*
+ * Single-producer/single-consumer ring buffer on shared memory.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "shm_ring.h"
+#include "wrapper.h"
+
+
+#define SHM_RING_MAGIC 0x7472656d61726e67ULL // "tremarng"
+#define SHM_RING_MIN_SIZE 4096
+#define SHM_RING_CACHE_LINE 64
+#define SHM_RING_RECORD_HEADER sizeof( uint64_t )
+#define SHM_RING_WRAP UINT64_MAX
+
+#define SHM_RING_ALIGN( len ) ( ( ( len ) + sizeof( uint64_t ) - 1 ) & ~( sizeof( uint64_t ) - 1 ) )
+
+
+/**
+ * Control block at the beginning of the shared memory. Positions are
+ * free running byte counters. Each field written by one side has its
+ * own cache line so that the two processes do not contend for it.
+ */
+typedef struct shm_ring_control {
+  uint64_t magic;
+  uint64_t size;
+  char pad0[ SHM_RING_CACHE_LINE - 2 * sizeof( uint64_t ) ];
+  uint64_t head;     // written by the consumer
+  char pad1[ SHM_RING_CACHE_LINE - sizeof( uint64_t ) ];
+  uint64_t tail;     // written by the producer
+  char pad2[ SHM_RING_CACHE_LINE - sizeof( uint64_t ) ];
+  uint32_t waiting;  // set by the consumer, cleared by the producer
+  char pad3[ SHM_RING_CACHE_LINE - sizeof( uint32_t ) ];
+} shm_ring_control;
+
+
+/**
+ * Local view of a ring. The producer keeps the tail it has reserved up
+ * to and the last head it has seen; the consumer keeps its head and
+ * the last tail it has seen.
+ */
+struct shm_ring {
+  int fd;
+  bool producer;
+  shm_ring_control *control;
+  char *data;
+  size_t size;
+  size_t mapped_size;
+  uint64_t head;
+  uint64_t tail;
+  size_t peeked;
+};
+
+
+static size_t
+round_up_to_power_of_two( size_t size ) {
+  size_t rounded = SHM_RING_MIN_SIZE;
+  while ( rounded < size ) {
+    rounded <<= 1;
+  }
+  return rounded;
+}
+
+
+static shm_ring *
+map_shm_ring( int fd, size_t mapped_size, bool producer ) {
+  void *p = mmap( NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  if ( p == MAP_FAILED ) {
+    error( "Failed to map a shared memory ring ( fd = %d, size = %zu, errno = %s [%d] ).",
+           fd, mapped_size, strerror( errno ), errno );
+    return NULL;
+  }
+
+  shm_ring *ring = xmalloc( sizeof( shm_ring ) );
+  ring->fd = fd;
+  ring->producer = producer;
+  ring->control = p;
+  ring->data = ( char * ) p + sizeof( shm_ring_control );
+  ring->size = mapped_size - sizeof( shm_ring_control );
+  ring->mapped_size = mapped_size;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->peeked = 0;
+
+  return ring;
+}
+
+
+/**
+ * Creates a ring as the producer.
+ * @param size Capacity in bytes, rounded up to a power of two
+ * @return shm_ring* Pointer to ring, or NULL on failure
+ */
+shm_ring *
+create_shm_ring( size_t size ) {
+  size = round_up_to_power_of_two( size );
+  size_t mapped_size = sizeof( shm_ring_control ) + size;
+
+  int fd = memfd_create( "trema_shm_ring", MFD_CLOEXEC );
+  if ( fd < 0 ) {
+    error( "Failed to create a shared memory file ( errno = %s [%d] ).", strerror( errno ), errno );
+    return NULL;
+  }
+  if ( ftruncate( fd, ( off_t ) mapped_size ) < 0 ) {
+    error( "Failed to resize a shared memory file ( fd = %d, size = %zu, errno = %s [%d] ).",
+           fd, mapped_size, strerror( errno ), errno );
+    close( fd );
+    return NULL;
+  }
+
+  shm_ring *ring = map_shm_ring( fd, mapped_size, true );
+  if ( ring == NULL ) {
+    close( fd );
+    return NULL;
+  }
+  ring->control->magic = SHM_RING_MAGIC;
+  ring->control->size = size;
+  ring->control->head = 0;
+  ring->control->tail = 0;
+  ring->control->waiting = 0;
+
+  return ring;
+}
+
+
+/**
+ * Attaches to a ring created by the producer. The ring takes over the
+ * file descriptor, which is closed by delete_shm_ring().
+ * @param fd File descriptor of the shared memory
+ * @return shm_ring* Pointer to ring, or NULL if fd is not a valid ring
+ */
+shm_ring *
+attach_shm_ring( int fd ) {
+  assert( fd >= 0 );
+
+  struct stat st;
+  if ( fstat( fd, &st ) < 0 ) {
+    error( "Failed to stat a shared memory file ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+    return NULL;
+  }
+  if ( st.st_size < ( off_t ) ( sizeof( shm_ring_control ) + SHM_RING_MIN_SIZE ) ) {
+    error( "Shared memory file is too small for a ring ( fd = %d, size = %jd ).", fd, ( intmax_t ) st.st_size );
+    return NULL;
+  }
+
+  shm_ring *ring = map_shm_ring( fd, ( size_t ) st.st_size, false );
+  if ( ring == NULL ) {
+    return NULL;
+  }
+  if ( ring->control->magic != SHM_RING_MAGIC || ring->control->size != ring->size
+       || ( ring->size & ( ring->size - 1 ) ) != 0 ) {
+    error( "Invalid shared memory ring ( fd = %d ).", fd );
+    munmap( ring->control, ring->mapped_size );
+    xfree( ring );
+    return NULL;
+  }
+  ring->head = __atomic_load_n( &ring->control->head, __ATOMIC_ACQUIRE );
+  ring->tail = ring->head;
+
+  return ring;
+}
+
+
+/**
+ * Unmaps a ring and closes its file descriptor. The memory is freed
+ * when both sides have deleted the ring.
+ * @param ring Pointer to ring
+ * @return None
+ */
+void
+delete_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+
+  munmap( ring->control, ring->mapped_size );
+  close( ring->fd );
+  xfree( ring );
+}
+
+
+/**
+ * Returns the file descriptor to be passed to the consumer.
+ * @param ring Pointer to ring
+ * @return int File descriptor
+ */
+int
+get_shm_ring_fd( const shm_ring *ring ) {
+  assert( ring != NULL );
+
+  return ring->fd;
+}
+
+
+/**
+ * Returns the capacity of a ring in bytes.
+ * @param ring Pointer to ring
+ * @return size_t Capacity
+ */
+size_t
+shm_ring_capacity( const shm_ring *ring ) {
+  assert( ring != NULL );
+
+  return ring->size;
+}
+
+
+/**
+ * Returns the number of bytes reserved by the producer and not yet
+ * released by the consumer, including record headers and padding.
+ * @param ring Pointer to ring
+ * @return size_t Bytes in use
+ */
+size_t
+shm_ring_used( shm_ring *ring ) {
+  assert( ring != NULL );
+  assert( ring->producer );
+
+  ring->head = __atomic_load_n( &ring->control->head, __ATOMIC_ACQUIRE );
+
+  return ( size_t ) ( ring->tail - ring->head );
+}
+
+
+/**
+ * Reserves a contiguous record at the tail. Records are not visible to
+ * the consumer until publish_shm_ring() is called, so several records
+ * may be reserved and published at once.
+ * @param ring Pointer to ring
+ * @param len Length of record
+ * @return void* Pointer to the record, or NULL if the ring is full
+ */
+void *
+reserve_shm_ring( shm_ring *ring, size_t len ) {
+  assert( ring != NULL );
+  assert( ring->producer );
+
+  size_t need = SHM_RING_RECORD_HEADER + SHM_RING_ALIGN( len );
+  size_t offset = ( size_t ) ring->tail & ( ring->size - 1 );
+  size_t skip = need > ring->size - offset ? ring->size - offset : 0;
+
+  if ( skip + need > ring->size ) {
+    return NULL;
+  }
+  if ( ring->tail + skip + need - ring->head > ring->size ) {
+    ring->head = __atomic_load_n( &ring->control->head, __ATOMIC_ACQUIRE );
+    if ( ring->tail + skip + need - ring->head > ring->size ) {
+      return NULL;
+    }
+  }
+
+  if ( skip > 0 ) {
+    *( uint64_t * ) ( ring->data + offset ) = SHM_RING_WRAP;
+    ring->tail += skip;
+    offset = 0;
+  }
+  *( uint64_t * ) ( ring->data + offset ) = len;
+  ring->tail += need;
+
+  return ring->data + offset + SHM_RING_RECORD_HEADER;
+}
+
+
+/**
+ * Makes reserved records visible to the consumer.
+ * @param ring Pointer to ring
+ * @return bool True if the consumer is sleeping and has to be woken up
+ */
+bool
+publish_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+  assert( ring->producer );
+
+  if ( ring->tail == ring->control->tail ) {
+    return false;
+  }
+  __atomic_store_n( &ring->control->tail, ring->tail, __ATOMIC_RELEASE );
+  // Pairs with the fence in wait_shm_ring(). Either the consumer sees
+  // the new tail, or the producer sees that the consumer is waiting.
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  if ( __atomic_load_n( &ring->control->waiting, __ATOMIC_RELAXED ) == 0 ) {
+    return false;
+  }
+
+  return __atomic_exchange_n( &ring->control->waiting, 0, __ATOMIC_ACQ_REL ) != 0;
+}
+
+
+/**
+ * Returns the record at the head without consuming it.
+ * @param ring Pointer to ring
+ * @param len Length of record
+ * @return void* Pointer to the record, or NULL if the ring is empty
+ */
+void *
+peek_shm_ring( shm_ring *ring, size_t *len ) {
+  assert( ring != NULL );
+  assert( !ring->producer );
+  assert( len != NULL );
+
+  while ( true ) {
+    if ( ring->head == ring->tail ) {
+      ring->tail = __atomic_load_n( &ring->control->tail, __ATOMIC_ACQUIRE );
+      if ( ring->head == ring->tail ) {
+        return NULL;
+      }
+    }
+
+    size_t offset = ( size_t ) ring->head & ( ring->size - 1 );
+    uint64_t length = *( uint64_t * ) ( ring->data + offset );
+    if ( length == SHM_RING_WRAP ) {
+      ring->head += ring->size - offset;
+      continue;
+    }
+    if ( length > ring->size - offset - SHM_RING_RECORD_HEADER
+         || ring->tail - ring->head < SHM_RING_RECORD_HEADER + SHM_RING_ALIGN( length ) ) {
+      error( "Discarding corrupted records in shared memory ring ( fd = %d, offset = %zu, length = %" PRIu64 " ).",
+             ring->fd, offset, length );
+      ring->head = ring->tail;
+      ring->peeked = 0;
+      __atomic_store_n( &ring->control->head, ring->head, __ATOMIC_RELEASE );
+      return NULL;
+    }
+
+    ring->peeked = SHM_RING_RECORD_HEADER + SHM_RING_ALIGN( ( size_t ) length );
+    *len = ( size_t ) length;
+    return ring->data + offset + SHM_RING_RECORD_HEADER;
+  }
+}
+
+
+/**
+ * Moves past the record returned by the last peek_shm_ring() but keeps
+ * its space, so that it stays valid until release_shm_ring() is called.
+ * @param ring Pointer to ring
+ * @return None
+ */
+void
+skip_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+  assert( !ring->producer );
+  assert( ring->peeked > 0 );
+
+  ring->head += ring->peeked;
+  ring->peeked = 0;
+}
+
+
+/**
+ * Consumes the record returned by the last peek_shm_ring(), if any, and
+ * gives its space back to the producer together with that of the
+ * records skipped before.
+ * @param ring Pointer to ring
+ * @return None
+ */
+void
+release_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+  assert( !ring->producer );
+
+  ring->head += ring->peeked;
+  ring->peeked = 0;
+  __atomic_store_n( &ring->control->head, ring->head, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * Announces that the consumer is about to sleep.
+ * @param ring Pointer to ring
+ * @return bool True if the ring is empty and the producer will send a wakeup, False if records are available
+ */
+bool
+wait_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+  assert( !ring->producer );
+
+  __atomic_store_n( &ring->control->waiting, 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  ring->tail = __atomic_load_n( &ring->control->tail, __ATOMIC_ACQUIRE );
+  if ( ring->head != ring->tail ) {
+    __atomic_store_n( &ring->control->waiting, 0, __ATOMIC_RELAXED );
+    return false;
+  }
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,87 @@
+/*
+ * Single-producer/single-consumer ring buffer on shared memory.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ *
+ * @brief Ring buffer shared between two processes
+ *
+ * The producer creates a ring backed by an anonymous shared memory
+ * file and passes its file descriptor to the consumer, which attaches
+ * to it. Records are variable length and always contiguous in memory,
+ * so the consumer can use them in place; records skipped rather than
+ * released stay valid until the next release. Neither side makes system
+ * calls while transferring records; the consumer announces when it is
+ * about to sleep so that the producer knows when a wakeup is needed.
+ * @code
+ * // Producer
+ * shm_ring *ring = create_shm_ring( 1048576 );
+ * // ... pass get_shm_ring_fd( ring ) to the consumer ...
+ * void *p = reserve_shm_ring( ring, len );
+ * memcpy( p, data, len );
+ * if ( publish_shm_ring( ring ) ) {
+ *   // wake up the consumer
+ * }
+ *
+ * // Consumer
+ * shm_ring *ring = attach_shm_ring( fd );
+ * while ( ( p = peek_shm_ring( ring, &len ) ) != NULL ) {
+ *   // use p
+ *   release_shm_ring( ring );
+ * }
+ * if ( wait_shm_ring( ring ) ) {
+ *   // sleep until woken up
+ * }
+ * @endcode
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+
+#include <stddef.h>
+#include "bool.h"
+
+
+typedef struct shm_ring shm_ring;
+
+
+shm_ring *create_shm_ring( size_t size );
+shm_ring *attach_shm_ring( int fd );
+void delete_shm_ring( shm_ring *ring );
+int get_shm_ring_fd( const shm_ring *ring );
+size_t shm_ring_capacity( const shm_ring *ring );
+size_t shm_ring_used( shm_ring *ring );
+void *reserve_shm_ring( shm_ring *ring, size_t len );
+bool publish_shm_ring( shm_ring *ring );
+void *peek_shm_ring( shm_ring *ring, size_t *len );
+void skip_shm_ring( shm_ring *ring );
+void release_shm_ring( shm_ring *ring );
+bool wait_shm_ring( shm_ring *ring );
+
+
+#endif // SHM_RING_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
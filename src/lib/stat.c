@@ -191,6 +191,19 @@ add_stat_entry( const char *key ) {
  */
 void
 increment_stat( const char *key ) {
+  increment_stat_by( key, 1 );
+}
+
+
+/**
+ * Increment the stat counter for the specified Parameter by a given
+ * value, for counters that are updated in batches.
+ * @param key Identifier for parameter
+ * @param value Value to add
+ * @return None
+ */
+void
+increment_stat_by( const char *key, uint64_t value ) {
   assert( key != NULL );
   assert( stats != NULL );
 
@@ -207,7 +220,7 @@ increment_stat( const char *key ) {
 
   assert( entry != NULL );
 
-  ( entry->value )++;
+  entry->value += value;
 
   pthread_mutex_unlock( &stats_table_mutex );
 }
@@ -48,6 +48,10 @@
 #ifndef STAT_H
 
 
+#include <stdint.h>
+#include "bool.h"
+
+
 #define STAT_KEY_LENGTH 256
 
 
@@ -55,6 +59,7 @@ bool init_stat( void );
 bool finalize_stat( void );
 bool add_stat_entry( const char *key );
 void increment_stat( const char *key );
+void increment_stat_by( const char *key, uint64_t value );
 void dump_stats();
 
 
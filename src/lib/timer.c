@@ -182,6 +182,65 @@ execute_timer_events() {
 }
 
 
+/**
+ * Calculates the time left until the earliest timer event expires.
+ * @param timeout Pointer to timespec where the remaining time is stored
+ * @return bool True if any timer event is registered, else False
+ */
+bool
+get_next_timer_event_timeout( struct timespec *timeout ) {
+  assert( timeout != NULL );
+
+  struct timespec now;
+  struct timespec *next = NULL;
+  timer_callback *callback;
+  dlist_element *element;
+
+  if ( timer_callbacks == NULL ) {
+    return false;
+  }
+
+  for ( element = timer_callbacks->next; element; element = element->next ) {
+    callback = element->data;
+    if ( callback->function == NULL || !VALID_TIMESPEC( &callback->expires_at ) ) {
+      continue;
+    }
+    if ( next == NULL
+         || ( callback->expires_at.tv_sec < next->tv_sec )
+         || ( ( callback->expires_at.tv_sec == next->tv_sec )
+              && ( callback->expires_at.tv_nsec < next->tv_nsec ) ) ) {
+      next = &callback->expires_at;
+    }
+  }
+  if ( next == NULL ) {
+    return false;
+  }
+
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    timeout->tv_sec = 0;
+    timeout->tv_nsec = 0;
+    return true;
+  }
+
+  if ( ( next->tv_sec < now.tv_sec )
+       || ( ( next->tv_sec == now.tv_sec ) && ( next->tv_nsec <= now.tv_nsec ) ) ) {
+    timeout->tv_sec = 0;
+    timeout->tv_nsec = 0;
+  }
+  else {
+    timeout->tv_sec = next->tv_sec - now.tv_sec;
+    timeout->tv_nsec = next->tv_nsec - now.tv_nsec;
+    if ( timeout->tv_nsec < 0 ) {
+      timeout->tv_sec--;
+      timeout->tv_nsec += 1000000000;
+    }
+  }
+
+  return true;
+}
+
+
 /**
  * Adds a timer event callback in the event list.
  * @param interval Time interval specification
@@ -53,6 +53,7 @@ bool add_periodic_event_callback( const time_t seconds, void ( *callback )( void
 bool delete_periodic_event_callback( void ( *callback )( void *user_data ) );
 
 void execute_timer_events( void );
+bool get_next_timer_event_timeout( struct timespec *timeout );
 
 
 #endif // TIMER_H
@@ -209,6 +209,18 @@ bool mock_init_stat();
 #define finalize_stat mock_finalize_stat
 bool mock_finalize_stat();
 
+#ifdef init_buffer_pool
+#undef init_buffer_pool
+#endif
+#define init_buffer_pool mock_init_buffer_pool
+void mock_init_buffer_pool( size_t headroom, size_t tailroom );
+
+#ifdef finalize_buffer_pool
+#undef finalize_buffer_pool
+#endif
+#define finalize_buffer_pool mock_finalize_buffer_pool
+void mock_finalize_buffer_pool();
+
 #ifdef init_timer
 #undef init_timer
 #endif
@@ -338,6 +350,7 @@ finalize_trema() {
 
   maybe_finalize_openflow_application_interface();
   finalize_messenger();
+  finalize_buffer_pool();
   finalize_stat();
   finalize_timer();
   trema_started = false;
@@ -607,6 +620,7 @@ init_trema( int *argc, char ***argv ) {
   set_usr2_handler();
   init_messenger( get_trema_tmp() );
   init_stat();
+  init_buffer_pool( DEFAULT_BUFFER_HEADROOM, DEFAULT_BUFFER_TAILROOM );
   init_timer();
 
   initialized = true;
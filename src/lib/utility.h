@@ -45,6 +45,9 @@
 
 extern void ( *die )( const char *format, ... );
 
+uint32_t crc32c( uint32_t crc, const void *data, size_t len );
+unsigned int hash_bytes( const void *data, size_t len );
+
 bool compare_string( const void *x, const void *y );
 unsigned int hash_string( const void *key );
 
@@ -144,15 +144,9 @@ parse_etherip( const buffer *data ) {
     error( "invalid etherip version 0x%04x.", ntohs( etherip->version ) );
     return NULL;
   }
-  buffer *copy = duplicate_buffer( data );
-  if ( copy == NULL ) {
-    error( "duplicate_buffer failed." );
-    return NULL;
-  }
-  copy->user_data = NULL;
   uint32_t offset = ( uint32_t ) ( ( char * ) etherip - ( char *) data->data );
   offset += ( uint32_t ) sizeof( etherip_header );
-  remove_front_buffer( copy, offset );
+  buffer *copy = slice_buffer( data, offset, data->length - offset );
 
   if ( !parse_packet( copy ) ) {
     error( "parse_packet failed." );
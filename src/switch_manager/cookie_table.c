@@ -25,31 +25,29 @@
 #include "trema.h"
 
 
-static cookie_table_t cookie_table;
-static uint64_t cookie_dough = 0;
 static uint64_t INVALID_COOKIE = UINT64_MAX;
 static const time_t COOKIE_ENTRY_LIFETIME = 86400 * 30;
 
 
 static uint64_t
-generate_cookie( void ) {
-  uint64_t initial_value = ( cookie_dough != ( INVALID_COOKIE - 1 ) ) ? ++cookie_dough : 1;
+generate_cookie( cookie_table_t *cookie_table ) {
+  uint64_t initial_value = ( cookie_table->cookie_dough != ( INVALID_COOKIE - 1 ) ) ? ++cookie_table->cookie_dough : 1;
 
-  while ( lookup_cookie_entry_by_cookie( &cookie_dough ) != NULL ) {
-    if ( cookie_dough != ( INVALID_COOKIE - 1 ) ) {
-      cookie_dough++;
+  while ( lookup_cookie_entry_by_cookie( cookie_table, &cookie_table->cookie_dough ) != NULL ) {
+    if ( cookie_table->cookie_dough != ( INVALID_COOKIE - 1 ) ) {
+      cookie_table->cookie_dough++;
     }
     else {
-      cookie_dough = 1;
+      cookie_table->cookie_dough = 1;
     }
-    if ( initial_value == cookie_dough ) {
+    if ( initial_value == cookie_table->cookie_dough ) {
       error( "Failed to generate cookie value." );
-      cookie_dough = RESERVED_COOKIE;
+      cookie_table->cookie_dough = RESERVED_COOKIE;
       break;
     }
   }
 
-  return cookie_dough;
+  return cookie_table->cookie_dough;
 }
 
 
@@ -74,13 +72,13 @@ compare_application( const void *x, const void *y ) {
 
 
 static cookie_entry_t *
-allocate_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags ) {
+allocate_cookie_entry( cookie_table_t *cookie_table, uint64_t *original_cookie, char *service_name, uint16_t flags ) {
   cookie_entry_t *new_entry;
 
   new_entry = xmalloc( sizeof ( cookie_entry_t ) );
   memset( new_entry, 0, sizeof( cookie_entry_t ) );
 
-  new_entry->cookie = generate_cookie();
+  new_entry->cookie = generate_cookie( cookie_table );
   new_entry->application.cookie = *original_cookie;
 
   if ( strlen( service_name ) + 1 > MESSENGER_SERVICE_NAME_LENGTH ) {
@@ -114,31 +112,34 @@ free_cookie_table_walker( void *key, void *value, void *user_data ) {
 }
 
 
-void
-init_cookie_table( void ) {
-  cookie_table.global = create_hash( compare_cookie, hash_cookie_entry );
-  cookie_table.application = create_hash( compare_application, hash_cookie_entry );
+cookie_table_t *
+create_cookie_table( void ) {
+  cookie_table_t *cookie_table = xmalloc( sizeof( cookie_table_t ) );
+  cookie_table->global = create_hash( compare_cookie, hash_cookie_entry );
+  cookie_table->application = create_hash( compare_application, hash_cookie_entry );
+  cookie_table->cookie_dough = 0;
+
+  return cookie_table;
 }
 
 
 void
-finalize_cookie_table( void ) {
-  foreach_hash( cookie_table.global, free_cookie_table_walker, NULL );
-  delete_hash( cookie_table.global );
-  delete_hash( cookie_table.application );
-  cookie_table.global = NULL;
-  cookie_table.application = NULL;
+delete_cookie_table( cookie_table_t *cookie_table ) {
+  foreach_hash( cookie_table->global, free_cookie_table_walker, NULL );
+  delete_hash( cookie_table->global );
+  delete_hash( cookie_table->application );
+  xfree( cookie_table );
 }
 
 
 uint64_t *
-insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags ) {
+insert_cookie_entry( cookie_table_t *cookie_table, uint64_t *original_cookie, char *service_name, uint16_t flags ) {
   cookie_entry_t *new_entry, *conflict_entry;
 
   debug( "Inserting cookie entry ( original_cookie = %#" PRIx64 ", service_name = %s, flags = %#x ).",
          *original_cookie, service_name, flags );
 
-  new_entry = lookup_cookie_entry_by_application( original_cookie, service_name );
+  new_entry = lookup_cookie_entry_by_application( cookie_table, original_cookie, service_name );
   if ( new_entry != NULL ) {
     new_entry->reference_count++;
     new_entry->expire_at = time( NULL ) + COOKIE_ENTRY_LIFETIME;
@@ -147,14 +148,14 @@ insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t fla
     return &new_entry->cookie;
   }
 
-  new_entry = allocate_cookie_entry( original_cookie, service_name, flags );
-  conflict_entry = insert_hash_entry( cookie_table.global, &new_entry->cookie, new_entry );
+  new_entry = allocate_cookie_entry( cookie_table, original_cookie, service_name, flags );
+  conflict_entry = insert_hash_entry( cookie_table->global, &new_entry->cookie, new_entry );
   if ( conflict_entry != NULL ) {
     warn( "Conflicted cookie ( cookie = %#" PRIx64 " ).", new_entry->cookie );
     // TODO: delete conflicted cookie entry
   }
 
-  conflict_entry = insert_hash_entry( cookie_table.application, &new_entry->application, new_entry );
+  conflict_entry = insert_hash_entry( cookie_table->application, &new_entry->application, new_entry );
   if ( conflict_entry != NULL ) {
     warn( "Conflicted cookie ( cookie = %#" PRIx64 ", service_name = %s ).",
           new_entry->application.cookie, new_entry->application.service_name );
@@ -166,7 +167,7 @@ insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t fla
 
 
 void
-delete_cookie_entry( cookie_entry_t *entry ) {
+delete_cookie_entry( cookie_table_t *cookie_table, cookie_entry_t *entry ) {
   debug( "Deleting cookie entry ( cookie = %#" PRIx64 ", application = [ cookie = %#" PRIx64 ", service_name = %s, "
          "flags = %#x ], reference_count = %d, expire_at = %u ).",
          entry->cookie, entry->application.cookie, entry->application.service_name,
@@ -178,11 +179,11 @@ delete_cookie_entry( cookie_entry_t *entry ) {
     return;
   }
 
-  cookie_entry_t *delete_entry_global = delete_hash_entry( cookie_table.global, &entry->cookie );
+  cookie_entry_t *delete_entry_global = delete_hash_entry( cookie_table->global, &entry->cookie );
   if ( delete_entry_global == NULL ) {
     error( "No cookie entry found ( cookie = %#" PRIx64 " ).", entry->cookie );
   }
-  cookie_entry_t *delete_entry_application = delete_hash_entry( cookie_table.application, &entry->application );
+  cookie_entry_t *delete_entry_application = delete_hash_entry( cookie_table->application, &entry->application );
   if ( delete_entry_application == NULL ) {
     error( "No cookie entry found ( cookie = %#" PRIx64 ", service_name = %s ).",
            entry->application.cookie, entry->application.service_name );
@@ -205,13 +206,13 @@ delete_cookie_entry( cookie_entry_t *entry ) {
 
 
 cookie_entry_t *
-lookup_cookie_entry_by_cookie( uint64_t *cookie ) {
-  return lookup_hash_entry( cookie_table.global, cookie );
+lookup_cookie_entry_by_cookie( cookie_table_t *cookie_table, uint64_t *cookie ) {
+  return lookup_hash_entry( cookie_table->global, cookie );
 }
 
 
 cookie_entry_t *
-lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name ) {
+lookup_cookie_entry_by_application( cookie_table_t *cookie_table, uint64_t *cookie, char *service_name ) {
   cookie_entry_t key;
   cookie_entry_t *entry;
 
@@ -220,14 +221,14 @@ lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name ) {
   strncpy( key.application.service_name, service_name, MESSENGER_SERVICE_NAME_LENGTH );
   key.application.service_name[ MESSENGER_SERVICE_NAME_LENGTH - 1 ] = '\0';
 
-  entry = lookup_hash_entry( cookie_table.application, &key );
+  entry = lookup_hash_entry( cookie_table->application, &key );
 
   return entry;
 }
 
 
 static void
-age_cookie_entry( cookie_entry_t *entry ) {
+age_cookie_entry( cookie_table_t *cookie_table, cookie_entry_t *entry ) {
   if ( entry->expire_at < time( NULL ) ) {
     // TODO: check if the target flow is still alive or not
     warn( "Aging out cookie entry ( cookie = %#" PRIx64 ", application = [ cookie = %#" PRIx64 ", service_name = %s, "
@@ -235,8 +236,8 @@ age_cookie_entry( cookie_entry_t *entry ) {
           entry->cookie, entry->application.cookie, entry->application.service_name,
           entry->application.flags, entry->reference_count, entry->expire_at );
 
-    delete_hash_entry( cookie_table.global, &entry->cookie );
-    delete_hash_entry( cookie_table.application, &entry->application );
+    delete_hash_entry( cookie_table->global, &entry->cookie );
+    delete_hash_entry( cookie_table->application, &entry->application );
     free_cookie_entry( entry );
   }
 }
@@ -244,14 +245,13 @@ age_cookie_entry( cookie_entry_t *entry ) {
 
 void
 age_cookie_table( void *user_data ) {
-  UNUSED( user_data );
-
+  cookie_table_t *cookie_table = user_data;
   hash_iterator iter;
   hash_entry *e;
 
-  init_hash_iterator( cookie_table.global, &iter );
+  init_hash_iterator( cookie_table->global, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    age_cookie_entry( e->value );
+    age_cookie_entry( cookie_table, e->value );
   }
 }
 
@@ -266,19 +266,19 @@ dump_cookie_entry( cookie_entry_t *entry ) {
 
 
 void
-dump_cookie_table( void ) {
+dump_cookie_table( cookie_table_t *cookie_table ) {
   hash_iterator iter;
   hash_entry *e;
 
   info( "#### COOKIE TABLE ####" );
   info( "[global]" );
-  init_hash_iterator( cookie_table.global, &iter );
+  init_hash_iterator( cookie_table->global, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
     dump_cookie_entry( e->value );
   }
 
   info( "[application]" );
-  init_hash_iterator( cookie_table.application, &iter );
+  init_hash_iterator( cookie_table->application, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
     dump_cookie_entry( e->value );
   }
@@ -48,17 +48,18 @@ typedef struct cookie_entry {
 typedef struct cookie_table {
   hash_table *global;
   hash_table *application;
+  uint64_t cookie_dough;
 } cookie_table_t;
 
 
-void init_cookie_table( void );
-void finalize_cookie_table( void );
-uint64_t *insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags );
-void delete_cookie_entry( cookie_entry_t *entry );
-cookie_entry_t *lookup_cookie_entry_by_cookie( uint64_t *cookie );
-cookie_entry_t *lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name );
+cookie_table_t *create_cookie_table( void );
+void delete_cookie_table( cookie_table_t *cookie_table );
+uint64_t *insert_cookie_entry( cookie_table_t *cookie_table, uint64_t *original_cookie, char *service_name, uint16_t flags );
+void delete_cookie_entry( cookie_table_t *cookie_table, cookie_entry_t *entry );
+cookie_entry_t *lookup_cookie_entry_by_cookie( cookie_table_t *cookie_table, uint64_t *cookie );
+cookie_entry_t *lookup_cookie_entry_by_application( cookie_table_t *cookie_table, uint64_t *cookie, char *service_name );
 void age_cookie_table( void *user_data );
-void dump_cookie_table( void );
+void dump_cookie_table( cookie_table_t *cookie_table );
 
 
 #endif // COOKIE_TABLE_H
@@ -19,15 +19,22 @@
 
 
 #include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 #include "message_queue.h"
 
 
+#define INITIAL_QUEUE_SIZE 16
+
+
 message_queue *
 create_message_queue( void ) {
   message_queue *queue = xmalloc( sizeof( message_queue ) );
-  create_list( &queue->head );
-  queue->tail = NULL;
-  queue->length = 0;
+  memset( queue, 0, sizeof( message_queue ) );
+  queue->messages = xmalloc( sizeof( buffer * ) * INITIAL_QUEUE_SIZE );
+  queue->size = INITIAL_QUEUE_SIZE;
+  queue->limits.overflow_policy = MESSAGE_QUEUE_DROP_NEW;
 
   return queue;
 }
@@ -37,39 +44,182 @@ bool
 delete_message_queue( message_queue *queue ) {
   assert( queue != NULL );
 
-  list_element *element = queue->head;
-  while( element != NULL ) {
-    free_buffer( element->data );
-    element = element->next;
+  for ( int i = 0; i < queue->length; i++ ) {
+    free_buffer( queue->messages[ ( queue->first + i ) & ( queue->size - 1 ) ] );
   }
-  delete_list( queue->head );
+  xfree( queue->messages );
   xfree( queue );
 
   return true;
 }
 
 
+bool
+set_message_queue_limits( message_queue *queue, const message_queue_limits *limits ) {
+  assert( queue != NULL );
+  assert( limits != NULL );
+
+  if ( limits->max_length < 0 ) {
+    return false;
+  }
+  if ( limits->overflow_policy != MESSAGE_QUEUE_DROP_NEW
+       && limits->overflow_policy != MESSAGE_QUEUE_DROP_OLDEST
+       && limits->overflow_policy != MESSAGE_QUEUE_BLOCK ) {
+    return false;
+  }
+  queue->limits = *limits;
+
+  return true;
+}
+
+
+/*
+ * Parses limits given as MESSAGES,BYTES[,POLICY], where POLICY is one
+ * of drop-new, drop-oldest and block.
+ */
+bool
+parse_message_queue_limits( const char *str, message_queue_limits *limits ) {
+  assert( str != NULL );
+  assert( limits != NULL );
+
+  char *ep;
+  long length = strtol( str, &ep, 0 );
+  if ( ep == str || *ep != ',' || length < 0 || length > INT_MAX ) {
+    return false;
+  }
+  str = ep + 1;
+  unsigned long long bytes = strtoull( str, &ep, 0 );
+  if ( ep == str || *str == '-' || ( *ep != ',' && *ep != '\0' ) ) {
+    return false;
+  }
+
+  int policy = MESSAGE_QUEUE_DROP_NEW;
+  if ( *ep == ',' ) {
+    if ( strcmp( ep + 1, "drop-new" ) == 0 ) {
+      policy = MESSAGE_QUEUE_DROP_NEW;
+    }
+    else if ( strcmp( ep + 1, "drop-oldest" ) == 0 ) {
+      policy = MESSAGE_QUEUE_DROP_OLDEST;
+    }
+    else if ( strcmp( ep + 1, "block" ) == 0 ) {
+      policy = MESSAGE_QUEUE_BLOCK;
+    }
+    else {
+      return false;
+    }
+  }
+
+  limits->max_length = ( int ) length;
+  limits->max_bytes = ( size_t ) bytes;
+  limits->overflow_policy = policy;
+
+  return true;
+}
+
+
+static bool
+exceeds_limits( message_queue *queue, int length, size_t bytes ) {
+  if ( queue->limits.max_length > 0 && length > queue->limits.max_length ) {
+    return true;
+  }
+  if ( queue->limits.max_bytes > 0 && bytes > queue->limits.max_bytes ) {
+    return true;
+  }
+
+  return false;
+}
+
+
+static void
+grow_message_queue( message_queue *queue ) {
+  buffer **messages = xmalloc( sizeof( buffer * ) * ( size_t ) queue->size * 2 );
+  for ( int i = 0; i < queue->length; i++ ) {
+    messages[ i ] = queue->messages[ ( queue->first + i ) & ( queue->size - 1 ) ];
+  }
+  xfree( queue->messages );
+  queue->messages = messages;
+  queue->size *= 2;
+  queue->first = 0;
+}
+
+
+static void
+drop_oldest_message( message_queue *queue ) {
+  int mask = queue->size - 1;
+  buffer *message;
+
+  if ( queue->head_offset == 0 ) {
+    message = queue->messages[ queue->first ];
+  }
+  else {
+    // Keep the first message which is partly consumed, and drop the
+    // next one by moving the first one into its slot.
+    int next = ( queue->first + 1 ) & mask;
+    message = queue->messages[ next ];
+    queue->messages[ next ] = queue->messages[ queue->first ];
+  }
+  queue->first = ( queue->first + 1 ) & mask;
+  queue->length--;
+  queue->bytes -= message->length;
+  queue->dropped++;
+  free_buffer( message );
+}
+
+
+/*
+ * Takes the message, or frees it if the limits drop it. Returns false
+ * if the message is dropped.
+ */
 bool
 enqueue_message( message_queue *queue, buffer *message ) {
   assert( queue != NULL );
   assert( message != NULL );
   assert( message->length > 0 );
 
-  list_element *new_tail = xmalloc( sizeof( list_element ) );
-  new_tail->data = message;
-  new_tail->next = NULL;
+  if ( exceeds_limits( queue, queue->length + 1, queue->bytes + message->length ) ) {
+    switch ( queue->limits.overflow_policy ) {
+      case MESSAGE_QUEUE_DROP_OLDEST:
+      {
+        int kept = queue->head_offset > 0 ? 1 : 0;
+        while ( queue->length > kept
+                && exceeds_limits( queue, queue->length + 1, queue->bytes + message->length ) ) {
+          drop_oldest_message( queue );
+        }
+        if ( !exceeds_limits( queue, queue->length + 1, queue->bytes + message->length ) ) {
+          break;
+        }
+      }
+      // fall through
+      case MESSAGE_QUEUE_DROP_NEW:
+        queue->dropped++;
+        free_buffer( message );
+        return false;
 
-  queue->length++;
-
-  if ( queue->head == NULL ) {
-    queue->head = new_tail;
-    queue->tail = new_tail;
+      default:
+        // The producer has been told to stop, and what it sent in the
+        // meantime is still taken.
+        break;
+    }
+  }
 
-    return true;
+  if ( queue->length == queue->size ) {
+    grow_message_queue( queue );
   }
+  queue->messages[ ( queue->first + queue->length ) & ( queue->size - 1 ) ] = message;
+  queue->length++;
+  queue->bytes += message->length;
 
-  queue->tail->next = new_tail;
-  queue->tail = new_tail;
+  // Tell the producer to stop as soon as the queue is full.
+  if ( queue->limits.overflow_policy == MESSAGE_QUEUE_BLOCK
+       && exceeds_limits( queue, queue->length + 1, queue->bytes + 1 ) ) {
+    queue->blocked = true;
+  }
+  if ( queue->length > queue->peak_length ) {
+    queue->peak_length = queue->length;
+  }
+  if ( queue->bytes > queue->peak_bytes ) {
+    queue->peak_bytes = queue->bytes;
+  }
 
   return true;
 }
@@ -79,34 +229,49 @@ buffer *
 dequeue_message( message_queue *queue ) {
   assert( queue != NULL );
 
-  if ( queue->head == NULL ) {
+  if ( queue->length == 0 ) {
     return NULL;
   }
 
-  list_element *delete_me = queue->head;
-  buffer *message = delete_me->data;
-  queue->head = queue->head->next;
-  xfree( delete_me );
+  buffer *message = queue->messages[ queue->first ];
+  queue->first = ( queue->first + 1 ) & ( queue->size - 1 );
+  queue->length--;
+  queue->bytes -= message->length;
+  queue->head_offset = 0;
 
-  if ( queue->head == NULL ) {
-    queue->tail = NULL;
+  if ( queue->blocked
+       && !exceeds_limits( queue, queue->length * 2, queue->bytes * 2 ) ) {
+    queue->blocked = false;
   }
 
-  queue->length--;
-
   return message;
 }
 
 
 buffer *
 peek_message( message_queue *queue ) {
+  return peek_message_at( queue, 0 );
+}
+
+
+buffer *
+peek_message_at( message_queue *queue, int index ) {
   assert( queue != NULL );
+  assert( index >= 0 );
 
-  if ( queue->head == NULL ) {
+  if ( index >= queue->length ) {
     return NULL;
   }
 
-  return queue->head->data;
+  return queue->messages[ ( queue->first + index ) & ( queue->size - 1 ) ];
+}
+
+
+bool
+is_message_queue_blocked( message_queue *queue ) {
+  assert( queue != NULL );
+
+  return queue->blocked;
 }
 
 
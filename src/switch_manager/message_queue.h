@@ -27,18 +27,44 @@
 #include "trema.h"
 
 
+/* What enqueue_message() does with a message beyond the limits. */
+enum {
+  MESSAGE_QUEUE_DROP_NEW,    // drop the message
+  MESSAGE_QUEUE_DROP_OLDEST, // drop queued messages to make room
+  MESSAGE_QUEUE_BLOCK,       // take the message and block the producer
+};
+
+/* Limits of a queue. Zero means no limit. */
+typedef struct {
+  int max_length;               // in messages
+  size_t max_bytes;
+  int overflow_policy;
+} message_queue_limits;
+
 typedef struct {
-  list_element *head;
-  list_element *tail;
+  buffer **messages;            // ring of queued messages
+  int size;                     // of the ring, a power of two
+  int first;                    // index of the first message in the ring
   int length;
+  size_t bytes;
+  size_t head_offset;           // bytes of the first message consumed
+  message_queue_limits limits;
+  bool blocked;                 // until half of the limits are free
+  int peak_length;
+  size_t peak_bytes;
+  uint64_t dropped;
 } message_queue;
 
 
 message_queue *create_message_queue( void );
 bool delete_message_queue( message_queue *queue );
+bool set_message_queue_limits( message_queue *queue, const message_queue_limits *limits );
+bool parse_message_queue_limits( const char *str, message_queue_limits *limits );
 bool enqueue_message( message_queue *queue, buffer *message );
 buffer *dequeue_message( message_queue *queue );
 buffer *peek_message( message_queue *queue );
+buffer *peek_message_at( message_queue *queue, int index );
+bool is_message_queue_blocked( message_queue *queue );
 
 
 #endif // MESSAGE_QUEUE_H
@@ -63,7 +63,7 @@ send_transaction_reply( struct switch_info *sw_info, buffer *buf ) {
   header = buf->data;
   xid = ntohl( header->xid );
 
-  xid_entry = lookup_xid_entry( xid );
+  xid_entry = lookup_xid_entry( sw_info->xid_table, xid );
   if ( xid_entry == NULL ) {
     free_buffer( buf );
     return -1;
@@ -71,7 +71,7 @@ send_transaction_reply( struct switch_info *sw_info, buffer *buf ) {
   header->xid = htonl( xid_entry->original_xid );
   service_send_to_reply( xid_entry->service_name, MESSENGER_OPENFLOW_MESSAGE,
                          &sw_info->datapath_id, buf );
-  delete_xid_entry( xid_entry );
+  delete_xid_entry( sw_info->xid_table, xid_entry );
   free_buffer( buf );
 
   return 0;
@@ -121,7 +121,7 @@ ofpmsg_recv_error( struct switch_info *sw_info, buffer *buf ) {
     if ( length >= offsetof( struct ofp_flow_mod, command ) ) {
       struct ofp_flow_mod *flow_mod = ( struct ofp_flow_mod * ) error_msg->data;
       uint32_t xid = ntohl( flow_mod->header.xid );
-      xid_entry_t *xid_entry = lookup_xid_entry( xid );
+      xid_entry_t *xid_entry = lookup_xid_entry( sw_info->xid_table, xid );
       if ( xid_entry != NULL ) {
         flow_mod->header.xid = htonl( xid_entry->original_xid );
       }
@@ -130,7 +130,7 @@ ofpmsg_recv_error( struct switch_info *sw_info, buffer *buf ) {
         free_buffer( buf );
         return 0;
       }
-      cookie_entry_t *entry = lookup_cookie_entry_by_cookie( &cookie );
+      cookie_entry_t *entry = lookup_cookie_entry_by_cookie( sw_info->cookie_table, &cookie );
       if ( entry != NULL ) {
         flow_mod->cookie = htonll( entry->application.cookie );
         if ( length >= offsetof( struct ofp_flow_mod, actions ) ) {
@@ -144,7 +144,7 @@ ofpmsg_recv_error( struct switch_info *sw_info, buffer *buf ) {
         case OFPFC_ADD:
         {
           if ( entry != NULL ) {
-            delete_cookie_entry( entry );
+            delete_cookie_entry( sw_info->cookie_table, entry );
           }
           else {
             error( "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
@@ -274,7 +274,7 @@ ofpmsg_recv_flowremoved( struct switch_info *sw_info, buffer *buf ) {
     return 0;
   }
 
-  entry = lookup_cookie_entry_by_cookie( &cookie );
+  entry = lookup_cookie_entry_by_cookie( sw_info->cookie_table, &cookie );
   if ( entry == NULL ) {
     error( "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
     free_buffer( buf );
@@ -292,7 +292,7 @@ ofpmsg_recv_flowremoved( struct switch_info *sw_info, buffer *buf ) {
                            &sw_info->datapath_id, buf );
   }
 
-  delete_cookie_entry( entry );
+  delete_cookie_entry( sw_info->cookie_table, entry );
   free_buffer( buf );
 
   return 0;
@@ -325,7 +325,7 @@ ofpmsg_recv_statsreply( struct switch_info *sw_info, buffer *buf ) {
     struct ofp_flow_stats *flow_stats = ( void * ) ( ( char * ) stats_reply + body_offset );
     while ( body_length > 0 ) {
       uint64_t cookie = ntohll( flow_stats->cookie );
-      cookie_entry_t *entry = lookup_cookie_entry_by_cookie( &cookie );
+      cookie_entry_t *entry = lookup_cookie_entry_by_cookie( sw_info->cookie_table, &cookie );
       if ( entry != NULL ) {
         debug( "Cookie entry found ( cookie = %#" PRIx64 ", application = [ cookie = %#" PRIx64 ", service name = %s ] ).",
                cookie, entry->application.cookie, entry->application.service_name );
@@ -342,7 +342,7 @@ ofpmsg_recv_statsreply( struct switch_info *sw_info, buffer *buf ) {
 
   // since we may receive multiple replies, we cannot call send_transaction_reply().
   uint32_t xid = ntohl( stats_reply->header.xid );
-  xid_entry_t *xid_entry = lookup_xid_entry( xid );
+  xid_entry_t *xid_entry = lookup_xid_entry( sw_info->xid_table, xid );
   if ( xid_entry == NULL ) {
     error( "No transaction id entry found ( transaction_id = %#lx ).", xid );
     free_buffer( buf );
@@ -353,7 +353,7 @@ ofpmsg_recv_statsreply( struct switch_info *sw_info, buffer *buf ) {
                          &sw_info->datapath_id, buf );
 
   if ( ( ntohs( stats_reply->flags ) & OFPSF_REPLY_MORE ) == 0 ) {
-    delete_xid_entry( xid_entry );
+    delete_xid_entry( sw_info->xid_table, xid_entry );
   }
   free_buffer( buf );
 
@@ -35,7 +35,7 @@ ofpmsg_send_hello( struct switch_info *sw_info ) {
   int ret;
   buffer *buf;
 
-  buf = create_hello( generate_xid() );
+  buf = create_hello( generate_xid( sw_info->xid_table ) );
 
   ret = send_to_secure_channel( sw_info, buf );
   if ( ret == 0 ) {
@@ -68,7 +68,7 @@ ofpmsg_send_featuresrequest( struct switch_info *sw_info ) {
   int ret;
   buffer *buf;
 
-  buf = create_features_request( generate_xid() );
+  buf = create_features_request( generate_xid( sw_info->xid_table ) );
 
   ret = send_to_secure_channel( sw_info, buf );
   if ( ret == 0 ) {
@@ -84,7 +84,7 @@ ofpmsg_send_setconfig( struct switch_info *sw_info ) {
   int ret;
   buffer *buf;
 
-  buf = create_set_config( generate_xid(), sw_info->config_flags,
+  buf = create_set_config( generate_xid( sw_info->xid_table ), sw_info->config_flags,
                            sw_info->miss_send_len );
 
   ret = send_to_secure_channel( sw_info, buf );
@@ -106,7 +106,7 @@ ofpmsg_send_error_msg( struct switch_info *sw_info, uint16_t type, uint16_t code
     data->length = OFP_ERROR_MSG_MAX_DATA;
   }
 
-  buf = create_error( generate_xid(), type, code, data );
+  buf = create_error( generate_xid( sw_info->xid_table ), type, code, data );
 
   ret = send_to_secure_channel( sw_info, buf );
   if ( ret == 0 ) {
@@ -118,7 +118,7 @@ ofpmsg_send_error_msg( struct switch_info *sw_info, uint16_t type, uint16_t code
 
 
 static int
-update_flowmod_cookie( buffer *buf, char *service_name ) {
+update_flowmod_cookie( struct switch_info *sw_info, buffer *buf, char *service_name ) {
   struct ofp_flow_mod *flow_mod = buf->data;
   uint16_t command = ntohs( flow_mod->command );
   uint16_t flags = ntohs( flow_mod->flags );
@@ -127,7 +127,7 @@ update_flowmod_cookie( buffer *buf, char *service_name ) {
   switch ( command ) {
   case OFPFC_ADD:
   {
-    uint64_t *new_cookie = insert_cookie_entry( &cookie, service_name, flags );
+    uint64_t *new_cookie = insert_cookie_entry( sw_info->cookie_table, &cookie, service_name, flags );
     if ( new_cookie == NULL ) {
       return -1;
     }
@@ -141,7 +141,7 @@ update_flowmod_cookie( buffer *buf, char *service_name ) {
   case OFPFC_DELETE:
   case OFPFC_DELETE_STRICT:
   {
-    cookie_entry_t *entry = lookup_cookie_entry_by_application( &cookie, service_name );
+    cookie_entry_t *entry = lookup_cookie_entry_by_application( sw_info->cookie_table, &cookie, service_name );
     if ( entry != NULL ) {
       flow_mod->cookie = htonll( entry->cookie );
     }
@@ -168,11 +168,11 @@ ofpmsg_send( struct switch_info *sw_info, buffer *buf, char *service_name ) {
 
   ofp_header = buf->data;
 
-  new_xid = insert_xid_entry( ntohl( ofp_header->xid ), service_name );
+  new_xid = insert_xid_entry( sw_info->xid_table, ntohl( ofp_header->xid ), service_name );
   ofp_header->xid = htonl( new_xid );
 
   if ( ofp_header->type == OFPT_FLOW_MOD ) {
-    ret = update_flowmod_cookie( buf, service_name );
+    ret = update_flowmod_cookie( sw_info, buf, service_name );
     if ( ret < 0 ) {
       error( "Failed to update cookie value ( ret = %d ).", ret );
       free_buffer( buf );
@@ -199,7 +199,7 @@ ofpmsg_send_delete_all_flows( struct switch_info *sw_info ) {
   memset( &match, 0, sizeof( match ) );
   match.wildcards = OFPFW_ALL;
 
-  buf = create_flow_mod( generate_xid(), match, RESERVED_COOKIE,
+  buf = create_flow_mod( generate_xid( sw_info->xid_table ), match, RESERVED_COOKIE,
                          OFPFC_DELETE, 0, 0, 0, 0, OFPP_NONE, 0, NULL );
 
   ret = send_to_secure_channel( sw_info, buf );
@@ -32,6 +32,7 @@
 #include "trema.h"
 #include "secure_channel_listener.h"
 #include "switch_manager.h"
+#include "switch_pool.h"
 
 
 const int LISTEN_SOCK_MAX = 128;
@@ -225,6 +226,12 @@ secure_channel_accept( struct listener_info *listener_info ) {
     error( "Failed to accept from switch. :%s.", strerror( errno )  );
     return;
   }
+  if ( listener_info->worker_threads > 0 ) {
+    if ( !add_switch_to_pool( accept_fd, &addr ) ) {
+      close( accept_fd );
+    }
+    return;
+  }
   pid = fork();
   if ( pid < 0 ) {
     error( "Failed to fork. %s.", strerror( errno ) );
@@ -24,29 +24,94 @@
 #include <string.h>
 #include <unistd.h>
 #include "trema.h"
-#include "message_queue.h"
 #include "ofpmsg_recv.h"
 #include "ofpmsg_send.h"
 #include "secure_channel_receiver.h"
 
 
+// Twice the maximum message length, so that more messages can be received
+// while one of the maximum length waits to be handled.
+#define RECV_RING_LENGTH ( ( size_t ) UINT16_MAX * 2 )
+
+
+static bool
+make_room_in_recv_ring( struct switch_info *sw_info ) {
+  if ( sw_info->recv_tail < RECV_RING_LENGTH ) {
+    return true;
+  }
+  if ( sw_info->recv_head == 0 ) {
+    return false;
+  }
+
+  // A message handled earlier may still be referred to by somebody.
+  unshare_buffer( sw_info->recv_ring );
+
+  size_t length = sw_info->recv_tail - sw_info->recv_head;
+  if ( length > 0 ) {
+    memmove( sw_info->recv_ring->data, ( char * ) sw_info->recv_ring->data + sw_info->recv_head, length );
+  }
+  sw_info->recv_framed -= sw_info->recv_head;
+  sw_info->recv_tail = length;
+  sw_info->recv_head = 0;
+
+  return true;
+}
+
+
+static void
+send_bad_request_error( struct switch_info *sw_info, uint16_t code ) {
+  buffer *fragment = slice_buffer( sw_info->recv_ring, sw_info->recv_framed,
+                                   sw_info->recv_tail - sw_info->recv_framed );
+  ofpmsg_send_error_msg( sw_info, OFPET_BAD_REQUEST, code, fragment );
+  free_buffer( fragment );
+}
+
+
+bool
+can_recv_from_secure_channel( const struct switch_info *sw_info ) {
+  assert( sw_info != NULL );
+
+  if ( sw_info->recv_paused ) {
+    return false;
+  }
+  if ( sw_info->recv_ring == NULL ) {
+    return true;
+  }
+
+  return sw_info->recv_tail < RECV_RING_LENGTH || sw_info->recv_head > 0;
+}
+
+
+bool
+has_messages_from_secure_channel( const struct switch_info *sw_info ) {
+  assert( sw_info != NULL );
+
+  return sw_info->recv_head < sw_info->recv_framed;
+}
+
+
 int
 recv_from_secure_channel( struct switch_info *sw_info ) {
   assert( sw_info != NULL );
-  assert( sw_info->recv_queue != NULL );
 
-  // all queued messages should be processed before receiving new messages from remote
-  if ( sw_info->recv_queue->length > 0 ) {
-    return 0;
+  if ( sw_info->recv_ring == NULL ) {
+    sw_info->recv_ring = alloc_buffer_with_length( RECV_RING_LENGTH );
+    append_back_buffer( sw_info->recv_ring, RECV_RING_LENGTH );
+    sw_info->recv_head = sw_info->recv_framed = sw_info->recv_tail = 0;
   }
-
-  if ( sw_info->fragment_buf == NULL ) {
-    sw_info->fragment_buf = alloc_buffer_with_length( UINT16_MAX );
+  else if ( sw_info->recv_head == sw_info->recv_tail ) {
+    // Everything received is handled, so start over from the front
+    // without moving anything.
+    unshare_buffer( sw_info->recv_ring );
+    sw_info->recv_head = sw_info->recv_framed = sw_info->recv_tail = 0;
+  }
+  if ( !make_room_in_recv_ring( sw_info ) ) {
+    return 0;
   }
 
-  size_t remaining_length = UINT16_MAX - sw_info->fragment_buf->length;
-  char *recv_buf = ( char * ) sw_info->fragment_buf->data + sw_info->fragment_buf->length;
-  ssize_t recv_length = read( sw_info->secure_channel_fd, recv_buf, remaining_length );
+  char *ring = sw_info->recv_ring->data;
+  ssize_t recv_length = read( sw_info->secure_channel_fd, ring + sw_info->recv_tail,
+                              RECV_RING_LENGTH - sw_info->recv_tail );
   if ( recv_length < 0 ) {
     if ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) {
       return 0;
@@ -58,58 +123,61 @@ recv_from_secure_channel( struct switch_info *sw_info ) {
     debug( "Connection closed by peer." );
     return -1;
   }
-  sw_info->fragment_buf->length += ( size_t ) recv_length;
+  sw_info->recv_tail += ( size_t ) recv_length;
 
-  size_t read_total = 0;
-  while ( sw_info->fragment_buf->length >= sizeof( struct ofp_header ) ) {
-    struct ofp_header *header = sw_info->fragment_buf->data;
+  while ( sw_info->recv_tail - sw_info->recv_framed >= sizeof( struct ofp_header ) ) {
+    struct ofp_header *header = ( struct ofp_header * ) ( ring + sw_info->recv_framed );
+    uint16_t message_length = ntohs( header->length );
     if ( header->version != OFP_VERSION ) {
       error( "Receive error: invalid version (version %d)", header->version );
-      ofpmsg_send_error_msg( sw_info,
-                             OFPET_BAD_REQUEST, OFPBRC_BAD_VERSION, sw_info->fragment_buf );
+      send_bad_request_error( sw_info, OFPBRC_BAD_VERSION );
       return -1;
     }
-    uint16_t message_length = ntohs( header->length );
-    if ( message_length > sw_info->fragment_buf->length ) {
+    if ( message_length < sizeof( struct ofp_header ) ) {
+      error( "Receive error: invalid length (length %u)", message_length );
+      send_bad_request_error( sw_info, OFPBRC_BAD_LEN );
+      return -1;
+    }
+    if ( message_length > sw_info->recv_tail - sw_info->recv_framed ) {
       break;
     }
-    buffer *message = alloc_buffer_with_length( message_length );
-    char *p = append_back_buffer( message, message_length );
-    memcpy( p, sw_info->fragment_buf->data, message_length );
-    remove_front_buffer( sw_info->fragment_buf, message_length ); 
-    enqueue_message( sw_info->recv_queue, message );
-    read_total += message_length;
-  }
-
-  // remove headroom manually for next call
-  if ( read_total > 0 ) {
-    memmove( ( char * ) sw_info->fragment_buf->data - read_total,
-             sw_info->fragment_buf->data,
-             sw_info->fragment_buf->length );
-    sw_info->fragment_buf->data = ( char * ) sw_info->fragment_buf->data - read_total;
+    sw_info->recv_framed += message_length;
   }
 
   return 0;
 }
 
 
+/*
+ * Handles framed messages until max_messages are handled or max_bytes
+ * are reached. The last message may go beyond max_bytes, so that a long
+ * message never gets stuck.
+ */
 int
-handle_messages_from_secure_channel( struct switch_info *sw_info ) {
+handle_messages_from_secure_channel( struct switch_info *sw_info, int max_messages, size_t max_bytes ) {
   assert( sw_info != NULL );
-  assert( sw_info->recv_queue != NULL );
 
   int ret;
   int errors = 0;
   int received = 0;
-  buffer *message;
+  size_t received_bytes = 0;
 
-  while ( ( message = dequeue_message( sw_info->recv_queue ) ) != NULL && received < 64 ) { // FIXME: magic number
+  // Handlers get views into the ring. Nothing else refers to the bytes of
+  // a framed message, so they may rewrite its header in place as before.
+  while ( !sw_info->recv_paused && has_messages_from_secure_channel( sw_info )
+          && received < max_messages && received_bytes < max_bytes ) {
+    struct ofp_header *header = ( struct ofp_header * ) ( ( char * ) sw_info->recv_ring->data + sw_info->recv_head );
+    uint16_t message_length = ntohs( header->length );
+    buffer *message = slice_buffer( sw_info->recv_ring, sw_info->recv_head, message_length );
+    sw_info->recv_head += message_length;
+    sw_info->recv_bytes += message_length;
     ret = ofpmsg_recv( sw_info, message );
     if ( ret < 0 ) {
       error( "Failed to handle message to application." );
       errors++;
     }
     received++;
+    received_bytes += message_length;
   }
 
   return errors == 0 ? 0 : -1;
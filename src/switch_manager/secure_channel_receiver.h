@@ -28,7 +28,9 @@
 
 
 int recv_from_secure_channel( struct switch_info *sw_info );
-int handle_messages_from_secure_channel( struct switch_info *sw_info );
+int handle_messages_from_secure_channel( struct switch_info *sw_info, int max_messages, size_t max_bytes );
+bool can_recv_from_secure_channel( const struct switch_info *sw_info );
+bool has_messages_from_secure_channel( const struct switch_info *sw_info );
 
 
 #endif // SECURE_CHANNEL_RECEIVER_H
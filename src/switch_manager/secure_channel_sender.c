@@ -20,8 +20,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <openflow.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "message_queue.h"
 #include "ofpmsg_send.h"
@@ -29,6 +33,11 @@
 #include "trema.h"
 
 
+#define SEND_BYTES_STAT_KEY "secure_channel.send_bytes"
+#define SEND_CALLS_STAT_KEY "secure_channel.send_calls"
+#define SEND_DROPS_STAT_KEY "secure_channel.send_drops"
+
+
 int
 send_to_secure_channel( struct switch_info *sw_info, buffer *buf ) {
   assert( sw_info != NULL );
@@ -39,7 +48,15 @@ send_to_secure_channel( struct switch_info *sw_info, buffer *buf ) {
     return -1;
   }
 
-  return ( enqueue_message( sw_info->send_queue, buf ) == true ) ? 0 : -1;
+  uint64_t dropped = sw_info->send_queue->dropped;
+  bool ret = enqueue_message( sw_info->send_queue, buf );
+  if ( sw_info->send_queue->dropped > dropped ) {
+    warn( "Dropped %" PRIu64 " messages to a switch ( dpid = %#" PRIx64 ", queued = %d ).",
+          sw_info->send_queue->dropped - dropped, sw_info->datapath_id, sw_info->send_queue->length );
+    increment_stat_by( SEND_DROPS_STAT_KEY, sw_info->send_queue->dropped - dropped );
+  }
+
+  return ret ? 0 : -1;
 }
 
 
@@ -49,28 +66,67 @@ flush_secure_channel( struct switch_info *sw_info ) {
   assert( sw_info->send_queue != NULL );
   assert( sw_info->secure_channel_fd >= 0 );
 
-  buffer *buf;
-  ssize_t write_length;
+  struct iovec iov[ IOV_MAX ];
+  uint64_t bytes = 0;
+  uint64_t calls = 0;
+  int ret = 0;
+
+  message_queue *queue = sw_info->send_queue;
+  while ( queue->length > 0 ) {
+    // Gather queued messages, starting behind the part of the first one
+    // written by the previous call.
+    size_t count = 0;
+    size_t total = 0;
+    size_t offset = queue->head_offset;
+    buffer *buf;
+    while ( count < IOV_MAX && ( buf = peek_message_at( queue, ( int ) count ) ) != NULL ) {
+      iov[ count ].iov_base = ( char * ) buf->data + offset;
+      iov[ count ].iov_len = buf->length - offset;
+      total += iov[ count ].iov_len;
+      offset = 0;
+      count++;
+    }
 
-  while ( ( buf = peek_message( sw_info->send_queue ) ) != NULL ) {
-    write_length = write( sw_info->secure_channel_fd, buf->data, buf->length );
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    // Let TCP fill segments across batches instead of pushing each one.
+    ssize_t write_length = sendmsg( sw_info->secure_channel_fd, &msg, ( int ) count < queue->length ? MSG_MORE : 0 );
     if ( write_length < 0 ) {
-      if ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) {
-        return 0;
+      if ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK ) {
+        error( "Failed to send a message to secure channel ( errno = %s [%d] ).",
+               strerror( errno ), errno );
+        ret = -1;
       }
-      error( "Failed to send a message to secure channel ( errno = %s [%d] ).",
-             strerror( errno ), errno );
-      return -1;
+      break;
     }
-    if ( ( size_t ) write_length < buf->length ) {
-      remove_front_buffer( buf, ( size_t ) write_length );
-      return 0;
+    bytes += ( size_t ) write_length;
+    calls++;
+
+    size_t remaining_length = ( size_t ) write_length;
+    while ( remaining_length > 0 ) {
+      size_t length = peek_message( queue )->length - queue->head_offset;
+      if ( remaining_length < length ) {
+        queue->head_offset += remaining_length;
+        break;
+      }
+      remaining_length -= length;
+      free_buffer( dequeue_message( queue ) );
+    }
+    if ( ( size_t ) write_length < total ) {
+      break;
     }
-    buf = dequeue_message( sw_info->send_queue );
-    free_buffer( buf );
   }
 
-  return 0;
+  if ( calls > 0 ) {
+    sw_info->send_bytes += bytes;
+    sw_info->send_calls += calls;
+    increment_stat_by( SEND_BYTES_STAT_KEY, bytes );
+    increment_stat_by( SEND_CALLS_STAT_KEY, calls );
+  }
+
+  return ret;
 }
 
 
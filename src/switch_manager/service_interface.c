@@ -26,53 +26,54 @@
 #include "trema.h"
 
 
-static buffer *
-create_openflow_application_message( uint64_t *datapath_id, buffer *data ) {
-  openflow_service_header_t *message;
-  buffer *buf;
-  void *append;
-  size_t append_len = 0;
-
-  if ( data != NULL ) {
-     append_len = data->length;
-  }
-  buf = alloc_buffer_with_length( sizeof( openflow_service_header_t ) + append_len );
-  message = append_back_buffer( buf, sizeof( openflow_service_header_t ) );
+static size_t
+create_openflow_application_message( messenger_segment *segments, openflow_service_header_t *header,
+                                     uint64_t *datapath_id, buffer *data ) {
+  size_t count = 0;
+
   if (datapath_id == NULL) {
-    message->datapath_id = ~0U; // FIXME: defined invalid datapath_id
+    header->datapath_id = ~0U; // FIXME: defined invalid datapath_id
   } else {
-    message->datapath_id = htonll( *datapath_id );
+    header->datapath_id = htonll( *datapath_id );
   }
-  message->service_name_length = htons( 0 );
+  header->service_name_length = htons( 0 );
   // TODO: append ipaddress and port
-  if ( append_len > 0 ) {
-    append = append_back_buffer( buf, append_len );
-    memcpy( append, data->data, append_len );
+  segments[ count ].data = header;
+  segments[ count ].len = sizeof( openflow_service_header_t );
+  count++;
+  // The payload is gathered by the messenger, so it is not copied here.
+  if ( data != NULL && data->length > 0 ) {
+    segments[ count ].data = data->data;
+    segments[ count ].len = data->length;
+    count++;
   }
 
-  return buf;
+  return count;
 }
 
 
 void
 service_send_to_reply( char *service_name, uint16_t message_type, uint64_t *datapath_id, buffer *data ) {
-  buffer *buf;
+  openflow_service_header_t header;
+  messenger_segment segments[ 2 ];
+  size_t count;
 
   if ( service_name == NULL ) {
     return;
   }
 
-  buf = create_openflow_application_message( datapath_id, data );
-  if ( !send_message( service_name, message_type, buf->data, buf->length ) ) {
+  count = create_openflow_application_message( segments, &header, datapath_id, data );
+  if ( !send_message_segments( service_name, message_type, segments, count ) ) {
     error( "Failed to send message." );
   }
-  free_buffer( buf );
 }
 
 
 void
 service_send_to_application( list_element *service_name_list, uint16_t message_type, uint64_t *datapath_id, buffer *data ) {
-  buffer *buf;
+  openflow_service_header_t header;
+  messenger_segment segments[ 2 ];
+  size_t count;
   list_element *list;
   char *service_name;
 
@@ -80,16 +81,14 @@ service_send_to_application( list_element *service_name_list, uint16_t message_t
     return;
   }
 
-  buf = create_openflow_application_message( datapath_id, data );
+  count = create_openflow_application_message( segments, &header, datapath_id, data );
 
   for ( list = service_name_list; list != NULL; list = list->next ) {
     service_name = list->data;
-    if ( !send_message( service_name, message_type, 
-                        buf->data, buf->length ) ) {
+    if ( !send_message_segments( service_name, message_type, segments, count ) ) {
       error( "Failed to send message." );
     }
   }
-  free_buffer( buf );
 }
 
 
@@ -27,6 +27,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "trema.h"
 #include "cookie_table.h"
@@ -44,11 +45,17 @@
 
 enum long_options_val {
   NO_FLOW_CLEANUP_LONG_OPTION_VALUE = 1,
+  SEND_QUEUE_LIMIT_LONG_OPTION_VALUE,
+  SECURE_CHANNEL_BUDGET_LONG_OPTION_VALUE,
+  APPLICATION_BUDGET_LONG_OPTION_VALUE,
 };
 
 static struct option long_options[] = {
   { "socket", 1, NULL, 's' },
   { "no-flow-cleanup", 0, NULL, NO_FLOW_CLEANUP_LONG_OPTION_VALUE },
+  { "send-queue-limit", 1, NULL, SEND_QUEUE_LIMIT_LONG_OPTION_VALUE },
+  { "secure-channel-budget", 1, NULL, SECURE_CHANNEL_BUDGET_LONG_OPTION_VALUE },
+  { "application-budget", 1, NULL, APPLICATION_BUDGET_LONG_OPTION_VALUE },
   { NULL, 0, NULL, 0  },
 };
 
@@ -61,6 +68,64 @@ static const time_t COOKIE_TABLE_AGING_INTERVAL = 3600;
 
 static bool age_cookie_table_enabled = false;
 
+// Number of applications whose send queue is above its high watermark.
+static int congested_service_count = 0;
+
+static message_queue_limits send_queue_limits = {
+  SWITCH_SEND_QUEUE_MAX_LENGTH,
+  SWITCH_SEND_QUEUE_MAX_BYTES,
+  SWITCH_SEND_QUEUE_OVERFLOW_POLICY,
+};
+
+/*
+ * Messages from the switch and messages from applications are handled
+ * in rounds by deficit round robin. In each round, a direction handles
+ * up to its budget of messages, and up to the bytes it has earned: its
+ * budget of bytes plus what it left unused in the previous round, or
+ * minus what it overdrew. Messages from applications are delivered by
+ * the messenger, so they are charged after the fact and applications
+ * are not read for the rest of a round once the budget is spent.
+ *
+ * Queueing delay is sampled by following one message of each direction
+ * at a time, from when it is received until it is handled, or until it
+ * is written to the switch.
+ */
+typedef struct {
+  int budget_messages;          // per round
+  size_t budget_bytes;          // per round
+  int64_t deficit;              // bytes that may still be handled
+  int messages;                 // handled in this round
+  bool exhausted;               // until the next round
+  bool sampling;
+  uint64_t sample_mark;         // byte count when the sample is done
+  struct timespec sample_since;
+  uint64_t delay_samples;
+  uint64_t delay_total;         // in microseconds
+  uint64_t delay_max;           // in microseconds
+  const char *delay_stat_key;
+  const char *samples_stat_key;
+} schedule_lane;
+
+static schedule_lane secure_channel_lane = {
+  .budget_messages = SWITCH_SECURE_CHANNEL_BUDGET_MESSAGES,
+  .budget_bytes = SWITCH_SECURE_CHANNEL_BUDGET_BYTES,
+  .delay_stat_key = "switch.secure_channel.delay_usec",
+  .samples_stat_key = "switch.secure_channel.delay_samples",
+};
+
+static schedule_lane application_lane = {
+  .budget_messages = SWITCH_APPLICATION_BUDGET_MESSAGES,
+  .budget_bytes = SWITCH_APPLICATION_BUDGET_BYTES,
+  .delay_stat_key = "switch.application.delay_usec",
+  .samples_stat_key = "switch.application.delay_samples",
+};
+
+static bool send_queue_blocked = false;
+
+// Applications are not read while the send queue is blocked or their
+// budget is spent.
+static bool service_recv_paused = false;
+
 
 void
 usage() {
@@ -72,6 +137,15 @@ usage() {
     "  -n, --name=SERVICE_NAME     service name\n"
     "  -l, --logging_level=LEVEL   set logging level\n"
     "      --no-flow-cleanup       do not cleanup flows on start\n"
+    "      --send-queue-limit=MESSAGES,BYTES[,POLICY]\n"
+    "                              limit messages queued to the switch, and\n"
+    "                              drop-new, drop-oldest or block beyond it\n"
+    "      --secure-channel-budget=MESSAGES,BYTES\n"
+    "                              handle messages from the switch up to\n"
+    "                              MESSAGES and BYTES per round (default %d,%d)\n"
+    "      --application-budget=MESSAGES,BYTES\n"
+    "                              handle messages from applications up to\n"
+    "                              MESSAGES and BYTES per round (default %d,%d)\n"
     "  -h, --help                  display this help and exit\n"
     "\n"
     "DESTINATION-RULE:\n"
@@ -84,7 +158,9 @@ usage() {
     "  state_notify                connection status\n"
     "\n"
     "destination-service-name      destination service name\n"
-    , get_executable_name()
+    , get_executable_name(),
+    SWITCH_SECURE_CHANNEL_BUDGET_MESSAGES, SWITCH_SECURE_CHANNEL_BUDGET_BYTES,
+    SWITCH_APPLICATION_BUDGET_MESSAGES, SWITCH_APPLICATION_BUDGET_BYTES
   );
 }
 
@@ -103,6 +179,26 @@ strtofd( const char *str ) {
 }
 
 
+static bool
+parse_budget( const char *str, schedule_lane *lane ) {
+  char *ep;
+
+  long messages = strtol( str, &ep, 0 );
+  if ( ep == str || *ep != ',' || messages <= 0 || messages > INT_MAX ) {
+    return false;
+  }
+  str = ep + 1;
+  long bytes = strtol( str, &ep, 0 );
+  if ( ep == str || *ep != '\0' || bytes <= 0 || bytes > INT_MAX ) {
+    return false;
+  }
+  lane->budget_messages = ( int ) messages;
+  lane->budget_bytes = ( size_t ) bytes;
+
+  return true;
+}
+
+
 static void
 option_parser( int argc, char *argv[] ) {
   int c;
@@ -119,6 +215,24 @@ option_parser( int argc, char *argv[] ) {
         switch_info.flow_cleanup = false;
         break;
 
+      case SEND_QUEUE_LIMIT_LONG_OPTION_VALUE:
+        if ( !parse_message_queue_limits( optarg, &send_queue_limits ) ) {
+          die( "Invalid send queue limit (%s).", optarg );
+        }
+        break;
+
+      case SECURE_CHANNEL_BUDGET_LONG_OPTION_VALUE:
+        if ( !parse_budget( optarg, &secure_channel_lane ) ) {
+          die( "Invalid secure channel budget (%s).", optarg );
+        }
+        break;
+
+      case APPLICATION_BUDGET_LONG_OPTION_VALUE:
+        if ( !parse_budget( optarg, &application_lane ) ) {
+          die( "Invalid application budget (%s).", optarg );
+        }
+        break;
+
       default:
         usage();
         exit( EXIT_SUCCESS );
@@ -128,6 +242,9 @@ option_parser( int argc, char *argv[] ) {
 }
 
 
+static void update_service_recv_paused( void );
+
+
 static void
 service_recv( uint16_t message_type, void *data, size_t data_len ) {
   buffer *buf;
@@ -139,6 +256,13 @@ service_recv( uint16_t message_type, void *data, size_t data_len ) {
   memcpy( msg, data, data_len );
 
   service_recv_from_application( message_type, buf );
+
+  application_lane.messages++;
+  application_lane.deficit -= ( int64_t ) data_len;
+  if ( application_lane.messages >= application_lane.budget_messages || application_lane.deficit <= 0 ) {
+    application_lane.exhausted = true;
+    update_service_recv_paused();
+  }
 }
 
 
@@ -148,15 +272,153 @@ service_send_state( struct switch_info *sw_info, uint64_t *dpid, uint16_t tag )
 }
 
 
+static void
+start_delay_sample( schedule_lane *lane, uint64_t mark ) {
+  if ( lane->sampling ) {
+    return;
+  }
+  lane->sampling = true;
+  lane->sample_mark = mark;
+  clock_gettime( CLOCK_MONOTONIC, &lane->sample_since );
+}
+
+
+static void
+end_delay_sample( schedule_lane *lane, uint64_t count ) {
+  if ( !lane->sampling || count < lane->sample_mark ) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  int64_t delay = ( int64_t ) ( now.tv_sec - lane->sample_since.tv_sec ) * 1000000
+                  + ( now.tv_nsec - lane->sample_since.tv_nsec ) / 1000;
+  if ( delay < 0 ) {
+    delay = 0;
+  }
+  lane->sampling = false;
+  lane->delay_samples++;
+  lane->delay_total += ( uint64_t ) delay;
+  if ( ( uint64_t ) delay > lane->delay_max ) {
+    lane->delay_max = ( uint64_t ) delay;
+  }
+  increment_stat_by( lane->delay_stat_key, ( uint64_t ) delay );
+  increment_stat( lane->samples_stat_key );
+}
+
+
+static bool
+secure_channel_backlogged( void ) {
+  return !switch_info.recv_paused && has_messages_from_secure_channel( &switch_info );
+}
+
+
+static void
+run_schedule_round( void ) {
+  if ( switch_info.secure_channel_fd < 0 ) {
+    return;
+  }
+
+  schedule_lane *lane = &secure_channel_lane;
+  if ( secure_channel_backlogged() ) {
+    lane->deficit += ( int64_t ) lane->budget_bytes;
+    if ( lane->deficit > 0 ) {
+      uint64_t handled = switch_info.recv_bytes;
+      int ret = handle_messages_from_secure_channel( &switch_info, lane->budget_messages, ( size_t ) lane->deficit );
+      lane->deficit -= ( int64_t ) ( switch_info.recv_bytes - handled );
+      end_delay_sample( lane, switch_info.recv_bytes );
+      if ( ret < 0 ) {
+        stop_messenger();
+        return;
+      }
+    }
+  }
+  if ( !has_messages_from_secure_channel( &switch_info ) && lane->deficit > 0 ) {
+    // Nothing is carried over by an idle direction.
+    lane->deficit = 0;
+  }
+
+  lane = &application_lane;
+  if ( !lane->exhausted && lane->deficit > 0 ) {
+    lane->deficit = 0;
+  }
+  lane->deficit += ( int64_t ) lane->budget_bytes;
+  lane->messages = 0;
+  lane->exhausted = lane->deficit <= 0;
+  update_service_recv_paused();
+}
+
+
+static bool
+has_schedule_work( void ) {
+  if ( secure_channel_backlogged() ) {
+    return true;
+  }
+  // The next round lets applications in again.
+  return application_lane.exhausted && !send_queue_blocked;
+}
+
+
+static void
+service_send_queue_pressure( const char *service_name, bool congested, void *user_data ) {
+  UNUSED( user_data );
+
+  if ( congested ) {
+    congested_service_count++;
+    notice( "Stop reading from secure channel until %s catches up ( dpid = %#" PRIx64 " ).",
+          service_name, switch_info.datapath_id );
+  }
+  else {
+    congested_service_count--;
+    debug( "Resume reading from secure channel ( service_name = %s ).", service_name );
+  }
+  // Received messages wait in the ring meanwhile.
+  switch_info.recv_paused = congested_service_count > 0;
+}
+
+
+static void
+update_service_recv_paused( void ) {
+  bool blocked = switch_info.send_queue != NULL && is_message_queue_blocked( switch_info.send_queue );
+  if ( blocked != send_queue_blocked ) {
+    if ( blocked ) {
+      notice( "Stop receiving messages from applications until a switch catches up ( dpid = %#" PRIx64 ", queued = %zu bytes ).",
+              switch_info.datapath_id, switch_info.send_queue->bytes );
+    }
+    else {
+      debug( "Resume receiving messages from applications ( dpid = %#" PRIx64 " ).", switch_info.datapath_id );
+    }
+    send_queue_blocked = blocked;
+  }
+
+  bool paused = blocked || application_lane.exhausted;
+  if ( paused == service_recv_paused ) {
+    return;
+  }
+  // Resuming delivers held messages, which may pause applications again.
+  service_recv_paused = paused;
+  set_receive_queue_paused( get_trema_name(), paused );
+}
+
+
 static void
 secure_channel_fd_set( fd_set *read_set, fd_set *write_set ) {
   if ( switch_info.secure_channel_fd < 0 ) {
     return;
   }
-  FD_SET( switch_info.secure_channel_fd, read_set );
+  // Leave messages in the kernel so that TCP slows the switch down
+  // rather than dropping them on the way to a busy application.
+  if ( can_recv_from_secure_channel( &switch_info ) ) {
+    FD_SET( switch_info.secure_channel_fd, read_set );
+  }
   if ( switch_info.send_queue != NULL && switch_info.send_queue->length > 0 ) {
     FD_SET( switch_info.secure_channel_fd, write_set );
   }
+  // Called on every iteration of the event loop, so that a round does
+  // not wait for the sockets when there is work left.
+  if ( has_schedule_work() ) {
+    set_external_callback( run_schedule_round );
+  }
 }
 
 
@@ -170,18 +432,17 @@ secure_channel_fd_isset( fd_set *read_set, fd_set *write_set ) {
       switch_event_disconnected( &switch_info );
       return;
     }
+    end_delay_sample( &application_lane, switch_info.send_bytes );
+    update_service_recv_paused();
   }
   if ( FD_ISSET( switch_info.secure_channel_fd, read_set ) ) {
     if ( recv_from_secure_channel( &switch_info ) < 0 ) {
       switch_event_disconnected( &switch_info );
       return;
     }
-  }
-
-  if ( switch_info.recv_queue->length > 0 ) {
-    int ret = handle_messages_from_secure_channel( &switch_info );
-    if ( ret < 0 ) {
-      stop_messenger();
+    if ( has_messages_from_secure_channel( &switch_info ) ) {
+      start_delay_sample( &secure_channel_lane,
+                          switch_info.recv_bytes + switch_info.recv_framed - switch_info.recv_head );
     }
   }
 }
@@ -315,6 +576,10 @@ switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
       start_messenger_dump( new_service_name, DEFAULT_DUMP_SERVICE_NAME );
     }
     set_trema_name( new_service_name );
+    // The receive queue under the new name is not paused yet.
+    if ( service_recv_paused ) {
+      set_receive_queue_paused( new_service_name, true );
+    }
 
     // notify state and datapath_id
     service_send_state( sw_info, &sw_info->datapath_id, MESSENGER_OPENFLOW_READY );
@@ -350,22 +615,35 @@ switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
 int
 switch_event_disconnected( struct switch_info *sw_info ) {
   sw_info->state = SWITCH_STATE_DISCONNECTED;
+  debug( "Sent %" PRIu64 " bytes to a switch in %" PRIu64 " system calls ( dpid = %#" PRIx64 " ).",
+         sw_info->send_bytes, sw_info->send_calls, sw_info->datapath_id );
+  if ( sw_info->send_queue != NULL ) {
+    debug( "Queued up to %d messages ( %zu bytes ) to a switch and dropped %" PRIu64 " ( dpid = %#" PRIx64 " ).",
+           sw_info->send_queue->peak_length, sw_info->send_queue->peak_bytes,
+           sw_info->send_queue->dropped, sw_info->datapath_id );
+  }
+  if ( secure_channel_lane.delay_samples > 0 ) {
+    debug( "Messages from a switch waited %" PRIu64 " usec on average and %" PRIu64 " usec at most ( dpid = %#" PRIx64 " ).",
+           secure_channel_lane.delay_total / secure_channel_lane.delay_samples, secure_channel_lane.delay_max,
+           sw_info->datapath_id );
+  }
+  if ( application_lane.delay_samples > 0 ) {
+    debug( "Messages to a switch waited %" PRIu64 " usec on average and %" PRIu64 " usec at most ( dpid = %#" PRIx64 " ).",
+           application_lane.delay_total / application_lane.delay_samples, application_lane.delay_max,
+           sw_info->datapath_id );
+  }
 
-  if ( sw_info->fragment_buf != NULL ) {
-    free_buffer( sw_info->fragment_buf );
-    sw_info->fragment_buf = NULL;
+  if ( sw_info->recv_ring != NULL ) {
+    free_buffer( sw_info->recv_ring );
+    sw_info->recv_ring = NULL;
   }
+  sw_info->recv_head = sw_info->recv_framed = sw_info->recv_tail = 0;
 
   if ( sw_info->send_queue != NULL ) {
     delete_message_queue( sw_info->send_queue );
     sw_info->send_queue = NULL;
   }
 
-  if ( sw_info->recv_queue != NULL ) {
-    delete_message_queue( sw_info->recv_queue );
-    sw_info->recv_queue = NULL;
-  }
-
   if ( sw_info->secure_channel_fd >= 0 ) {
     close( sw_info->secure_channel_fd );
     sw_info->secure_channel_fd = -1;
@@ -392,7 +670,14 @@ switch_event_recv_from_application( uint64_t *datapath_id, char *application_ser
     return -1;
   }
 
-  return ofpmsg_send( &switch_info, buf, application_service_name );
+  int ret = ofpmsg_send( &switch_info, buf, application_service_name );
+  if ( switch_info.send_queue != NULL && switch_info.send_queue->length > 0 ) {
+    start_delay_sample( &application_lane, switch_info.send_bytes + switch_info.send_queue->bytes
+                        - switch_info.send_queue->head_offset );
+  }
+  update_service_recv_paused();
+
+  return ret;
 }
 
 
@@ -424,11 +709,11 @@ management_recv( uint16_t tag, void *data, size_t data_len ) {
 
   switch ( tag ) {
   case DUMP_XID_TABLE:
-    dump_xid_table();
+    dump_xid_table( switch_info.xid_table );
     break;
 
   case DUMP_COOKIE_TABLE:
-    dump_cookie_table();
+    dump_cookie_table( switch_info.cookie_table );
     break;
 
   case TOGGLE_COOKIE_AGING:
@@ -437,7 +722,7 @@ management_recv( uint16_t tag, void *data, size_t data_len ) {
       age_cookie_table_enabled = false;
     }
     else {
-      add_periodic_event_callback( COOKIE_TABLE_AGING_INTERVAL, age_cookie_table, NULL );
+      add_periodic_event_callback( COOKIE_TABLE_AGING_INTERVAL, age_cookie_table, switch_info.cookie_table );
       age_cookie_table_enabled = true;
     }
     break;
@@ -457,17 +742,18 @@ main( int argc, char *argv[] ) {
 
   init_trema( &argc, &argv );
   option_parser( argc, argv );
+  application_lane.deficit = ( int64_t ) application_lane.budget_bytes;
+
+  // Switch state changes must not wait behind queued packet_in messages.
+  set_message_tag_priority( MESSENGER_OPENFLOW_CONNECTED, MESSENGER_PRIORITY_HIGH );
+  set_message_tag_priority( MESSENGER_OPENFLOW_READY, MESSENGER_PRIORITY_HIGH );
+  set_message_tag_priority( MESSENGER_OPENFLOW_DISCONNECTED, MESSENGER_PRIORITY_HIGH );
 
   create_list( &switch_info.vendor_service_name_list );
   create_list( &switch_info.packetin_service_name_list );
   create_list( &switch_info.portstatus_service_name_list );
   create_list( &switch_info.state_service_name_list );
 
-  // FIXME
-#define VENDER_PREFIX "vendor::"
-#define PACKET_IN_PREFIX "packet_in::"
-#define PORTSTATUS_PREFIX "port_status::"
-#define STATE_PREFIX "state_notify::"
   for ( i = optind; i < argc; i++ ) {
     if ( strncmp( argv[i], VENDER_PREFIX, strlen( VENDER_PREFIX ) ) == 0 ) {
       service_name = xstrdup( argv[i] + strlen( VENDER_PREFIX ) );
@@ -492,15 +778,20 @@ main( int argc, char *argv[] ) {
   switch_info.config_flags = OFPC_FRAG_NORMAL;
   switch_info.miss_send_len = UINT16_MAX;
 
-  switch_info.fragment_buf = NULL;
+  switch_info.recv_ring = NULL;
+  switch_info.recv_head = switch_info.recv_framed = switch_info.recv_tail = 0;
+  switch_info.recv_paused = false;
+  switch_info.recv_bytes = 0;
   switch_info.send_queue = create_message_queue();
-  switch_info.recv_queue = create_message_queue();
+  set_message_queue_limits( switch_info.send_queue, &send_queue_limits );
+  switch_info.send_bytes = switch_info.send_calls = 0;
 
-  init_xid_table();
-  init_cookie_table();
+  switch_info.xid_table = create_xid_table();
+  switch_info.cookie_table = create_cookie_table();
 
   set_fd_set_callback( secure_channel_fd_set );
   set_check_fd_isset_callback( secure_channel_fd_isset );
+  add_send_queue_pressure_callback( service_send_queue_pressure, NULL );
   add_message_received_callback( get_trema_name(), service_recv );
 
   snprintf( management_service_name , MESSENGER_SERVICE_NAME_LENGTH,
@@ -516,8 +807,8 @@ main( int argc, char *argv[] ) {
 
   start_trema();
 
-  finalize_xid_table();
-  finalize_cookie_table();
+  delete_xid_table( switch_info.xid_table );
+  delete_cookie_table( switch_info.cookie_table );
 
   return 0;
 }
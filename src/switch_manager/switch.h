@@ -35,10 +35,27 @@
 #define SWITCH_STATE_TIMEOUT_HELLO 5          // in seconds
 #define SWITCH_STATE_TIMEOUT_FEATURES_REPLY 5 // in seconds
 
+// Default limits of the queue of messages to a switch
+#define SWITCH_SEND_QUEUE_MAX_LENGTH 65536
+#define SWITCH_SEND_QUEUE_MAX_BYTES ( 16 * 1024 * 1024 )
+#define SWITCH_SEND_QUEUE_OVERFLOW_POLICY MESSAGE_QUEUE_BLOCK
+
+// Default budgets per scheduling round
+#define SWITCH_SECURE_CHANNEL_BUDGET_MESSAGES 64
+#define SWITCH_SECURE_CHANNEL_BUDGET_BYTES 65536
+#define SWITCH_APPLICATION_BUDGET_MESSAGES 64
+#define SWITCH_APPLICATION_BUDGET_BYTES 65536
+
 #define SWITCH_MANAGER_PREFIX "switch."
 #define SWITCH_MANAGER_PREFIX_STR_LEN sizeof( SWITCH_MANAGER_PREFIX )
 #define SWITCH_MANAGER_DPID_STR_LEN sizeof( "1234567812345678" )
 
+// Prefixes of DESTINATION-RULEs
+#define VENDER_PREFIX "vendor::"
+#define PACKET_IN_PREFIX "packet_in::"
+#define PORTSTATUS_PREFIX "port_status::"
+#define STATE_PREFIX "state_notify::"
+
 int switch_event_connected( struct switch_info *switch_info );
 int switch_event_disconnected( struct switch_info *switch_info );
 int switch_event_recv_hello( struct switch_info *switch_info );
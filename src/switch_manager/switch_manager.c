@@ -32,6 +32,7 @@
 #include "trema.h"
 #include "secure_channel_listener.h"
 #include "switch_manager.h"
+#include "switch_pool.h"
 #include "dpid_table.h"
 
 
@@ -147,10 +148,11 @@ struct listener_info listener_info;
 static struct option long_options[] = {
   { "port", 1, NULL, 'p' },
   { "switch", 1, NULL, 's' },
+  { "threads", 1, NULL, 't' },
   { NULL, 0, NULL, 0  },
 };
 
-static char short_options[] = "p:s:";
+static char short_options[] = "p:s:t:";
 
 
 void
@@ -162,6 +164,7 @@ usage() {
 	 "  -s, --switch=PATH           the command path of switch\n"
 	 "  -n, --name=SERVICE_NAME     service name\n"
          "  -p, --port=PORT             server listen port (default %u)\n"
+	 "  -t, --threads=NUM           handle switches in NUM threads of this process\n"
 	 "  -d, --daemonize             run in the background\n"
 	 "  -l, --logging_level=LEVEL   set logging level\n"
 	 "  -h, --help                  display this help and exit\n"
@@ -275,6 +278,7 @@ init_listener_info( struct listener_info *listener_info ) {
   listener_info->switch_daemon = xconcatenate_path( get_trema_home(), SWITCH_MANAGER_PATH );
   listener_info->listen_port = OFP_TCP_PORT;
   listener_info->listen_fd = -1;
+  listener_info->worker_threads = 0;
 }
 
 
@@ -305,6 +309,20 @@ strtoport( const char *str ) {
 }
 
 
+static int
+strtothreads( const char *str ) {
+  char *ep;
+  long l;
+
+  l = strtol( str, &ep, 0 );
+  if ( l <= 0 || l > 1024 || *ep != '\0' ) {
+    die( "Invalid number of threads. %s", str );
+    return 0;
+  }
+  return ( int ) l;
+}
+
+
 static bool
 parse_argument( struct listener_info *listener_info, int argc, char *argv[] ) {
   int c;
@@ -321,6 +339,12 @@ parse_argument( struct listener_info *listener_info, int argc, char *argv[] ) {
         xfree( (void *)( uintptr_t )listener_info->switch_daemon );
         listener_info->switch_daemon = xstrdup( optarg );
         break;
+      case 't':
+        listener_info->worker_threads = strtothreads( optarg );
+        if ( listener_info->worker_threads == 0 ) {
+          return false;
+        }
+        break;
       default:
         usage();
         exit( EXIT_SUCCESS );
@@ -430,9 +454,19 @@ main( int argc, char *argv[] ) {
   start_service_management();
   start_switch_management();
 
-  switch_daemon = listener_info.switch_daemon;
-  listener_info.switch_daemon = absolute_path( startup_dir, switch_daemon );
-  xfree( ( void * )( uintptr_t )switch_daemon );
+  if ( listener_info.worker_threads > 0 ) {
+    ret = start_switch_pool( listener_info.worker_threads,
+                             listener_info.switch_daemon_argc, listener_info.switch_daemon_argv );
+    if ( !ret ) {
+      finalize_listener_info( &listener_info );
+      exit( EXIT_FAILURE );
+    }
+  }
+  else {
+    switch_daemon = listener_info.switch_daemon;
+    listener_info.switch_daemon = absolute_path( startup_dir, switch_daemon );
+    xfree( ( void * )( uintptr_t )switch_daemon );
+  }
   // free returned buffer of get_current_dir_name()
   free( startup_dir );
 
@@ -449,6 +483,7 @@ main( int argc, char *argv[] ) {
 
   start_trema();
 
+  stop_switch_pool();
   finalize_listener_info( &listener_info );
   stop_switch_management();
   stop_service_management();
@@ -49,6 +49,7 @@ struct listener_info {
   char **switch_daemon_argv;
   uint16_t listen_port;
   int listen_fd;
+  int worker_threads;           // handles switches in this process if > 0
 };
 
 
@@ -0,0 +1,866 @@
+/*
+ * OpenFlow Switch Manager
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Handles the secure channels of all switches in the switch manager
+ * process, instead of running a switch daemon for each of them.
+ *
+ * Connections are spread over a fixed number of worker threads. Each
+ * worker waits on its sockets with epoll, splits received data into
+ * OpenFlow messages and writes queued messages out. Everything else a
+ * switch daemon does - the state machine, the xid and cookie tables and
+ * all messenger traffic - runs in the main thread, which the workers wake
+ * up through an eventfd when a switch has received messages or has been
+ * disconnected. The struct switch_info of a switch, its receive ring, its
+ * send queue and its tables are guarded by the mutex of the switch.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <openflow.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "trema.h"
+#include "message_queue.h"
+#include "ofpmsg_send.h"
+#include "secure_channel_receiver.h"
+#include "secure_channel_sender.h"
+#include "service_interface.h"
+#include "switch.h"
+#include "switch_pool.h"
+
+
+#define MAX_EPOLL_EVENTS 64
+#define SEND_QUEUE_LIMIT_OPTION "--send-queue-limit="
+#define SECURE_CHANNEL_BUDGET_OPTION "--secure-channel-budget"
+#define APPLICATION_BUDGET_OPTION "--application-budget"
+
+typedef struct {
+  int epoll_fd;
+  int wakeup_fd;
+  pthread_t thread;
+} switch_worker;
+
+typedef struct {
+  struct switch_info info; // must be the first member
+  pthread_mutex_t mutex;
+  switch_worker *worker;
+  uint32_t events;         // events the worker waits for
+  bool closed;             // removed from the worker
+  bool notified;           // in ready_switches ( guarded by ready_mutex )
+
+  // Used by the main thread only
+  bool registered;         // owns the service name and the datapath id
+  bool replaced;           // by a newer connection of the same datapath id
+  bool service_paused;     // while the send queue is blocked
+  time_t deadline;         // of hello or features reply
+  char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+} pooled_switch;
+
+
+static switch_worker *workers = NULL;
+static int worker_count = 0;
+static int next_worker = 0;
+
+static list_element *switches = NULL;
+static hash_table *switches_by_datapath_id = NULL;
+
+static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+static list_element *ready_switches = NULL;
+static int ready_fd = -1;
+
+// Number of applications whose send queue is above its high watermark.
+static int congested_service_count = 0;
+
+static bool flow_cleanup = true;
+static message_queue_limits send_queue_limits = {
+  SWITCH_SEND_QUEUE_MAX_LENGTH,
+  SWITCH_SEND_QUEUE_MAX_BYTES,
+  SWITCH_SEND_QUEUE_OVERFLOW_POLICY,
+};
+static int secure_channel_budget_messages = SWITCH_SECURE_CHANNEL_BUDGET_MESSAGES;
+static size_t secure_channel_budget_bytes = SWITCH_SECURE_CHANNEL_BUDGET_BYTES;
+static list_element *vendor_service_name_list = NULL;
+static list_element *packetin_service_name_list = NULL;
+static list_element *portstatus_service_name_list = NULL;
+static list_element *state_service_name_list = NULL;
+
+
+static void
+notify_switch( pooled_switch *sw ) {
+  pthread_mutex_lock( &ready_mutex );
+  if ( !sw->notified ) {
+    sw->notified = true;
+    append_to_tail( &ready_switches, sw );
+  }
+  pthread_mutex_unlock( &ready_mutex );
+
+  uint64_t count = 1;
+  if ( write( ready_fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to wake up the main thread ( errno = %s [%d] ).", strerror( errno ), errno );
+  }
+}
+
+
+static void
+update_switch_events( pooled_switch *sw ) {
+  if ( sw->closed ) {
+    return;
+  }
+
+  uint32_t events = 0;
+  // Leave messages in the kernel while the receive ring is full of
+  // messages the main thread has not handled, or while an application
+  // is busy.
+  if ( can_recv_from_secure_channel( &sw->info ) ) {
+    events |= EPOLLIN;
+  }
+  if ( sw->info.send_queue->length > 0 ) {
+    events |= EPOLLOUT;
+  }
+  if ( events == sw->events ) {
+    return;
+  }
+
+  struct epoll_event event;
+  memset( &event, 0, sizeof( event ) );
+  event.events = events;
+  event.data.ptr = sw;
+  if ( epoll_ctl( sw->worker->epoll_fd, EPOLL_CTL_MOD, sw->info.secure_channel_fd, &event ) < 0 ) {
+    error( "Failed to update events of a secure channel ( fd = %d, errno = %s [%d] ).",
+           sw->info.secure_channel_fd, strerror( errno ), errno );
+    return;
+  }
+  sw->events = events;
+}
+
+
+static void
+handle_secure_channel_event( pooled_switch *sw, uint32_t events ) {
+  struct switch_info *sw_info = &sw->info;
+  int ret = 0;
+
+  pthread_mutex_lock( &sw->mutex );
+
+  bool blocked = is_message_queue_blocked( sw_info->send_queue );
+
+  if ( ( events & ( EPOLLERR | EPOLLHUP ) ) != 0 ) {
+    ret = -1;
+  }
+  if ( ret == 0 && ( events & EPOLLOUT ) != 0 ) {
+    ret = flush_secure_channel( sw_info );
+  }
+  if ( ret == 0 && ( events & EPOLLIN ) != 0 ) {
+    ret = recv_from_secure_channel( sw_info );
+  }
+
+  if ( ret < 0 ) {
+    // The worker never sees the switch again, so that the main thread
+    // may release it.
+    epoll_ctl( sw->worker->epoll_fd, EPOLL_CTL_DEL, sw_info->secure_channel_fd, NULL );
+    sw->closed = true;
+    notify_switch( sw );
+  }
+  else {
+    // The main thread resumes receiving from applications.
+    if ( has_messages_from_secure_channel( sw_info )
+         || ( blocked && !is_message_queue_blocked( sw_info->send_queue ) ) ) {
+      notify_switch( sw );
+    }
+    update_switch_events( sw );
+  }
+
+  pthread_mutex_unlock( &sw->mutex );
+}
+
+
+static void *
+run_switch_worker( void *data ) {
+  switch_worker *worker = data;
+  struct epoll_event events[ MAX_EPOLL_EVENTS ];
+
+  sigset_t signals;
+  sigfillset( &signals );
+  pthread_sigmask( SIG_BLOCK, &signals, NULL );
+
+  while ( true ) {
+    int n = epoll_wait( worker->epoll_fd, events, MAX_EPOLL_EVENTS, -1 );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      error( "Failed to wait for secure channels ( errno = %s [%d] ).", strerror( errno ), errno );
+      break;
+    }
+    for ( int i = 0; i < n; i++ ) {
+      if ( events[ i ].data.ptr == NULL ) {
+        return NULL;
+      }
+      handle_secure_channel_event( events[ i ].data.ptr, events[ i ].events );
+    }
+  }
+
+  return NULL;
+}
+
+
+static void
+service_send_state( struct switch_info *sw_info, uint64_t *dpid, uint16_t tag ) {
+  service_send_to_application( sw_info->state_service_name_list, tag, dpid, NULL );
+}
+
+
+static void
+service_recv( uint16_t message_type, void *data, size_t data_len ) {
+  buffer *buf;
+  void *msg;
+
+  buf = alloc_buffer_with_length( data_len );
+
+  msg = append_back_buffer( buf, data_len );
+  memcpy( msg, data, data_len );
+
+  service_recv_from_application( message_type, buf );
+}
+
+
+static void
+free_switch( pooled_switch *sw ) {
+  struct switch_info *sw_info = &sw->info;
+
+  close( sw_info->secure_channel_fd );
+  if ( sw_info->recv_ring != NULL ) {
+    free_buffer( sw_info->recv_ring );
+  }
+  delete_message_queue( sw_info->send_queue );
+  delete_xid_table( sw_info->xid_table );
+  delete_cookie_table( sw_info->cookie_table );
+  pthread_mutex_destroy( &sw->mutex );
+  xfree( sw );
+}
+
+
+static void
+update_service_paused( pooled_switch *sw ) {
+  if ( !sw->registered ) {
+    return;
+  }
+
+  bool blocked = is_message_queue_blocked( sw->info.send_queue );
+  if ( blocked == sw->service_paused ) {
+    return;
+  }
+  if ( blocked ) {
+    notice( "Stop receiving messages from applications until a switch catches up ( dpid = %#" PRIx64 ", queued = %zu bytes ).",
+            sw->info.datapath_id, sw->info.send_queue->bytes );
+  }
+  else {
+    debug( "Resume receiving messages from applications ( dpid = %#" PRIx64 " ).", sw->info.datapath_id );
+  }
+  // Resuming delivers held messages, which may block the queue again.
+  sw->service_paused = blocked;
+  set_receive_queue_paused( sw->service_name, blocked );
+}
+
+
+static void
+release_switch( pooled_switch *sw ) {
+  struct switch_info *sw_info = &sw->info;
+
+  debug( "Releasing a switch ( dpid = %#" PRIx64 ", fd = %d ).", sw_info->datapath_id, sw_info->secure_channel_fd );
+  debug( "Sent %" PRIu64 " bytes to a switch in %" PRIu64 " system calls ( dpid = %#" PRIx64 " ).",
+         sw_info->send_bytes, sw_info->send_calls, sw_info->datapath_id );
+  debug( "Queued up to %d messages ( %zu bytes ) to a switch and dropped %" PRIu64 " ( dpid = %#" PRIx64 " ).",
+         sw_info->send_queue->peak_length, sw_info->send_queue->peak_bytes,
+         sw_info->send_queue->dropped, sw_info->datapath_id );
+
+  sw_info->state = SWITCH_STATE_DISCONNECTED;
+  if ( sw->registered ) {
+    delete_message_received_callback( sw->service_name, service_recv );
+    delete_hash_entry( switches_by_datapath_id, &sw_info->datapath_id );
+  }
+  if ( !sw->replaced ) {
+    service_send_state( sw_info, &sw_info->datapath_id, MESSENGER_OPENFLOW_DISCONNECTED );
+    debug( "send disconnected state" );
+  }
+
+  pthread_mutex_lock( &ready_mutex );
+  if ( sw->notified ) {
+    delete_element( &ready_switches, sw );
+  }
+  pthread_mutex_unlock( &ready_mutex );
+  delete_element( &switches, sw );
+
+  free_switch( sw );
+}
+
+
+static void
+handle_switch( pooled_switch *sw ) {
+  struct switch_info *sw_info = &sw->info;
+
+  pthread_mutex_lock( &sw->mutex );
+
+  if ( sw->closed ) {
+    pthread_mutex_unlock( &sw->mutex );
+    release_switch( sw );
+    return;
+  }
+
+  if ( has_messages_from_secure_channel( sw_info ) ) {
+    if ( handle_messages_from_secure_channel( sw_info, secure_channel_budget_messages,
+                                              secure_channel_budget_bytes ) < 0 ) {
+      switch_event_disconnected( sw_info );
+    }
+  }
+  // Come back later rather than starve other switches and the messenger.
+  if ( !sw_info->recv_paused && has_messages_from_secure_channel( sw_info ) ) {
+    notify_switch( sw );
+  }
+  update_switch_events( sw );
+  update_service_paused( sw );
+
+  pthread_mutex_unlock( &sw->mutex );
+}
+
+
+static void
+handle_ready_switches( int fd, void *data ) {
+  UNUSED( data );
+
+  uint64_t count;
+  if ( read( fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to read from eventfd ( errno = %s [%d] ).", strerror( errno ), errno );
+  }
+
+  // Handle only the switches that are ready now. Those notified again
+  // meanwhile wait for the next round, so that the messenger can flush
+  // its send queues while workers keep receiving.
+  pthread_mutex_lock( &ready_mutex );
+  list_element *switches_to_handle = ready_switches;
+  create_list( &ready_switches );
+  for ( list_element *e = switches_to_handle; e != NULL; e = e->next ) {
+    pooled_switch *sw = e->data;
+    sw->notified = false;
+  }
+  pthread_mutex_unlock( &ready_mutex );
+
+  for ( list_element *e = switches_to_handle; e != NULL; e = e->next ) {
+    handle_switch( e->data );
+  }
+  delete_list( switches_to_handle );
+}
+
+
+static void
+check_switch_timeouts( void *user_data ) {
+  UNUSED( user_data );
+
+  time_t now = time( NULL );
+  for ( list_element *e = switches; e != NULL; e = e->next ) {
+    pooled_switch *sw = e->data;
+    struct switch_info *sw_info = &sw->info;
+
+    pthread_mutex_lock( &sw->mutex );
+    if ( sw_info->state == SWITCH_STATE_WAIT_HELLO && now >= sw->deadline ) {
+      error( "Hello timeout. state:%d, dpid:%#" PRIx64 ", fd:%d.",
+             sw_info->state, sw_info->datapath_id, sw_info->secure_channel_fd );
+      switch_event_disconnected( sw_info );
+    }
+    else if ( sw_info->state == SWITCH_STATE_WAIT_FEATURES_REPLY && now >= sw->deadline ) {
+      error( "Features Reply timeout. state:%d, dpid:%#" PRIx64 ", fd:%d.",
+             sw_info->state, sw_info->datapath_id, sw_info->secure_channel_fd );
+      switch_event_disconnected( sw_info );
+    }
+    pthread_mutex_unlock( &sw->mutex );
+  }
+}
+
+
+static void
+handle_send_queue_pressure( const char *service_name, bool congested, void *user_data ) {
+  UNUSED( user_data );
+
+  if ( congested ) {
+    congested_service_count++;
+    notice( "Stop reading from secure channels until %s catches up.", service_name );
+  }
+  else {
+    congested_service_count--;
+    debug( "Resume reading from secure channels ( service_name = %s ).", service_name );
+  }
+
+  for ( list_element *e = switches; e != NULL; e = e->next ) {
+    pooled_switch *sw = e->data;
+    pthread_mutex_lock( &sw->mutex );
+    // Received messages wait in the ring meanwhile.
+    sw->info.recv_paused = congested_service_count > 0;
+    if ( !sw->info.recv_paused && has_messages_from_secure_channel( &sw->info ) ) {
+      notify_switch( sw );
+    }
+    update_switch_events( sw );
+    pthread_mutex_unlock( &sw->mutex );
+  }
+}
+
+
+int
+switch_event_connected( struct switch_info *sw_info ) {
+  pooled_switch *sw = ( pooled_switch * ) sw_info;
+  int ret;
+
+  service_send_state( sw_info, &sw_info->datapath_id, MESSENGER_OPENFLOW_CONNECTED );
+  debug( "Send connected state" );
+  ret = ofpmsg_send_hello( sw_info );
+  if ( ret < 0 ) {
+    return ret;
+  }
+  sw_info->state = SWITCH_STATE_WAIT_HELLO;
+  sw->deadline = time( NULL ) + SWITCH_STATE_TIMEOUT_HELLO;
+
+  return 0;
+}
+
+
+int
+switch_event_recv_hello( struct switch_info *sw_info ) {
+  pooled_switch *sw = ( pooled_switch * ) sw_info;
+  int ret;
+
+  if ( sw_info->state == SWITCH_STATE_WAIT_HELLO ) {
+    ret = ofpmsg_send_featuresrequest( sw_info );
+    if ( ret < 0 ) {
+      return ret;
+    }
+    sw_info->state = SWITCH_STATE_WAIT_FEATURES_REPLY;
+    sw->deadline = time( NULL ) + SWITCH_STATE_TIMEOUT_FEATURES_REPLY;
+  }
+
+  return 0;
+}
+
+
+int
+switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
+  pooled_switch *sw = ( pooled_switch * ) sw_info;
+  int ret;
+
+  switch ( sw_info->state ) {
+  case SWITCH_STATE_WAIT_FEATURES_REPLY:
+  {
+    sw_info->datapath_id = *dpid;
+    sw_info->state = SWITCH_STATE_COMPLETED;
+    snprintf( sw->service_name, sizeof( sw->service_name ), "%s%" PRIx64, SWITCH_MANAGER_PREFIX, sw_info->datapath_id );
+
+    // checking duplicate switch
+    pooled_switch *old = lookup_hash_entry( switches_by_datapath_id, &sw_info->datapath_id );
+    if ( old != NULL ) {
+      notice( "Switch ( dpid = %#" PRIx64 " ) reconnected. Closing the old connection ( fd = %d ).",
+              sw_info->datapath_id, old->info.secure_channel_fd );
+      // takes over the service name of the old connection
+      delete_hash_entry( switches_by_datapath_id, &old->info.datapath_id );
+      old->registered = false;
+      old->replaced = true;
+      sw->service_paused = old->service_paused;
+      switch_event_disconnected( &old->info );
+    }
+    else if ( !add_message_received_callback( sw->service_name, service_recv ) ) {
+      return -1;
+    }
+    insert_hash_entry( switches_by_datapath_id, &sw_info->datapath_id, sw );
+    sw->registered = true;
+
+    // notify state and datapath_id
+    service_send_state( sw_info, &sw_info->datapath_id, MESSENGER_OPENFLOW_READY );
+    debug( "send ready state" );
+
+    ret = ofpmsg_send_setconfig( sw_info );
+    if ( ret < 0 ) {
+      return ret;
+    }
+    if ( sw_info->flow_cleanup ) {
+      ret = ofpmsg_send_delete_all_flows( sw_info );
+      if ( ret < 0 ) {
+        return ret;
+      }
+    }
+  }
+  break;
+
+  case SWITCH_STATE_COMPLETED:
+    // NOP
+    break;
+
+  default:
+    notice( "Invalid event 'features reply' from a switch." );
+    return -1;
+
+    break;
+  }
+
+  return 0;
+}
+
+
+int
+switch_event_disconnected( struct switch_info *sw_info ) {
+  pooled_switch *sw = ( pooled_switch * ) sw_info;
+
+  pthread_mutex_lock( &sw->mutex );
+  sw_info->state = SWITCH_STATE_DISCONNECTED;
+  if ( !sw->closed ) {
+    // The worker sees a hang up and hands the switch back to be released.
+    shutdown( sw_info->secure_channel_fd, SHUT_RDWR );
+  }
+  pthread_mutex_unlock( &sw->mutex );
+
+  return 0;
+}
+
+
+int
+switch_event_recv_from_application( uint64_t *datapath_id, char *application_service_name, buffer *buf ) {
+  pooled_switch *sw = lookup_hash_entry( switches_by_datapath_id, datapath_id );
+  if ( sw == NULL ) {
+    error( "Invalid datapath id %#" PRIx64 ".", *datapath_id );
+    free_buffer( buf );
+
+    return -1;
+  }
+
+  pthread_mutex_lock( &sw->mutex );
+  int ret = ofpmsg_send( &sw->info, buf, application_service_name );
+  update_switch_events( sw );
+  update_service_paused( sw );
+  pthread_mutex_unlock( &sw->mutex );
+
+  return ret;
+}
+
+
+int
+switch_event_disconnect_request( uint64_t *datapath_id ) {
+  pooled_switch *sw = lookup_hash_entry( switches_by_datapath_id, datapath_id );
+  if ( sw == NULL ) {
+    error( "Invalid datapath id %#" PRIx64 ".", *datapath_id );
+    return -1;
+  }
+
+  return switch_event_disconnected( &sw->info );
+}
+
+
+int
+switch_event_recv_error( struct switch_info *sw_info ) {
+  if ( sw_info->state == SWITCH_STATE_COMPLETED ) {
+    return 0;
+  }
+
+  return -1;
+}
+
+
+bool
+add_switch_to_pool( int fd, const struct sockaddr_in *addr ) {
+  assert( worker_count > 0 );
+
+  pooled_switch *sw = xmalloc( sizeof( pooled_switch ) );
+  memset( sw, 0, sizeof( pooled_switch ) );
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init( &attr );
+  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
+  pthread_mutex_init( &sw->mutex, &attr );
+  pthread_mutexattr_destroy( &attr );
+
+  struct switch_info *sw_info = &sw->info;
+  sw_info->vendor_service_name_list = vendor_service_name_list;
+  sw_info->packetin_service_name_list = packetin_service_name_list;
+  sw_info->portstatus_service_name_list = portstatus_service_name_list;
+  sw_info->state_service_name_list = state_service_name_list;
+  sw_info->secure_channel_fd = fd;
+  sw_info->flow_cleanup = flow_cleanup;
+  sw_info->state = SWITCH_STATE_CONNECTED;
+  // default switch configuration
+  sw_info->config_flags = OFPC_FRAG_NORMAL;
+  sw_info->miss_send_len = UINT16_MAX;
+  sw_info->recv_ring = NULL;
+  sw_info->recv_head = sw_info->recv_framed = sw_info->recv_tail = 0;
+  sw_info->recv_paused = congested_service_count > 0;
+  sw_info->recv_bytes = 0;
+  sw_info->send_queue = create_message_queue();
+  set_message_queue_limits( sw_info->send_queue, &send_queue_limits );
+  sw_info->send_bytes = sw_info->send_calls = 0;
+  sw_info->xid_table = create_xid_table();
+  sw_info->cookie_table = create_cookie_table();
+
+  sw->worker = &workers[ next_worker ];
+  next_worker = ( next_worker + 1 ) % worker_count;
+
+  fcntl( fd, F_SETFL, O_NONBLOCK );
+  struct epoll_event event;
+  memset( &event, 0, sizeof( event ) );
+  event.events = 0;
+  event.data.ptr = sw;
+  if ( epoll_ctl( sw->worker->epoll_fd, EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+    error( "Failed to add a secure channel to a worker ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+    free_switch( sw );
+    return false;
+  }
+  append_to_tail( &switches, sw );
+
+  debug( "Switch connected from %s:%u ( fd = %d ).", inet_ntoa( addr->sin_addr ), ntohs( addr->sin_port ), fd );
+
+  pthread_mutex_lock( &sw->mutex );
+  int ret = switch_event_connected( sw_info );
+  update_switch_events( sw );
+  pthread_mutex_unlock( &sw->mutex );
+  if ( ret < 0 ) {
+    error( "Failed to set connected state." );
+    switch_event_disconnected( sw_info );
+  }
+
+  return true;
+}
+
+
+static bool
+parse_secure_channel_budget( const char *str ) {
+  char *ep;
+
+  long messages = strtol( str, &ep, 0 );
+  if ( ep == str || *ep != ',' || messages <= 0 || messages > INT_MAX ) {
+    return false;
+  }
+  str = ep + 1;
+  long bytes = strtol( str, &ep, 0 );
+  if ( ep == str || *ep != '\0' || bytes <= 0 || bytes > INT_MAX ) {
+    return false;
+  }
+  secure_channel_budget_messages = ( int ) messages;
+  secure_channel_budget_bytes = ( size_t ) bytes;
+
+  return true;
+}
+
+
+static void
+parse_switch_options( int argc, char *argv[] ) {
+  create_list( &vendor_service_name_list );
+  create_list( &packetin_service_name_list );
+  create_list( &portstatus_service_name_list );
+  create_list( &state_service_name_list );
+
+  // as the switch manager tells each switch daemon
+  insert_in_front( &state_service_name_list, xstrdup( get_trema_name() ) );
+
+  for ( int i = 0; i < argc; i++ ) {
+    if ( strcmp( argv[ i ], "--no-flow-cleanup" ) == 0 ) {
+      flow_cleanup = false;
+    }
+    else if ( strncmp( argv[ i ], SEND_QUEUE_LIMIT_OPTION, strlen( SEND_QUEUE_LIMIT_OPTION ) ) == 0 ) {
+      if ( !parse_message_queue_limits( argv[ i ] + strlen( SEND_QUEUE_LIMIT_OPTION ), &send_queue_limits ) ) {
+        die( "Invalid send queue limit (%s).", argv[ i ] );
+      }
+    }
+    else if ( strncmp( argv[ i ], SECURE_CHANNEL_BUDGET_OPTION, strlen( SECURE_CHANNEL_BUDGET_OPTION ) ) == 0 ) {
+      const char *value = argv[ i ] + strlen( SECURE_CHANNEL_BUDGET_OPTION );
+      if ( *value != '=' || !parse_secure_channel_budget( value + 1 ) ) {
+        die( "Invalid secure channel budget (%s).", argv[ i ] );
+      }
+    }
+    else if ( strncmp( argv[ i ], APPLICATION_BUDGET_OPTION, strlen( APPLICATION_BUDGET_OPTION ) ) == 0 ) {
+      // Messages from applications are handled as the messenger receives
+      // them, without rounds to budget.
+      die( "Application budget is not supported with switch threads (%s).", argv[ i ] );
+    }
+    else if ( strncmp( argv[ i ], VENDER_PREFIX, strlen( VENDER_PREFIX ) ) == 0 ) {
+      insert_in_front( &vendor_service_name_list, xstrdup( argv[ i ] + strlen( VENDER_PREFIX ) ) );
+    }
+    else if ( strncmp( argv[ i ], PACKET_IN_PREFIX, strlen( PACKET_IN_PREFIX ) ) == 0 ) {
+      insert_in_front( &packetin_service_name_list, xstrdup( argv[ i ] + strlen( PACKET_IN_PREFIX ) ) );
+    }
+    else if ( strncmp( argv[ i ], PORTSTATUS_PREFIX, strlen( PORTSTATUS_PREFIX ) ) == 0 ) {
+      insert_in_front( &portstatus_service_name_list, xstrdup( argv[ i ] + strlen( PORTSTATUS_PREFIX ) ) );
+    }
+    else if ( strncmp( argv[ i ], STATE_PREFIX, strlen( STATE_PREFIX ) ) == 0 ) {
+      insert_in_front( &state_service_name_list, xstrdup( argv[ i ] + strlen( STATE_PREFIX ) ) );
+    }
+    else {
+      warn( "Ignoring an unknown switch option ( %s ).", argv[ i ] );
+    }
+  }
+}
+
+
+static void
+delete_service_name_list( list_element **list ) {
+  for ( list_element *e = *list; e != NULL; e = e->next ) {
+    xfree( e->data );
+  }
+  delete_list( *list );
+  *list = NULL;
+}
+
+
+static bool
+start_switch_worker( switch_worker *worker ) {
+  worker->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( worker->epoll_fd < 0 ) {
+    error( "Failed to create an epoll instance ( errno = %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+  worker->wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( worker->wakeup_fd < 0 ) {
+    error( "Failed to create an eventfd ( errno = %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+
+  struct epoll_event event;
+  memset( &event, 0, sizeof( event ) );
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if ( epoll_ctl( worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd, &event ) < 0 ) {
+    error( "Failed to add an eventfd to an epoll instance ( errno = %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+
+  int ret = pthread_create( &worker->thread, NULL, run_switch_worker, worker );
+  if ( ret != 0 ) {
+    error( "Failed to create a worker thread ( errno = %s [%d] ).", strerror( ret ), ret );
+    return false;
+  }
+
+  return true;
+}
+
+
+bool
+start_switch_pool( int threads, int argc, char *argv[] ) {
+  assert( threads > 0 );
+  assert( workers == NULL );
+
+  parse_switch_options( argc, argv );
+
+  ready_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( ready_fd < 0 ) {
+    error( "Failed to create an eventfd ( errno = %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+  set_fd_handler( ready_fd, handle_ready_switches, NULL, NULL, NULL );
+  set_readable( ready_fd, true );
+
+  create_list( &switches );
+  create_list( &ready_switches );
+  switches_by_datapath_id = create_hash( compare_datapath_id, hash_datapath_id );
+
+  workers = xcalloc( ( size_t ) threads, sizeof( switch_worker ) );
+  for ( worker_count = 0; worker_count < threads; worker_count++ ) {
+    if ( !start_switch_worker( &workers[ worker_count ] ) ) {
+      stop_switch_pool();
+      return false;
+    }
+  }
+
+  // Switch state changes must not wait behind queued packet_in messages.
+  set_message_tag_priority( MESSENGER_OPENFLOW_CONNECTED, MESSENGER_PRIORITY_HIGH );
+  set_message_tag_priority( MESSENGER_OPENFLOW_READY, MESSENGER_PRIORITY_HIGH );
+  set_message_tag_priority( MESSENGER_OPENFLOW_DISCONNECTED, MESSENGER_PRIORITY_HIGH );
+
+  add_periodic_event_callback( 1, check_switch_timeouts, NULL );
+  add_send_queue_pressure_callback( handle_send_queue_pressure, NULL );
+
+  info( "Handling secure channels in %d worker threads.", threads );
+
+  return true;
+}
+
+
+void
+stop_switch_pool( void ) {
+  if ( workers == NULL ) {
+    return;
+  }
+
+  delete_send_queue_pressure_callback( handle_send_queue_pressure );
+  delete_periodic_event_callback( check_switch_timeouts );
+
+  for ( int i = 0; i < worker_count; i++ ) {
+    switch_worker *worker = &workers[ i ];
+    uint64_t count = 1;
+    if ( write( worker->wakeup_fd, &count, sizeof( count ) ) == sizeof( count ) ) {
+      pthread_join( worker->thread, NULL );
+    }
+    close( worker->wakeup_fd );
+    close( worker->epoll_fd );
+  }
+  xfree( workers );
+  workers = NULL;
+  worker_count = 0;
+  next_worker = 0;
+
+  for ( list_element *e = switches; e != NULL; e = e->next ) {
+    pooled_switch *sw = e->data;
+    if ( sw->registered ) {
+      delete_message_received_callback( sw->service_name, service_recv );
+    }
+    free_switch( sw );
+  }
+  delete_list( switches );
+  switches = NULL;
+  delete_list( ready_switches );
+  ready_switches = NULL;
+  delete_hash( switches_by_datapath_id );
+  switches_by_datapath_id = NULL;
+
+  delete_fd_handler( ready_fd );
+  close( ready_fd );
+  ready_fd = -1;
+
+  delete_service_name_list( &vendor_service_name_list );
+  delete_service_name_list( &packetin_service_name_list );
+  delete_service_name_list( &portstatus_service_name_list );
+  delete_service_name_list( &state_service_name_list );
+  flow_cleanup = true;
+  send_queue_limits.max_length = SWITCH_SEND_QUEUE_MAX_LENGTH;
+  send_queue_limits.max_bytes = SWITCH_SEND_QUEUE_MAX_BYTES;
+  send_queue_limits.overflow_policy = SWITCH_SEND_QUEUE_OVERFLOW_POLICY;
+  congested_service_count = 0;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,42 @@
+/*
+ * OpenFlow Switch Manager
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SWITCH_POOL_H
+#define SWITCH_POOL_H
+
+
+#include <netinet/in.h>
+#include "trema.h"
+
+
+bool start_switch_pool( int threads, int argc, char *argv[] );
+void stop_switch_pool( void );
+bool add_switch_to_pool( int fd, const struct sockaddr_in *addr );
+
+
+#endif // SWITCH_POOL_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -22,7 +22,9 @@
 #define SWITCHINFO_H
 
 
+#include "cookie_table.h"
 #include "message_queue.h"
+#include "xid_table.h"
 
 
 #define SWITCH_STATE_CONNECTED           0
@@ -51,11 +53,20 @@ struct switch_info {
   uint16_t miss_send_len;       /* Max bytes of new flow that datapath should
                                    send to the controller. */
 
-  buffer *fragment_buf;         /* openflow message fragmentation buffer of
-                                   secure channel receiver */
+  buffer *recv_ring;            /* openflow messages are framed in place in
+                                   this buffer of secure channel receiver */
+  size_t recv_head;             // offset of the first unhandled message
+  size_t recv_framed;           // offset next to the last framed message
+  size_t recv_tail;             // offset next to the last received byte
+  bool recv_paused;             // applications cannot take more messages
+  uint64_t recv_bytes;          // bytes handed to handlers
 
   message_queue *send_queue;
-  message_queue *recv_queue;
+  uint64_t send_bytes;          // bytes written to secure channel
+  uint64_t send_calls;          // system calls writing them
+
+  xid_table_t *xid_table;
+  cookie_table_t *cookie_table;
 };
 
 
@@ -25,47 +25,44 @@
 #include "xid_table.h"
 
 
-static uint32_t transaction_id = 0U;
-
 #define XID_MAX_ENTRIES 4096
 
-typedef struct xid_table {
+struct xid_table {
   xid_entry_t *entries[ XID_MAX_ENTRIES ];
   hash_table *hash;
   int next_index;
-} xid_table_t;
-
-static xid_table_t xid_table;
+  uint32_t transaction_id;
+};
 
 
 uint32_t
-generate_xid( void ) {
-  uint32_t initial_value = ( transaction_id != UINT32_MAX ) ? ++transaction_id : 0;
+generate_xid( xid_table_t *xid_table ) {
+  uint32_t initial_value = ( xid_table->transaction_id != UINT32_MAX ) ? ++xid_table->transaction_id : 0;
 
-  while ( lookup_xid_entry( transaction_id ) != NULL ) {
-    if ( transaction_id != UINT32_MAX ) {
-      transaction_id++;
+  while ( lookup_xid_entry( xid_table, xid_table->transaction_id ) != NULL ) {
+    if ( xid_table->transaction_id != UINT32_MAX ) {
+      xid_table->transaction_id++;
     }
     else {
-      transaction_id = 0;
+      xid_table->transaction_id = 0;
     }
-    if ( initial_value == transaction_id ) {
+    if ( initial_value == xid_table->transaction_id ) {
       error( "Failed to generate transaction id value." );
-      transaction_id = 0;
+      xid_table->transaction_id = 0;
       break;
     }
   }
 
-  return transaction_id;
+  return xid_table->transaction_id;
 }
 
 
 static xid_entry_t *
-allocate_xid_entry( uint32_t original_xid, char *service_name, int index ) {
+allocate_xid_entry( xid_table_t *xid_table, uint32_t original_xid, char *service_name, int index ) {
   xid_entry_t *new_entry;
 
   new_entry = xmalloc( sizeof ( xid_entry_t ) );
-  new_entry->xid = generate_xid();
+  new_entry->xid = generate_xid( xid_table );
   new_entry->original_xid = original_xid;
   new_entry->service_name = xstrdup( service_name );
   new_entry->index = index;
@@ -93,58 +90,60 @@ hash_xid( const void *key ) {
 }
 
 
-void
-init_xid_table( void ) {
-  memset( &xid_table, 0, sizeof( xid_table_t ) );
-  xid_table.hash = create_hash( compare_xid, hash_xid );
-  xid_table.next_index = 0;
+xid_table_t *
+create_xid_table( void ) {
+  xid_table_t *xid_table = xmalloc( sizeof( xid_table_t ) );
+  memset( xid_table, 0, sizeof( xid_table_t ) );
+  xid_table->hash = create_hash( compare_xid, hash_xid );
+  xid_table->next_index = 0;
+
+  return xid_table;
 }
 
 
 void
-finalize_xid_table( void ) {
+delete_xid_table( xid_table_t *xid_table ) {
   for( int i = 0; i < XID_MAX_ENTRIES; i++ ) {
-    if ( xid_table.entries[ i ] != NULL ) {
-      free_xid_entry( xid_table.entries[ i ] );
-      xid_table.entries[ i ] = NULL;
+    if ( xid_table->entries[ i ] != NULL ) {
+      free_xid_entry( xid_table->entries[ i ] );
+      xid_table->entries[ i ] = NULL;
     }
   }
-  delete_hash( xid_table.hash );
-  xid_table.hash = NULL;
-  xid_table.next_index = 0;
+  delete_hash( xid_table->hash );
+  xfree( xid_table );
 }
 
 
 uint32_t
-insert_xid_entry( uint32_t original_xid, char *service_name ) {
+insert_xid_entry( xid_table_t *xid_table, uint32_t original_xid, char *service_name ) {
   xid_entry_t *new_entry;
 
   debug( "Inserting xid entry ( original_xid = %#lx, service_name = %s ).",
          original_xid, service_name );
 
-  if ( xid_table.next_index >= XID_MAX_ENTRIES ) {
-    xid_table.next_index = 0;
+  if ( xid_table->next_index >= XID_MAX_ENTRIES ) {
+    xid_table->next_index = 0;
   }
 
-  if ( xid_table.entries[ xid_table.next_index ] != NULL ) {
-    delete_xid_entry( xid_table.entries[ xid_table.next_index ] );
+  if ( xid_table->entries[ xid_table->next_index ] != NULL ) {
+    delete_xid_entry( xid_table, xid_table->entries[ xid_table->next_index ] );
   }
 
-  new_entry = allocate_xid_entry( original_xid, service_name, xid_table.next_index );
-  insert_hash_entry( xid_table.hash, &new_entry->xid, new_entry );
-  xid_table.entries[ xid_table.next_index ] = new_entry;
-  xid_table.next_index++;
+  new_entry = allocate_xid_entry( xid_table, original_xid, service_name, xid_table->next_index );
+  insert_hash_entry( xid_table->hash, &new_entry->xid, new_entry );
+  xid_table->entries[ xid_table->next_index ] = new_entry;
+  xid_table->next_index++;
 
   return new_entry->xid;
 }
 
 
 void
-delete_xid_entry( xid_entry_t *delete_entry ) {
+delete_xid_entry( xid_table_t *xid_table, xid_entry_t *delete_entry ) {
   debug( "Deleting xid entry ( xid = %#lx, original_xid = %#lx, service_name = %s, index = %d ).",
          delete_entry->xid, delete_entry->original_xid, delete_entry->service_name, delete_entry->index );
 
-  xid_entry_t *deleted = delete_hash_entry( xid_table.hash, &delete_entry->xid );
+  xid_entry_t *deleted = delete_hash_entry( xid_table->hash, &delete_entry->xid );
 
   if ( deleted == NULL ) {
     error( "Failed to delete xid entry ( xid = %#lx ).", delete_entry->xid );
@@ -152,14 +151,14 @@ delete_xid_entry( xid_entry_t *delete_entry ) {
     return;
   }
 
-  xid_table.entries[ deleted->index ] = NULL;
+  xid_table->entries[ deleted->index ] = NULL;
   free_xid_entry( deleted );
 }
 
 
 xid_entry_t *
-lookup_xid_entry( uint32_t xid ) {
-  return lookup_hash_entry( xid_table.hash, &xid );
+lookup_xid_entry( xid_table_t *xid_table, uint32_t xid ) {
+  return lookup_hash_entry( xid_table->hash, &xid );
 }
 
 
@@ -171,12 +170,12 @@ dump_xid_entry( xid_entry_t *entry ) {
 
 
 void
-dump_xid_table( void ) {
+dump_xid_table( xid_table_t *xid_table ) {
   hash_iterator iter;
   hash_entry *e;
 
   info( "#### XID TABLE ####" );
-  init_hash_iterator( xid_table.hash, &iter );
+  init_hash_iterator( xid_table->hash, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
     dump_xid_entry( e->value );
   }
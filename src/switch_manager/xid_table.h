@@ -34,14 +34,16 @@ typedef struct xid_entry {
   int index;
 } xid_entry_t;
 
+typedef struct xid_table xid_table_t;
 
-uint32_t generate_xid( void );
-void init_xid_table( void );
-void finalize_xid_table( void );
-uint32_t insert_xid_entry( uint32_t original_xid, char *service_name );
-void delete_xid_entry( xid_entry_t *entry );
-xid_entry_t *lookup_xid_entry( uint32_t xid );
-void dump_xid_table( void );
+
+uint32_t generate_xid( xid_table_t *xid_table );
+xid_table_t *create_xid_table( void );
+void delete_xid_table( xid_table_t *xid_table );
+uint32_t insert_xid_entry( xid_table_t *xid_table, uint32_t original_xid, char *service_name );
+void delete_xid_entry( xid_table_t *xid_table, xid_entry_t *entry );
+xid_entry_t *lookup_xid_entry( xid_table_t *xid_table, uint32_t xid );
+void dump_xid_table( xid_table_t *xid_table );
 
 
 #endif // XID_TABLE_H
@@ -19,9 +19,17 @@
 
 
 #include <pthread.h>
+#include <stdint.h>
 #include "checks.h"
 
 
+void
+mock_increment_stat_by( const char *key, uint64_t value ) {
+  UNUSED( key );
+  UNUSED( value );
+}
+
+
 int
 mock_pthread_mutex_init( pthread_mutex_t *mutex, const pthread_mutexattr_t *mutexattr ) {
   UNUSED( mutex );
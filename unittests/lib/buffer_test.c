@@ -26,8 +26,11 @@
 #include "buffer.h"
 #include "checks.h"
 #include "cmockery_trema.h"
+#include "log.h"
 #include "openflow.h"
+#include "openflow_service_interface.h"
 #include "packet_info.h"
+#include "stat.h"
 
 
 typedef struct tea {
@@ -43,10 +46,31 @@ typedef struct private_buffer {
   buffer public;
   size_t real_length;
   void *top;
-  pthread_mutex_t *mutex;
 } private_buffer;
 
 
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+// Pooled objects are released by finalize_buffer_pool(), so the pool has to
+// be finalized within each test for the leak detector.
+static void
+start_buffer_pool( size_t headroom, size_t tailroom ) {
+  init_log( "buffer_test", "/tmp", false );
+  init_stat();
+  init_buffer_pool( headroom, tailroom );
+}
+
+
+static void
+stop_buffer_pool() {
+  finalize_buffer_pool();
+  finalize_stat();
+  finalize_log();
+}
+
+
 /********************************************************************************
  * Tests.
  ********************************************************************************/
@@ -292,6 +316,207 @@ test_duplicate_buffer_succeeds_if_initialize_length_is_0() {
 }
 
 
+static void
+test_append_front_buffer_uses_headroom() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  void *top = ( ( private_buffer * ) buf )->top;
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  void *data = buf->data;
+
+  void *header = append_front_buffer( buf, sizeof( openflow_service_header_t ) );
+  assert_true( header == ( char * ) data - sizeof( openflow_service_header_t ) );
+  assert_true( buf->data == header );
+  assert_true( buf->length == sizeof( openflow_service_header_t ) + sizeof( tea ) );
+  assert_true( ( ( private_buffer * ) buf )->top == top );
+
+  tea *tea_data = ( tea * ) ( ( char * ) buf->data + sizeof( openflow_service_header_t ) );
+  assert_true( 0 == strcmp( tea_data->name, CEYLON.name ) );
+
+  free_buffer( buf );
+}
+
+
+static void
+test_append_front_buffer_reserves_headroom_when_resized() {
+  buffer *buf = alloc_buffer();
+
+  void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
+  assert_true( ( char * ) data_pointer - ( char * ) ( ( private_buffer * ) buf )->top == DEFAULT_BUFFER_HEADROOM );
+
+  free_buffer( buf );
+}
+
+
+static void
+test_append_back_buffer_uses_tailroom() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
+  void *top = ( ( private_buffer * ) buf )->top;
+  void *data = buf->data;
+
+  append_back_buffer( buf, sizeof( tea ) );
+  append_back_buffer( buf, sizeof( tea ) );
+  assert_true( ( ( private_buffer * ) buf )->top == top );
+  assert_true( buf->data == data );
+  assert_true( buf->length == sizeof( tea ) * 2 );
+
+  free_buffer( buf );
+}
+
+
+static void
+test_duplicate_buffer_copies_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+  remove_front_buffer( buf, sizeof( tea ) / 2 );
+
+  buffer *duplicate = duplicate_buffer( buf );
+  assert_true( duplicate->length == buf->length );
+  assert_memory_equal( duplicate->data, buf->data, buf->length );
+  assert_true( ( char * ) duplicate->data - ( char * ) ( ( private_buffer * ) duplicate )->top == DEFAULT_BUFFER_HEADROOM );
+
+  free_buffer( buf );
+  free_buffer( duplicate );
+}
+
+
+static void
+test_clone_buffer_shares_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  buf->user_data = &DARJEELING;
+
+  buffer *clone = clone_buffer( buf );
+  assert_true( clone->data == buf->data );
+  assert_true( clone->length == buf->length );
+  assert_true( clone->user_data == buf->user_data );
+  assert_true( clone->user_data_free_function == NULL );
+
+  buf->user_data = NULL;
+  free_buffer( buf );
+  tea *tea_data = ( tea * ) clone->data;
+  assert_true( 0 == strcmp( tea_data->name, CEYLON.name ) );
+
+  free_buffer( clone );
+}
+
+
+static void
+test_slice_buffer_refers_to_part_of_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+
+  buffer *slice = slice_buffer( buf, sizeof( tea ), sizeof( tea ) );
+  assert_true( slice->data == ( char * ) buf->data + sizeof( tea ) );
+  assert_true( slice->length == sizeof( tea ) );
+  assert_true( slice->user_data == NULL );
+  tea *tea_data = ( tea * ) slice->data;
+  assert_true( 0 == strcmp( tea_data->name, DARJEELING.name ) );
+
+  free_buffer( slice );
+  free_buffer( buf );
+}
+
+
+static void
+test_append_front_buffer_copies_claimed_headroom() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  void *top = ( ( private_buffer * ) buf )->top;
+
+  buffer *clone = clone_buffer( buf );
+  append_front_buffer( clone, sizeof( openflow_service_header_t ) );
+  assert_true( ( ( private_buffer * ) clone )->top == top );
+
+  void *data_pointer = append_front_buffer( buf, sizeof( openflow_service_header_t ) );
+  assert_true( ( ( private_buffer * ) buf )->top != top );
+  assert_true( buf->length == sizeof( openflow_service_header_t ) + sizeof( tea ) );
+  tea *tea_data = ( tea * ) ( ( char * ) data_pointer + sizeof( openflow_service_header_t ) );
+  assert_true( 0 == strcmp( tea_data->name, CEYLON.name ) );
+
+  free_buffer( clone );
+  free_buffer( buf );
+}
+
+
+static void
+test_append_back_buffer_copies_claimed_tailroom() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  void *top = ( ( private_buffer * ) buf )->top;
+
+  buffer *clone = clone_buffer( buf );
+  memcpy( append_back_buffer( clone, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+  assert_true( ( ( private_buffer * ) clone )->top == top );
+
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
+  assert_true( ( ( private_buffer * ) buf )->top != top );
+  memcpy( data_pointer, &CEYLON, sizeof( tea ) );
+  tea *tea_data = ( tea * ) ( ( char * ) clone->data + sizeof( tea ) );
+  assert_true( 0 == strcmp( tea_data->name, DARJEELING.name ) );
+
+  free_buffer( clone );
+  free_buffer( buf );
+}
+
+
+static void
+test_unshare_buffer_copies_shared_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  void *data = buf->data;
+  assert_true( unshare_buffer( buf ) == data );
+
+  buffer *clone = clone_buffer( buf );
+  tea *tea_data = unshare_buffer( clone );
+  assert_true( tea_data != data );
+  assert_true( clone->length == sizeof( tea ) );
+  memcpy( tea_data, &DARJEELING, sizeof( tea ) );
+  assert_true( 0 == strcmp( ( ( tea * ) buf->data )->name, CEYLON.name ) );
+
+  free_buffer( clone );
+  free_buffer( buf );
+}
+
+
+static void
+test_buffer_pool_reuses_released_buffers() {
+  uint64_t hits, misses;
+  start_buffer_pool( DEFAULT_BUFFER_HEADROOM, DEFAULT_BUFFER_TAILROOM );
+
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  void *top = ( ( private_buffer * ) buf )->top;
+  get_buffer_pool_stats( &hits, &misses );
+  assert_true( hits == 0 );
+  assert_true( misses == 2 );
+  free_buffer( buf );
+
+  buffer *reused = alloc_buffer_with_length( sizeof( tea ) );
+  assert_true( reused == buf );
+  assert_true( ( ( private_buffer * ) reused )->top == top );
+  get_buffer_pool_stats( &hits, &misses );
+  assert_true( hits == 2 );
+  assert_true( misses == 2 );
+
+  free_buffer( reused );
+  stop_buffer_pool();
+}
+
+
+static void
+test_init_buffer_pool_sets_headroom_and_tailroom() {
+  start_buffer_pool( 128, 32 );
+
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  private_buffer *pbuf = ( private_buffer * ) buf;
+  assert_true( ( char * ) buf->data - ( char * ) pbuf->top == 128 );
+  assert_true( pbuf->real_length >= 128 + sizeof( tea ) + 32 );
+
+  free_buffer( buf );
+  stop_buffer_pool();
+}
+
+
 static void
 dump_function( const char *format, ... ) {
   char hex[ 1000 ];
@@ -350,6 +575,20 @@ main() {
     unit_test( test_duplicate_buffer_succeeds_if_initialize_length_is_0 ),
 
     unit_test( test_dump_buffer ),
+
+    unit_test( test_append_front_buffer_uses_headroom ),
+    unit_test( test_append_front_buffer_reserves_headroom_when_resized ),
+    unit_test( test_append_back_buffer_uses_tailroom ),
+    unit_test( test_duplicate_buffer_copies_data ),
+
+    unit_test( test_clone_buffer_shares_data ),
+    unit_test( test_slice_buffer_refers_to_part_of_data ),
+    unit_test( test_append_front_buffer_copies_claimed_headroom ),
+    unit_test( test_append_back_buffer_copies_claimed_tailroom ),
+    unit_test( test_unshare_buffer_copies_shared_data ),
+
+    unit_test( test_buffer_pool_reuses_released_buffers ),
+    unit_test( test_init_buffer_pool_sets_headroom_and_tailroom ),
   };
   setup_leak_detector();
   return run_tests( tests );
@@ -0,0 +1,189 @@
+/*
+ * Unit tests for event handler.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "event_handler.h"
+#include "utility.h"
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static int fds[ 2 ];
+static int read_count;
+static int write_count;
+
+static char read_data[] = "read";
+static char write_data[] = "write";
+
+
+static void
+read_callback( int fd, void *data ) {
+  assert_int_equal( fd, fds[ 0 ] );
+  assert_string_equal( data, "read" );
+
+  char buf[ 16 ];
+  assert_true( read( fd, buf, sizeof( buf ) ) > 0 );
+  read_count++;
+}
+
+
+static void
+write_callback( int fd, void *data ) {
+  assert_int_equal( fd, fds[ 1 ] );
+  assert_string_equal( data, "write" );
+
+  write_count++;
+}
+
+
+static void
+setup() {
+  stub_logger();
+  assert_true( init_event_handler() );
+  assert_int_equal( pipe( fds ), 0 );
+  read_count = 0;
+  write_count = 0;
+}
+
+
+static void
+teardown() {
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+  assert_true( finalize_event_handler() );
+  unstub_logger();
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_no_event_until_readable_is_set() {
+  set_fd_handler( fds[ 0 ], read_callback, read_data, NULL, NULL );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  assert_int_equal( run_event_handler_once( 0 ), 0 );
+  assert_int_equal( read_count, 0 );
+  assert_false( readable( fds[ 0 ] ) );
+
+  delete_fd_handler( fds[ 0 ] );
+}
+
+
+static void
+test_read_callback_is_called_when_readable() {
+  set_fd_handler( fds[ 0 ], read_callback, read_data, NULL, NULL );
+  set_readable( fds[ 0 ], true );
+  assert_true( readable( fds[ 0 ] ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  assert_int_equal( run_event_handler_once( 0 ), 1 );
+  assert_int_equal( read_count, 1 );
+
+  // Level-triggered: nothing left to read.
+  assert_int_equal( run_event_handler_once( 0 ), 0 );
+  assert_int_equal( read_count, 1 );
+
+  delete_fd_handler( fds[ 0 ] );
+}
+
+
+static void
+test_write_callback_is_called_while_writable() {
+  set_fd_handler( fds[ 1 ], NULL, NULL, write_callback, write_data );
+  set_writable( fds[ 1 ], true );
+  assert_true( writable( fds[ 1 ] ) );
+
+  assert_int_equal( run_event_handler_once( 0 ), 1 );
+  assert_int_equal( run_event_handler_once( 0 ), 1 );
+  assert_int_equal( write_count, 2 );
+
+  set_writable( fds[ 1 ], false );
+  assert_false( writable( fds[ 1 ] ) );
+  assert_int_equal( run_event_handler_once( 0 ), 0 );
+  assert_int_equal( write_count, 2 );
+
+  delete_fd_handler( fds[ 1 ] );
+}
+
+
+static void
+test_no_event_after_delete_fd_handler() {
+  set_fd_handler( fds[ 0 ], read_callback, read_data, NULL, NULL );
+  set_readable( fds[ 0 ], true );
+  delete_fd_handler( fds[ 0 ] );
+  assert_false( readable( fds[ 0 ] ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  assert_int_equal( run_event_handler_once( 0 ), 0 );
+  assert_int_equal( read_count, 0 );
+}
+
+
+static void
+test_set_fd_handler_twice_replaces_callbacks() {
+  set_fd_handler( fds[ 0 ], write_callback, write_data, NULL, NULL );
+  set_readable( fds[ 0 ], true );
+  set_fd_handler( fds[ 0 ], read_callback, read_data, NULL, NULL );
+  assert_false( readable( fds[ 0 ] ) );
+  set_readable( fds[ 0 ], true );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  assert_int_equal( run_event_handler_once( 0 ), 1 );
+  assert_int_equal( read_count, 1 );
+
+  delete_fd_handler( fds[ 0 ] );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test_setup_teardown( test_no_event_until_readable_is_set, setup, teardown ),
+    unit_test_setup_teardown( test_read_callback_is_called_when_readable, setup, teardown ),
+    unit_test_setup_teardown( test_write_callback_is_called_while_writable, setup, teardown ),
+    unit_test_setup_teardown( test_no_event_after_delete_fd_handler, setup, teardown ),
+    unit_test_setup_teardown( test_set_fd_handler_twice_replaces_callbacks, setup, teardown ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,6 +20,7 @@
  */
 
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -127,7 +128,7 @@ test_nonexistent_entry_returns_NULL() {
 }
 
 
-static char **abc0[ 3 ] = { NULL, NULL, NULL };
+static char *abc0[ 3 ] = { NULL, NULL, NULL };
 
 static void
 append_back( void *value, void *user_data ) {
@@ -155,8 +156,8 @@ test_map() {
   map_hash( table, key, append_back, NULL );
 
   assert_string_equal( abc0[ 0 ], "charlie" );
-  assert_string_equal( abc0[ 1 ], "bravo" );
-  assert_string_equal( abc0[ 2 ], "alpha" );
+  assert_true( abc0[ 1 ] == NULL );
+  assert_true( abc0[ 2 ] == NULL );
 
   delete_hash( table );
 }
@@ -283,6 +284,246 @@ test_iterate_empty_hash() {
 }
 
 
+#define MANY 10000
+
+static uint32_t many_keys[ MANY ];
+
+
+static void
+test_entries_survive_resizing() {
+  table = create_hash( compare_uint32, hash_uint32 );
+  unsigned int initial_number_of_buckets = table->number_of_buckets;
+
+  uint32_t i;
+  for ( i = 0; i < MANY; i++ ) {
+    many_keys[ i ] = i;
+    assert_true( insert_hash_entry( table, &many_keys[ i ], ( void * ) ( uintptr_t ) ( i + 1 ) ) == NULL );
+    // Entries inserted so far are found while the table is being rehashed.
+    assert_true( lookup_hash_entry( table, &many_keys[ i / 2 ] ) == ( void * ) ( uintptr_t ) ( i / 2 + 1 ) );
+  }
+  assert_true( table->number_of_buckets > initial_number_of_buckets );
+  assert_int_equal( table->length, MANY );
+
+  for ( i = 0; i < MANY; i += 2 ) {
+    assert_true( delete_hash_entry( table, &many_keys[ i ] ) == ( void * ) ( uintptr_t ) ( i + 1 ) );
+  }
+  assert_int_equal( table->length, MANY / 2 );
+
+  for ( i = 0; i < MANY; i++ ) {
+    void *expected = i % 2 == 0 ? NULL : ( void * ) ( uintptr_t ) ( i + 1 );
+    assert_true( lookup_hash_entry( table, &many_keys[ i ] ) == expected );
+  }
+
+  unsigned int count = 0;
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    assert_int_equal( *( uint32_t * ) e->key % 2, 1 );
+    count++;
+  }
+  assert_int_equal( count, MANY / 2 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_tombstones_do_not_grow_table() {
+  table = create_hash( compare_uint32, hash_uint32 );
+
+  uint32_t i;
+  for ( i = 0; i < MANY; i++ ) {
+    many_keys[ i ] = i;
+    insert_hash_entry( table, &many_keys[ i ], &many_keys[ i ] );
+    delete_hash_entry( table, &many_keys[ i ] );
+  }
+  assert_true( table->number_of_buckets <= 16 );
+  assert_int_equal( table->length, 0 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_create_hash_with_size() {
+  table = create_hash_with_size( compare_uint32, hash_uint32, 1000 );
+  unsigned int number_of_buckets = table->number_of_buckets;
+  assert_true( number_of_buckets >= 1000 );
+
+  uint32_t i;
+  for ( i = 0; i < 1000; i++ ) {
+    many_keys[ i ] = i;
+    insert_hash_entry( table, &many_keys[ i ], &many_keys[ i ] );
+  }
+  assert_int_equal( table->number_of_buckets, number_of_buckets );
+
+  delete_hash( table );
+}
+
+
+static void
+delete_entry_walker( void *key, void *value, void *user_data ) {
+  UNUSED( value );
+  delete_hash_entry( user_data, key );
+}
+
+
+static void
+test_unlocked_table() {
+  table = create_hash_with_concurrency( compare_string, hash_string, 0, HASH_TABLE_UNLOCKED );
+
+  insert_hash_entry( table, alpha, alpha );
+  insert_hash_entry( table, bravo, bravo );
+  assert_string_equal( lookup_hash_entry( table, alpha ), "alpha" );
+  assert_string_equal( delete_hash_entry( table, bravo ), "bravo" );
+  assert_true( lookup_hash_entry( table, bravo ) == NULL );
+
+  foreach_hash( table, delete_entry_walker, table );
+  assert_int_equal( table->length, 0 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_concurrent_table() {
+  table = create_hash_with_concurrency( compare_uint32, hash_uint32, 0, HASH_TABLE_CONCURRENT );
+
+  uint32_t i;
+  for ( i = 0; i < MANY; i++ ) {
+    many_keys[ i ] = i;
+    insert_hash_entry( table, &many_keys[ i ], ( void * ) ( uintptr_t ) ( i + 1 ) );
+  }
+  assert_int_equal( table->length, MANY );
+  for ( i = 0; i < MANY; i++ ) {
+    assert_true( lookup_hash_entry( table, &many_keys[ i ] ) == ( void * ) ( uintptr_t ) ( i + 1 ) );
+  }
+
+  foreach_hash( table, delete_entry_walker, table );
+  assert_int_equal( table->length, 0 );
+  assert_true( lookup_hash_entry( table, &many_keys[ 0 ] ) == NULL );
+
+  delete_hash( table );
+}
+
+
+static unsigned int
+hash_constant( const void *key ) {
+  UNUSED( key );
+  return 42;
+}
+
+
+static void
+test_stats_of_colliding_keys() {
+  table = create_hash( compare_uint32, hash_constant );
+
+  uint32_t i;
+  for ( i = 0; i < 5; i++ ) {
+    many_keys[ i ] = i;
+    insert_hash_entry( table, &many_keys[ i ], &many_keys[ i ] );
+  }
+
+  hash_table_stats stats;
+  get_hash_table_stats( table, &stats );
+  assert_int_equal( stats.entries, 5 );
+  assert_int_equal( stats.number_of_buckets, table->number_of_buckets );
+  assert_int_equal( stats.displaced_entries, 4 );
+  assert_int_equal( stats.max_probe_length, 5 );
+  assert_true( stats.average_probe_length > 2.9 && stats.average_probe_length < 3.1 );
+  assert_int_equal( stats.max_cluster_length, 5 );
+  assert_int_equal( stats.hash_collisions, 4 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_stats_of_sequential_keys() {
+  table = create_hash( compare_uint32, hash_uint32 );
+
+  uint32_t i;
+  for ( i = 0; i < MANY; i++ ) {
+    many_keys[ i ] = i;
+    insert_hash_entry( table, &many_keys[ i ], &many_keys[ i ] );
+  }
+
+  hash_table_stats stats;
+  get_hash_table_stats( table, &stats );
+  assert_int_equal( stats.entries, MANY );
+  assert_int_equal( stats.hash_collisions, 0 );
+  assert_true( stats.average_probe_length < 2.0 );
+
+  delete_hash( table );
+}
+
+
+#define STABLE_KEYS 1000
+#define READERS 4
+
+static volatile bool stop_readers;
+
+
+static void *
+read_stable_keys( void *arg ) {
+  uintptr_t misses = 0;
+  UNUSED( arg );
+
+  while ( !stop_readers ) {
+    uint32_t i;
+    for ( i = 0; i < STABLE_KEYS; i++ ) {
+      if ( lookup_hash_entry( table, &many_keys[ i ] ) != ( void * ) ( uintptr_t ) ( i + 1 ) ) {
+        misses++;
+      }
+    }
+  }
+  return ( void * ) misses;
+}
+
+
+static void
+test_concurrent_lookups_while_resizing() {
+  table = create_hash_with_concurrency( compare_uint32, hash_uint32, 0, HASH_TABLE_CONCURRENT );
+
+  uint32_t i;
+  for ( i = 0; i < MANY; i++ ) {
+    many_keys[ i ] = i;
+  }
+  for ( i = 0; i < STABLE_KEYS; i++ ) {
+    insert_hash_entry( table, &many_keys[ i ], ( void * ) ( uintptr_t ) ( i + 1 ) );
+  }
+
+  stop_readers = false;
+  pthread_t readers[ READERS ];
+  int j;
+  for ( j = 0; j < READERS; j++ ) {
+    assert_int_equal( pthread_create( &readers[ j ], NULL, read_stable_keys, NULL ), 0 );
+  }
+
+  // Grows and shrinks every segment a few times under the readers.
+  int round;
+  for ( round = 0; round < 5; round++ ) {
+    for ( i = STABLE_KEYS; i < MANY; i++ ) {
+      insert_hash_entry( table, &many_keys[ i ], &many_keys[ i ] );
+    }
+    for ( i = STABLE_KEYS; i < MANY; i++ ) {
+      delete_hash_entry( table, &many_keys[ i ] );
+    }
+  }
+
+  stop_readers = true;
+  for ( j = 0; j < READERS; j++ ) {
+    void *misses;
+    pthread_join( readers[ j ], &misses );
+    assert_true( misses == NULL );
+  }
+  assert_int_equal( table->length, STABLE_KEYS );
+
+  delete_hash( table );
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -301,6 +542,14 @@ main() {
     unit_test( test_iterator ),
     unit_test( test_multiple_inserts_and_deletes_then_iterate ),
     unit_test( test_iterate_empty_hash ),
+    unit_test( test_entries_survive_resizing ),
+    unit_test( test_tombstones_do_not_grow_table ),
+    unit_test( test_create_hash_with_size ),
+    unit_test( test_stats_of_colliding_keys ),
+    unit_test( test_stats_of_sequential_keys ),
+    unit_test( test_unlocked_table ),
+    unit_test( test_concurrent_table ),
+    unit_test( test_concurrent_lookups_while_resizing ),
   };
   setup_leak_detector();
   return run_tests( tests );
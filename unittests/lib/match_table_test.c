@@ -21,6 +21,7 @@
 
 
 #include <net/ethernet.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,11 +34,16 @@
 #include "utility.h"
 
 
-typedef struct match_table {
+struct match_table {
   hash_table *exact_table; // no wildcards are set
-  list_element *wildcard_table; // wildcard flags are set
+  void *wildcard_table; // tuples of wildcard entries, NULL if there is none
   pthread_mutex_t *mutex;
-} match_table;
+  uint64_t next_sequence;
+  unsigned int epoch;
+  unsigned int readers[ 2 ];
+  void *cache;
+  uint64_t generation;
+};
 
 
 extern match_table match_table_head;
@@ -55,6 +61,13 @@ mock_die( const char *format, ... ) {
   mock_assert( false, "mock_die", __FILE__, __LINE__ ); } // Hoaxes gcov.
 
 
+void
+mock_increment_stat_by( const char *key, uint64_t value ) {
+  check_expected( key );
+  check_expected( value );
+}
+
+
 static void
 setup() {
   original_die = die;
@@ -495,6 +508,114 @@ test_insert_and_delete_of_wildcard_any_lldp_ipv4_entry() {
 }
 
 
+static void
+set_nw_src_match_entry( struct ofp_match *match, uint32_t nw_src, uint32_t prefix_length ) {
+  memset( match, 0, sizeof( struct ofp_match ) );
+  match->wildcards = ( OFPFW_ALL & ~OFPFW_DL_TYPE & ~OFPFW_NW_SRC_MASK )
+                     | ( ( 32 - prefix_length ) << OFPFW_NW_SRC_SHIFT );
+  match->dl_type = ETHERTYPE_IP;
+  match->nw_src = nw_src;
+}
+
+
+static void
+test_lookup_of_wildcard_entries_with_same_priority_prefers_first_inserted() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_entry *match_entry;
+
+  init_match_table();
+
+  set_ipv4_match_entry( &match );
+  insert_match_entry( &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME_1 );
+  set_nw_src_match_entry( &match, 0x0a000000, 8 );
+  insert_match_entry( &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME_2 );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  lookup_match.nw_src = 0x0a010203;
+
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( ( char * ) match_entry->services_name->data, IPV4_MATCH_SERVICE_NAME_1 );
+
+  set_ipv4_match_entry( &match );
+  delete_match_entry( &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME_1 );
+  insert_match_entry( &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME_1 );
+
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( ( char * ) match_entry->services_name->data, IPV4_MATCH_SERVICE_NAME_2 );
+
+  finalize_match_table();
+
+  teardown();
+}
+
+
+static void
+test_insert_and_delete_of_wildcard_nw_src_prefix_entries() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_entry *match_entry;
+
+  init_match_table();
+
+  set_nw_src_match_entry( &match, 0x0a000000, 8 );
+  insert_match_entry( &match, 0x100, "service-name-8" );
+  set_nw_src_match_entry( &match, 0x0a010000, 16 );
+  insert_match_entry( &match, 0x300, "service-name-16-high" );
+  set_nw_src_match_entry( &match, 0x0a010000, 16 );
+  insert_match_entry( &match, 0x50, "service-name-16-low" );
+  set_ipv4_match_entry( &match );
+  insert_match_entry( &match, 0x200, IPV4_MATCH_SERVICE_NAME );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  lookup_match.nw_src = 0x0a010203;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_true( match_entry->priority == 0x300 );
+  assert_string_equal( ( char * ) match_entry->services_name->data, "service-name-16-high" );
+
+  lookup_match.nw_src = 0x0a020203;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_true( match_entry->priority == 0x200 );
+
+  set_nw_src_match_entry( &match, 0x0a010000, 16 );
+  delete_match_entry( &match, 0x300, "service-name-16-high" );
+  set_ipv4_match_entry( &match );
+  delete_match_entry( &match, 0x200, IPV4_MATCH_SERVICE_NAME );
+
+  lookup_match.nw_src = 0x0a010203;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_true( match_entry->priority == 0x100 );
+  assert_string_equal( ( char * ) match_entry->services_name->data, "service-name-8" );
+
+  set_nw_src_match_entry( &match, 0x0a000000, 8 );
+  delete_match_entry( &match, 0x100, "service-name-8" );
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_true( match_entry->priority == 0x50 );
+
+  lookup_match.nw_src = 0x0b010203;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry == NULL );
+
+  set_nw_src_match_entry( &match, 0x0a010000, 16 );
+  delete_match_entry( &match, 0x50, "service-name-16-low" );
+  assert_true( match_table_head.wildcard_table == NULL );
+
+  finalize_match_table();
+
+  teardown();
+}
+
+
 static void
 set_alice_match_entry( struct ofp_match *match ) {
   memset( match, 0, sizeof( struct ofp_match ) );
@@ -791,6 +912,234 @@ test_insert_and_delete_of_exact_all_entry_failed() {
 }
 
 
+static void
+test_match_tables_are_independent() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+
+  match_table *lldp_table = create_match_table();
+  match_table *ipv4_table = create_match_table();
+
+  set_lldp_match_entry( &match );
+  insert_match_entry_in( lldp_table, &match, LLDP_MATCH_PRIORITY, LLDP_MATCH_SERVICE_NAME );
+  set_ipv4_match_entry( &match );
+  insert_match_entry_in( ipv4_table, &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETH_ETHTYPE_LLDP;
+  match_entry *match_entry = lookup_match_entry_in( lldp_table, &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( ( char * ) match_entry->services_name->data, LLDP_MATCH_SERVICE_NAME );
+  assert_true( lookup_match_entry_in( ipv4_table, &lookup_match ) == NULL );
+
+  lookup_match.dl_type = ETHERTYPE_IP;
+  assert_true( lookup_match_entry_in( lldp_table, &lookup_match ) == NULL );
+  match_entry = lookup_match_entry_in( ipv4_table, &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( ( char * ) match_entry->services_name->data, IPV4_MATCH_SERVICE_NAME );
+
+  set_ipv4_match_entry( &match );
+  delete_match_entry_in( ipv4_table, &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME );
+  assert_true( lookup_match_entry_in( ipv4_table, &lookup_match ) == NULL );
+
+  delete_match_table( lldp_table );
+  delete_match_table( ipv4_table );
+
+  teardown();
+}
+
+
+typedef struct {
+  match_table *table;
+  match_entry *expected;
+  volatile bool *running;
+  unsigned int failures;
+} lookup_thread_arg;
+
+
+static void *
+lookup_thread( void *data ) {
+  lookup_thread_arg *arg = data;
+  struct ofp_match lookup_match;
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  lookup_match.nw_src = 0x0a010203;
+  while ( *arg->running ) {
+    if ( lookup_match_entry_in( arg->table, &lookup_match ) != arg->expected ) {
+      arg->failures++;
+    }
+  }
+
+  return NULL;
+}
+
+
+static void
+test_lookups_run_while_entries_change() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_table *table = create_match_table();
+
+  set_nw_src_match_entry( &match, 0x0a000000, 8 );
+  insert_match_entry_in( table, &match, 0xffff, "service-name-stable" );
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  lookup_match.nw_src = 0x0a010203;
+  match_entry *expected = lookup_match_entry_in( table, &lookup_match );
+  assert_true( expected != NULL );
+
+  enum { THREADS = 4 };
+  volatile bool running = true;
+  pthread_t threads[ THREADS ];
+  lookup_thread_arg args[ THREADS ];
+  for ( int i = 0; i < THREADS; i++ ) {
+    args[ i ].table = table;
+    args[ i ].expected = expected;
+    args[ i ].running = &running;
+    args[ i ].failures = 0;
+    assert_int_equal( pthread_create( &threads[ i ], NULL, lookup_thread, &args[ i ] ), 0 );
+  }
+
+  // Entries below match the packet looked up, in other tuples and with
+  // lower priorities, so that tuples come and go and get reordered.
+  for ( uint32_t round = 0; round < 200; round++ ) {
+    for ( uint32_t prefix_length = 8; prefix_length <= 32; prefix_length += 8 ) {
+      set_nw_src_match_entry( &match, 0x0a010203, prefix_length );
+      insert_match_entry_in( table, &match, ( uint16_t ) ( round * 32 + prefix_length ), "service-name-churn" );
+    }
+    for ( uint32_t prefix_length = 8; prefix_length <= 32; prefix_length += 8 ) {
+      set_nw_src_match_entry( &match, 0x0a010203, prefix_length );
+      delete_match_entry_in( table, &match, ( uint16_t ) ( round * 32 + prefix_length ), "service-name-churn" );
+    }
+  }
+
+  running = false;
+  for ( int i = 0; i < THREADS; i++ ) {
+    pthread_join( threads[ i ], NULL );
+    assert_int_equal( args[ i ].failures, 0 );
+  }
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == expected );
+
+  delete_match_table( table );
+
+  teardown();
+}
+
+
+static void
+test_microflow_cache_is_invalidated_by_updates() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_table *table = create_match_table();
+  enable_microflow_cache_in( table, 16 );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETH_ETHTYPE_LLDP;
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+
+  set_lldp_match_entry( &match );
+  insert_match_entry_in( table, &match, LLDP_MATCH_PRIORITY, LLDP_MATCH_SERVICE_NAME );
+  match_entry *lldp_entry = lookup_match_entry_in( table, &lookup_match );
+  assert_true( lldp_entry != NULL );
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == lldp_entry );
+
+  set_any_match_entry( &match );
+  insert_match_entry_in( table, &match, 0xffff, ANY_MATCH_SERVICE_NAME );
+  match_entry *any_entry = lookup_match_entry_in( table, &lookup_match );
+  assert_true( any_entry != NULL );
+  assert_string_equal( ( char * ) any_entry->services_name->data, ANY_MATCH_SERVICE_NAME );
+
+  delete_match_entry_in( table, &match, 0xffff, ANY_MATCH_SERVICE_NAME );
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == lldp_entry );
+
+  set_lldp_match_entry( &match );
+  delete_match_entry_in( table, &match, LLDP_MATCH_PRIORITY, LLDP_MATCH_SERVICE_NAME );
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+
+  expect_string( mock_increment_stat_by, key, "match_table.microflow_cache_hits" );
+  expect_value( mock_increment_stat_by, value, 2 );
+  expect_string( mock_increment_stat_by, key, "match_table.microflow_cache_misses" );
+  expect_value( mock_increment_stat_by, value, 5 );
+  delete_match_table( table );
+
+  teardown();
+}
+
+
+static void
+test_microflow_cache_evicts_beyond_its_size() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_table *table = create_match_table();
+  enable_microflow_cache_in( table, 4 );
+
+  set_ipv4_match_entry( &match );
+  insert_match_entry_in( table, &match, IPV4_MATCH_PRIORITY, IPV4_MATCH_SERVICE_NAME );
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  match_entry *ipv4_entry = lookup_match_entry_in( table, &lookup_match );
+  assert_true( ipv4_entry != NULL );
+
+  for ( int round = 0; round < 3; round++ ) {
+    for ( uint32_t i = 0; i < 100; i++ ) {
+      lookup_match.dl_type = ETHERTYPE_IP;
+      lookup_match.nw_src = i;
+      assert_true( lookup_match_entry_in( table, &lookup_match ) == ipv4_entry );
+      lookup_match.dl_type = ETH_ETHTYPE_LLDP;
+      assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+    }
+  }
+
+  expect_string( mock_increment_stat_by, key, "match_table.microflow_cache_hits" );
+  expect_value( mock_increment_stat_by, value, 1 );
+  expect_string( mock_increment_stat_by, key, "match_table.microflow_cache_misses" );
+  expect_value( mock_increment_stat_by, value, 600 );
+  disable_microflow_cache_in( table );
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+
+  delete_match_table( table );
+
+  teardown();
+}
+
+
+static void
+test_microflow_cache_reports_hits_and_misses() {
+  setup();
+
+  struct ofp_match lookup_match;
+  match_table *table = create_match_table();
+  enable_microflow_cache_in( table, 16 );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+
+  expect_string( mock_increment_stat_by, key, "match_table.microflow_cache_hits" );
+  expect_value( mock_increment_stat_by, value, 1024 );
+  for ( int i = 0; i < 1024; i++ ) {
+    assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+  }
+
+  expect_string( mock_increment_stat_by, key, "match_table.microflow_cache_misses" );
+  expect_value( mock_increment_stat_by, value, 1024 );
+  for ( uint32_t i = 1; i < 1024; i++ ) {
+    lookup_match.nw_src = i;
+    assert_true( lookup_match_entry_in( table, &lookup_match ) == NULL );
+  }
+
+  delete_match_table( table );
+
+  teardown();
+}
+
+
 /*************************************************************************
  * Run tests.
  *************************************************************************/
@@ -810,6 +1159,13 @@ main() {
     unit_test( test_delete_of_wildcard_any_entry_failed ),
     unit_test( test_insert_and_delete_of_wildcard_any_entry ),
     unit_test( test_insert_and_delete_of_wildcard_any_lldp_ipv4_entry ),
+    unit_test( test_lookup_of_wildcard_entries_with_same_priority_prefers_first_inserted ),
+    unit_test( test_insert_and_delete_of_wildcard_nw_src_prefix_entries ),
+    unit_test( test_match_tables_are_independent ),
+    unit_test( test_lookups_run_while_entries_change ),
+    unit_test( test_microflow_cache_is_invalidated_by_updates ),
+    unit_test( test_microflow_cache_evicts_beyond_its_size ),
+    unit_test( test_microflow_cache_reports_hits_and_misses ),
     unit_test( test_insert_and_lookup_of_exact_alice_entry ),
     unit_test( test_insert_and_lookup_of_exact_alice_entry_conflict ),
     unit_test( test_insert_and_lookup_of_exact_all_entry ),
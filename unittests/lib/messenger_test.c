@@ -35,6 +35,7 @@
 #include "doubly_linked_list.h"
 #include "hash_table.h"
 #include "messenger.h"
+#include "shm_ring.h"
 #include "timer.h"
 #include "wrapper.h"
 
@@ -46,6 +47,9 @@ enum {
   MESSAGE_TYPE_NOTIFY,
   MESSAGE_TYPE_REQUEST,
   MESSAGE_TYPE_REPLY,
+  MESSAGE_TYPE_SHM_SETUP,
+  MESSAGE_TYPE_SHM_ACK,
+  MESSAGE_TYPE_SHM_WAKEUP,
 };
 
 typedef struct message_header {
@@ -60,15 +64,21 @@ typedef struct message_buffer {
   void *buffer;
   size_t data_length;
   size_t size;
+  size_t head_offset;
 } message_buffer;
 
 typedef struct messenger_socket {
   int fd;
+  struct receive_queue *rq;
+  shm_ring *ring;
 } messenger_socket;
 
 typedef struct messenger_context {
   uint32_t transaction_id;
-  int life_count;
+  uint16_t tag;
+  struct timespec deadline;
+  size_t heap_index;
+  callback_request_timeout timeout_callback;
   void *user_data;
 } messenger_context;
 
@@ -84,59 +94,100 @@ typedef struct receive_queue {
   struct sockaddr_un listen_addr;
   dlist_element *client_sockets;
   message_buffer *buffer;
+  bool dispatching;
+  messenger_queue_stats stats;
+  int notify_callback_count;
+  int batch_callback_count;
+  messenger_message *batch;
+  size_t batch_count;
+  size_t batch_size;
 } receive_queue;
 
+typedef struct send_queue_chunk {
+  struct send_queue_chunk *next;
+  size_t size;
+  size_t head;
+  size_t tail;
+  char data[ 0 ];
+} send_queue_chunk;
+
+typedef struct send_queue_lane {
+  send_queue_chunk *head_chunk;
+  send_queue_chunk *tail_chunk;
+  size_t data_length;
+  messenger_lane_stats stats;
+} send_queue_lane;
+
 typedef struct send_queue {
   char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
   int server_socket;
   int refused_count;
   struct timespec reconnect_at;
   struct sockaddr_un server_addr;
-  message_buffer *buffer;
+  send_queue_lane lanes[ MESSENGER_PRIORITY_LANES ];
+  send_queue_chunk *free_chunks;
+  int free_chunk_count;
+  size_t data_length;
+  dlist_element *reconnect_element;
+  messenger_queue_stats stats;
+  int transport;
+  int shm_state;
+  shm_ring *ring;
+  dlist_element *publish_element;
+  dlist_element *hold_element;
+  messenger_queue_limits limits;
+  bool congested;
 } send_queue;
 
+struct messenger_send_handle {
+  char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+  send_queue *sq;
+  uint32_t generation;
+};
+
 
 static void send_dump_message( uint16_t dump_type, const char *service_name, const void *data, uint32_t data_len );
 
 static bool run_once( void );
 
-static void on_accept( int fd, receive_queue *queue );
-static void on_recv( int fd, receive_queue *queue );
-static void on_send( int fd, send_queue *queue );
+static void on_accept( int fd, void *data );
+static void on_recv( int fd, void *data );
+static void on_send( int fd, void *data );
+static void on_send_queue_readable( int fd, void *data );
 
 static receive_queue *create_receive_queue( const char *service_name );
 static void delete_all_receive_queues( void );
 static void delete_receive_queue( void *service_name, void *queue, void *user_data );
-static int pull_from_recv_queue( receive_queue *queue, uint8_t *message_type, uint16_t *tag, void *data, size_t *len, size_t maxlen );
-static void set_recv_queue_fd_set( fd_set *read_set );
-static void check_recv_queue_fd_isset( fd_set *read_set );
+static message_header *pull_from_recv_queue( receive_queue *queue );
 static void add_recv_queue_client_fd( receive_queue *queue, int fd );
 static int del_recv_queue_client_fd( receive_queue *queue, int fd );
 static void call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uint16_t tag, void *data, size_t len );
 
-static send_queue *create_send_queue( const char *service_name );
+static send_queue *create_send_queue( const char *service_name, int transport );
 static int send_queue_connect( send_queue *queue );
 static void delete_all_send_queues( void );
 static void delete_send_queue( send_queue *sq );
 static void number_of_send_queue( int *connected_count, int *sending_count, int *reconnecting_count, int *closed_count );
 static bool push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len );
-static void set_send_queue_fd_set( fd_set *read_set, fd_set *write_set );
-static void check_send_queue_fd_isset( fd_set *read_set, fd_set *write_set );
+static void reconnect_send_queues( void );
+static void close_send_queue_socket( send_queue *sq );
+static send_queue_chunk *reserve_send_queue_chunk( send_queue *sq, send_queue_lane *lane, size_t len );
+static void consume_send_queue( send_queue *sq, send_queue_lane *lane, size_t len, uint64_t messages );
 
 static message_buffer *create_message_buffer( size_t size );
-static bool write_message_buffer( message_buffer *buf, const void *data, size_t len );
 static void truncate_message_buffer( message_buffer *buf, size_t len );
 static void free_message_buffer( message_buffer *buf );
-static size_t message_buffer_remain_bytes( message_buffer *buf );
+static size_t message_buffer_tail_bytes( message_buffer *buf );
+static size_t compact_message_buffer( message_buffer *buf );
 
 static void delete_timer_callbacks( void );
 static void execute_timer_events( void );
 
-static messenger_context* insert_context( void *user_data );
+static messenger_context* insert_context( uint16_t tag, void *user_data, const struct timespec *timeout, callback_request_timeout timeout_callback );
 static messenger_context* get_context( uint32_t transaction_id );
 static void delete_context( messenger_context *context );
 static void delete_context_db( void );
-static void age_context_db( void * );
+static void expire_contexts( void );
 
 static const uint32_t messenger_buffer_length;
 
@@ -147,6 +198,8 @@ static bool finalized;
 static hash_table *receive_queues;
 static hash_table *send_queues;
 static hash_table *context_db;
+static size_t context_heap_count;
+static dlist_element *reconnecting_send_queues;
 static dlist_element *timer_callbacks;
 static char *_dump_service_name;
 static char *_dump_app_name;
@@ -225,10 +278,10 @@ mock_connect( int sockfd, const struct sockaddr *addr, socklen_t addrlen ) {
 }
 
 
-static bool fail_mock_select = false;
-int
-mock_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout ) {
-  return fail_mock_select ? -1 : select( nfds, readfds, writefds, exceptfds, timeout );
+bool
+mock_get_next_timer_event_timeout( struct timespec *timeout ) {
+  UNUSED( timeout );
+  return false;
 }
 
 
@@ -246,10 +299,18 @@ mock_recv( int sockfd, void *buf, size_t len, int flags ) {
 }
 
 
+ssize_t
+mock_recvmsg( int sockfd, struct msghdr *msg, int flags ) {
+  return fail_mock_recv ? -1 : recvmsg( sockfd, msg, flags );
+}
+
+
 static bool fail_mock_send = false;
+static int mock_sendmsg_count = 0;
 ssize_t
-mock_send( int sockfd, const void *buf, size_t len, int flags ) {
-  return fail_mock_send ? -1 : send( sockfd, buf, len, flags );
+mock_sendmsg( int sockfd, const struct msghdr *msg, int flags ) {
+  mock_sendmsg_count++;
+  return fail_mock_send ? -1 : sendmsg( sockfd, msg, flags );
 }
 
 
@@ -264,10 +325,18 @@ mock_setsockopt( int s, int level, int optname, const void *optval, socklen_t op
 }
 
 
+static bool use_mock_now = false;
+static struct timespec mock_now;
+
+
 int
 mock_clock_gettime( clockid_t clk_id, struct timespec *tp ) {
   UNUSED( clk_id );
-  UNUSED( tp );
+
+  if ( use_mock_now ) {
+    *tp = mock_now;
+    return 0;
+  }
 
   return ( int ) mock();
 }
@@ -331,6 +400,7 @@ static void
 reset_messenger() {
   initialized = false;
   finalized = false;
+  use_mock_now = false;
 }
 
 
@@ -387,8 +457,6 @@ static void
 test_send_then_message_received_callback_is_called() {
   init_messenger( "/tmp" );
 
-  will_return_count( mock_clock_gettime, 0, -1 );
-
   const char service_name[] = "Say HELLO";
 
   expect_value( callback_hello, tag, 43556 );
@@ -406,6 +474,973 @@ test_send_then_message_received_callback_is_called() {
 }
 
 
+static void
+test_send_message_segments_then_message_received_callback_is_called() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Say HELLO in parts";
+
+  expect_value( callback_hello, tag, 43556 );
+  expect_string( callback_hello, data, "HELLO" );
+  expect_value( callback_hello, len, 6 );
+
+  messenger_segment segments[] = { { "HE", 2 }, { NULL, 0 }, { "LLO", strlen( "LLO" ) + 1 } };
+  add_message_received_callback( service_name, callback_hello );
+  assert_true( send_message_segments( service_name, 43556, segments, 3 ) );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_hello );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static const char in_place_service_name[] = "In place";
+static int in_place_count = 0;
+
+
+static void
+callback_in_place( uint16_t tag, void *data, size_t len ) {
+  receive_queue *rq = lookup_hash_entry( receive_queues, in_place_service_name );
+  assert_true( rq != NULL );
+  char *begin = rq->buffer->buffer;
+  assert_true( ( char * ) data > begin );
+  assert_true( ( char * ) data + len <= begin + rq->buffer->size );
+  assert_int_equal( tag, in_place_count );
+  assert_int_equal( len, 6 );
+
+  if ( ++in_place_count == 3 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_received_messages_are_dispatched_in_place() {
+  init_messenger( "/tmp" );
+  in_place_count = 0;
+
+  add_message_received_callback( in_place_service_name, callback_in_place );
+  send_message( in_place_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( in_place_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( in_place_service_name, 2, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  messenger_queue_stats stats;
+  assert_true( get_receive_queue_stats( in_place_service_name, &stats ) );
+  assert_int_equal( stats.messages, 3 );
+  assert_int_equal( stats.bytes, 3 * ( sizeof( message_header ) + 6 ) );
+  assert_int_equal( stats.copied_bytes, 0 );
+
+  delete_message_received_callback( in_place_service_name, callback_in_place );
+  delete_send_queue( lookup_hash_entry( send_queues, in_place_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_pending_messages_are_sent_with_a_single_syscall() {
+  init_messenger( "/tmp" );
+  in_place_count = 0;
+  mock_sendmsg_count = 0;
+
+  add_message_received_callback( in_place_service_name, callback_in_place );
+  send_message( in_place_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( in_place_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( in_place_service_name, 2, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  messenger_queue_stats stats;
+  assert_true( get_send_queue_stats( in_place_service_name, &stats ) );
+  assert_int_equal( stats.messages, 3 );
+  assert_int_equal( stats.bytes, 3 * ( sizeof( message_header ) + 6 ) );
+  assert_int_equal( stats.syscalls, 1 );
+  assert_int_equal( mock_sendmsg_count, 1 );
+
+  delete_message_received_callback( in_place_service_name, callback_in_place );
+  delete_send_queue( lookup_hash_entry( send_queues, in_place_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static const char priority_service_name[] = "Priority";
+static int priority_count = 0;
+
+
+static void
+callback_priority( uint16_t tag, void *data, size_t len ) {
+  UNUSED( data );
+  UNUSED( len );
+
+  const uint16_t order[] = { 3, 4, 0, 1, 2 };
+  assert_int_equal( tag, order[ priority_count ] );
+  if ( ++priority_count == 5 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_high_priority_messages_are_sent_first() {
+  init_messenger( "/tmp" );
+  priority_count = 0;
+
+  add_message_received_callback( priority_service_name, callback_priority );
+  assert_true( set_message_tag_priority( 4, MESSENGER_PRIORITY_HIGH ) );
+  send_message( priority_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( priority_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( priority_service_name, 2, "HELLO", strlen( "HELLO" ) + 1 );
+  assert_true( send_message_with_priority( priority_service_name, 3, "HELLO", strlen( "HELLO" ) + 1, MESSENGER_PRIORITY_HIGH ) );
+  send_message( priority_service_name, 4, "HELLO", strlen( "HELLO" ) + 1 );
+
+  messenger_lane_stats high, normal;
+  assert_true( get_send_queue_lane_stats( priority_service_name, MESSENGER_PRIORITY_HIGH, &high ) );
+  assert_true( get_send_queue_lane_stats( priority_service_name, MESSENGER_PRIORITY_NORMAL, &normal ) );
+  assert_int_equal( high.queued_messages, 2 );
+  assert_int_equal( normal.queued_messages, 3 );
+  assert_int_equal( normal.queued_bytes, 3 * ( sizeof( message_header ) + 6 ) );
+
+  start_messenger();
+
+  assert_true( get_send_queue_lane_stats( priority_service_name, MESSENGER_PRIORITY_HIGH, &high ) );
+  assert_true( get_send_queue_lane_stats( priority_service_name, MESSENGER_PRIORITY_NORMAL, &normal ) );
+  assert_int_equal( high.messages, 2 );
+  assert_int_equal( high.queued_messages, 0 );
+  assert_int_equal( high.max_queued_bytes, 2 * ( sizeof( message_header ) + 6 ) );
+  assert_int_equal( normal.messages, 3 );
+  assert_int_equal( normal.queued_bytes, 0 );
+  assert_int_equal( normal.max_queued_bytes, 3 * ( sizeof( message_header ) + 6 ) );
+
+  assert_false( send_message_with_priority( priority_service_name, 0, NULL, 0, MESSENGER_PRIORITY_LANES ) );
+  assert_false( get_send_queue_lane_stats( priority_service_name, -1, &high ) );
+  assert_false( set_message_tag_priority( 4, MESSENGER_PRIORITY_LANES ) );
+  assert_int_equal( get_message_tag_priority( 4 ), MESSENGER_PRIORITY_HIGH );
+  assert_true( set_message_tag_priority( 4, MESSENGER_PRIORITY_NORMAL ) );
+
+  delete_message_received_callback( priority_service_name, callback_priority );
+  delete_send_queue( lookup_hash_entry( send_queues, priority_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_send_queue_chunks_are_reused() {
+  send_queue sq;
+  memset( &sq, 0, sizeof( sq ) );
+  send_queue_lane *lane = &sq.lanes[ MESSENGER_PRIORITY_NORMAL ];
+
+  send_queue_chunk *first = reserve_send_queue_chunk( &sq, lane, 100 );
+  first->tail += 100;
+  sq.data_length += 100;
+  lane->data_length += 100;
+  lane->stats.queued_messages++;
+  assert_true( reserve_send_queue_chunk( &sq, lane, 100 ) == first );
+
+  send_queue_chunk *large = reserve_send_queue_chunk( &sq, lane, first->size + 1 );
+  assert_true( large != first );
+  assert_int_equal( large->size, first->size + 1 );
+  large->tail += large->size;
+  sq.data_length += large->size;
+  lane->data_length += large->size;
+  lane->stats.queued_messages++;
+
+  consume_send_queue( &sq, lane, 100, 1 );
+  assert_true( lane->head_chunk == large );
+  assert_true( sq.free_chunks == first );
+
+  send_queue_chunk *next = reserve_send_queue_chunk( &sq, lane, 100 );
+  assert_true( next == first );
+  assert_true( sq.free_chunks == NULL );
+  next->tail += 100;
+  sq.data_length += 100;
+  lane->data_length += 100;
+  lane->stats.queued_messages++;
+
+  consume_send_queue( &sq, lane, sq.data_length, 2 );
+  assert_int_equal( sq.data_length, 0 );
+  assert_int_equal( lane->stats.queued_messages, 0 );
+  assert_true( lane->head_chunk == first );
+  assert_int_equal( first->head, 0 );
+  assert_int_equal( first->tail, 0 );
+
+  xfree( first );
+}
+
+
+static void
+test_compact_message_buffer() {
+  message_buffer *buf = create_message_buffer( 16 );
+
+  memcpy( buf->buffer, "0123456789", 10 );
+  buf->data_length = 10;
+  truncate_message_buffer( buf, 8 );
+  assert_int_equal( message_buffer_tail_bytes( buf ), 6 );
+
+  assert_int_equal( compact_message_buffer( buf ), 2 );
+  assert_int_equal( buf->head_offset, 0 );
+  assert_int_equal( message_buffer_tail_bytes( buf ), 14 );
+  assert_memory_equal( buf->buffer, "89", 2 );
+  assert_int_equal( compact_message_buffer( buf ), 0 );
+
+  free_message_buffer( buf );
+}
+
+
+static const char batch_service_name[] = "Batch";
+static int batch_message_count = 0;
+static int batch_call_count = 0;
+static int batch_stop_count = 0;
+
+
+static void
+callback_batch_message( uint16_t tag, void *data, size_t len ) {
+  UNUSED( data );
+  UNUSED( len );
+
+  // Per-message callbacks see every message before the batch does.
+  assert_int_equal( tag, batch_message_count++ );
+}
+
+
+static void
+callback_batch( const messenger_message *messages, size_t count ) {
+  batch_call_count++;
+  for ( size_t i = 0; i < count; i++ ) {
+    assert_int_equal( messages[ i ].tag, batch_message_count - ( int ) count + ( int ) i );
+    assert_string_equal( messages[ i ].data, "HELLO" );
+    assert_int_equal( messages[ i ].len, 6 );
+  }
+  if ( batch_message_count == batch_stop_count ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+send_batch_messages( int count ) {
+  batch_message_count = 0;
+  batch_stop_count = count;
+  for ( int i = 0; i < count; i++ ) {
+    send_message( batch_service_name, ( uint16_t ) i, "HELLO", strlen( "HELLO" ) + 1 );
+  }
+  start_messenger();
+}
+
+
+static void
+test_received_messages_are_delivered_in_a_batch() {
+  init_messenger( "/tmp" );
+  batch_call_count = 0;
+
+  add_message_received_callback( batch_service_name, callback_batch_message );
+  add_message_batch_received_callback( batch_service_name, callback_batch );
+  send_batch_messages( 100 );
+
+  // All messages were flushed with a single sendmsg().
+  assert_int_equal( batch_call_count, 1 );
+  assert_int_equal( batch_message_count, 100 );
+
+  delete_send_queue( lookup_hash_entry( send_queues, batch_service_name ) );
+  assert_true( set_message_transport( batch_service_name, MESSENGER_TRANSPORT_SHM ) );
+  send_batch_messages( 3 );
+  batch_call_count = 0;
+  send_batch_messages( 3 );
+  assert_int_equal( get_message_transport( batch_service_name ), MESSENGER_TRANSPORT_SHM );
+  assert_int_equal( batch_call_count, 1 );
+
+  delete_message_received_callback( batch_service_name, callback_batch_message );
+  delete_message_batch_received_callback( batch_service_name, callback_batch );
+  delete_send_queue( lookup_hash_entry( send_queues, batch_service_name ) );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Shared memory transport tests.
+ ********************************************************************************/
+
+static const char shm_service_name[] = "Shared memory";
+static int shm_count = 0;
+static int shm_stop_count = 0;
+
+
+static void
+callback_shm( uint16_t tag, void *data, size_t len ) {
+  assert_int_equal( tag, shm_count );
+  assert_string_equal( data, "HELLO" );
+  assert_int_equal( len, 6 );
+
+  if ( ++shm_count == shm_stop_count ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_messages_are_sent_through_shm_ring() {
+  init_messenger( "/tmp" );
+  shm_count = 0;
+  shm_stop_count = 3;
+
+  add_message_received_callback( shm_service_name, callback_shm );
+  assert_true( set_message_transport( shm_service_name, MESSENGER_TRANSPORT_SHM ) );
+  assert_int_equal( get_message_transport( shm_service_name ), MESSENGER_TRANSPORT_SOCKET );
+  send_message( shm_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( shm_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( shm_service_name, 2, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  assert_int_equal( get_message_transport( shm_service_name ), MESSENGER_TRANSPORT_SHM );
+  messenger_queue_stats stats;
+  assert_true( get_send_queue_stats( shm_service_name, &stats ) );
+  assert_int_equal( stats.messages, 3 );
+  assert_int_equal( stats.bytes, 3 * ( sizeof( message_header ) + 6 ) );
+  // One setup message and one wakeup.
+  assert_int_equal( stats.syscalls, 2 );
+
+  shm_stop_count = 6;
+  send_message( shm_service_name, 3, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( shm_service_name, 4, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( shm_service_name, 5, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  assert_true( get_send_queue_stats( shm_service_name, &stats ) );
+  assert_int_equal( stats.messages, 6 );
+  assert_int_equal( stats.syscalls, 3 );
+  assert_true( get_receive_queue_stats( shm_service_name, &stats ) );
+  assert_int_equal( stats.messages, 6 );
+  assert_int_equal( stats.copied_bytes, 0 );
+
+  delete_message_received_callback( shm_service_name, callback_shm );
+  delete_send_queue( lookup_hash_entry( send_queues, shm_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_socket_transport_is_used_when_ring_is_refused() {
+  init_messenger( "/tmp" );
+
+  struct sockaddr_un addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  sprintf( addr.sun_path, "/tmp/trema.%s.sock", shm_service_name );
+  unlink( addr.sun_path );
+  int listen_fd = socket( AF_UNIX, SOCK_SEQPACKET, 0 );
+  assert_true( listen_fd >= 0 );
+  assert_int_equal( bind( listen_fd, ( struct sockaddr * ) &addr, sizeof( addr ) ), 0 );
+  assert_int_equal( listen( listen_fd, 1 ), 0 );
+
+  assert_true( set_message_transport( shm_service_name, MESSENGER_TRANSPORT_SHM ) );
+  int fd = accept( listen_fd, NULL, NULL );
+  assert_true( fd >= 0 );
+
+  message_header header;
+  struct iovec iov = { &header, sizeof( header ) };
+  char control[ CMSG_SPACE( sizeof( int ) ) ];
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+  assert_int_equal( recvmsg( fd, &msg, 0 ), sizeof( header ) );
+  assert_int_equal( header.message_type, MESSAGE_TYPE_SHM_SETUP );
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+  assert_true( cmsg != NULL );
+  assert_int_equal( cmsg->cmsg_type, SCM_RIGHTS );
+  int ring_fd;
+  memcpy( &ring_fd, CMSG_DATA( cmsg ), sizeof( int ) );
+  close( ring_fd );
+
+  // Messages are held until the answer comes.
+  assert_true( send_message( shm_service_name, TAG1, "HELLO", strlen( "HELLO" ) + 1 ) );
+  header.message_type = MESSAGE_TYPE_SHM_ACK;
+  header.tag = 0;
+  assert_int_equal( send( fd, &header, sizeof( header ), 0 ), sizeof( header ) );
+
+  messenger_queue_stats stats;
+  for ( int i = 0; i < 10; i++ ) {
+    run_once();
+    assert_true( get_send_queue_stats( shm_service_name, &stats ) );
+    if ( stats.messages == 1 ) {
+      break;
+    }
+  }
+  assert_int_equal( stats.messages, 1 );
+  assert_int_equal( get_message_transport( shm_service_name ), MESSENGER_TRANSPORT_SOCKET );
+
+  char buf[ 64 ];
+  assert_int_equal( recv( fd, buf, sizeof( buf ), 0 ), sizeof( message_header ) + 6 );
+  message_header *received = ( message_header * ) buf;
+  assert_int_equal( received->message_type, MESSAGE_TYPE_NOTIFY );
+  assert_int_equal( received->tag, TAG1 );
+  assert_string_equal( received->value, "HELLO" );
+
+  delete_send_queue( lookup_hash_entry( send_queues, shm_service_name ) );
+  close( fd );
+  close( listen_fd );
+  unlink( addr.sun_path );
+
+  finalize_messenger();
+}
+
+
+static const char shm_burst_service_name[] = "Shared memory burst";
+static int shm_burst_count = 0;
+static int shm_burst_stop_count = 0;
+
+// 40 messages of 50000 bytes are more than the ring holds.
+#define SHM_BURST_MESSAGES 40
+#define SHM_BURST_MESSAGE_LENGTH 50000
+
+
+static void
+callback_shm_burst( uint16_t tag, void *data, size_t len ) {
+  assert_int_equal( tag, 0 );
+  assert_int_equal( len, SHM_BURST_MESSAGE_LENGTH );
+  int number;
+  memcpy( &number, data, sizeof( number ) );
+  assert_int_equal( number, shm_burst_count );
+  assert_int_equal( ( ( uint8_t * ) data )[ len - 1 ], number & 0xff );
+
+  if ( ++shm_burst_count == shm_burst_stop_count ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+send_shm_burst( int first ) {
+  char *data = xmalloc( SHM_BURST_MESSAGE_LENGTH );
+  for ( int i = first; i < first + SHM_BURST_MESSAGES; i++ ) {
+    memset( data, i & 0xff, SHM_BURST_MESSAGE_LENGTH );
+    memcpy( data, &i, sizeof( i ) );
+    assert_true( send_message( shm_burst_service_name, 0, data, SHM_BURST_MESSAGE_LENGTH ) );
+  }
+  xfree( data );
+}
+
+
+static void
+test_messages_beyond_shm_ring_capacity_are_held() {
+  init_messenger( "/tmp" );
+  shm_burst_count = 0;
+  shm_burst_stop_count = SHM_BURST_MESSAGES;
+
+  messenger_queue_limits limits = { 4000000, 3000000, 1000000 };
+  add_message_received_callback( shm_burst_service_name, callback_shm_burst );
+  assert_true( set_send_queue_limits( shm_burst_service_name, &limits ) );
+  assert_true( set_message_transport( shm_burst_service_name, MESSENGER_TRANSPORT_SHM ) );
+
+  // Sent before the service attaches to the ring.
+  send_shm_burst( 0 );
+  start_messenger();
+  assert_int_equal( shm_burst_count, SHM_BURST_MESSAGES );
+  assert_int_equal( get_message_transport( shm_burst_service_name ), MESSENGER_TRANSPORT_SHM );
+
+  // Sent while the ring is in use.
+  shm_burst_stop_count = 2 * SHM_BURST_MESSAGES;
+  send_shm_burst( SHM_BURST_MESSAGES );
+  send_queue *sq = lookup_hash_entry( send_queues, shm_burst_service_name );
+  assert_true( sq->data_length > 0 );
+  start_messenger();
+  assert_int_equal( shm_burst_count, 2 * SHM_BURST_MESSAGES );
+  assert_int_equal( sq->data_length, 0 );
+
+  messenger_queue_stats stats;
+  assert_true( get_send_queue_stats( shm_burst_service_name, &stats ) );
+  assert_int_equal( stats.messages, 2 * SHM_BURST_MESSAGES );
+  assert_int_equal( stats.dropped, 0 );
+
+  delete_message_received_callback( shm_burst_service_name, callback_shm_burst );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Send handle tests.
+ ********************************************************************************/
+
+static const char handle_service_name[] = "Send handle";
+static int handle_count = 0;
+static int handle_stop_count = 0;
+
+
+static void
+callback_handle( uint16_t tag, void *data, size_t len ) {
+  assert_int_equal( tag, handle_count );
+  assert_string_equal( data, "HELLO" );
+  assert_int_equal( len, 6 );
+
+  if ( ++handle_count == handle_stop_count ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_send_handle_resolves_send_queue_once() {
+  init_messenger( "/tmp" );
+  handle_count = 0;
+  handle_stop_count = 2;
+
+  add_message_received_callback( handle_service_name, callback_handle );
+  messenger_send_handle *handle = create_send_handle( handle_service_name );
+  assert_true( handle != NULL );
+  assert_string_equal( get_send_handle_service_name( handle ), handle_service_name );
+
+  assert_true( send_message_by_handle( handle, 0, "HELLO", strlen( "HELLO" ) + 1 ) );
+  send_queue *sq = lookup_hash_entry( send_queues, handle_service_name );
+  assert_true( sq != NULL );
+  assert_true( handle->sq == sq );
+  assert_true( send_message_by_handle( handle, 1, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_true( handle->sq == sq );
+  start_messenger();
+  assert_int_equal( handle_count, 2 );
+
+  // The handle looks the send queue up again once it is deleted.
+  handle_stop_count = 3;
+  delete_send_queue( sq );
+  assert_true( send_message_by_handle( handle, 2, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_true( handle->sq == lookup_hash_entry( send_queues, handle_service_name ) );
+  start_messenger();
+  assert_int_equal( handle_count, 3 );
+
+  delete_send_handle( handle );
+  delete_message_received_callback( handle_service_name, callback_handle );
+  delete_send_queue( lookup_hash_entry( send_queues, handle_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_create_send_handle_fails_with_too_long_service_name() {
+  assert_true( create_send_handle( "0123456789012345678901234567890123456789" ) == NULL );
+}
+
+
+/********************************************************************************
+ * Send queue limit tests.
+ ********************************************************************************/
+
+static const char pressure_service_name[] = "Pressure";
+static int pressure_received_count = 0;
+static int pressure_congested_count = 0;
+static int pressure_released_count = 0;
+
+
+static void
+callback_pressure_received( uint16_t tag, void *data, size_t len ) {
+  UNUSED( data );
+  UNUSED( len );
+
+  assert_int_equal( tag, pressure_received_count );
+  if ( ++pressure_received_count == 4 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+callback_pressure( const char *service_name, bool congested, void *user_data ) {
+  assert_string_equal( service_name, pressure_service_name );
+  assert_true( user_data == &pressure_congested_count );
+  assert_true( is_send_queue_congested( service_name ) == congested );
+
+  if ( congested ) {
+    pressure_congested_count++;
+  }
+  else {
+    pressure_released_count++;
+  }
+}
+
+
+static void
+test_send_queue_pressure_is_signalled() {
+  init_messenger( "/tmp" );
+  pressure_received_count = 0;
+  pressure_congested_count = 0;
+  pressure_released_count = 0;
+
+  // Each message takes 14 bytes including its header.
+  messenger_queue_limits limits = { 56, 42, 14 };
+  add_message_received_callback( pressure_service_name, callback_pressure_received );
+  assert_true( add_send_queue_pressure_callback( callback_pressure, &pressure_congested_count ) );
+  assert_true( set_send_queue_limits( pressure_service_name, &limits ) );
+
+  assert_true( send_message( pressure_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_true( send_message( pressure_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_int_equal( pressure_congested_count, 0 );
+  assert_true( send_message( pressure_service_name, 2, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_int_equal( pressure_congested_count, 1 );
+  assert_true( send_message( pressure_service_name, 3, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_false( send_message( pressure_service_name, 4, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_int_equal( pressure_congested_count, 1 );
+
+  start_messenger();
+
+  assert_int_equal( pressure_received_count, 4 );
+  assert_int_equal( pressure_released_count, 1 );
+  assert_false( is_send_queue_congested( pressure_service_name ) );
+  messenger_queue_stats stats;
+  assert_true( get_send_queue_stats( pressure_service_name, &stats ) );
+  assert_int_equal( stats.messages, 4 );
+  assert_int_equal( stats.dropped, 1 );
+
+  assert_true( delete_send_queue_pressure_callback( callback_pressure ) );
+  assert_false( delete_send_queue_pressure_callback( callback_pressure ) );
+  delete_message_received_callback( pressure_service_name, callback_pressure_received );
+  delete_send_queue( lookup_hash_entry( send_queues, pressure_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_too_long_message_is_rejected() {
+  init_messenger( "/tmp" );
+  pressure_received_count = 0;
+
+  messenger_queue_limits limits = { 1000000, 500000, 100000 };
+  add_message_received_callback( pressure_service_name, callback_pressure_received );
+  assert_true( set_send_queue_limits( pressure_service_name, &limits ) );
+
+  size_t len = 150000;
+  char *data = xcalloc( 1, len );
+  assert_false( send_message( pressure_service_name, 0, data, len ) );
+  xfree( data );
+  assert_true( send_message( pressure_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_true( send_message( pressure_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_true( send_message( pressure_service_name, 2, "HELLO", strlen( "HELLO" ) + 1 ) );
+  assert_true( send_message( pressure_service_name, 3, "HELLO", strlen( "HELLO" ) + 1 ) );
+
+  start_messenger();
+
+  assert_int_equal( pressure_received_count, 4 );
+  messenger_queue_stats stats;
+  assert_true( get_send_queue_stats( pressure_service_name, &stats ) );
+  assert_int_equal( stats.messages, 4 );
+  assert_int_equal( stats.dropped, 1 );
+
+  delete_message_received_callback( pressure_service_name, callback_pressure_received );
+  delete_send_queue( lookup_hash_entry( send_queues, pressure_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_invalid_send_queue_limits_are_rejected() {
+  init_messenger( "/tmp" );
+
+  messenger_queue_limits limits = { 100, 200, 0 };
+  assert_false( set_send_queue_limits( pressure_service_name, &limits ) );
+  assert_false( set_default_send_queue_limits( &limits ) );
+  limits.high_watermark = 50;
+  limits.low_watermark = 60;
+  assert_false( set_default_send_queue_limits( &limits ) );
+
+  limits.max_length = 1000000;
+  limits.high_watermark = 500000;
+  limits.low_watermark = 100000;
+  assert_true( set_default_send_queue_limits( &limits ) );
+  add_message_received_callback( pressure_service_name, callback_pressure_received );
+  send_message( pressure_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 );
+  messenger_queue_limits result;
+  assert_true( get_send_queue_limits( pressure_service_name, &result ) );
+  assert_int_equal( result.max_length, 1000000 );
+  assert_int_equal( result.high_watermark, 500000 );
+  assert_int_equal( result.low_watermark, 100000 );
+
+  limits.max_length = 100000;
+  limits.high_watermark = 75000;
+  limits.low_watermark = 25000;
+  assert_true( set_default_send_queue_limits( &limits ) );
+  delete_message_received_callback( pressure_service_name, callback_pressure_received );
+  delete_send_queue( lookup_hash_entry( send_queues, pressure_service_name ) );
+
+  finalize_messenger();
+}
+
+
+static const char paused_service_name[] = "Paused";
+static int paused_received_count = 0;
+static int paused_fds[ 2 ];
+
+
+static void
+callback_paused_received( uint16_t tag, void *data, size_t len ) {
+  UNUSED( data );
+  UNUSED( len );
+
+  assert_int_equal( tag, paused_received_count );
+  if ( ++paused_received_count == 1 ) {
+    assert_true( set_receive_queue_paused( paused_service_name, true ) );
+    assert_int_equal( write( paused_fds[ 1 ], "x", 1 ), 1 );
+  }
+  else {
+    stop_messenger();
+  }
+}
+
+
+static void
+paused_fd_set_callback( fd_set *read_set, fd_set *write_set ) {
+  UNUSED( write_set );
+
+  FD_SET( paused_fds[ 0 ], read_set );
+}
+
+
+static void
+paused_fd_isset_callback( fd_set *read_set, fd_set *write_set ) {
+  UNUSED( write_set );
+
+  if ( FD_ISSET( paused_fds[ 0 ], read_set ) ) {
+    char buf[ 8 ];
+    assert_int_equal( read( paused_fds[ 0 ], buf, sizeof( buf ) ), 1 );
+    assert_int_equal( paused_received_count, 1 );
+    assert_true( set_receive_queue_paused( paused_service_name, false ) );
+  }
+}
+
+
+static void
+test_paused_receive_queue_holds_messages() {
+  init_messenger( "/tmp" );
+  paused_received_count = 0;
+
+  assert_false( set_receive_queue_paused( paused_service_name, true ) );
+  assert_int_equal( pipe( paused_fds ), 0 );
+  set_fd_set_callback( paused_fd_set_callback );
+  set_check_fd_isset_callback( paused_fd_isset_callback );
+
+  add_message_received_callback( paused_service_name, callback_paused_received );
+  send_message( paused_service_name, 0, "HELLO", strlen( "HELLO" ) + 1 );
+  send_message( paused_service_name, 1, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  assert_int_equal( paused_received_count, 2 );
+
+  close( paused_fds[ 0 ] );
+  close( paused_fds[ 1 ] );
+  delete_message_received_callback( paused_service_name, callback_paused_received );
+  delete_send_queue( lookup_hash_entry( send_queues, paused_service_name ) );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * External fd_set callback tests.
+ ********************************************************************************/
+
+static int external_fds[ 2 ];
+
+
+static void
+external_fd_set_callback( fd_set *read_set, fd_set *write_set ) {
+  UNUSED( write_set );
+
+  FD_SET( external_fds[ 0 ], read_set );
+}
+
+
+static void
+external_fd_isset_callback( fd_set *read_set, fd_set *write_set ) {
+  UNUSED( write_set );
+
+  if ( FD_ISSET( external_fds[ 0 ], read_set ) ) {
+    char buf[ 8 ];
+    assert_int_equal( read( external_fds[ 0 ], buf, sizeof( buf ) ), 1 );
+    stop_messenger();
+  }
+}
+
+
+static void
+test_external_fd_set_callbacks_are_called() {
+  init_messenger( "/tmp" );
+
+  assert_int_equal( pipe( external_fds ), 0 );
+  assert_int_equal( write( external_fds[ 1 ], "x", 1 ), 1 );
+
+  set_fd_set_callback( external_fd_set_callback );
+  set_check_fd_isset_callback( external_fd_isset_callback );
+  start_messenger();
+
+  close( external_fds[ 0 ] );
+  close( external_fds[ 1 ] );
+
+  finalize_messenger();
+}
+
+
+static int external_callback_count = 0;
+
+
+static void
+callback_external() {
+  if ( ++external_callback_count < 3 ) {
+    assert_true( set_external_callback( callback_external ) );
+  }
+  else {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_external_callback_may_set_itself_again() {
+  init_messenger( "/tmp" );
+  external_callback_count = 0;
+
+  assert_true( set_external_callback( callback_external ) );
+  assert_false( set_external_callback( callback_external ) );
+  start_messenger();
+
+  assert_int_equal( external_callback_count, 3 );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Request timeout tests.
+ ********************************************************************************/
+
+static void
+callback_request_timed_out( uint16_t tag, void *user_data ) {
+  check_expected( tag );
+  check_expected( user_data );
+}
+
+
+static void
+test_requests_time_out_in_deadline_order() {
+  init_messenger( "/tmp" );
+  use_mock_now = true;
+  mock_now.tv_sec = 1000;
+  mock_now.tv_nsec = 0;
+
+  struct timespec three_sec = { 3, 0 };
+  struct timespec one_sec = { 1, 0 };
+  struct timespec two_sec = { 2, 0 };
+  insert_context( 3, ( void * ) 3, &three_sec, callback_request_timed_out );
+  insert_context( 1, ( void * ) 1, &one_sec, callback_request_timed_out );
+  insert_context( 2, ( void * ) 2, &two_sec, callback_request_timed_out );
+  insert_context( 4, NULL, NULL, NULL );
+  assert_int_equal( context_heap_count, 4 );
+
+  mock_now.tv_nsec = 999999999;
+  expire_contexts();
+  assert_int_equal( context_heap_count, 4 );
+
+  expect_value( callback_request_timed_out, tag, 1 );
+  expect_value( callback_request_timed_out, user_data, 1 );
+  mock_now.tv_sec = 1001;
+  mock_now.tv_nsec = 500000000;
+  expire_contexts();
+  assert_int_equal( context_heap_count, 3 );
+
+  expect_value( callback_request_timed_out, tag, 2 );
+  expect_value( callback_request_timed_out, user_data, 2 );
+  expect_value( callback_request_timed_out, tag, 3 );
+  expect_value( callback_request_timed_out, user_data, 3 );
+  mock_now.tv_sec = 1003;
+  expire_contexts();
+  assert_int_equal( context_heap_count, 1 );
+
+  // The default timeout applies to requests without one.
+  mock_now.tv_sec = 1100;
+  expire_contexts();
+  assert_int_equal( context_heap_count, 0 );
+  assert_true( get_context( last_transaction_id ) == NULL );
+
+  finalize_messenger();
+}
+
+
+static void
+test_deleted_context_is_removed_from_deadline_heap() {
+  init_messenger( "/tmp" );
+  use_mock_now = true;
+  mock_now.tv_sec = 1000;
+  mock_now.tv_nsec = 0;
+
+  struct timespec timeout = { 1, 0 };
+  messenger_context *contexts[ 10 ];
+  for ( int i = 0; i < 10; i++ ) {
+    timeout.tv_nsec = ( 7 * i % 10 ) * 10000000;
+    contexts[ i ] = insert_context( ( uint16_t ) i, NULL, &timeout, callback_request_timed_out );
+  }
+  for ( int i = 0; i < 10; i += 2 ) {
+    delete_context( contexts[ i ] );
+  }
+  assert_int_equal( context_heap_count, 5 );
+
+  // Remaining contexts expire in deadline order: 1, 3, 5, 7, 9 have
+  // offsets 70, 10, 50, 90, 30 msec.
+  const uint16_t order[] = { 3, 9, 5, 1, 7 };
+  for ( int i = 0; i < 5; i++ ) {
+    expect_value( callback_request_timed_out, tag, order[ i ] );
+    expect_value( callback_request_timed_out, user_data, NULL );
+  }
+  mock_now.tv_sec = 1002;
+  expire_contexts();
+  assert_int_equal( context_heap_count, 0 );
+
+  finalize_messenger();
+}
+
+
+static void
+test_replied_request_does_not_time_out() {
+  init_messenger( "/tmp" );
+  use_mock_now = true;
+  mock_now.tv_sec = 1000;
+  mock_now.tv_nsec = 0;
+
+  struct timespec timeout = { 1, 0 };
+  add_message_requested_callback( SERVICE_NAME1, message_requested_callback );
+  add_message_replied_callback( SERVICE_NAME2, message_replied_callback );
+  assert_true( send_request_message_with_timeout( SERVICE_NAME1, SERVICE_NAME2, TAG1, MESSAGE1, strlen( MESSAGE1 ) + 1,
+                                                  xstrdup( CONTEXT_DATA ), &timeout, callback_request_timed_out ) );
+  assert_int_equal( context_heap_count, 1 );
+
+  start_messenger();
+
+  assert_int_equal( context_heap_count, 0 );
+
+  delete_message_requested_callback( SERVICE_NAME1, message_requested_callback );
+  delete_message_replied_callback( SERVICE_NAME2, message_replied_callback );
+  finalize_messenger();
+}
+
+
+static void
+test_invalid_request_timeout_is_rejected() {
+  struct timespec timeout = { 0, 1000000000 };
+  assert_false( set_default_request_timeout( &timeout ) );
+  assert_false( send_request_message_with_timeout( SERVICE_NAME1, SERVICE_NAME2, TAG1, MESSAGE1, strlen( MESSAGE1 ) + 1,
+                                                   NULL, &timeout, NULL ) );
+  timeout.tv_sec = 100;
+  timeout.tv_nsec = 0;
+  assert_true( set_default_request_timeout( &timeout ) );
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -431,6 +1466,76 @@ main() {
     unit_test_setup_teardown( test_send_then_message_received_callback_is_called,
                               reset_messenger,
                               reset_messenger ),
+
+    unit_test_setup_teardown( test_send_message_segments_then_message_received_callback_is_called,
+                              reset_messenger,
+                              reset_messenger ),
+
+    unit_test_setup_teardown( test_received_messages_are_dispatched_in_place,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_pending_messages_are_sent_with_a_single_syscall,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_received_messages_are_delivered_in_a_batch,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_high_priority_messages_are_sent_first,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test( test_send_queue_chunks_are_reused ),
+    unit_test( test_compact_message_buffer ),
+
+    // Shared memory transport tests.
+    unit_test_setup_teardown( test_messages_are_sent_through_shm_ring,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_socket_transport_is_used_when_ring_is_refused,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_messages_beyond_shm_ring_capacity_are_held,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Send handle tests.
+    unit_test_setup_teardown( test_send_handle_resolves_send_queue_once,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test( test_create_send_handle_fails_with_too_long_service_name ),
+
+    // Send queue limit tests.
+    unit_test_setup_teardown( test_send_queue_pressure_is_signalled,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_too_long_message_is_rejected,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_invalid_send_queue_limits_are_rejected,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_paused_receive_queue_holds_messages,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Request timeout tests.
+    unit_test_setup_teardown( test_requests_time_out_in_deadline_order,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_deleted_context_is_removed_from_deadline_heap,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_replied_request_does_not_time_out,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test( test_invalid_request_timeout_is_rejected ),
+
+    // External fd_set callback tests.
+    unit_test_setup_teardown( test_external_fd_set_callbacks_are_called,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_external_callback_may_set_itself_again,
+                              reset_messenger,
+                              reset_messenger ),
   };
   return run_tests( tests );
 }
@@ -51,8 +51,10 @@ extern bool openflow_application_interface_initialized;
 extern openflow_event_handlers_t event_handlers;
 extern char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
 extern hash_table *stats;
+extern hash_table *switch_send_handles;
 
 extern void assert_if_not_initialized();
+extern void delete_switch_send_handles();
 extern void handle_error( const uint64_t datapath_id, buffer *data );
 extern void handle_vendor( const uint64_t datapath_id, buffer *data );
 extern void handle_features_reply( const uint64_t datapath_id, buffer *data );
@@ -205,6 +207,32 @@ mock_send_message( char *service_name, uint16_t tag, void *data, size_t len ) {
 }
 
 
+// Send handles are the service names themselves, so that sends through
+// them can be checked with mock_send_message().
+messenger_send_handle *
+mock_create_send_handle( const char *service_name ) {
+  return ( messenger_send_handle * ) xstrdup( service_name );
+}
+
+
+void
+mock_delete_send_handle( messenger_send_handle *handle ) {
+  xfree( handle );
+}
+
+
+const char *
+mock_get_send_handle_service_name( const messenger_send_handle *handle ) {
+  return ( const char * ) handle;
+}
+
+
+bool
+mock_send_message_by_handle( messenger_send_handle *handle, uint16_t tag, void *data, size_t len ) {
+  return mock_send_message( ( char * ) handle, tag, data, len );
+}
+
+
 bool
 mock_send_request_message( char *to_service_name, char *from_service_name, uint16_t tag,
                            void *data, size_t len, void *user_data ) {
@@ -490,6 +518,7 @@ cleanup() {
     delete_hash( stats );
     stats = NULL;
   }
+  delete_switch_send_handles();
 }
 
 
@@ -1241,6 +1270,35 @@ test_send_openflow_message() {
 }
 
 
+static void
+test_send_openflow_message_resolves_remote_service_once() {
+  buffer *buffer = create_hello( TRANSACTION_ID );
+  uint64_t datapath_id = DATAPATH_ID;
+
+  for ( int i = 0; i < 2; i++ ) {
+    expect_string( mock_send_message, service_name, REMOTE_SERVICE_NAME );
+    expect_value( mock_send_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
+    expect_any( mock_send_message, len );
+    expect_any( mock_send_message, data );
+    will_return( mock_send_message, true );
+    assert_true( send_openflow_message( DATAPATH_ID, buffer ) );
+  }
+
+  void *handle = lookup_hash_entry( switch_send_handles, &datapath_id );
+  assert_true( handle != NULL );
+
+  openflow_service_header_t header;
+  memset( &header, 0, sizeof( header ) );
+  header.datapath_id = htonll( DATAPATH_ID );
+  handle_switch_events( MESSENGER_OPENFLOW_DISCONNECTED, &header, sizeof( header ) );
+  assert_true( lookup_hash_entry( switch_send_handles, &datapath_id ) == NULL );
+
+  free_buffer( buffer );
+  xfree( delete_hash_entry( stats, "openflow_application_interface.hello_send_succeeded" ) );
+  xfree( delete_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" ) );
+}
+
+
 static void
 test_send_openflow_message_if_message_is_NULL() {
   expect_assert_failure( send_openflow_message( DATAPATH_ID, NULL ) );
@@ -3295,6 +3353,7 @@ main() {
     unit_test_setup_teardown( test_set_list_switches_reply_handler_if_handler_is_NULL, init, cleanup ),
 
     unit_test_setup_teardown( test_send_openflow_message, init, cleanup ),
+    unit_test_setup_teardown( test_send_openflow_message_resolves_remote_service_once, init, cleanup ),
     unit_test_setup_teardown( test_send_openflow_message_if_message_is_NULL, init, cleanup ),
     unit_test_setup_teardown( test_send_openflow_message_if_message_length_is_zero, init, cleanup ),
 
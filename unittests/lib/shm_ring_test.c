@@ -0,0 +1,219 @@
+/*
+ * Unit tests for shared memory ring.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "shm_ring.h"
+#include "utility.h"
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static shm_ring *producer;
+static shm_ring *consumer;
+
+
+static void
+setup() {
+  stub_logger();
+  producer = create_shm_ring( 4096 );
+  assert_true( producer != NULL );
+  consumer = attach_shm_ring( dup( get_shm_ring_fd( producer ) ) );
+  assert_true( consumer != NULL );
+}
+
+
+static void
+teardown() {
+  delete_shm_ring( consumer );
+  delete_shm_ring( producer );
+  unstub_logger();
+}
+
+
+static void
+write_record( size_t len, char c ) {
+  char *p = reserve_shm_ring( producer, len );
+  assert_true( p != NULL );
+  memset( p, c, len );
+}
+
+
+static void
+read_record( size_t len, char c ) {
+  size_t read_len;
+  char *p = peek_shm_ring( consumer, &read_len );
+  assert_true( p != NULL );
+  assert_int_equal( read_len, len );
+  for ( size_t i = 0; i < len; i++ ) {
+    assert_int_equal( p[ i ], c );
+  }
+  release_shm_ring( consumer );
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_capacity_is_rounded_up_to_power_of_two() {
+  shm_ring *ring = create_shm_ring( 5000 );
+  assert_true( ring != NULL );
+  assert_int_equal( shm_ring_capacity( ring ), 8192 );
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_records_are_invisible_until_published() {
+  size_t len;
+
+  write_record( 10, 'a' );
+  assert_true( peek_shm_ring( consumer, &len ) == NULL );
+
+  publish_shm_ring( producer );
+  read_record( 10, 'a' );
+  assert_true( peek_shm_ring( consumer, &len ) == NULL );
+}
+
+
+static void
+test_records_stay_contiguous_across_wrap_around() {
+  for ( int i = 0; i < 100; i++ ) {
+    size_t len = ( size_t ) ( 1 + ( i * 37 ) % 1000 );
+    write_record( len, ( char ) i );
+    write_record( 3, 'x' );
+    publish_shm_ring( producer );
+    read_record( len, ( char ) i );
+    read_record( 3, 'x' );
+  }
+}
+
+
+static void
+test_reserve_fails_when_full() {
+  write_record( 2000, 'a' );
+  write_record( 2000, 'b' );
+  assert_true( reserve_shm_ring( producer, 2000 ) == NULL );
+  assert_true( reserve_shm_ring( producer, 5000 ) == NULL );
+  publish_shm_ring( producer );
+
+  read_record( 2000, 'a' );
+  write_record( 2000, 'c' );
+  publish_shm_ring( producer );
+  read_record( 2000, 'b' );
+  read_record( 2000, 'c' );
+}
+
+
+static void
+test_skipped_records_stay_until_released() {
+  size_t len;
+
+  write_record( 2000, 'a' );
+  write_record( 1000, 'b' );
+  publish_shm_ring( producer );
+
+  char *a = peek_shm_ring( consumer, &len );
+  assert_int_equal( len, 2000 );
+  skip_shm_ring( consumer );
+  char *b = peek_shm_ring( consumer, &len );
+  assert_int_equal( len, 1000 );
+  skip_shm_ring( consumer );
+  assert_true( peek_shm_ring( consumer, &len ) == NULL );
+
+  // Space of skipped records is not given back yet.
+  assert_true( reserve_shm_ring( producer, 2000 ) == NULL );
+  assert_int_equal( a[ 0 ], 'a' );
+  assert_int_equal( b[ 999 ], 'b' );
+
+  release_shm_ring( consumer );
+  write_record( 2000, 'c' );
+  publish_shm_ring( producer );
+  read_record( 2000, 'c' );
+}
+
+
+static void
+test_wakeup_is_needed_only_when_consumer_waits() {
+  write_record( 10, 'a' );
+  assert_false( publish_shm_ring( producer ) );
+
+  assert_false( wait_shm_ring( consumer ) );
+  read_record( 10, 'a' );
+  assert_true( wait_shm_ring( consumer ) );
+
+  write_record( 10, 'b' );
+  assert_true( publish_shm_ring( producer ) );
+  write_record( 10, 'c' );
+  assert_false( publish_shm_ring( producer ) );
+
+  read_record( 10, 'b' );
+  read_record( 10, 'c' );
+}
+
+
+static void
+test_attach_fails_with_invalid_fd() {
+  int fds[ 2 ];
+  assert_int_equal( pipe( fds ), 0 );
+
+  assert_true( attach_shm_ring( fds[ 0 ] ) == NULL );
+
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_capacity_is_rounded_up_to_power_of_two ),
+    unit_test_setup_teardown( test_records_are_invisible_until_published, setup, teardown ),
+    unit_test_setup_teardown( test_records_stay_contiguous_across_wrap_around, setup, teardown ),
+    unit_test_setup_teardown( test_reserve_fails_when_full, setup, teardown ),
+    unit_test_setup_teardown( test_skipped_records_stay_until_released, setup, teardown ),
+    unit_test_setup_teardown( test_wakeup_is_needed_only_when_consumer_waits, setup, teardown ),
+    unit_test_setup_teardown( test_attach_fails_with_invalid_fd, setup, teardown ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -212,6 +212,24 @@ test_increment_stat_fails_if_not_initialized() {
 }
 
 
+static void
+test_increment_stat_by_adds_value() {
+  assert_true( init_stat() );
+
+  const char *key = "key";
+  increment_stat_by( key, 1000 );
+  increment_stat( key );
+  increment_stat_by( key, 24 );
+
+  stat_entry *entry = lookup_hash_entry( stats, key );
+  assert_string_equal( entry->key, key );
+  uint64_t expected_value = 1025;
+  assert_memory_equal( &entry->value, &expected_value, sizeof( uint64_t ) );
+
+  assert_true( finalize_stat() );
+}
+
+
 /********************************************************************************
  * dump_stats() tests.
  ********************************************************************************/
@@ -273,6 +291,7 @@ main() {
     unit_test_setup_teardown( test_increment_stat_succeeds_with_undefined_key, reset, reset ),
     unit_test_setup_teardown( test_increment_stat_fails_if_key_is_NULL, reset, reset ),
     unit_test_setup_teardown( test_increment_stat_fails_if_not_initialized, reset, reset ),
+    unit_test_setup_teardown( test_increment_stat_by_adds_value, reset, reset ),
 
     // dump_sats() tests.
     unit_test_setup_teardown( test_dump_stats_succeeds, reset, reset ),
@@ -63,6 +63,7 @@ static bool messenger_started;
 static bool messenger_flushed;
 static bool messenger_dump_started;
 static bool stat_initialized;
+static bool buffer_pool_initialized;
 
 
 bool
@@ -283,6 +284,26 @@ mock_finalize_stat() {
 }
 
 
+void
+mock_init_buffer_pool( size_t headroom, size_t tailroom ) {
+  assert_true( stat_initialized );
+  assert_false( buffer_pool_initialized );
+  assert_true( headroom == DEFAULT_BUFFER_HEADROOM );
+  assert_true( tailroom == DEFAULT_BUFFER_TAILROOM );
+
+  buffer_pool_initialized = true;
+}
+
+
+void
+mock_finalize_buffer_pool() {
+  assert_true( stat_initialized );
+  assert_true( buffer_pool_initialized );
+
+  buffer_pool_initialized = false;
+}
+
+
 bool
 mock_set_external_callback( void ( *callback ) ( void ) ) {
   UNUSED( callback );
@@ -335,6 +356,7 @@ reset_trema() {
   messenger_flushed = false;
 
   stat_initialized = false;
+  buffer_pool_initialized = false;
 
   errno = 0;
 }
@@ -354,6 +376,7 @@ test_init_trema_initializes_submodules_in_right_order() {
   assert_true( messenger_initialized );
   assert_true( initialized );
   assert_true( stat_initialized );
+  assert_true( buffer_pool_initialized );
   assert_string_equal( _get_trema_home(), "/" );
   assert_string_equal( _get_trema_tmp(), "/tmp" );
 
@@ -475,6 +498,7 @@ test_finalize_trema_finalizes_submodules_in_right_order() {
   assert_false( messenger_initialized );
   assert_false( initialized );
   assert_false( stat_initialized );
+  assert_false( buffer_pool_initialized );
   assert_true( _get_trema_home() == NULL );
   assert_true( _get_trema_tmp() == NULL );
 }
@@ -119,9 +119,12 @@ test_compare_uint32() {
 
 static void
 test_hash_uint32() {
-  uint32_t key = 123;
+  uint32_t x = 123;
+  uint32_t y = 123;
+  uint32_t z = 124;
 
-  assert_int_equal( 123, hash_uint32( ( void * ) &key ) );
+  assert_true( hash_uint32( ( void * ) &x ) == hash_uint32( ( void * ) &y ) );
+  assert_true( hash_uint32( ( void * ) &x ) != hash_uint32( ( void * ) &z ) );
 }
 
 
@@ -166,6 +169,31 @@ test_hash_mac() {
 }
 
 
+static void
+test_hash_mac_uses_all_bytes() {
+  uint8_t mac1[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05 };
+  uint8_t mac2[] = { 0x01, 0x01, 0x02, 0x03, 0x04, 0x05 };
+  uint8_t mac3[] = { 0x00, 0x02, 0x02, 0x03, 0x04, 0x05 };
+
+  assert_true( hash_mac( mac1 ) != hash_mac( mac2 ) );
+  assert_true( hash_mac( mac1 ) != hash_mac( mac3 ) );
+}
+
+
+static void
+test_crc32c() {
+  // Check value of CRC-32C (RFC 3720, appendix B.4).
+  assert_true( crc32c( 0, "123456789", 9 ) == 0xe3069283 );
+
+  uint8_t zeros[ 32 ];
+  memset( zeros, 0, sizeof( zeros ) );
+  assert_true( crc32c( 0, zeros, sizeof( zeros ) ) == 0x8a9136aa );
+
+  // Checksums can be computed piecewise.
+  assert_true( crc32c( crc32c( 0, "12345", 5 ), "6789", 4 ) == 0xe3069283 );
+}
+
+
 static void
 test_mac_to_uint64() {
   uint8_t mac1[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
@@ -267,6 +295,8 @@ main() {
 
     unit_test( test_compare_mac ),
     unit_test( test_hash_mac ),
+    unit_test( test_hash_mac_uses_all_bytes ),
+    unit_test( test_crc32c ),
     unit_test( test_mac_to_uint64 ),
 
     unit_test( test_string_to_datapath_id ),
@@ -0,0 +1,460 @@
+/*
+ * Unit tests for the switch message queue.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "message_queue.h"
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static message_queue *queue;
+
+
+static void
+setup() {
+  queue = create_message_queue();
+  assert_true( queue != NULL );
+}
+
+
+static void
+teardown() {
+  delete_message_queue( queue );
+}
+
+
+static buffer *
+new_message( size_t length ) {
+  buffer *message = alloc_buffer_with_length( length );
+  append_back_buffer( message, length );
+  return message;
+}
+
+
+static void
+limit_queue( int max_length, size_t max_bytes, int overflow_policy ) {
+  message_queue_limits limits = { max_length, max_bytes, overflow_policy };
+  assert_true( set_message_queue_limits( queue, &limits ) );
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_queue_is_unlimited_by_default() {
+  for ( int i = 0; i < 100; i++ ) {
+    assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  }
+  assert_int_equal( queue->length, 100 );
+  assert_int_equal( queue->bytes, 1000 );
+  assert_int_equal( queue->dropped, 0 );
+  assert_false( is_message_queue_blocked( queue ) );
+
+  for ( int i = 0; i < 100; i++ ) {
+    free_buffer( dequeue_message( queue ) );
+  }
+  assert_true( dequeue_message( queue ) == NULL );
+}
+
+
+static void
+test_messages_are_dequeued_in_order_across_growth() {
+  buffer *messages[ 40 ];
+  for ( int i = 0; i < 10; i++ ) {
+    messages[ i ] = new_message( 10 );
+    assert_true( enqueue_message( queue, messages[ i ] ) );
+  }
+  // Move the first message away from the start of the ring before it grows.
+  for ( int i = 0; i < 5; i++ ) {
+    assert_true( dequeue_message( queue ) == messages[ i ] );
+    free_buffer( messages[ i ] );
+  }
+  for ( int i = 10; i < 40; i++ ) {
+    messages[ i ] = new_message( 10 );
+    assert_true( enqueue_message( queue, messages[ i ] ) );
+  }
+
+  assert_true( peek_message( queue ) == messages[ 5 ] );
+  assert_true( peek_message_at( queue, 34 ) == messages[ 39 ] );
+  assert_true( peek_message_at( queue, 35 ) == NULL );
+  for ( int i = 5; i < 40; i++ ) {
+    assert_true( dequeue_message( queue ) == messages[ i ] );
+    free_buffer( messages[ i ] );
+  }
+}
+
+
+static void
+test_drop_new_drops_messages_beyond_length_limit() {
+  limit_queue( 2, 0, MESSAGE_QUEUE_DROP_NEW );
+
+  buffer *first = new_message( 10 );
+  assert_true( enqueue_message( queue, first ) );
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_false( enqueue_message( queue, new_message( 10 ) ) );
+
+  assert_int_equal( queue->length, 2 );
+  assert_int_equal( queue->bytes, 20 );
+  assert_int_equal( queue->dropped, 1 );
+  assert_true( peek_message( queue ) == first );
+  assert_false( is_message_queue_blocked( queue ) );
+}
+
+
+static void
+test_drop_new_drops_messages_beyond_byte_limit() {
+  limit_queue( 0, 100, MESSAGE_QUEUE_DROP_NEW );
+
+  assert_true( enqueue_message( queue, new_message( 60 ) ) );
+  assert_false( enqueue_message( queue, new_message( 50 ) ) );
+  assert_true( enqueue_message( queue, new_message( 40 ) ) );
+
+  assert_int_equal( queue->length, 2 );
+  assert_int_equal( queue->bytes, 100 );
+  assert_int_equal( queue->dropped, 1 );
+}
+
+
+static void
+test_drop_oldest_makes_room_for_new_message() {
+  limit_queue( 3, 0, MESSAGE_QUEUE_DROP_OLDEST );
+
+  buffer *messages[ 5 ];
+  for ( int i = 0; i < 5; i++ ) {
+    messages[ i ] = new_message( 10 );
+    assert_true( enqueue_message( queue, messages[ i ] ) );
+  }
+
+  assert_int_equal( queue->length, 3 );
+  assert_int_equal( queue->bytes, 30 );
+  assert_int_equal( queue->dropped, 2 );
+  assert_true( peek_message_at( queue, 0 ) == messages[ 2 ] );
+  assert_true( peek_message_at( queue, 1 ) == messages[ 3 ] );
+  assert_true( peek_message_at( queue, 2 ) == messages[ 4 ] );
+}
+
+
+static void
+test_drop_oldest_drops_as_many_as_bytes_need() {
+  limit_queue( 0, 100, MESSAGE_QUEUE_DROP_OLDEST );
+
+  assert_true( enqueue_message( queue, new_message( 30 ) ) );
+  assert_true( enqueue_message( queue, new_message( 30 ) ) );
+  buffer *third = new_message( 30 );
+  assert_true( enqueue_message( queue, third ) );
+  buffer *large = new_message( 70 );
+  assert_true( enqueue_message( queue, large ) );
+
+  assert_int_equal( queue->length, 2 );
+  assert_int_equal( queue->bytes, 100 );
+  assert_int_equal( queue->dropped, 2 );
+  assert_true( peek_message_at( queue, 0 ) == third );
+  assert_true( peek_message_at( queue, 1 ) == large );
+}
+
+
+static void
+test_drop_oldest_keeps_partly_written_head() {
+  limit_queue( 3, 0, MESSAGE_QUEUE_DROP_OLDEST );
+
+  buffer *messages[ 4 ];
+  for ( int i = 0; i < 4; i++ ) {
+    messages[ i ] = new_message( 10 );
+  }
+  for ( int i = 0; i < 3; i++ ) {
+    assert_true( enqueue_message( queue, messages[ i ] ) );
+  }
+  queue->head_offset = 4;
+
+  assert_true( enqueue_message( queue, messages[ 3 ] ) );
+
+  assert_int_equal( queue->length, 3 );
+  assert_int_equal( queue->dropped, 1 );
+  assert_int_equal( queue->head_offset, 4 );
+  assert_true( peek_message_at( queue, 0 ) == messages[ 0 ] );
+  assert_true( peek_message_at( queue, 1 ) == messages[ 2 ] );
+  assert_true( peek_message_at( queue, 2 ) == messages[ 3 ] );
+
+  assert_true( dequeue_message( queue ) == messages[ 0 ] );
+  assert_int_equal( queue->head_offset, 0 );
+  free_buffer( messages[ 0 ] );
+}
+
+
+static void
+test_drop_oldest_drops_new_message_if_only_partly_written_head_is_left() {
+  limit_queue( 1, 0, MESSAGE_QUEUE_DROP_OLDEST );
+
+  buffer *head = new_message( 10 );
+  assert_true( enqueue_message( queue, head ) );
+  queue->head_offset = 4;
+
+  assert_false( enqueue_message( queue, new_message( 10 ) ) );
+
+  assert_int_equal( queue->length, 1 );
+  assert_int_equal( queue->dropped, 1 );
+  assert_true( peek_message( queue ) == head );
+}
+
+
+static void
+test_drop_oldest_drops_message_larger_than_byte_limit() {
+  limit_queue( 0, 100, MESSAGE_QUEUE_DROP_OLDEST );
+
+  assert_true( enqueue_message( queue, new_message( 60 ) ) );
+  assert_false( enqueue_message( queue, new_message( 150 ) ) );
+
+  assert_int_equal( queue->length, 0 );
+  assert_int_equal( queue->bytes, 0 );
+  assert_int_equal( queue->dropped, 2 );
+}
+
+
+static void
+test_block_takes_messages_and_blocks_when_length_limit_is_reached() {
+  limit_queue( 4, 0, MESSAGE_QUEUE_BLOCK );
+
+  for ( int i = 0; i < 3; i++ ) {
+    assert_true( enqueue_message( queue, new_message( 10 ) ) );
+    assert_false( is_message_queue_blocked( queue ) );
+  }
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_true( is_message_queue_blocked( queue ) );
+
+  // What the producer sent before it stopped is still taken.
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_int_equal( queue->length, 5 );
+  assert_int_equal( queue->dropped, 0 );
+  assert_true( is_message_queue_blocked( queue ) );
+
+  // Unblocked only when half of the limit is free.
+  free_buffer( dequeue_message( queue ) );
+  assert_true( is_message_queue_blocked( queue ) );
+  free_buffer( dequeue_message( queue ) );
+  assert_true( is_message_queue_blocked( queue ) );
+  free_buffer( dequeue_message( queue ) );
+  assert_int_equal( queue->length, 2 );
+  assert_false( is_message_queue_blocked( queue ) );
+
+  // And blocked again when full.
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_false( is_message_queue_blocked( queue ) );
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_true( is_message_queue_blocked( queue ) );
+}
+
+
+static void
+test_block_blocks_when_byte_limit_is_reached() {
+  limit_queue( 0, 100, MESSAGE_QUEUE_BLOCK );
+
+  assert_true( enqueue_message( queue, new_message( 30 ) ) );
+  assert_true( enqueue_message( queue, new_message( 30 ) ) );
+  assert_false( is_message_queue_blocked( queue ) );
+  assert_true( enqueue_message( queue, new_message( 40 ) ) );
+  assert_true( is_message_queue_blocked( queue ) );
+
+  free_buffer( dequeue_message( queue ) );
+  assert_int_equal( queue->bytes, 70 );
+  assert_true( is_message_queue_blocked( queue ) );
+  free_buffer( dequeue_message( queue ) );
+  assert_int_equal( queue->bytes, 40 );
+  assert_false( is_message_queue_blocked( queue ) );
+}
+
+
+static void
+test_block_waits_for_both_limits_before_unblocking() {
+  limit_queue( 4, 1000, MESSAGE_QUEUE_BLOCK );
+
+  assert_true( enqueue_message( queue, new_message( 100 ) ) );
+  assert_true( enqueue_message( queue, new_message( 900 ) ) );
+  assert_true( is_message_queue_blocked( queue ) );
+
+  // Half of the length limit is free, but not of the byte limit.
+  free_buffer( dequeue_message( queue ) );
+  assert_int_equal( queue->length, 1 );
+  assert_true( is_message_queue_blocked( queue ) );
+  free_buffer( dequeue_message( queue ) );
+  assert_false( is_message_queue_blocked( queue ) );
+
+  for ( int i = 0; i < 4; i++ ) {
+    assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  }
+  assert_true( is_message_queue_blocked( queue ) );
+
+  // Half of the byte limit is free, but not of the length limit.
+  free_buffer( dequeue_message( queue ) );
+  assert_int_equal( queue->bytes, 30 );
+  assert_true( is_message_queue_blocked( queue ) );
+  free_buffer( dequeue_message( queue ) );
+  assert_false( is_message_queue_blocked( queue ) );
+}
+
+
+static void
+test_peak_counters_keep_highest_values() {
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_true( enqueue_message( queue, new_message( 20 ) ) );
+  assert_true( enqueue_message( queue, new_message( 30 ) ) );
+  free_buffer( dequeue_message( queue ) );
+  free_buffer( dequeue_message( queue ) );
+  assert_true( enqueue_message( queue, new_message( 40 ) ) );
+
+  assert_int_equal( queue->length, 2 );
+  assert_int_equal( queue->bytes, 70 );
+  assert_int_equal( queue->peak_length, 3 );
+  assert_int_equal( queue->peak_bytes, 70 );
+  assert_int_equal( queue->dropped, 0 );
+
+  assert_true( enqueue_message( queue, new_message( 50 ) ) );
+  assert_int_equal( queue->peak_length, 3 );
+  assert_int_equal( queue->peak_bytes, 120 );
+}
+
+
+static void
+test_peak_counters_do_not_count_dropped_messages() {
+  limit_queue( 2, 0, MESSAGE_QUEUE_DROP_NEW );
+
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_true( enqueue_message( queue, new_message( 10 ) ) );
+  assert_false( enqueue_message( queue, new_message( 100 ) ) );
+  assert_false( enqueue_message( queue, new_message( 100 ) ) );
+
+  assert_int_equal( queue->peak_length, 2 );
+  assert_int_equal( queue->peak_bytes, 20 );
+  assert_int_equal( queue->dropped, 2 );
+}
+
+
+static void
+test_set_message_queue_limits_fails_with_invalid_limits() {
+  message_queue_limits limits = { -1, 0, MESSAGE_QUEUE_DROP_NEW };
+  assert_false( set_message_queue_limits( queue, &limits ) );
+
+  limits.max_length = 1;
+  limits.overflow_policy = MESSAGE_QUEUE_BLOCK + 1;
+  assert_false( set_message_queue_limits( queue, &limits ) );
+
+  assert_int_equal( queue->limits.max_length, 0 );
+  assert_int_equal( queue->limits.max_bytes, 0 );
+  assert_int_equal( queue->limits.overflow_policy, MESSAGE_QUEUE_DROP_NEW );
+}
+
+
+static void
+test_parse_message_queue_limits_succeeds() {
+  message_queue_limits limits;
+
+  assert_true( parse_message_queue_limits( "100,65536", &limits ) );
+  assert_int_equal( limits.max_length, 100 );
+  assert_int_equal( limits.max_bytes, 65536 );
+  assert_int_equal( limits.overflow_policy, MESSAGE_QUEUE_DROP_NEW );
+
+  assert_true( parse_message_queue_limits( "0,0x1000,drop-oldest", &limits ) );
+  assert_int_equal( limits.max_length, 0 );
+  assert_int_equal( limits.max_bytes, 4096 );
+  assert_int_equal( limits.overflow_policy, MESSAGE_QUEUE_DROP_OLDEST );
+
+  assert_true( parse_message_queue_limits( "10,0,block", &limits ) );
+  assert_int_equal( limits.max_length, 10 );
+  assert_int_equal( limits.max_bytes, 0 );
+  assert_int_equal( limits.overflow_policy, MESSAGE_QUEUE_BLOCK );
+
+  assert_true( parse_message_queue_limits( "1,1,drop-new", &limits ) );
+  assert_int_equal( limits.overflow_policy, MESSAGE_QUEUE_DROP_NEW );
+}
+
+
+static void
+test_parse_message_queue_limits_fails_with_invalid_string() {
+  const char *invalid[] = {
+    "",
+    "100",
+    "100,",
+    ",100",
+    "-1,100",
+    "100,-1",
+    "100x,100",
+    "100,100x",
+    "100,100,",
+    "100,100,drop",
+    "100,100,block,",
+    "100,100,BLOCK",
+    "2147483648,100",
+  };
+
+  for ( size_t i = 0; i < sizeof( invalid ) / sizeof( invalid[ 0 ] ); i++ ) {
+    message_queue_limits limits = { 1, 2, MESSAGE_QUEUE_BLOCK };
+    assert_false( parse_message_queue_limits( invalid[ i ], &limits ) );
+    assert_int_equal( limits.max_length, 1 );
+    assert_int_equal( limits.max_bytes, 2 );
+    assert_int_equal( limits.overflow_policy, MESSAGE_QUEUE_BLOCK );
+  }
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test_setup_teardown( test_queue_is_unlimited_by_default, setup, teardown ),
+    unit_test_setup_teardown( test_messages_are_dequeued_in_order_across_growth, setup, teardown ),
+    unit_test_setup_teardown( test_drop_new_drops_messages_beyond_length_limit, setup, teardown ),
+    unit_test_setup_teardown( test_drop_new_drops_messages_beyond_byte_limit, setup, teardown ),
+    unit_test_setup_teardown( test_drop_oldest_makes_room_for_new_message, setup, teardown ),
+    unit_test_setup_teardown( test_drop_oldest_drops_as_many_as_bytes_need, setup, teardown ),
+    unit_test_setup_teardown( test_drop_oldest_keeps_partly_written_head, setup, teardown ),
+    unit_test_setup_teardown( test_drop_oldest_drops_new_message_if_only_partly_written_head_is_left, setup, teardown ),
+    unit_test_setup_teardown( test_drop_oldest_drops_message_larger_than_byte_limit, setup, teardown ),
+    unit_test_setup_teardown( test_block_takes_messages_and_blocks_when_length_limit_is_reached, setup, teardown ),
+    unit_test_setup_teardown( test_block_blocks_when_byte_limit_is_reached, setup, teardown ),
+    unit_test_setup_teardown( test_block_waits_for_both_limits_before_unblocking, setup, teardown ),
+    unit_test_setup_teardown( test_peak_counters_keep_highest_values, setup, teardown ),
+    unit_test_setup_teardown( test_peak_counters_do_not_count_dropped_messages, setup, teardown ),
+    unit_test_setup_teardown( test_set_message_queue_limits_fails_with_invalid_limits, setup, teardown ),
+    unit_test_setup_teardown( test_parse_message_queue_limits_succeeds, setup, teardown ),
+    unit_test_setup_teardown( test_parse_message_queue_limits_fails_with_invalid_string, setup, teardown ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */